@@ -14,12 +14,42 @@
  */
 
 #include <curl/curl.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include "http_api.h"
 #include "../../core/utils/data_structures.h"
 #include "../../core/logging/log.h"
+#include "../../core/metrics/metrics.h"
+#include "../timing/lhings_time.h"
+
+// seconds curl keeps the addresses of a name, the default TTL of the UDP resolver
+#define HTTP_DNS_CACHE_SECS 60
+
+// every request uses a new handle, the DNS cache is shared among all of them
+static CURLSH *http_share = NULL;
+static pthread_once_t http_share_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t http_share_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void http_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *user_pointer) {
+    pthread_mutex_lock(&http_share_mutex);
+}
+
+void http_share_unlock(CURL *handle, curl_lock_data data, void *user_pointer) {
+    pthread_mutex_unlock(&http_share_mutex);
+}
+
+void http_share_init() {
+    http_share = curl_share_init();
+    if (http_share == NULL) {
+        log_warn("HTTP: the DNS cache can not be shared between requests.");
+        return;
+    }
+    curl_share_setopt(http_share, CURLSHOPT_LOCKFUNC, http_share_lock);
+    curl_share_setopt(http_share, CURLSHOPT_UNLOCKFUNC, http_share_unlock);
+    curl_share_setopt(http_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+}
 
 struct string {
     char *ptr;
@@ -79,6 +109,10 @@ LH_HttpResponse* http_execute_request(const char* url, LH_Dict* headers, uint8_t
         }
         lh_list_free(keys_of_headers);
         curl_easy_setopt(curl, CURLOPT_URL, url);
+        pthread_once(&http_share_once, http_share_init);
+        if (http_share != NULL)
+            curl_easy_setopt(curl, CURLOPT_SHARE, http_share);
+        curl_easy_setopt(curl, CURLOPT_DNS_CACHE_TIMEOUT, (long) HTTP_DNS_CACHE_SECS);
         if (method == PERFORM_POST) {
             curl_easy_setopt(curl, CURLOPT_POST, 1);
             if (request_body != NULL)
@@ -94,9 +128,13 @@ LH_HttpResponse* http_execute_request(const char* url, LH_Dict* headers, uint8_t
         curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, writefunc);
         curl_easy_setopt(curl, CURLOPT_WRITEDATA, &s);
 
+        uint64_t start = lh_get_absolute_time_micros();
         res = curl_easy_perform(curl);
+        lh_metrics_record(LH_HISTOGRAM_HTTP_MICROS, (uint32_t) (lh_get_absolute_time_micros() - start));
+        lh_metrics_inc(LH_COUNTER_HTTP_REQUESTS);
 	
         if (res != CURLE_OK) {
+            lh_metrics_inc(LH_COUNTER_HTTP_ERRORS);
             char* message_template = "Request to url %s failed. CURLcode %d.";
             char* message = malloc((strlen(url) + strlen(message_template) + 15) * sizeof message);
             sprintf(message, message_template, url, res);
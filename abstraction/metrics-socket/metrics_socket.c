@@ -0,0 +1,102 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics_socket.h"
+#include "../../core/metrics/metrics.h"
+#include "../../core/metrics/prometheus.h"
+#include "../../core/logging/log.h"
+
+static int server_fd = -1;
+static int client_fd = -1;
+static LH_PrometheusRenderer renderer;
+// rendered bytes not yet accepted by the client socket
+static char chunk[METRICS_SOCKET_CHUNK_LEN];
+static size_t chunk_length = 0;
+static size_t chunk_offset = 0;
+
+int lh_metrics_socket_open(const char *path) {
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof address.sun_path) {
+        log_errorf("Metrics socket path is too long: %s", path);
+        return 0;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        log_errorf("Unable to create metrics socket. Reason: %s", strerror(errno));
+        return 0;
+    }
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof address) == -1 || listen(fd, 4) == -1) {
+        log_errorf("Unable to listen in metrics socket %s. Reason: %s", path, strerror(errno));
+        close(fd);
+        return 0;
+    }
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    server_fd = fd;
+    log_infof("Serving metrics in %s", path);
+    return 1;
+}
+
+void close_client() {
+    close(client_fd);
+    client_fd = -1;
+}
+
+void lh_metrics_socket_poll() {
+    if (server_fd == -1)
+        return;
+    if (client_fd == -1) {
+        client_fd = accept(server_fd, NULL, NULL);
+        if (client_fd == -1)
+            return;
+        fcntl(client_fd, F_SETFL, O_NONBLOCK);
+        lh_metrics_set_gauge(LH_GAUGE_LOG_QUEUE_DEPTH, log_get_queue_depth());
+        lh_prometheus_start(&renderer);
+        chunk_length = chunk_offset = 0;
+    }
+    if (chunk_offset == chunk_length) {
+        chunk_length = lh_prometheus_render(&renderer, chunk, sizeof chunk);
+        chunk_offset = 0;
+        if (chunk_length == 0) {
+            // scrape complete
+            close_client();
+            return;
+        }
+    }
+    ssize_t sent = send(client_fd, chunk + chunk_offset, chunk_length - chunk_offset, MSG_NOSIGNAL);
+    if (sent == -1) {
+        // the scraper went away, try again with the next one
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            close_client();
+        return;
+    }
+    chunk_offset += sent;
+}
+
+int lh_metrics_socket_get_fd(int *writable) {
+    *writable = client_fd != -1;
+    return client_fd != -1 ? client_fd : server_fd;
+}
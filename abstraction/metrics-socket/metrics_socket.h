@@ -0,0 +1,71 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file metrics_socket.h
+ * @brief This header file contains the functions that serve the metrics of
+ * the library to local scrapers.
+ * 
+ * All the function in this header file belong to the abstraction API of the 
+ * library and need to be reimplemented when changing platform. The documentation
+ * of each function contains all the information about its expected behaviour. This
+ * information must be carefully followed when porting the library to other platforms.
+ * Platforms without local sockets can implement lh_metrics_socket_open as a
+ * function that returns 0, and lh_metrics_socket_poll as an empty function.
+ */
+
+#ifndef METRICS_SOCKET_H
+#define	METRICS_SOCKET_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    // bytes rendered and sent to the scraper in each iteration of the main loop
+#define METRICS_SOCKET_CHUNK_LEN 1024
+
+    /**
+     * Starts listening for scrapers in a local, read only endpoint. Every
+     * connection accepted receives the metrics in Prometheus text format, and
+     * is closed afterwards. Optional, it is usually called from setup().
+     * @param path The path of the Unix domain socket. An existing file in that
+     * path is replaced.
+     * @return 1 on success, 0 otherwise.
+     */
+    int lh_metrics_socket_open(const char *path);
+
+    /**
+     * Serves the pending scrapes without blocking. Called by the library in
+     * every iteration of the main loop, each call must do a bounded amount of
+     * work and must not allocate memory. Does nothing if lh_metrics_socket_open
+     * was not called.
+     */
+    void lh_metrics_socket_poll();
+
+    /**
+     * Returns the descriptor lh_metrics_socket_poll waits on: the connection
+     * of the scraper being served, which must be writable, or the listening
+     * socket, which must be readable. Ports without descriptors return -1.
+     * @param writable Set to 1 if the descriptor must be writable, 0 otherwise.
+     * @return The descriptor, or -1 if lh_metrics_socket_open was not called.
+     */
+    int lh_metrics_socket_get_fd(int *writable);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* METRICS_SOCKET_H */
@@ -27,9 +27,7 @@ char* lh_storage_get_uuid(char* requested_device_name){
     char buffer[80];
     FILE *uuid_file = fopen(UUIDS_FILENAME, "a+");
     if (uuid_file == NULL){
-        char *message = lh_get_message_str("Could not read uuid file. Reason: %s \n", strerror(errno));
-        log_error(message);
-        free(message);
+        log_errorf("Could not read uuid file. Reason: %s", strerror(errno));
         return NULL;
     }
 
@@ -51,9 +49,7 @@ char* lh_storage_get_uuid(char* requested_device_name){
 int lh_storage_save_uuid(const char *device_name, const char *uuid){
     FILE *uuid_file = fopen(UUIDS_FILENAME, "a+");
     if (uuid_file == NULL){
-        char *message = lh_get_message_str("Could not save uuid file. Reason: %s \n", strerror(errno));
-        log_error(message);
-        free(message);
+        log_errorf("Could not save uuid file. Reason: %s", strerror(errno));
         return 0;
     }
     fprintf(uuid_file, "%s=%s\n", device_name, uuid);
@@ -0,0 +1,43 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+#include "lhings_random.h"
+
+void lh_random_seed(uint8_t *bytes, size_t length) {
+    size_t filled = 0;
+    while (filled < length) {
+        ssize_t count = getrandom(bytes + filled, length - filled, 0);
+        if (count > 0)
+            filled += count;
+        else if (count == -1 && errno != EINTR)
+            break;
+    }
+    if (filled == length)
+        return;
+    // without getrandom (Linux < 3.17), mix the time, the process and the thread
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    uint64_t mix[4] = {(uint64_t) now.tv_sec, (uint64_t) now.tv_nsec, (uint64_t) getpid(), (uint64_t) pthread_self()};
+    size_t j;
+    for (j = filled; j < length; j++)
+        bytes[j] = ((const uint8_t *) mix)[j % sizeof mix] ^ (uint8_t) (j * 0x9B);
+}
@@ -0,0 +1,55 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file lhings_random.h
+ * @brief This header file defines the function that provides the library
+ * with unpredictable bytes, used to seed its random number generators.
+ * 
+ * All the functions in this header file belong to the abstraction API of the 
+ * library and need to be reimplemented when changing platform. The documentation
+ * of each function contains all the information about its expected behaviour. This
+ * information must be carefully followed when porting the library to other platforms.
+ */
+
+#ifndef LHINGS_RANDOM_H
+#define	LHINGS_RANDOM_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+    /**
+     * Fills a buffer with bytes from the entropy source of the platform
+     * (getrandom() on Linux, a hardware generator on microcontrollers). It
+     * is called once per thread, to seed the generator of lh_random_bytes(),
+     * so it may be slow but must not block for long. Devices and threads
+     * started at the same time must get different bytes: when no entropy
+     * source is available, implementations must at least mix the time, a
+     * serial number or address of the device and the calling thread.
+     * @param bytes
+     * @param length
+     */
+    void lh_random_seed(uint8_t *bytes, size_t length);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LHINGS_RANDOM_H */
@@ -0,0 +1,65 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "lhings_thread.h"
+
+typedef struct thread_start {
+    void (*function)(void *argument);
+    void *argument;
+} ThreadStart;
+
+void* thread_main(void *start_ptr) {
+    ThreadStart start = *(ThreadStart *) start_ptr;
+    free(start_ptr);
+    start.function(start.argument);
+    return NULL;
+}
+
+int lh_thread_start(void (*function)(void *argument), void *argument) {
+    ThreadStart *start = malloc(sizeof *start);
+    if (start == NULL)
+        return 0;
+    start->function = function;
+    start->argument = argument;
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, thread_main, start) != 0) {
+        free(start);
+        return 0;
+    }
+    pthread_detach(thread);
+    return 1;
+}
+
+int lh_wakeup_new() {
+    return eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+}
+
+void lh_wakeup_signal(int wakeup) {
+    uint64_t one = 1;
+    // fails only when the counter is about to overflow, and it is readable then
+    if (write(wakeup, &one, sizeof one) != sizeof one)
+        return;
+}
+
+void lh_wakeup_clear(int wakeup) {
+    uint64_t count;
+    if (read(wakeup, &count, sizeof count) != sizeof count)
+        return;
+}
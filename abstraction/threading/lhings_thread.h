@@ -0,0 +1,88 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file lhings_thread.h
+ * @brief This file defines the functions and macros related to threads and
+ * atomic operations, which are platform dependent.
+ * 
+ * All the functions in this header file belong to the abstraction API of the 
+ * library and need to be reimplemented when changing platform. The documentation
+ * of each function contains all the information about its expected behaviour. This
+ * information must be carefully followed when porting the library to other platforms.
+ * 
+ * The atomic macros map to the GCC/Clang __atomic builtins. On platforms without
+ * them they must be redefined with equivalent operations.
+ */
+
+#ifndef LHINGS_THREAD_H
+#define	LHINGS_THREAD_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+    // loads and stores with acquire / release semantics
+#define LH_ATOMIC_LOAD(ptr) __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define LH_ATOMIC_STORE(ptr, value) __atomic_store_n(ptr, value, __ATOMIC_RELEASE)
+    // loads and increments that do not order other memory accesses, for counters
+#define LH_ATOMIC_LOAD_RELAXED(ptr) __atomic_load_n(ptr, __ATOMIC_RELAXED)
+#define LH_ATOMIC_FETCH_ADD(ptr, value) __atomic_fetch_add(ptr, value, __ATOMIC_RELAXED)
+    // storage class of variables with one instance per thread
+#define LH_THREAD_LOCAL __thread
+    // weak compare and swap, on failure the current value is stored in *expected
+#define LH_ATOMIC_CAS(ptr, expected, desired) \
+    __atomic_compare_exchange_n(ptr, expected, desired, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)
+    // stores a value and returns the previous one
+#define LH_ATOMIC_EXCHANGE(ptr, value) __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL)
+
+    /**
+     * Starts a detached thread that runs the given function. The thread
+     * ends when the function returns.
+     * @param function The function executed by the thread.
+     * @param argument The argument passed to the function.
+     * @return 1 if the thread was started, 0 otherwise.
+     */
+    int lh_thread_start(void (*function)(void *argument), void *argument);
+
+    /**
+     * Creates a descriptor that one thread signals to wake up another one
+     * waiting on it with lh_wait_fds(). It becomes readable when signalled,
+     * and stays readable until it is cleared.
+     * @return The descriptor, or -1 if the platform has none, in which case
+     * the waiting thread only wakes up when its timeout expires.
+     */
+    int lh_wakeup_new();
+
+    /**
+     * Makes a wake up descriptor readable, without blocking. Safe to call
+     * from any thread.
+     * @param wakeup
+     */
+    void lh_wakeup_signal(int wakeup);
+
+    /**
+     * Makes a wake up descriptor not readable, without blocking.
+     * @param wakeup
+     */
+    void lh_wakeup_clear(int wakeup);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LHINGS_THREAD_H */
+
@@ -17,19 +17,20 @@
 #include <time.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <poll.h>
 #include <stdlib.h>
 #include "lhings_time.h"
 #include "../../core/stun-messaging/stun_message.h"
 #include "../../core/logging/log.h"
+#include "../../core/metrics/metrics.h"
 
 uint32_t get_UTC_unix_time_worker(int update_offset, uint32_t server_time){
     static uint32_t offset = 0;
     uint32_t time_now = time(NULL);
     if (update_offset){
         offset = time_now - server_time;
-        char *log_msg = lh_get_message_int("Adjusting clock by %d seconds", (int)offset);
-        log_info(log_msg);
-        free(log_msg);
+        lh_metrics_set_gauge(LH_GAUGE_CLOCK_OFFSET_SECONDS, (int32_t) offset);
+        log_infof("Adjusting clock by %d seconds", (int)offset);
     } 
     return (uint32_t) (time_now - offset);
 }
@@ -63,3 +64,30 @@ uint32_t lh_get_absolute_time_millis(){
     long msecs = ((long)time_now.tv_usec - (long)init_time.tv_usec);
     return (uint32_t)(secs*1000L + msecs/1000L);
 }
+
+uint64_t lh_get_absolute_time_micros(){
+    struct timespec time_now;
+    clock_gettime(CLOCK_MONOTONIC, &time_now);
+    return (uint64_t)time_now.tv_sec * 1000000 + (uint64_t)time_now.tv_nsec / 1000;
+}
+
+uint32_t lh_wait_fds(const LH_Fd *fds, int count, uint32_t timeout_millis){
+    struct pollfd poll_fds[LH_MAX_FDS];
+    int j;
+    if (count > LH_MAX_FDS)
+        count = LH_MAX_FDS;
+    for (j = 0; j < count; j++){
+        poll_fds[j].fd = fds[j].fd;
+        poll_fds[j].events = (fds[j].events & LH_FD_WRITABLE) ? POLLOUT : POLLIN;
+        poll_fds[j].revents = 0;
+    }
+    if (poll(poll_fds, count, (int) timeout_millis) <= 0)
+        return 0;
+    uint32_t ready = 0;
+    for (j = 0; j < count; j++){
+        // errors and hang ups are reported as ready, the next read finds them
+        if (poll_fds[j].revents != 0)
+            ready |= 1u << j;
+    }
+    return ready;
+}
@@ -33,6 +33,7 @@ extern "C" {
 #endif
 
     #include <stdint.h>
+    #include "../../core/lhings.h"
     
     /**
      * Returns a 32 bit integer with the UNIX time in seconds. 
@@ -77,6 +78,28 @@ extern "C" {
      */
     uint32_t lh_get_absolute_time_millis();
 
+    /**
+     * Same as lh_get_absolute_time_millis, in microseconds. Used to measure
+     * latencies. The time reference must not change during program execution,
+     * and the clock must not go backwards when the system time is changed.
+     * 
+     * @return A 64 bit integer representing the number of microseconds elapsed
+     * since the time reference.
+     */
+    uint64_t lh_get_absolute_time_micros();
+
+    /**
+     * Waits until one of the given descriptors is ready or the timeout
+     * expires. Used by lh_start_device() to wait between the steps of the
+     * device. Ports without descriptors may sleep for the timeout, or a
+     * shorter time, and return all the bits set.
+     * @param fds The descriptors returned by lh_get_fds().
+     * @param count
+     * @param timeout_millis
+     * @return Bit j set if fds[j] is ready, 0 if the timeout expired.
+     */
+    uint32_t lh_wait_fds(const LH_Fd *fds, int count, uint32_t timeout_millis);
+
 
 
 #ifdef	__cplusplus
@@ -27,161 +27,276 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include "udp_api.h"
+#include "udp_uring.h"
+#include "udp_resolver.h"
 #include "../../core/stun-messaging/stun_message.h"
 #include "../../core/logging/log.h"
+#include "../../core/metrics/metrics.h"
+#include "../../core/utils/utils.h"
+#include "../timing/lhings_time.h"
 
 
-static struct sockaddr_in *destination_addr = NULL;
 static char str_client_port[6];
 static int listener_sock_fd = -1;
+static LH_UdpBackend udp_backend = LH_UDP_BACKEND_SOCKETS;
+// AF_INET6 when dual stack sockets are available, AF_INET otherwise
+static int socket_family = 0;
+// Happy Eyeballs: until a family is chosen, keepalives are sent to an address of each family
+static int family_chosen = 0;
+// transaction id of the keepalive sent over both families
+static uint8_t probe_trId[12];
+// when the probe was sent and its round trip time over IPv4 and IPv6, 0 until answered
+static uint64_t probe_sent_micros[2];
+static uint64_t probe_rtt_micros[2];
+// when the first answer arrived, the other family has LH_UDP_FAMILY_RACE_MILLIS more to answer
+static uint64_t first_answer_micros = 0;
+// source of the last datagram received, whose family answered the probe
+static struct sockaddr_storage last_source;
 
-int lh_send_to_server(StunMessage *message) {
-    uint8_t *bytes = message->bytes;
-    uint16_t length = message->length;
-    int status;
-    char *log_msg;
-
-
-    //initialize socket and bind
-    if (destination_addr == NULL) {
-        struct addrinfo hints;
-        struct addrinfo *servinfo, *p;
-        srand(time(NULL));
-        memset(&hints, 0, sizeof hints);
-        hints.ai_family = AF_INET;
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_flags = AI_PASSIVE;
-
-        if ((status = getaddrinfo(LHINGS_SERVER_HOST, LHINGS_SERVER_UDP_PORT, &hints, &servinfo)) != 0) {
-            log_msg = lh_get_message_str("Unable to send UDP. Reason: %s", gai_strerror(status));
-            log_error(log_msg);
-            free(log_msg);
-            return 0;
-        }
+int lh_udp_set_backend(LH_UdpBackend backend) {
+    if (backend == LH_UDP_BACKEND_IO_URING && !udp_uring_init()) {
+        log_warn("UDP: io_uring is not available, using sockets.");
+        udp_backend = LH_UDP_BACKEND_SOCKETS;
+        return 0;
+    }
+    if (backend == LH_UDP_BACKEND_SOCKETS)
+        udp_uring_close();
+    udp_backend = backend;
+    return 1;
+}
+
+/**
+ * Returns the family of the sockets of the device. IPv6 sockets also carry
+ * IPv4 traffic, using IPv4 mapped addresses, so they are used whenever the
+ * system supports IPv6.
+ */
+int udp_socket_family() {
+    if (socket_family != 0)
+        return socket_family;
+    int no = 0;
+    int fd = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd != -1 && setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof no) == 0) {
+        socket_family = AF_INET6;
+    } else {
+        log_info("UDP: IPv6 is not available, using IPv4 only.");
+        socket_family = AF_INET;
+        udp_resolver_restrict_family(AF_INET);
+    }
+    if (fd != -1)
+        close(fd);
+    return socket_family;
+}
 
+void lh_udp_resolve_server() {
+    // without IPv6 sockets only IPv4 addresses are resolved
+    udp_socket_family();
+    udp_resolver_start();
+}
 
-        for (p = servinfo; p != NULL; p = p->ai_next) {
-            if (p->ai_addr != NULL) {
-                destination_addr = malloc(sizeof *destination_addr);
-                memcpy(destination_addr, (struct sockaddr_in *) p->ai_addr, sizeof *p->ai_addr);
-            }
-        }
-        int client_port = 1027 + rand() % 50000;
+void lh_udp_server_unresponsive() {
+    udp_resolver_failover();
+    // the other family may work better now
+    family_chosen = 0;
+    probe_sent_micros[0] = probe_sent_micros[1] = 0;
+    probe_rtt_micros[0] = probe_rtt_micros[1] = 0;
+    first_answer_micros = 0;
+}
+
+/**
+ * Opens a non blocking UDP socket bound to the port of the session, in all
+ * the local addresses of both families when possible.
+ * @return The socket, or -1 on failure.
+ */
+int udp_open_bound_socket() {
+    struct sockaddr_storage local;
+    socklen_t local_len;
+    int yes = 1, no = 0;
+    // the local port is chosen once and used for the entire session
+    if (str_client_port[0] == 0) {
+        int client_port = 1027 + (int) (lh_random_uint64() % 50000);
         snprintf(str_client_port, 6, "%d", client_port);
-        freeaddrinfo(servinfo);
     }
-
-    int send_socket_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (send_socket_fd == -1) {
-        log_msg = lh_get_message_str("Unable to create UDP socket. Reason: %s", strerror(errno));
-        log_error(log_msg);
-        free(log_msg);
-        return 0;
+    memset(&local, 0, sizeof local);
+    if (udp_socket_family() == AF_INET6) {
+        struct sockaddr_in6 *local6 = (struct sockaddr_in6 *) &local;
+        local6->sin6_family = AF_INET6;
+        local6->sin6_addr = in6addr_any;
+        local6->sin6_port = htons(atoi(str_client_port));
+        local_len = sizeof *local6;
+    } else {
+        struct sockaddr_in *local4 = (struct sockaddr_in *) &local;
+        local4->sin_family = AF_INET;
+        local4->sin_addr.s_addr = htonl(INADDR_ANY);
+        local4->sin_port = htons(atoi(str_client_port));
+        local_len = sizeof *local4;
     }
-
-    int yes = 1;
-    if (setsockopt(send_socket_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (int)) == -1) {
-        perror("setsockopt");
-        return 0;
+    int fd = socket(socket_family, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == -1) {
+        log_errorf("Unable to create UDP socket. Reason: %s", strerror(errno));
+        return -1;
     }
-    // bind to local address
-    struct addrinfo *source_addr_info;
-    struct addrinfo hints;
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_DGRAM;
-    hints.ai_flags = AI_PASSIVE;
-    if ((status = getaddrinfo(NULL, str_client_port, &hints, &source_addr_info)) != 0) {
-        log_msg = lh_get_message_str("Unable to send UDP. Reason: %s", gai_strerror(status));
-        log_error(log_msg);
-        free(log_msg);
-        return 0;
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    if (socket_family == AF_INET6)
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof no);
+    if (bind(fd, (struct sockaddr *) &local, local_len) == -1) {
+        log_errorf("Bind failed. Reason: %s", strerror(errno));
+        close(fd);
+        return -1;
     }
+    return fd;
+}
 
-    status = bind(send_socket_fd, source_addr_info->ai_addr, source_addr_info->ai_addrlen);
-    if (status == -1) {
-        log_msg = lh_get_message_str("Bind failed. Reason: %s", strerror(errno));
-        log_error(log_msg);
-        free(log_msg);
-        freeaddrinfo(source_addr_info);
-        return 0;
+/**
+ * Converts an address to the family of the sockets: IPv4 addresses are
+ * mapped into IPv6 ones when the sockets are dual stack.
+ */
+void udp_socket_address(const struct sockaddr_storage *address, socklen_t address_len,
+        struct sockaddr_storage *socket_address, socklen_t *socket_address_len) {
+    if (udp_socket_family() == AF_INET6 && address->ss_family == AF_INET) {
+        const struct sockaddr_in *address4 = (const struct sockaddr_in *) address;
+        struct sockaddr_in6 *mapped = (struct sockaddr_in6 *) socket_address;
+        memset(mapped, 0, sizeof *mapped);
+        mapped->sin6_family = AF_INET6;
+        mapped->sin6_port = address4->sin_port;
+        mapped->sin6_addr.s6_addr[10] = 0xff;
+        mapped->sin6_addr.s6_addr[11] = 0xff;
+        memcpy(&mapped->sin6_addr.s6_addr[12], &address4->sin_addr, 4);
+        *socket_address_len = sizeof *mapped;
+    } else {
+        memcpy(socket_address, address, address_len);
+        *socket_address_len = address_len;
     }
+}
+
+/**
+ * Returns the family of an address, AF_INET for IPv4 mapped IPv6 addresses.
+ */
+int udp_address_family(const struct sockaddr_storage *address) {
+    if (address->ss_family == AF_INET6 && IN6_IS_ADDR_V4MAPPED(&((const struct sockaddr_in6 *) address)->sin6_addr))
+        return AF_INET;
+    return address->ss_family;
+}
 
-    // send
-    struct sockaddr destination_sock_addr = *((struct sockaddr *) destination_addr);
-    int bytes_sent = sendto(send_socket_fd, bytes, length, 0, &destination_sock_addr, sizeof (destination_sock_addr));
+const char* family_name(int family) {
+    return family == AF_INET6 ? "IPv6" : "IPv4";
+}
+
+int udp_send_datagram(const uint8_t *bytes, uint16_t length, const struct sockaddr_storage *address, socklen_t address_len) {
+    struct sockaddr_storage destination;
+    socklen_t destination_len;
+    udp_socket_address(address, address_len, &destination, &destination_len);
+    if (udp_backend == LH_UDP_BACKEND_IO_URING)
+        return udp_uring_send(bytes, length, (struct sockaddr *) &destination, destination_len, family_chosen);
+
+    if (listener_sock_fd == -1 && (listener_sock_fd = udp_open_bound_socket()) == -1)
+        return 0;
+    int bytes_sent = sendto(listener_sock_fd, bytes, length, 0, (struct sockaddr *) &destination, destination_len);
     if (bytes_sent != length) {
+        lh_metrics_inc(LH_COUNTER_SEND_ERRORS);
         if (bytes_sent == -1) {
-            log_msg = lh_get_message_str("UDP send failed. Reason: %s", strerror(errno));
-            log_error(log_msg);
-            free(log_msg);
+            log_errorf("UDP send failed. Reason: %s", strerror(errno));
         } else {
             log_warn("UDP: not all bytes could be sent.");
         }
+    } else {
+        lh_metrics_inc(LH_COUNTER_DATAGRAMS_SENT);
+        lh_metrics_add(LH_COUNTER_BYTES_SENT, bytes_sent);
     }
-
-    freeaddrinfo(source_addr_info);
-    close(send_socket_fd);
     return 1;
 }
 
-uint8_t* lh_receive_from_server(uint16_t *bytes_recv) {
-    struct addrinfo hints, *servinfo, *p;
-    int rv;
-    int numbytes;
-    struct sockaddr_storage their_addr;
-    char buf[MAXBUFLEN];
-    socklen_t addr_len;
-    char *log_msg;
-
-    if (listener_sock_fd == -1) {
-        // initialize listener socket
-        memset(&hints, 0, sizeof hints);
-        hints.ai_family = AF_INET; // set to AF_INET to force IPv4
-        hints.ai_socktype = SOCK_DGRAM;
-        hints.ai_flags = AI_PASSIVE; // use my IP
-
-        if ((rv = getaddrinfo(NULL, str_client_port, &hints, &servinfo)) != 0) {
-            log_msg = lh_get_message_str("getaddrinfo: %s\n", gai_strerror(rv));
-            log_error(log_msg);
-            free(log_msg);
-            return NULL;
-        }
+int family_index(int family) {
+    return family == AF_INET6;
+}
 
-        // loop through all the results and bind to the first we can
-        for (p = servinfo; p != NULL; p = p->ai_next) {
-            if ((listener_sock_fd = socket(p->ai_family, p->ai_socktype,
-                    p->ai_protocol)) == -1) {
-                perror("listener: socket");
-                continue;
-            }
-            // set socket non-blocking
-            fcntl(listener_sock_fd, F_SETFL, O_NONBLOCK);
-            int yes = 1;
-            if (setsockopt(listener_sock_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof (int)) == -1) {
-                perror("setsockopt");
-                return 0;
-            }
+/**
+ * Prefers the family with the lowest keepalive round trip time, or the only
+ * one that answered.
+ */
+void udp_choose_family() {
+    char rtt[2][24];
+    int j;
+    for (j = 0; j < 2; j++) {
+        if (probe_rtt_micros[j] == 0)
+            snprintf(rtt[j], sizeof rtt[j], "no answer");
+        else
+            snprintf(rtt[j], sizeof rtt[j], "%llu us", (unsigned long long) probe_rtt_micros[j]);
+    }
+    int family = probe_rtt_micros[1] != 0 && (probe_rtt_micros[0] == 0 || probe_rtt_micros[1] <= probe_rtt_micros[0])
+        ? AF_INET6 : AF_INET;
+    log_infof("UDP: keepalive round trip over IPv4 %s, over IPv6 %s, using %s.", rtt[0], rtt[1], family_name(family));
+    udp_resolver_prefer_family(family);
+    family_chosen = 1;
+    probe_sent_micros[0] = probe_sent_micros[1] = 0;
+    first_answer_micros = 0;
+}
 
-            if (bind(listener_sock_fd, p->ai_addr, p->ai_addrlen) == -1) {
-                close(listener_sock_fd);
-                perror("listener: bind");
-                continue;
-            }
+int lh_send_to_server(StunMessage *message) {
+    struct sockaddr_storage destination, alternative;
+    socklen_t destination_len, alternative_len;
+    uint16_t method, class;
 
-            break;
+    if (!udp_resolver_get(&destination, &destination_len)) {
+        log_errorf_limited("Unable to send UDP. The address of %s is not known.", config.server_host);
+        return 0;
+    }
+    if (!family_chosen) {
+        int other_family = destination.ss_family == AF_INET6 ? AF_INET : AF_INET6;
+        stun_get_method_and_class(message, &method, &class);
+        if (!udp_resolver_get_family(other_family, &alternative, &alternative_len)) {
+            // nothing to choose
+            family_chosen = 1;
+        } else if (first_answer_micros != 0) {
+            if (lh_get_absolute_time_micros() - first_answer_micros >= (uint64_t) LH_UDP_FAMILY_RACE_MILLIS * 1000) {
+                // the other family has not answered in time
+                udp_choose_family();
+                udp_resolver_get(&destination, &destination_len);
+            }
+        } else if (method == M_KEEP_ALIVE && class == CL_REQUEST) {
+            // until one of them answers, every keepalive is a new probe
+            memcpy(probe_trId, message->bytes + 8, sizeof probe_trId);
+            probe_sent_micros[family_index(other_family)] = lh_get_absolute_time_micros();
+            udp_send_datagram(message->bytes, message->length, &alternative, alternative_len);
+            probe_sent_micros[family_index(destination.ss_family)] = lh_get_absolute_time_micros();
         }
+    }
+    return udp_send_datagram(message->bytes, message->length, &destination, destination_len);
+}
 
-        if (p == NULL) {
-            log_error("listener: failed to bind socket\n");
-            return NULL;
-        }
+void lh_udp_keepalive_answered(const uint8_t *trId) {
+    if (family_chosen || memcmp(trId, probe_trId, sizeof probe_trId) != 0)
+        return;
+    int index = family_index(udp_address_family(&last_source));
+    if (probe_sent_micros[index] == 0 || probe_rtt_micros[index] != 0)
+        return;
+    uint64_t rtt = lh_get_absolute_time_micros() - probe_sent_micros[index];
+    probe_rtt_micros[index] = rtt > 0 ? rtt : 1;
+    if (probe_rtt_micros[0] != 0 && probe_rtt_micros[1] != 0) {
+        udp_choose_family();
+    } else {
+        // the family that answered is used until the race is over
+        first_answer_micros = lh_get_absolute_time_micros();
+        udp_resolver_prefer_family(udp_address_family(&last_source));
+    }
+}
+
+uint8_t* lh_receive_from_server(uint16_t *bytes_recv) {
+    int numbytes;
+    struct sockaddr_storage their_addr;
+    char buf[MAXBUFLEN];
+    socklen_t addr_len = sizeof their_addr;
 
-        freeaddrinfo(servinfo);
+    if (udp_backend == LH_UDP_BACKEND_IO_URING) {
+        uint8_t *datagram = udp_uring_receive(bytes_recv, &their_addr);
+        if (datagram != NULL)
+            last_source = their_addr;
+        return datagram;
     }
 
+    if (listener_sock_fd == -1 && (listener_sock_fd = udp_open_bound_socket()) == -1)
+        return NULL;
 
-    addr_len = sizeof their_addr;
     if ((numbytes = recvfrom(listener_sock_fd, buf, MAXBUFLEN - 1, 0,
             (struct sockaddr *) &their_addr, &addr_len)) == -1) {
         if (errno != EAGAIN && errno != EWOULDBLOCK){
@@ -191,14 +306,28 @@ uint8_t* lh_receive_from_server(uint16_t *bytes_recv) {
         return NULL;
     }
 
+    lh_metrics_inc(LH_COUNTER_DATAGRAMS_RECEIVED);
+    lh_metrics_add(LH_COUNTER_BYTES_RECEIVED, numbytes);
+    last_source = their_addr;
     uint8_t *datagram = malloc(numbytes * sizeof *datagram);
     memcpy(datagram, buf, numbytes);
     if (bytes_recv != NULL){
         *bytes_recv = (uint16_t) numbytes;
     }
-    log_msg = lh_get_message_int("listener: packet is %d bytes long", numbytes);
-    log_debug(log_msg);
-    free(log_msg);
+    log_debugf("listener: packet is %d bytes long", numbytes);
 
     return datagram;
 }
+
+int lh_udp_get_fd() {
+    if (udp_backend == LH_UDP_BACKEND_IO_URING)
+        return udp_uring_get_fd();
+    if (listener_sock_fd == -1)
+        listener_sock_fd = udp_open_bound_socket();
+    return listener_sock_fd;
+}
+
+void lh_udp_flush() {
+    if (udp_backend == LH_UDP_BACKEND_IO_URING)
+        udp_uring_flush();
+}
@@ -34,18 +34,78 @@ extern "C" {
 #define LHINGS_SERVER_HOST "www.lhings.com"
 #define LHINGS_SERVER_UDP_PORT "3478"
 #define MAXBUFLEN 2048
+    // how long the other family of the server has to answer a keepalive after the first one did
+#define LH_UDP_FAMILY_RACE_MILLIS 1000
 #include <stdint.h>
 #include "../../core/stun-messaging/stun_message.h"
+
+    typedef enum {
+        // one system call per datagram sent or received
+        LH_UDP_BACKEND_SOCKETS,
+        // sends are batched and receives use a multishot request, needs Linux 6.0
+        LH_UDP_BACKEND_IO_URING
+    } LH_UdpBackend;
+
+    /**
+     * Selects how datagrams are sent and received. Sockets are used by default.
+     * It must be called before lh_start_device(). When io_uring is requested
+     * but the kernel does not support it, sockets are used instead.
+     * 
+     * With io_uring the datagrams sent are queued and submitted together at
+     * the end of each step of the main loop (see lh_udp_flush), and their send
+     * errors are counted and logged when they complete.
+     * 
+     * This function is specific to the Linux port, other ports do not need
+     * to implement it.
+     * @param backend
+     * @return 1 if the requested backend is used, 0 otherwise.
+     */
+    int lh_udp_set_backend(LH_UdpBackend backend);
     
     /**
-     * Sends to Lhings server (www.lhings.com) UDP port 3478 the bytes that make up the given
+     * Starts resolving the address of the server (config.server_host), so
+     * that it is known by the time the first datagram is sent. lh_start_device
+     * calls it before starting the session over HTTP. Implementations may
+     * resolve it in the background and must not block for long.
+     */
+    void lh_udp_resolve_server();
+
+    /**
+     * Tells the transport that the server has stopped answering the keepalives.
+     * When the name of the server resolves to several addresses, the following
+     * datagrams must be sent to the next one; after trying all of them, the
+     * name is resolved again. Implementations that keep a single address may
+     * do nothing.
+     */
+    void lh_udp_server_unresponsive();
+
+    /**
+     * Sends to Lhings server (config.server_host, by default www.lhings.com)
+     * UDP port config.server_udp_port (by default 3478) the bytes that make up the given
      * STUN message. Implementations must bind to a port and use it for the 
      * entire session, so that the server knows where to send replies and
-     * requests to the device.
+     * requests to the device. The name of the server must be resolved again
+     * when its DNS records expire, without blocking the main loop. When the
+     * server has both IPv4 and IPv6 addresses, implementations should use the
+     * family that answers first, and fall back to IPv4 on hosts without IPv6.
      * @param message 
      * @return 1 on success, 0 otherwise.
      */
     int lh_send_to_server(StunMessage *message);
+
+    /**
+     * Tells the transport that a keepalive success response has been
+     * received, right after lh_receive_from_server returned it. While it
+     * races the families of the server, the transport sends the keepalive
+     * over both, records the round trip time of each family whose answer
+     * carries the transaction id of that keepalive, and prefers the fastest
+     * once both have answered. The first family that answers is used in the
+     * meantime, and is kept if the other does not answer within
+     * LH_UDP_FAMILY_RACE_MILLIS. Implementations that use a single family do
+     * nothing.
+     * @param trId The 12 bytes of the transaction id of the response.
+     */
+    void lh_udp_keepalive_answered(const uint8_t *trId);
     
     /**
      * Listens asynchronously to UDP packets sent from Lhings server UDP port 3478. The call must not block
@@ -59,7 +119,82 @@ extern "C" {
      * data received.
      */
     uint8_t* lh_receive_from_server(uint16_t *bytes_recv);
-    
+
+    /**
+     * Returns a descriptor that becomes readable when lh_receive_from_server
+     * has a datagram to return, opening the socket if it is not open yet.
+     * @return The descriptor, or -1 if the port has none, in which case the
+     * main loop does not wait for datagrams.
+     */
+    int lh_udp_get_fd();
+
+    /**
+     * Sends the datagrams that lh_send_to_server has queued but not sent yet.
+     * Called at the end of every step of the main loop, before waiting.
+     * Ports that send datagrams right away do nothing.
+     */
+    void lh_udp_flush();
+
+    /**
+     * Opens the sockets of the workers of a gateway (see core/gateway/gateway.h),
+     * one per worker, all bound to the same local port. It is called once,
+     * from the thread that starts the gateway, before the workers start.
+     *
+     * Implementations should deliver each datagram from the server to the
+     * socket of the worker that owns its device, lh_gateway_shard() of the
+     * value of its LYNCPORT_ID attribute; datagrams delivered to another
+     * worker are handed over to the right one, at some cost.
+     *
+     * The server is resolved once, here, and every socket sends to that
+     * address for as long as it is open.
+     *
+     * Ports that do not support gateways return 0.
+     * @param count Number of workers.
+     * @return 1 on success, 0 otherwise.
+     */
+    int lh_udp_shards_open(uint16_t count);
+
+    /**
+     * Closes the sockets opened by lh_udp_shards_open, so that they can be
+     * opened again. It is called from the thread that starts the gateway,
+     * once no worker uses them.
+     */
+    void lh_udp_shards_close();
+
+    /**
+     * Queues a datagram to the server in the socket of a worker. Only the
+     * worker may call it.
+     * @param shard Index of the worker.
+     * @param bytes
+     * @param length
+     * @return 1 on success, 0 otherwise.
+     */
+    int lh_udp_shard_send(uint16_t shard, const uint8_t *bytes, uint16_t length);
+
+    /**
+     * Sends the datagrams queued by lh_udp_shard_send. Only the worker may call it.
+     * @param shard Index of the worker.
+     */
+    void lh_udp_shard_flush(uint16_t shard);
+
+    /**
+     * Returns the next datagram received by the socket of a worker, without
+     * blocking. Only the worker may call it.
+     * @param shard Index of the worker.
+     * @param bytes_recv Where the number of bytes received is stored.
+     * @return null if no datagram has been received, otherwise the datagram,
+     * which belongs to the socket and is valid until the next call.
+     */
+    uint8_t* lh_udp_shard_receive(uint16_t shard, uint16_t *bytes_recv);
+
+    /**
+     * Waits until the socket of a worker receives a datagram or the timeout
+     * expires. Only the worker may call it.
+     * @param shard Index of the worker.
+     * @param timeout_millis
+     */
+    void lh_udp_shard_wait(uint16_t shard, uint32_t timeout_millis);
+
 
 
 #ifdef	__cplusplus
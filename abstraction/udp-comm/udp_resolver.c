@@ -0,0 +1,233 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <arpa/nameser.h>
+#include <resolv.h>
+#include "udp_resolver.h"
+#include "../../core/lhings.h"
+#include "../../core/logging/log.h"
+#include "../threading/lhings_thread.h"
+#include "../timing/lhings_time.h"
+
+typedef struct resolver_result {
+    char host[256];
+    char port[8];
+    int family;
+    struct sockaddr_storage addresses[RESOLVER_MAX_ADDRESSES];
+    socklen_t lengths[RESOLVER_MAX_ADDRESSES];
+    int count;
+    uint32_t ttl_secs;
+    int status;
+} ResolverResult;
+
+// written by the resolver thread, read by the main loop once result_ready is set
+static ResolverResult result;
+static uint32_t result_ready = 0;
+static uint32_t in_flight = 0;
+// addresses in use
+static ResolverResult current;
+static int current_index = 0;
+static uint32_t expires_at_millis = 0;
+static int resolver_family = AF_UNSPEC;
+
+uint16_t dns_read_16(const uint8_t *bytes) {
+    return (uint16_t) (bytes[0] << 8 | bytes[1]);
+}
+
+/**
+ * Returns the smallest TTL of the address records of a name, or 0 if it
+ * can not be found. getaddrinfo does not return TTLs, so the records are
+ * queried apart.
+ */
+uint32_t dns_ttl(const char *host) {
+    uint8_t answer[1024];
+    int length = res_query(host, C_IN, T_A, answer, sizeof answer);
+    if (length < HFIXEDSZ)
+        length = res_query(host, C_IN, T_AAAA, answer, sizeof answer);
+    if (length < HFIXEDSZ)
+        return 0;
+    const uint8_t *end = answer + length, *position = answer + HFIXEDSZ;
+    int questions = dns_read_16(answer + 4), answers = dns_read_16(answer + 6);
+    uint32_t ttl = 0;
+    int skipped;
+    while (questions-- > 0) {
+        if ((skipped = dn_skipname(position, end)) < 0)
+            return 0;
+        position += skipped + QFIXEDSZ;
+    }
+    while (answers-- > 0 && position < end) {
+        if ((skipped = dn_skipname(position, end)) < 0 || position + skipped + RRFIXEDSZ > end)
+            break;
+        position += skipped;
+        uint16_t type = dns_read_16(position);
+        uint32_t record_ttl = (uint32_t) dns_read_16(position + 4) << 16 | dns_read_16(position + 6);
+        position += RRFIXEDSZ + dns_read_16(position + 8);
+        if ((type == T_A || type == T_AAAA) && (ttl == 0 || record_ttl < ttl))
+            ttl = record_ttl;
+    }
+    return ttl;
+}
+
+void resolver_thread(void *argument) {
+    struct addrinfo hints, *info, *p;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = result.family;
+    hints.ai_socktype = SOCK_DGRAM;
+    result.count = 0;
+    result.status = getaddrinfo(result.host, result.port, &hints, &info);
+    if (result.status == 0) {
+        for (p = info; p != NULL && result.count < RESOLVER_MAX_ADDRESSES; p = p->ai_next) {
+            memcpy(&result.addresses[result.count], p->ai_addr, p->ai_addrlen);
+            result.lengths[result.count] = p->ai_addrlen;
+            result.count++;
+        }
+        freeaddrinfo(info);
+    }
+    result.ttl_secs = dns_ttl(result.host);
+    LH_ATOMIC_STORE(&result_ready, 1);
+}
+
+void udp_resolver_start() {
+    if (LH_ATOMIC_LOAD(&in_flight))
+        return;
+    snprintf(result.host, sizeof result.host, "%s", config.server_host);
+    snprintf(result.port, sizeof result.port, "%s", config.server_udp_port);
+    result.family = resolver_family;
+    LH_ATOMIC_STORE(&in_flight, 1);
+    if (!lh_thread_start(resolver_thread, NULL)) {
+        log_error("Unable to start the resolver thread.");
+        LH_ATOMIC_STORE(&in_flight, 0);
+    }
+}
+
+const char* address_to_string(const struct sockaddr_storage *address, char *buffer, socklen_t size) {
+    const void *ip = address->ss_family == AF_INET6 ? (const void *) &((const struct sockaddr_in6 *) address)->sin6_addr
+            : (const void *) &((const struct sockaddr_in *) address)->sin_addr;
+    if (inet_ntop(address->ss_family, ip, buffer, size) == NULL)
+        snprintf(buffer, size, "?");
+    return buffer;
+}
+
+int address_equals(const struct sockaddr_storage *a, socklen_t a_len, const struct sockaddr_storage *b, socklen_t b_len) {
+    return a_len == b_len && memcmp(a, b, a_len) == 0;
+}
+
+/**
+ * Takes the result of the last resolution, if there is one. The address in
+ * use is kept when it is still among the new ones.
+ */
+void resolver_adopt() {
+    int j;
+    char text[INET6_ADDRSTRLEN];
+    if (!LH_ATOMIC_LOAD(&result_ready))
+        return;
+    uint32_t now = lh_get_absolute_time_millis();
+    if (strcmp(result.host, config.server_host) != 0 || strcmp(result.port, config.server_udp_port) != 0) {
+        // the server changed while resolving, resolve the new one
+        expires_at_millis = now;
+    } else if (result.count == 0) {
+        log_errorf_limited("Unable to resolve %s. Reason: %s", result.host, gai_strerror(result.status));
+        expires_at_millis = now + RESOLVER_MIN_TTL_SECS * 1000;
+    } else {
+        int index = 0;
+        for (j = 0; j < result.count && current.count > 0; j++) {
+            if (address_equals(&result.addresses[j], result.lengths[j], &current.addresses[current_index], current.lengths[current_index]))
+                index = j;
+        }
+        uint32_t ttl = result.ttl_secs == 0 ? RESOLVER_DEFAULT_TTL_SECS : result.ttl_secs;
+        if (ttl < RESOLVER_MIN_TTL_SECS)
+            ttl = RESOLVER_MIN_TTL_SECS;
+        if (ttl > RESOLVER_MAX_TTL_SECS)
+            ttl = RESOLVER_MAX_TTL_SECS;
+        if (current.count == 0 || !address_equals(&result.addresses[index], result.lengths[index], &current.addresses[current_index], current.lengths[current_index]))
+            log_infof("UDP: server %s resolved to %s, %d addresses, TTL %u s", result.host,
+                address_to_string(&result.addresses[index], text, sizeof text), result.count, ttl);
+        current = result;
+        current_index = index;
+        expires_at_millis = now + ttl * 1000;
+    }
+    LH_ATOMIC_STORE(&result_ready, 0);
+    LH_ATOMIC_STORE(&in_flight, 0);
+}
+
+int udp_resolver_get(struct sockaddr_storage *address, socklen_t *address_len) {
+    resolver_adopt();
+    if (current.count > 0 && (strcmp(current.host, config.server_host) != 0 || strcmp(current.port, config.server_udp_port) != 0))
+        current.count = 0;
+    if (current.count == 0) {
+        uint32_t start = lh_get_absolute_time_millis();
+        udp_resolver_start();
+        while (current.count == 0 && lh_get_absolute_time_millis() - start < RESOLVER_FIRST_WAIT_MILLIS) {
+            lh_sleep(1);
+            resolver_adopt();
+            if (!LH_ATOMIC_LOAD(&in_flight))
+                break;
+        }
+        if (current.count == 0)
+            return 0;
+    } else if ((int32_t) (lh_get_absolute_time_millis() - expires_at_millis) >= 0) {
+        udp_resolver_start();
+    }
+    memcpy(address, &current.addresses[current_index], current.lengths[current_index]);
+    *address_len = current.lengths[current_index];
+    return 1;
+}
+
+void udp_resolver_failover() {
+    char text[INET6_ADDRSTRLEN];
+    if (current.count == 0)
+        return;
+    current_index = (current_index + 1) % current.count;
+    // every address has been tried, maybe the server has moved
+    if (current_index == 0)
+        udp_resolver_start();
+    if (current.count > 1)
+        log_warnf("UDP: server not responding, switching to %s",
+            address_to_string(&current.addresses[current_index], text, sizeof text));
+}
+
+void udp_resolver_restrict_family(int family) {
+    resolver_family = family;
+}
+
+int udp_resolver_get_family(int family, struct sockaddr_storage *address, socklen_t *address_len) {
+    int j;
+    for (j = 0; j < current.count; j++) {
+        int index = (current_index + j) % current.count;
+        if (current.addresses[index].ss_family == family) {
+            memcpy(address, &current.addresses[index], current.lengths[index]);
+            *address_len = current.lengths[index];
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void udp_resolver_prefer_family(int family) {
+    int j;
+    for (j = 0; j < current.count; j++) {
+        int index = (current_index + j) % current.count;
+        if (current.addresses[index].ss_family == family) {
+            current_index = index;
+            return;
+        }
+    }
+}
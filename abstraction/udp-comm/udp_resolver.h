@@ -0,0 +1,98 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file udp_resolver.h
+ * @brief Resolution of the address of the server for the UDP transport.
+ *
+ * Names are resolved by a background thread, so that a slow resolver does
+ * not stall the main loop. Every address returned is kept, and the name is
+ * resolved again when the TTL of its DNS records expires. Until the new
+ * addresses arrive the old ones are used. When the server stops answering,
+ * the transport moves to the next address.
+ *
+ * Addresses of both families are resolved, in the order getaddrinfo returns
+ * them; the transport chooses the family that answers first.
+ *
+ * This header is internal to the Linux port.
+ */
+
+#ifndef UDP_RESOLVER_H
+#define	UDP_RESOLVER_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <sys/socket.h>
+
+#define RESOLVER_MAX_ADDRESSES 8
+    // used when the TTL is not known, e.g. for names in /etc/hosts
+#define RESOLVER_DEFAULT_TTL_SECS 60
+#define RESOLVER_MIN_TTL_SECS 5
+#define RESOLVER_MAX_TTL_SECS 3600
+    // time the first send waits for the first resolution
+#define RESOLVER_FIRST_WAIT_MILLIS 5000
+
+    /**
+     * Starts resolving config.server_host in the background, unless it is
+     * already being resolved.
+     */
+    void udp_resolver_start();
+
+    /**
+     * Gets the address the datagrams to the server must be sent to. It does
+     * not block, unless the name has never been resolved; then it waits up to
+     * RESOLVER_FIRST_WAIT_MILLIS for the first resolution.
+     * @param address
+     * @param address_len
+     * @return 1 if there is an address, 0 otherwise.
+     */
+    int udp_resolver_get(struct sockaddr_storage *address, socklen_t *address_len);
+
+    /**
+     * Moves to the next address of the server. After all of them have been
+     * tried the name is resolved again.
+     */
+    void udp_resolver_failover();
+
+    /**
+     * Resolves only addresses of the given family from the next resolution on.
+     * @param family AF_INET, AF_INET6 or AF_UNSPEC for both, the default.
+     */
+    void udp_resolver_restrict_family(int family);
+
+    /**
+     * Gets the next address of the given family, starting from the one in use.
+     * @param family
+     * @param address
+     * @param address_len
+     * @return 1 if the server has an address of that family, 0 otherwise.
+     */
+    int udp_resolver_get_family(int family, struct sockaddr_storage *address, socklen_t *address_len);
+
+    /**
+     * Moves to the next address of the given family, if the address in use
+     * is not of that family.
+     * @param family
+     */
+    void udp_resolver_prefer_family(int family);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UDP_RESOLVER_H */
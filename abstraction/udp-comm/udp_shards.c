@@ -0,0 +1,284 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/*
+ * Sockets of the workers of a gateway. Every worker has its own socket, bound
+ * with SO_REUSEPORT to the same port, so the workers never share a socket or
+ * a lock. A classic BPF program attached to the group makes the kernel
+ * deliver each datagram to the socket of the worker that owns its device,
+ * computing the same partition as lh_gateway_shard(): the first 32 bits of
+ * the LYNCPORT_ID attribute modulo the number of workers. Datagrams are sent
+ * and received in batches with sendmmsg and recvmmsg.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/filter.h>
+#include "udp_api.h"
+#include "udp_resolver.h"
+#include "../../core/lhings.h"
+#include "../../core/logging/log.h"
+#include "../../core/metrics/metrics.h"
+
+// datagrams sent or received with a single system call
+#define UDP_SHARD_BATCH 32
+// attributes the steering program looks at before giving up on finding LYNCPORT_ID
+#define UDP_SHARD_STEER_ATTRIBUTES 6
+
+typedef struct udp_shard {
+    int fd;
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    // datagrams queued by lh_udp_shard_send
+    struct mmsghdr send_headers[UDP_SHARD_BATCH];
+    struct iovec send_iovecs[UDP_SHARD_BATCH];
+    uint8_t send_buffers[UDP_SHARD_BATCH][MAXBUFLEN];
+    uint32_t send_count;
+    // datagrams received by the last recvmmsg, handed out one by one
+    struct mmsghdr recv_headers[UDP_SHARD_BATCH];
+    struct iovec recv_iovecs[UDP_SHARD_BATCH];
+    uint8_t recv_buffers[UDP_SHARD_BATCH][MAXBUFLEN];
+    uint32_t recv_count, recv_next;
+} UdpShard;
+
+// each shard is allocated apart, so workers do not share cache lines
+static UdpShard **shards = NULL;
+static uint16_t shard_count = 0;
+
+/**
+ * Builds the program that chooses the socket of a datagram. Its offsets are
+ * relative to the UDP payload: it walks the attributes that follow the STUN
+ * header and returns the first 32 bits of the uuid modulo the number of
+ * sockets. When LYNCPORT_ID is not found it returns an index out of range,
+ * and the kernel falls back to choosing the socket by the hash of the addresses.
+ * @return The number of instructions.
+ */
+int udp_shard_steering_program(struct sock_filter *code, uint16_t count) {
+    int n = 0, j;
+    // the program is a straight line, found is the instruction after the fallback return
+    int found = 1 + 7 * UDP_SHARD_STEER_ATTRIBUTES + 1;
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_LDX | BPF_W | BPF_IMM, STUN_MIN_MESS_LEN);
+    for (j = 0; j < UDP_SHARD_STEER_ATTRIBUTES; j++) {
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_IND, 0);
+        code[n] = (struct sock_filter) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ATTR_LYNCPORT_ID, found - n - 1, 0);
+        n++;
+        // X += 4 + length rounded up to 32 bits
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 7);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_AND | BPF_K, ~3u);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0);
+        code[n++] = (struct sock_filter) BPF_STMT(BPF_MISC | BPF_TAX, 0);
+    }
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_K, 0xffffffff);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_LD | BPF_W | BPF_IND, 4);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, count);
+    code[n++] = (struct sock_filter) BPF_STMT(BPF_RET | BPF_A, 0);
+    return n;
+}
+
+void udp_shard_attach_steering(int fd, uint16_t count) {
+#ifdef SO_ATTACH_REUSEPORT_CBPF
+    struct sock_filter code[UDP_SHARD_STEER_ATTRIBUTES * 7 + 5];
+    struct sock_fprog program;
+    program.len = udp_shard_steering_program(code, count);
+    program.filter = code;
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof program) == 0)
+        return;
+    log_warnf("UDP: datagrams can not be steered to their worker (%s), workers will hand them over.", strerror(errno));
+#else
+    log_warn("UDP: datagrams can not be steered to their worker, workers will hand them over.");
+#endif
+}
+
+/**
+ * Opens a socket of the group, bound to the given port of the family of
+ * the server, or to any port if it is 0.
+ * @return The socket, or -1 on failure.
+ */
+int udp_shard_socket(int family, uint16_t port) {
+    struct sockaddr_storage local;
+    socklen_t local_len;
+    int yes = 1;
+    memset(&local, 0, sizeof local);
+    if (family == AF_INET6) {
+        struct sockaddr_in6 *local6 = (struct sockaddr_in6 *) &local;
+        local6->sin6_family = AF_INET6;
+        local6->sin6_addr = in6addr_any;
+        local6->sin6_port = htons(port);
+        local_len = sizeof *local6;
+    } else {
+        struct sockaddr_in *local4 = (struct sockaddr_in *) &local;
+        local4->sin_family = AF_INET;
+        local4->sin_addr.s_addr = htonl(INADDR_ANY);
+        local4->sin_port = htons(port);
+        local_len = sizeof *local4;
+    }
+    int fd = socket(family, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+    if (fd == -1) {
+        log_errorf("Unable to create UDP socket. Reason: %s", strerror(errno));
+        return -1;
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1
+            || bind(fd, (struct sockaddr *) &local, local_len) == -1) {
+        log_errorf("Bind failed. Reason: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+uint16_t udp_socket_port(int fd) {
+    struct sockaddr_storage local;
+    socklen_t local_len = sizeof local;
+    if (getsockname(fd, (struct sockaddr *) &local, &local_len) == -1)
+        return 0;
+    if (local.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6 *) &local)->sin6_port);
+    return ntohs(((struct sockaddr_in *) &local)->sin_port);
+}
+
+int lh_udp_shards_open(uint16_t count) {
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    uint16_t port = 0;
+    int j;
+    if (shards != NULL || count == 0)
+        return 0;
+    // the workers keep the address resolved now, the resolver is not thread safe
+    if (!udp_resolver_get(&server, &server_len)) {
+        log_errorf("Unable to open the gateway sockets. The address of %s is not known.", config.server_host);
+        return 0;
+    }
+    shards = calloc(count, sizeof *shards);
+    // sockets are indexed in the group in the order they are bound, which is the order of the workers
+    for (j = 0; j < count; j++) {
+        UdpShard *shard = calloc(1, sizeof *shard);
+        if (shard == NULL || (shard->fd = udp_shard_socket(server.ss_family, port)) == -1) {
+            free(shard);
+            break;
+        }
+        // the first socket gets a free port, the rest join it
+        if (port == 0)
+            port = udp_socket_port(shard->fd);
+        memcpy(&shard->server, &server, server_len);
+        shard->server_len = server_len;
+        shards[j] = shard;
+        shard_count++;
+    }
+    if (shard_count != count) {
+        lh_udp_shards_close();
+        return 0;
+    }
+    if (count > 1)
+        udp_shard_attach_steering(shards[0]->fd, count);
+    log_infof("UDP: gateway listening in port %u with %u sockets.", (unsigned) port, (unsigned) count);
+    return 1;
+}
+
+void lh_udp_shards_close() {
+    int j;
+    for (j = 0; j < shard_count; j++) {
+        close(shards[j]->fd);
+        free(shards[j]);
+    }
+    free(shards);
+    shards = NULL;
+    shard_count = 0;
+}
+
+void lh_udp_shard_flush(uint16_t index) {
+    UdpShard *shard = shards[index];
+    uint32_t sent = 0;
+    while (sent < shard->send_count) {
+        int result = sendmmsg(shard->fd, shard->send_headers + sent, shard->send_count - sent, 0);
+        if (result <= 0) {
+            if (result == -1 && errno == EINTR)
+                continue;
+            // the datagram that failed is dropped, the rest are retried
+            lh_metrics_inc(LH_COUNTER_SEND_ERRORS);
+            log_errorf_limited("UDP send failed. Reason: %s", strerror(errno));
+            sent++;
+            continue;
+        }
+        int j;
+        for (j = 0; j < result; j++)
+            lh_metrics_add(LH_COUNTER_BYTES_SENT, shard->send_headers[sent + j].msg_len);
+        lh_metrics_add(LH_COUNTER_DATAGRAMS_SENT, result);
+        sent += result;
+    }
+    shard->send_count = 0;
+}
+
+int lh_udp_shard_send(uint16_t index, const uint8_t *bytes, uint16_t length) {
+    UdpShard *shard = shards[index];
+    if (length > MAXBUFLEN)
+        return 0;
+    if (shard->send_count == UDP_SHARD_BATCH)
+        lh_udp_shard_flush(index);
+    uint32_t slot = shard->send_count++;
+    memcpy(shard->send_buffers[slot], bytes, length);
+    shard->send_iovecs[slot].iov_base = shard->send_buffers[slot];
+    shard->send_iovecs[slot].iov_len = length;
+    memset(&shard->send_headers[slot], 0, sizeof shard->send_headers[slot]);
+    shard->send_headers[slot].msg_hdr.msg_name = &shard->server;
+    shard->send_headers[slot].msg_hdr.msg_namelen = shard->server_len;
+    shard->send_headers[slot].msg_hdr.msg_iov = &shard->send_iovecs[slot];
+    shard->send_headers[slot].msg_hdr.msg_iovlen = 1;
+    return 1;
+}
+
+uint8_t* lh_udp_shard_receive(uint16_t index, uint16_t *bytes_recv) {
+    UdpShard *shard = shards[index];
+    int j;
+    if (shard->recv_next == shard->recv_count) {
+        shard->recv_next = shard->recv_count = 0;
+        for (j = 0; j < UDP_SHARD_BATCH; j++) {
+            shard->recv_iovecs[j].iov_base = shard->recv_buffers[j];
+            shard->recv_iovecs[j].iov_len = MAXBUFLEN;
+            memset(&shard->recv_headers[j], 0, sizeof shard->recv_headers[j]);
+            shard->recv_headers[j].msg_hdr.msg_iov = &shard->recv_iovecs[j];
+            shard->recv_headers[j].msg_hdr.msg_iovlen = 1;
+        }
+        int received = recvmmsg(shard->fd, shard->recv_headers, UDP_SHARD_BATCH, MSG_DONTWAIT, NULL);
+        if (received <= 0) {
+            if (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                log_errorf_limited("UDP receive failed. Reason: %s", strerror(errno));
+            return NULL;
+        }
+        shard->recv_count = received;
+        lh_metrics_add(LH_COUNTER_DATAGRAMS_RECEIVED, received);
+    }
+    j = shard->recv_next++;
+    lh_metrics_add(LH_COUNTER_BYTES_RECEIVED, shard->recv_headers[j].msg_len);
+    *bytes_recv = (uint16_t) shard->recv_headers[j].msg_len;
+    return shard->recv_buffers[j];
+}
+
+void lh_udp_shard_wait(uint16_t index, uint32_t timeout_millis) {
+    UdpShard *shard = shards[index];
+    if (shard->recv_next != shard->recv_count)
+        return;
+    struct pollfd pfd = {shard->fd, POLLIN, 0};
+    poll(&pfd, 1, (int) timeout_millis);
+}
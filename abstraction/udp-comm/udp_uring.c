@@ -0,0 +1,472 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "udp_uring.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define LH_HAVE_IO_URING 1
+#endif
+#endif
+
+#ifdef LH_HAVE_IO_URING
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/utsname.h>
+#include <linux/io_uring.h>
+#include "udp_api.h"
+#include "../../core/logging/log.h"
+#include "../../core/metrics/metrics.h"
+
+#define URING_ENTRIES 256
+// both must be powers of two
+#define URING_SEND_BUFFERS 128
+#define URING_RECV_BUFFERS 128
+#define URING_BUFFER_GROUP 0
+// a received buffer starts with the header of the message and the address of
+// the sender, so it takes datagrams as long as those of the sockets backend
+#define URING_RECV_BUFFER_LEN (sizeof (struct io_uring_recvmsg_out) + sizeof (struct sockaddr_storage) + MAXBUFLEN)
+// user data of the receive request, sends carry the index of their buffer
+#define URING_RECV_TAG 0xffffffffULL
+
+typedef struct uring_state {
+    int ring_fd;
+    int socket_fd;
+    struct sockaddr_storage destination;
+    socklen_t destination_len;
+    // submission queue, shared with the kernel
+    void *sq_ring;
+    size_t sq_ring_size;
+    uint32_t *sq_head, *sq_tail, *sq_mask, *sq_array;
+    uint32_t sq_entries;
+    struct io_uring_sqe *sqes;
+    uint32_t sq_local_tail;
+    uint32_t to_submit;
+    // completion queue, shared with the kernel
+    void *cq_ring;
+    size_t cq_ring_size;
+    uint32_t *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    // registered send buffers and the indexes of the free ones; sends to an
+    // address other than the connected one use the message headers
+    uint8_t *send_buffers;
+    struct msghdr send_headers[URING_SEND_BUFFERS];
+    struct iovec send_iovecs[URING_SEND_BUFFERS];
+    struct sockaddr_storage send_addresses[URING_SEND_BUFFERS];
+    uint16_t free_sends[URING_SEND_BUFFERS];
+    int free_count;
+    // provided receive buffers, and those filled and not yet returned by udp_uring_receive
+    struct io_uring_buf_ring *recv_ring;
+    uint8_t *recv_buffers;
+    uint16_t recv_ring_tail;
+    uint16_t ready_bids[URING_RECV_BUFFERS];
+    uint32_t ready_lengths[URING_RECV_BUFFERS];
+    uint32_t ready_head, ready_tail;
+    int receiving;
+} UringState;
+
+static UringState uring = {-1, -1};
+// the source address of each datagram is stored in the buffer, before its bytes
+static struct msghdr recv_msghdr = {NULL, sizeof (struct sockaddr_storage)};
+
+int udp_open_bound_socket();
+
+int uring_enter(uint32_t to_submit, uint32_t min_complete) {
+    return (int) syscall(__NR_io_uring_enter, uring.ring_fd, to_submit, min_complete,
+            min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+int uring_register(uint32_t opcode, void *argument, uint32_t count) {
+    return (int) syscall(__NR_io_uring_register, uring.ring_fd, opcode, argument, count);
+}
+
+int kernel_supports_multishot_recvmsg() {
+    struct utsname name;
+    int major, minor;
+    if (uname(&name) != 0 || sscanf(name.release, "%d.%d", &major, &minor) != 2)
+        return 0;
+    return major >= 6;
+}
+
+void uring_submit(uint32_t min_complete) {
+    if (uring.to_submit == 0 && min_complete == 0)
+        return;
+    __atomic_store_n(uring.sq_tail, uring.sq_local_tail, __ATOMIC_RELEASE);
+    int submitted = uring_enter(uring.to_submit, min_complete);
+    if (submitted < 0) {
+        log_errorf_limited("io_uring submission failed. Reason: %s", strerror(errno));
+        return;
+    }
+    uring.to_submit -= submitted;
+}
+
+struct io_uring_sqe* uring_get_sqe() {
+    if (uring.sq_local_tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries)
+        uring_submit(0);
+    struct io_uring_sqe *sqe = &uring.sqes[uring.sq_local_tail & *uring.sq_mask];
+    memset(sqe, 0, sizeof *sqe);
+    uring.sq_local_tail++;
+    uring.to_submit++;
+    return sqe;
+}
+
+void recv_buffer_add(uint16_t bid) {
+    // only the fields of the entry are written, its reserved field overlaps the tail of the ring
+    struct io_uring_buf *buffer = &uring.recv_ring->bufs[uring.recv_ring_tail & (URING_RECV_BUFFERS - 1)];
+    buffer->addr = (uint64_t) (uintptr_t) (uring.recv_buffers + bid * URING_RECV_BUFFER_LEN);
+    buffer->len = URING_RECV_BUFFER_LEN;
+    buffer->bid = bid;
+    uring.recv_ring_tail++;
+    __atomic_store_n(&uring.recv_ring->tail, uring.recv_ring_tail, __ATOMIC_RELEASE);
+}
+
+void uring_arm_receive() {
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = uring.socket_fd;
+    sqe->addr = (uint64_t) (uintptr_t) &recv_msghdr;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECV_TAG;
+    uring.receiving = 1;
+}
+
+void uring_handle_completion(struct io_uring_cqe *cqe) {
+    if (cqe->user_data == URING_RECV_TAG) {
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            uring.receiving = 0;
+        if (cqe->res < 0) {
+            // ENOBUFS only means that every buffer was full, the request is armed again
+            if (cqe->res != -ENOBUFS)
+                log_errorf_limited("io_uring receive failed. Reason: %s", strerror(-cqe->res));
+            return;
+        }
+        if (cqe->flags & IORING_CQE_F_BUFFER) {
+            uint32_t slot = uring.ready_tail++ & (URING_RECV_BUFFERS - 1);
+            uring.ready_bids[slot] = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            uring.ready_lengths[slot] = cqe->res;
+        }
+        return;
+    }
+    uring.free_sends[uring.free_count++] = (uint16_t) cqe->user_data;
+    if (cqe->res < 0) {
+        lh_metrics_inc(LH_COUNTER_SEND_ERRORS);
+        log_errorf_limited("UDP send failed. Reason: %s", strerror(-cqe->res));
+    } else {
+        lh_metrics_inc(LH_COUNTER_DATAGRAMS_SENT);
+        lh_metrics_add(LH_COUNTER_BYTES_SENT, cqe->res);
+    }
+}
+
+void uring_reap() {
+    uint32_t head = *uring.cq_head;
+    uint32_t tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        uring_handle_completion(&uring.cqes[head & *uring.cq_mask]);
+        head++;
+    }
+    __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+int udp_uring_init() {
+    struct io_uring_params params;
+    int j;
+    if (uring.ring_fd != -1)
+        return 1;
+    if (!kernel_supports_multishot_recvmsg()) {
+        log_warn("io_uring: multishot receive needs Linux 6.0 or later.");
+        return 0;
+    }
+    memset(&params, 0, sizeof params);
+    uring.ring_fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (uring.ring_fd < 0) {
+        log_warnf("io_uring not available. Reason: %s", strerror(errno));
+        uring.ring_fd = -1;
+        return 0;
+    }
+
+    // map the queues, in a single mapping when the kernel allows it
+    uring.sq_ring_size = params.sq_off.array + params.sq_entries * sizeof (uint32_t);
+    uring.cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (uring.cq_ring_size > uring.sq_ring_size)
+            uring.sq_ring_size = uring.cq_ring_size;
+        uring.cq_ring_size = uring.sq_ring_size;
+    }
+    uring.sq_ring = mmap(NULL, uring.sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+            uring.ring_fd, IORING_OFF_SQ_RING);
+    if (uring.sq_ring == MAP_FAILED) {
+        uring.sq_ring = NULL;
+        goto fail;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        uring.cq_ring = uring.sq_ring;
+    } else {
+        uring.cq_ring = mmap(NULL, uring.cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                uring.ring_fd, IORING_OFF_CQ_RING);
+        if (uring.cq_ring == MAP_FAILED) {
+            uring.cq_ring = NULL;
+            goto fail;
+        }
+    }
+    uring.sqes = mmap(NULL, params.sq_entries * sizeof (struct io_uring_sqe), PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, uring.ring_fd, IORING_OFF_SQES);
+    if (uring.sqes == MAP_FAILED) {
+        uring.sqes = NULL;
+        goto fail;
+    }
+    uint8_t *sq = uring.sq_ring, *cq = uring.cq_ring;
+    uring.sq_head = (uint32_t *) (sq + params.sq_off.head);
+    uring.sq_tail = (uint32_t *) (sq + params.sq_off.tail);
+    uring.sq_mask = (uint32_t *) (sq + params.sq_off.ring_mask);
+    uring.sq_array = (uint32_t *) (sq + params.sq_off.array);
+    uring.sq_entries = params.sq_entries;
+    uring.sq_local_tail = *uring.sq_tail;
+    for (j = 0; j < params.sq_entries; j++)
+        uring.sq_array[j] = j;
+    uring.cq_head = (uint32_t *) (cq + params.cq_off.head);
+    uring.cq_tail = (uint32_t *) (cq + params.cq_off.tail);
+    uring.cq_mask = (uint32_t *) (cq + params.cq_off.ring_mask);
+    uring.cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+    // send buffers, registered so that the kernel does not map them on every send
+    uring.send_buffers = mmap(NULL, URING_SEND_BUFFERS * MAXBUFLEN, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (uring.send_buffers == MAP_FAILED) {
+        uring.send_buffers = NULL;
+        goto fail;
+    }
+    struct iovec send_iovec = {uring.send_buffers, URING_SEND_BUFFERS * MAXBUFLEN};
+    if (uring_register(IORING_REGISTER_BUFFERS, &send_iovec, 1) < 0)
+        goto fail;
+    for (j = 0; j < URING_SEND_BUFFERS; j++)
+        uring.free_sends[j] = j;
+    uring.free_count = URING_SEND_BUFFERS;
+
+    // ring of provided buffers for the multishot receive, the ring must be page aligned
+    uring.recv_ring = mmap(NULL, URING_RECV_BUFFERS * sizeof (struct io_uring_buf), PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uring.recv_buffers = malloc(URING_RECV_BUFFERS * URING_RECV_BUFFER_LEN);
+    if (uring.recv_ring == MAP_FAILED || uring.recv_buffers == NULL) {
+        if (uring.recv_ring == MAP_FAILED)
+            uring.recv_ring = NULL;
+        goto fail;
+    }
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof registration);
+    registration.ring_addr = (uint64_t) (uintptr_t) uring.recv_ring;
+    registration.ring_entries = URING_RECV_BUFFERS;
+    registration.bgid = URING_BUFFER_GROUP;
+    if (uring_register(IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+        goto fail;
+    for (j = 0; j < URING_RECV_BUFFERS; j++)
+        recv_buffer_add(j);
+    log_info("UDP: using io_uring backend.");
+    return 1;
+
+fail:
+    log_warnf("io_uring could not be initialized. Reason: %s", strerror(errno));
+    udp_uring_close();
+    return 0;
+}
+
+void udp_uring_close() {
+    if (uring.socket_fd != -1)
+        close(uring.socket_fd);
+    if (uring.ring_fd != -1)
+        close(uring.ring_fd);
+    if (uring.sqes != NULL)
+        munmap(uring.sqes, uring.sq_entries * sizeof (struct io_uring_sqe));
+    if (uring.cq_ring != NULL && uring.cq_ring != uring.sq_ring)
+        munmap(uring.cq_ring, uring.cq_ring_size);
+    if (uring.sq_ring != NULL)
+        munmap(uring.sq_ring, uring.sq_ring_size);
+    if (uring.send_buffers != NULL)
+        munmap(uring.send_buffers, URING_SEND_BUFFERS * MAXBUFLEN);
+    if (uring.recv_ring != NULL)
+        munmap(uring.recv_ring, URING_RECV_BUFFERS * sizeof (struct io_uring_buf));
+    free(uring.recv_buffers);
+    memset(&uring, 0, sizeof uring);
+    uring.ring_fd = -1;
+    uring.socket_fd = -1;
+}
+
+int uring_open_socket() {
+    if ((uring.socket_fd = udp_open_bound_socket()) == -1)
+        return 0;
+    uring_arm_receive();
+    return 1;
+}
+
+/**
+ * Connects the socket to the destination, or dissolves its association when
+ * destination is NULL.
+ */
+int uring_connect(const struct sockaddr *destination, socklen_t destination_len) {
+    struct sockaddr unspecified = {AF_UNSPEC};
+    if (destination == NULL) {
+        if (uring.destination_len == 0)
+            return 1;
+        destination = &unspecified;
+        destination_len = sizeof unspecified;
+    } else if (destination_len == uring.destination_len && memcmp(destination, &uring.destination, destination_len) == 0) {
+        return 1;
+    }
+    if (connect(uring.socket_fd, destination, destination_len) == -1) {
+        log_errorf("Unable to connect UDP socket. Reason: %s", strerror(errno));
+        return 0;
+    }
+    uring.destination_len = destination == &unspecified ? 0 : destination_len;
+    if (uring.destination_len > 0)
+        memcpy(&uring.destination, destination, destination_len);
+    return 1;
+}
+
+int udp_uring_send(const uint8_t *bytes, uint16_t length, const struct sockaddr *destination,
+        socklen_t destination_len, int connect_socket) {
+    if (uring.ring_fd == -1 || length > MAXBUFLEN)
+        return 0;
+    if (uring.socket_fd == -1 && !uring_open_socket())
+        return 0;
+    // a connected socket only receives from the server, so it is connected once the destination is settled
+    if (!uring_connect(connect_socket ? destination : NULL, destination_len))
+        return 0;
+    // wait for a send to complete when every buffer is in flight
+    while (uring.free_count == 0) {
+        uring_submit(1);
+        uring_reap();
+    }
+    uint16_t index = uring.free_sends[--uring.free_count];
+    uint8_t *buffer = uring.send_buffers + index * MAXBUFLEN;
+    memcpy(buffer, bytes, length);
+    struct io_uring_sqe *sqe = uring_get_sqe();
+    sqe->fd = uring.socket_fd;
+    sqe->user_data = index;
+    if (connect_socket) {
+        // plain write of a registered buffer
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->addr = (uint64_t) (uintptr_t) buffer;
+        sqe->len = length;
+        sqe->buf_index = 0;
+    } else {
+        struct msghdr *header = &uring.send_headers[index];
+        memcpy(&uring.send_addresses[index], destination, destination_len);
+        uring.send_iovecs[index].iov_base = buffer;
+        uring.send_iovecs[index].iov_len = length;
+        memset(header, 0, sizeof *header);
+        header->msg_name = &uring.send_addresses[index];
+        header->msg_namelen = destination_len;
+        header->msg_iov = &uring.send_iovecs[index];
+        header->msg_iovlen = 1;
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->addr = (uint64_t) (uintptr_t) header;
+        sqe->len = 1;
+    }
+    return 1;
+}
+
+uint8_t* udp_uring_receive(uint16_t *bytes_recv, struct sockaddr_storage *source) {
+    if (uring.ring_fd == -1 || uring.socket_fd == -1)
+        return NULL;
+    // the sends queued since the last call are submitted here, in one system call
+    uring_reap();
+    if (!uring.receiving)
+        uring_arm_receive();
+    uring_submit(0);
+    if (uring.ready_head == uring.ready_tail)
+        uring_reap();
+    uint8_t *datagram = NULL;
+    // truncated datagrams are skipped, so that the ones behind them are not
+    // left in the queue after the descriptor of the ring stops being readable
+    while (datagram == NULL && uring.ready_head != uring.ready_tail) {
+        uint32_t slot = uring.ready_head++ & (URING_RECV_BUFFERS - 1);
+        uint16_t bid = uring.ready_bids[slot];
+        uint8_t *buffer = uring.recv_buffers + bid * URING_RECV_BUFFER_LEN;
+        struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+        uint32_t header_length = sizeof *out + recv_msghdr.msg_namelen + recv_msghdr.msg_controllen;
+        if (uring.ready_lengths[slot] < header_length || (out->flags & MSG_TRUNC)) {
+            log_warnf_limited("io_uring: discarding truncated datagram.");
+        } else {
+            memset(source, 0, sizeof *source);
+            memcpy(source, buffer + sizeof *out, out->namelen < sizeof *source ? out->namelen : sizeof *source);
+            datagram = malloc(out->payloadlen);
+            memcpy(datagram, buffer + header_length, out->payloadlen);
+            lh_metrics_inc(LH_COUNTER_DATAGRAMS_RECEIVED);
+            lh_metrics_add(LH_COUNTER_BYTES_RECEIVED, out->payloadlen);
+            if (bytes_recv != NULL)
+                *bytes_recv = (uint16_t) out->payloadlen;
+        }
+        recv_buffer_add(bid);
+    }
+    return datagram;
+}
+
+void udp_uring_flush() {
+    if (uring.ring_fd == -1)
+        return;
+    uring_reap();
+    uring_submit(0);
+}
+
+int udp_uring_get_fd() {
+    if (uring.ring_fd == -1)
+        return -1;
+    if (uring.socket_fd == -1 && !uring_open_socket())
+        return -1;
+    if (!uring.receiving) {
+        uring_arm_receive();
+        uring_submit(0);
+    }
+    return uring.ring_fd;
+}
+
+#else
+
+int udp_uring_init() {
+    return 0;
+}
+
+void udp_uring_close() {
+}
+
+int udp_uring_send(const uint8_t *bytes, uint16_t length, const struct sockaddr *destination,
+        socklen_t destination_len, int connect_socket) {
+    return 0;
+}
+
+uint8_t* udp_uring_receive(uint16_t *bytes_recv, struct sockaddr_storage *source) {
+    return NULL;
+}
+
+void udp_uring_flush() {
+}
+
+int udp_uring_get_fd() {
+    return -1;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file udp_uring.h
+ * @brief io_uring backend of the UDP transport, used by udp_api.c when
+ * selected with lh_udp_set_backend().
+ *
+ * The backend owns a single UDP socket, connected to the server once its
+ * address is settled. Datagrams sent are copied into buffers registered with
+ * the ring and queued as WRITE_FIXED requests, or SENDMSG ones before the
+ * socket is connected, which are submitted together at the end of each step
+ * of the device loop, or when no send buffer is free. Datagrams are
+ * received with a multishot RECVMSG request into a ring of provided buffers,
+ * so receiving does not need a system call while the ring has completions.
+ *
+ * It needs Linux 6.0 or later. This header is internal to the Linux port.
+ */
+
+#ifndef UDP_URING_H
+#define	UDP_URING_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/socket.h>
+
+    /**
+     * Creates the ring and registers its buffers.
+     * @return 1 on success, 0 if the kernel does not support the features needed.
+     */
+    int udp_uring_init();
+
+    /**
+     * Releases the ring, its buffers and its socket.
+     */
+    void udp_uring_close();
+
+    /**
+     * Queues a datagram to the server. The socket is opened the first time.
+     * @param bytes
+     * @param length
+     * @param destination
+     * @param destination_len
+     * @param connect_socket 1 to connect the socket to the destination and send
+     * a plain write of a registered buffer, 0 to send a message with the
+     * destination to an unconnected socket, which receives from any address.
+     * @return 1 if the datagram has been queued, 0 otherwise.
+     */
+    int udp_uring_send(const uint8_t *bytes, uint16_t length, const struct sockaddr *destination,
+            socklen_t destination_len, int connect_socket);
+
+    /**
+     * Submits the queued datagrams and returns the next datagram received, if any.
+     * @param bytes_recv If not null, the number of bytes received is stored here.
+     * @param source Where the address the datagram comes from is stored.
+     * @return null if no datagram has been received, otherwise a copy of the
+     * datagram that must be freed with free().
+     */
+    uint8_t* udp_uring_receive(uint16_t *bytes_recv, struct sockaddr_storage *source);
+
+    /**
+     * Submits the queued datagrams, without waiting for them to complete.
+     */
+    void udp_uring_flush();
+
+    /**
+     * Returns the descriptor of the ring, which becomes readable when it has
+     * completions, opening the socket and arming the receive if needed.
+     * @return The descriptor, or -1 if the ring could not be used.
+     */
+    int udp_uring_get_fd();
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* UDP_URING_H */
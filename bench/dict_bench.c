@@ -0,0 +1,230 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * Microbenchmark of LH_Dict against the implementation it replaced, which is
+ * kept below renamed as legacy_dict. Build and run with:
+ *
+ *     gcc -O2 bench/dict_bench.c core/utils/data_structures.c core/utils/string_pool.c core/utils/utils.c -o build/dict_bench
+ *     ./build/dict_bench
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "../core/utils/data_structures.h"
+
+#define NUM_KEYS 20000
+#define NUM_ROUNDS 20
+
+/* ---------- legacy implementation: Java style hash, linear probing ---------- */
+
+typedef struct {
+    char* ptr_key;
+    void* ptr_value;
+} LegacyDictItem;
+
+typedef struct {
+    LegacyDictItem* items;
+    uint32_t size, max_capacity;
+} LegacyDict;
+
+static uint32_t legacy_hash_code(const char *string) {
+    uint32_t h = 0;
+    uint16_t j = 0;
+    while (string[j] != 0) {
+        h = (h << 5) - h + string[j];
+        j++;
+    }
+    return h;
+}
+
+static LegacyDictItem* legacy_dict_get_entry(const LegacyDict* my_dict, const char* key) {
+    uint32_t position = legacy_hash_code(key) % my_dict->max_capacity;
+    uint32_t iteration_count = 0;
+    do {
+        LegacyDictItem* entry = my_dict->items + position;
+        if (entry->ptr_key == NULL)
+            return entry;
+        else if (strcmp(entry->ptr_key, key) == 0)
+            return entry;
+        position++;
+        iteration_count++;
+        if (position >= my_dict->max_capacity)
+            position = 0;
+    } while (iteration_count < my_dict->max_capacity);
+    return NULL;
+}
+
+static LegacyDict* legacy_dict_new(int capacity) {
+    LegacyDict *my_dict = malloc(sizeof *my_dict);
+    my_dict->items = calloc(capacity, sizeof *my_dict->items);
+    my_dict->size = 0;
+    my_dict->max_capacity = capacity;
+    return my_dict;
+}
+
+static void legacy_dict_put(LegacyDict* my_dict, const char *key, void* value);
+
+static void legacy_dict_increase_and_rehash(LegacyDict* my_dict) {
+    int size = my_dict->size;
+    char** keys = malloc(size * sizeof *keys);
+    void** values = malloc(size * sizeof *values);
+    uint32_t i = 0, j;
+    for (j = 0; j < my_dict->max_capacity; j++) {
+        char* key = my_dict->items[j].ptr_key;
+        if (key == NULL || strlen(key) == 0)
+            continue;
+        keys[i] = key;
+        values[i] = my_dict->items[j].ptr_value;
+        i++;
+    }
+    uint32_t new_capacity = my_dict->max_capacity * 2;
+    my_dict->items = realloc(my_dict->items, new_capacity * sizeof *my_dict->items);
+    memset(my_dict->items, 0, new_capacity * sizeof *my_dict->items);
+    my_dict->max_capacity = new_capacity;
+    my_dict->size = 0;
+    // the legacy implementation copied the keys again when rehashing
+    for (j = 0; j < i; j++) {
+        legacy_dict_put(my_dict, keys[j], values[j]);
+        free(keys[j]);
+    }
+    free(keys);
+    free(values);
+}
+
+static void legacy_dict_put(LegacyDict* my_dict, const char *key, void* value) {
+    LegacyDictItem *entry = legacy_dict_get_entry(my_dict, key);
+    if (entry->ptr_key != NULL && strcmp(entry->ptr_key, key) == 0) {
+        entry->ptr_value = value;
+        return;
+    }
+    char* keycopy = calloc(1 + strlen(key), 1);
+    strcpy(keycopy, key);
+    entry->ptr_key = keycopy;
+    entry->ptr_value = value;
+    my_dict->size++;
+    if ((float) my_dict->size / my_dict->max_capacity > 0.5)
+        legacy_dict_increase_and_rehash(my_dict);
+}
+
+static void* legacy_dict_get(LegacyDict* my_dict, const char* key) {
+    LegacyDictItem* entry = legacy_dict_get_entry(my_dict, key);
+    if (entry == NULL || entry->ptr_key == NULL)
+        return NULL;
+    return entry->ptr_value;
+}
+
+static void legacy_dict_free(LegacyDict* my_dict) {
+    uint32_t j;
+    for (j = 0; j < my_dict->max_capacity; j++)
+        free(my_dict->items[j].ptr_key);
+    free(my_dict->items);
+    free(my_dict);
+}
+
+/* ---------- benchmark ---------- */
+
+static char keys[NUM_KEYS][24];
+static volatile uintptr_t sink;
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void report(const char* name, double elapsed_ns, long operations) {
+    printf("%-32s %10.1f ns/op\n", name, elapsed_ns / operations);
+}
+
+int main() {
+    int j, round;
+    double start;
+    long operations = (long) NUM_KEYS * NUM_ROUNDS;
+    for (j = 0; j < NUM_KEYS; j++)
+        snprintf(keys[j], sizeof keys[j], "component_%d", j);
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        LegacyDict* legacy = legacy_dict_new(DICT_INITIAL_CAPACITY);
+        for (j = 0; j < NUM_KEYS; j++)
+            legacy_dict_put(legacy, keys[j], keys[j]);
+        legacy_dict_free(legacy);
+    }
+    report("legacy put", now_ns() - start, operations);
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++) {
+        LH_Dict* dict = lh_dict_new();
+        for (j = 0; j < NUM_KEYS; j++)
+            lh_dict_put(dict, keys[j], keys[j]);
+        lh_dict_free(dict);
+    }
+    report("lh_dict put", now_ns() - start, operations);
+
+    LegacyDict* legacy = legacy_dict_new(DICT_INITIAL_CAPACITY);
+    LH_Dict* dict = lh_dict_new();
+    for (j = 0; j < NUM_KEYS; j++) {
+        legacy_dict_put(legacy, keys[j], keys[j]);
+        lh_dict_put(dict, keys[j], keys[j]);
+    }
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++)
+        for (j = 0; j < NUM_KEYS; j++)
+            sink += (uintptr_t) legacy_dict_get(legacy, keys[j]);
+    report("legacy get (hit)", now_ns() - start, operations);
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++)
+        for (j = 0; j < NUM_KEYS; j++)
+            sink += (uintptr_t) lh_dict_get(dict, keys[j]);
+    report("lh_dict get (hit)", now_ns() - start, operations);
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++)
+        for (j = 0; j < NUM_KEYS; j++)
+            sink += (uintptr_t) legacy_dict_get(legacy, "missing_component");
+    report("legacy get (miss)", now_ns() - start, operations);
+
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++)
+        for (j = 0; j < NUM_KEYS; j++)
+            sink += (uintptr_t) lh_dict_get(dict, "missing_component");
+    report("lh_dict get (miss)", now_ns() - start, operations);
+    legacy_dict_free(legacy);
+    lh_dict_free(dict);
+
+    // put and remove keys, as done with the arguments of actions. The legacy
+    // implementation is not measured: removed keys are never released, so its
+    // table fills up after max_capacity distinct keys and the next put crashes
+    printf("%-32s %10s\n", "legacy put + remove", "n/a");
+    dict = lh_dict_new();
+    start = now_ns();
+    for (round = 0; round < NUM_ROUNDS; round++)
+        for (j = 0; j < NUM_KEYS; j++) {
+            lh_dict_put(dict, keys[j], keys[j]);
+            lh_dict_remove(dict, keys[j]);
+        }
+    report("lh_dict put + remove", now_ns() - start, operations);
+    printf("%-32s %10u slots\n", "lh_dict capacity after churn", dict->max_capacity);
+    lh_dict_free(dict);
+    return 0;
+}
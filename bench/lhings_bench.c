@@ -0,0 +1,328 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * Microbenchmarks of the hot paths of the library: building and checking
+ * STUN messages, HMAC, dictionaries and the JSON documents. Build and run with:
+ *
+ *     make -f Makefile.prj bench
+ *     ./build/lhings-bench [--json] [filter]
+ *
+ * For each benchmark and size it reports the time, the number of heap
+ * allocations done by the library and the TSC cycles per operation. The
+ * allocations are counted by wrapping malloc, calloc and realloc at link
+ * time, so allocations done inside libc or libcurl are not included. With
+ * --json the results are written as a JSON array, to compare them between
+ * versions. Only benchmarks whose name contains filter are run.
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "../core/lhings.h"
+#include "../core/stun-messaging/stun_message.h"
+#include "../core/crypto/hmac.h"
+#include "../core/utils/data_structures.h"
+#include "../core/utils/string_pool.h"
+#include "../core/utils/utils.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define read_cycles() __rdtsc()
+#else
+#define read_cycles() 0
+#endif
+
+// each benchmark runs for at least this time
+#define BENCH_MIN_NANOS 200000000.0
+#define BENCH_MAX_COMPONENTS 32
+
+char* generate_descriptor(LH_Device *device);
+char *build_structured_payload(LH_List *components);
+
+/* ---------- allocation counting ---------- */
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *pointer, size_t size);
+
+static uint64_t allocations = 0;
+static double start_nanos, stop_nanos;
+static uint64_t start_cycles, stop_cycles, stop_allocations;
+
+void *__wrap_malloc(size_t size) {
+    allocations++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+    allocations++;
+    return __real_realloc(pointer, size);
+}
+
+/* ---------- measurement ---------- */
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// benchmarks call bench_start after preparing their fixtures and bench_stop
+// before releasing them, so that only the measured loop is counted
+void bench_start() {
+    allocations = 0;
+    start_cycles = read_cycles();
+    start_nanos = now_ns();
+}
+
+void bench_stop() {
+    stop_nanos = now_ns();
+    stop_cycles = read_cycles();
+    stop_allocations = allocations;
+}
+
+/* ---------- fixtures ---------- */
+
+// the library calls the setup and loop functions of the program
+void setup() {
+}
+
+void loop() {
+}
+
+static LH_Device device;
+static char payload[2048];
+static uint8_t message_bytes[2048];
+static uint16_t message_length;
+static char keys[1024][24];
+static LH_Dict *dict;
+static LH_List *components;
+static uint32_t component_values[BENCH_MAX_COMPONENTS];
+static volatile uintptr_t sink;
+
+static LH_Device descriptor_device;
+// stun_set_message_integrity lower cases the api key in place, it can not be a literal
+static char api_key[] = "45ced63d-a080-434a-a53b-df3d404814b2";
+
+void init_device() {
+    memset(&device, 0, sizeof device);
+    device.name = "bench";
+    device.username = "bench@lhings.com";
+    device.uuid = "bc1e2e6a-8bf8-4c4f-a63f-d2ab1f5b4b1e";
+    device.api_key = api_key;
+}
+
+void init_payload(int size) {
+    memset(payload, 'x', size);
+    payload[size] = 0;
+}
+
+/* ---------- benchmarks ---------- */
+
+void bench_keepalive(int size, long iterations) {
+    long j;
+    bench_start();
+    for (j = 0; j < iterations; j++)
+        stun_free(stun_get_keepalive_message(&device));
+    bench_stop();
+}
+
+void bench_event(int size, long iterations) {
+    long j;
+    init_payload(size);
+    bench_start();
+    for (j = 0; j < iterations; j++)
+        stun_free(stun_get_event_message(&device, "temperature", size > 0 ? payload : NULL));
+    bench_stop();
+}
+
+void bench_process_and_check(int size, long iterations) {
+    long j;
+    init_payload(size);
+    StunMessage *event = stun_get_event_message(&device, "temperature", size > 0 ? payload : NULL);
+    message_length = event->length;
+    memcpy(message_bytes, event->bytes, message_length);
+    stun_free(event);
+    bench_start();
+    for (j = 0; j < iterations; j++) {
+        StunMessage message;
+        stun_process_stun_message(message_bytes, message_length, &message);
+        sink += stun_is_integrity_correct(&message, device.api_key);
+    }
+    bench_stop();
+}
+
+void bench_hmac(int size, long iterations) {
+    long j;
+    uint8_t signature[20];
+    init_payload(size);
+    bench_start();
+    for (j = 0; j < iterations; j++) {
+        hmac_sha1(device.api_key, 36, payload, size, signature);
+        sink += signature[0];
+    }
+    bench_stop();
+}
+
+void bench_hex(int size, long iterations) {
+    long j;
+    char hex[2 * sizeof payload + 1];
+    init_payload(size);
+    bench_start();
+    for (j = 0; j < iterations; j++) {
+        lh_hex_encode((const uint8_t *) payload, size, hex, sizeof hex);
+        sink += hex[0];
+    }
+    bench_stop();
+}
+
+void bench_dict(int size, long iterations) {
+    long j;
+    int k;
+    dict = lh_dict_new();
+    for (k = 0; k < size; k++)
+        lh_dict_put(dict, keys[k], keys[k]);
+    bench_start();
+    for (j = 0, k = 0; j < iterations; j++) {
+        lh_dict_put(dict, keys[k], keys[k]);
+        sink += (uintptr_t) lh_dict_get(dict, keys[k]);
+        if (++k == size)
+            k = 0;
+    }
+    bench_stop();
+    lh_dict_free(dict);
+}
+
+void init_components(int size) {
+    int k;
+    components = lh_list_new();
+    for (k = 0; k < size; k++) {
+        component_values[k] = k;
+        lh_list_add(components, lh_model_create_component(keys[k], LH_TYPE_INTEGER, &component_values[k]));
+    }
+}
+
+void free_components() {
+    int k;
+    for (k = 0; k < components->size; k++)
+        lh_model_free_component(lh_list_get(components, k));
+    lh_list_free(components);
+}
+
+void bench_descriptor(int size, long iterations) {
+    long j;
+    int k;
+    memset(&descriptor_device, 0, sizeof descriptor_device);
+    for (k = 0; k < size; k++) {
+        lh_model_add_status_component(&descriptor_device, keys[k], LH_TYPE_FLOAT, &component_values[k]);
+        lh_model_add_event(&descriptor_device, keys[k], NULL);
+        lh_model_add_action(&descriptor_device, keys[k], "benchmark action", NULL, NULL);
+    }
+    bench_start();
+    for (j = 0; j < iterations; j++)
+        free(generate_descriptor(&descriptor_device));
+    bench_stop();
+}
+
+void bench_structured_payload(int size, long iterations) {
+    long j;
+    init_components(size);
+    bench_start();
+    for (j = 0; j < iterations; j++)
+        free(build_structured_payload(components));
+    bench_stop();
+    free_components();
+}
+
+/* ---------- harness ---------- */
+
+typedef struct {
+    const char *name;
+    void (*function)(int size, long iterations);
+    int sizes[4];
+} Benchmark;
+
+static const Benchmark benchmarks[] = {
+    {"stun_get_keepalive_message", bench_keepalive, {0, -1}},
+    {"stun_get_event_message", bench_event, {0, 64, 512, -1}},
+    {"stun_process_and_check_integrity", bench_process_and_check, {0, 64, 512, -1}},
+    {"hmac_sha1", bench_hmac, {64, 512, 1400, -1}},
+    {"lh_hex_encode", bench_hex, {12, 20, 512, -1}},
+    {"lh_dict_put_get", bench_dict, {16, 1024, -1}},
+    {"generate_descriptor", bench_descriptor, {4, 32, -1}},
+    {"build_structured_payload", bench_structured_payload, {1, 8, 32, -1}},
+    {NULL}
+};
+
+int main(int argc, char **argv) {
+    int json = 0, first = 1, j, k;
+    const char *filter = NULL;
+    for (j = 1; j < argc; j++) {
+        if (strcmp(argv[j], "--json") == 0)
+            json = 1;
+        else
+            filter = argv[j];
+    }
+    init_device();
+    for (j = 0; j < 1024; j++)
+        snprintf(keys[j], sizeof keys[j], "component_%d", j);
+
+    if (json)
+        printf("[\n");
+    else
+        printf("%-34s %6s %12s %12s %12s\n", "benchmark", "size", "ns/op", "allocs/op", "cycles/op");
+    for (j = 0; benchmarks[j].name != NULL; j++) {
+        const Benchmark *benchmark = &benchmarks[j];
+        if (filter != NULL && strstr(benchmark->name, filter) == NULL)
+            continue;
+        for (k = 0; benchmark->sizes[k] >= 0; k++) {
+            int size = benchmark->sizes[k];
+            long iterations = 1;
+            double elapsed;
+            uint64_t cycles, allocated;
+            // double the iterations until the run is long enough to be measured
+            while (1) {
+                benchmark->function(size, iterations);
+                elapsed = stop_nanos - start_nanos;
+                cycles = stop_cycles - start_cycles;
+                allocated = stop_allocations;
+                if (elapsed >= BENCH_MIN_NANOS)
+                    break;
+                iterations *= 2;
+            }
+            if (json)
+                printf("%s  {\"name\": \"%s\", \"size\": %d, \"iterations\": %ld, \"ns_per_op\": %.1f, "
+                    "\"allocs_per_op\": %.2f, \"cycles_per_op\": %.1f}", first ? "" : ",\n", benchmark->name, size,
+                    iterations, elapsed / iterations, (double) allocated / iterations, (double) cycles / iterations);
+            else
+                printf("%-34s %6d %12.1f %12.2f %12.1f\n", benchmark->name, size, elapsed / iterations,
+                    (double) allocated / iterations, (double) cycles / iterations);
+            first = 0;
+        }
+    }
+    if (json)
+        printf("\n]\n");
+    return 0;
+}
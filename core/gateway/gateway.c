@@ -0,0 +1,481 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "gateway.h"
+#include "../lhings_internal.h"
+#include "../logging/log.h"
+#include "../http-comm/lhings_api.h"
+#include "../stun-messaging/stun_message.h"
+#include "../stun-messaging/submission_queue.h"
+#include "../utils/utils.h"
+#include "../utils/wire.h"
+#include "../metrics/metrics.h"
+#include "../../abstraction/udp-comm/udp_api.h"
+#include "../../abstraction/timing/lhings_time.h"
+#include "../../abstraction/threading/lhings_thread.h"
+
+// datagrams a worker processes before checking its keepalives and handoffs again
+#define GATEWAY_RECEIVE_BUDGET 256
+
+typedef struct gateway_handoff_cell {
+    // equals the position of the cell when free, position + 1 when it holds a datagram
+    uint64_t sequence;
+    uint16_t length;
+    uint8_t bytes[MAXBUFLEN];
+} GatewayHandoffCell;
+
+typedef struct gateway_device {
+    LH_Device *device;
+    // uuid in lower case hex without dashes, the key of the device in the table of its worker
+    char key[33];
+    uint32_t next_keepalive_millis;
+    // transaction id and send time of the last keepalive, to measure the round trip time
+    uint8_t keepalive_trId[12];
+    uint64_t keepalive_sent_micros;
+} GatewayDevice;
+
+typedef struct gateway_worker {
+    LH_Gateway *gateway;
+    uint16_t index;
+    // devices of the worker, in the order their keepalives are due, since they all have the same period
+    GatewayDevice *devices;
+    uint32_t count, capacity, next_keepalive;
+    LH_NameTable *device_table;
+    // own copy of the api key of the user, already in lower case
+    char api_key[37];
+    // the slots of the argument views of the actions are shared by every device of a class
+    LH_ArgSlot *slots;
+    uint16_t slot_count;
+    // datagrams received by other workers for devices of this one
+    GatewayHandoffCell handoffs[LH_GATEWAY_HANDOFF_CAPACITY];
+    uint64_t handoff_enqueue __attribute__((aligned(64)));
+    uint64_t handoff_dequeue __attribute__((aligned(64)));
+    // events and status stores of the devices of the worker, submitted from any thread
+    SubmissionQueue submissions;
+    // 1 while the thread of the worker runs
+    uint32_t running;
+} GatewayWorker;
+
+struct _gateway {
+    char *username;
+    char *api_key;
+    uint16_t worker_count;
+    GatewayWorker **workers;
+    uint8_t started;
+    // set to make the workers return, when the gateway could not be started
+    uint32_t stopping;
+};
+
+static LH_THREAD_LOCAL LH_Device *current_device = NULL;
+
+uint16_t lh_gateway_shard(const uint8_t *uuid, uint16_t workers) {
+    return (uint16_t) (load_be32(uuid) % workers);
+}
+
+LH_Device* lh_gateway_current_device() {
+    return current_device;
+}
+
+void gateway_device_key(const uint8_t *uuid, char *key) {
+    static const char *hex = "0123456789abcdef";
+    int j;
+    for (j = 0; j < 16; j++) {
+        key[2 * j] = hex[uuid[j] >> 4];
+        key[2 * j + 1] = hex[uuid[j] & 0x0F];
+    }
+    key[32] = 0;
+}
+
+LH_Gateway* lh_gateway_new(char *username, char *password, uint16_t workers) {
+    int j, k;
+    if (workers == 0 || workers > LH_GATEWAY_MAX_WORKERS) {
+        log_errorf("A gateway must have between 1 and %d workers.", LH_GATEWAY_MAX_WORKERS);
+        return NULL;
+    }
+    // resolve the server while the user logs in
+    lh_udp_resolve_server();
+    char *api_key = lh_api_get_api_key(username, password);
+    if (api_key == NULL)
+        return NULL;
+
+    LH_Gateway *gateway = calloc(1, sizeof *gateway);
+    gateway->username = username;
+    gateway->api_key = api_key;
+    gateway->worker_count = workers;
+    gateway->workers = calloc(workers, sizeof *gateway->workers);
+    for (j = 0; j < workers; j++) {
+        GatewayWorker *worker = calloc(1, sizeof *worker);
+        worker->gateway = gateway;
+        worker->index = j;
+        for (k = 0; k < 36 && api_key[k] != 0; k++)
+            worker->api_key[k] = tolower(api_key[k]);
+        for (k = 0; k < LH_GATEWAY_HANDOFF_CAPACITY; k++)
+            worker->handoffs[k].sequence = k;
+        // the worker checks its queue every LH_GATEWAY_MAX_WAIT_MILLIS, no need to wake it up
+        submission_queue_init(&worker->submissions, -1);
+        gateway->workers[j] = worker;
+    }
+    return gateway;
+}
+
+/**
+ * Returns 1 if the devices of a class can be hosted by a gateway, that is, if
+ * all its actions receive a view over their arguments.
+ */
+int gateway_class_is_hostable(LH_DeviceClass *device_class) {
+    LH_List *actions = device_class->model.actions;
+    int j;
+    for (j = 0; actions != NULL && j < actions->size; j++) {
+        LH_Action *action = lh_list_get(actions, j);
+        if (action->action_function_view == NULL) {
+            log_errorf("Action %s must be added with lh_class_add_action_view to be hosted by a gateway.", action->name);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint16_t gateway_class_max_arguments(LH_DeviceClass *device_class) {
+    LH_List *actions = device_class->model.actions;
+    uint16_t max = 0;
+    int j;
+    for (j = 0; actions != NULL && j < actions->size; j++) {
+        LH_Action *action = lh_list_get(actions, j);
+        if (action->arguments_view.count > max)
+            max = action->arguments_view.count;
+    }
+    return max;
+}
+
+int lh_gateway_add_device(LH_Gateway *gateway, LH_Device *device, char *device_name, LH_DeviceClass *device_class) {
+    uint8_t uuid[16];
+    if (gateway->started) {
+        log_error("Devices can not be added to a gateway that has been started.");
+        return 0;
+    }
+    if (device_class == NULL || !gateway_class_is_hostable(device_class))
+        return 0;
+
+    memset(device, 0, sizeof *device);
+    device->name = device_name;
+    device->username = gateway->username;
+    device->api_key = gateway->api_key;
+    if (!register_device(device))
+        return 0;
+    if (!uuid_string_to_byte_array(device->uuid, uuid) || !lh_device_set_class(device, device_class))
+        return 0;
+    GatewayWorker *worker = gateway->workers[lh_gateway_shard(uuid, gateway->worker_count)];
+    if (worker->count == UINT16_MAX) {
+        log_errorf("A worker of a gateway can not host more than %d devices.", UINT16_MAX);
+        return 0;
+    }
+    announce_device(device);
+
+    if (worker->count == worker->capacity) {
+        worker->capacity = worker->capacity == 0 ? 16 : 2 * worker->capacity;
+        worker->devices = realloc(worker->devices, worker->capacity * sizeof *worker->devices);
+    }
+    GatewayDevice *hosted = &worker->devices[worker->count++];
+    memset(hosted, 0, sizeof *hosted);
+    hosted->device = device;
+    gateway_device_key(uuid, hosted->key);
+    // only the worker signs with its copy of the key, and sends the events of the device
+    device->api_key = worker->api_key;
+    device->submissions = &worker->submissions;
+    uint16_t arguments = gateway_class_max_arguments(device_class);
+    if (arguments > worker->slot_count)
+        worker->slot_count = arguments;
+    return 1;
+}
+
+/**
+ * Queues a datagram received by another worker. Safe to call from any thread.
+ */
+void gateway_hand_over(GatewayWorker *worker, const uint8_t *bytes, uint16_t length) {
+    GatewayHandoffCell *cell;
+    uint64_t position = LH_ATOMIC_LOAD_RELAXED(&worker->handoff_enqueue);
+    while (1) {
+        cell = worker->handoffs + (position & (LH_GATEWAY_HANDOFF_CAPACITY - 1));
+        uint64_t sequence = LH_ATOMIC_LOAD(&cell->sequence);
+        int64_t difference = (int64_t) (sequence - position);
+        if (difference == 0) {
+            if (LH_ATOMIC_CAS(&worker->handoff_enqueue, &position, position + 1))
+                break;
+        } else if (difference < 0) {
+            lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+            log_warnf_limited("Gateway worker %d is not keeping up, discarding message.", (int) worker->index);
+            return;
+        } else {
+            position = LH_ATOMIC_LOAD_RELAXED(&worker->handoff_enqueue);
+        }
+    }
+    memcpy(cell->bytes, bytes, length);
+    cell->length = length;
+    LH_ATOMIC_STORE(&cell->sequence, position + 1);
+}
+
+void gateway_send(GatewayWorker *worker, StunMessage *message) {
+    if (message == NULL)
+        return;
+    lh_udp_shard_send(worker->index, message->bytes, message->length);
+    stun_free(message);
+}
+
+void gateway_send_keepalives(GatewayWorker *worker, uint32_t now) {
+    uint32_t j;
+    for (j = 0; j < worker->count; j++) {
+        GatewayDevice *hosted = &worker->devices[worker->next_keepalive];
+        if ((int32_t) (now - hosted->next_keepalive_millis) < 0)
+            return;
+        StunMessage *keepalive = stun_get_keepalive_message(hosted->device);
+        memcpy(hosted->keepalive_trId, keepalive->bytes + 8, 12);
+        hosted->keepalive_sent_micros = lh_get_absolute_time_micros();
+        hosted->next_keepalive_millis = now + DELAY_BETWEEN_KEEPALIVES_SECS * 1000;
+        gateway_send(worker, keepalive);
+        lh_device_metrics_add(&hosted->device->metrics, LH_DEVICE_COUNTER_KEEPALIVES_SENT, 1);
+        worker->next_keepalive = (worker->next_keepalive + 1) % worker->count;
+    }
+}
+
+int gateway_execute_action(GatewayWorker *worker, LH_Device *device, StunMessage *message) {
+    StunAttribute attr_name, attr_arguments;
+    if (!stun_get_attribute(message, ATTR_NAME, &attr_name))
+        return 0;
+    LH_Action *action = device_get_action(device, attr_name.bytes, attr_name.length);
+    if (action == NULL) {
+        log_warnf_limited("Device has no action with name %.*s", (int) attr_name.length, (const char *) attr_name.bytes);
+        return 0;
+    }
+    if (!stun_get_attribute(message, ATTR_ARGUMENTS, &attr_arguments))
+        return 0;
+
+    LH_Args view = {action->arguments_view.count, worker->slots};
+    int j;
+    for (j = 0; j < view.count; j++)
+        view.slots[j].type = action->arguments_view.slots[j].type;
+    if (!fill_arguments_view(&attr_arguments, action, &view)) {
+        log_error("Could not process arguments attribute. Action not performed.");
+        return 0;
+    }
+    current_device = device;
+    action->action_function_view(&view);
+    current_device = NULL;
+    return 1;
+}
+
+void gateway_send_status(GatewayWorker *worker, LH_Device *device, StunMessage *message) {
+    StunAttribute attr_status;
+    int length;
+    uint8_t *attr_status_bytes = build_arguments_attribute(device, &length);
+    if (attr_status_bytes == NULL) {
+        log_error("Status response could not be built.");
+        return;
+    }
+    attr_status.attr_type = ATTR_ARGUMENTS;
+    attr_status.bytes = attr_status_bytes;
+    attr_status.length = length;
+    gateway_send(worker, stun_get_success_response(device, message, &attr_status));
+    free(attr_status_bytes);
+}
+
+void gateway_handle_datagram(GatewayWorker *worker, uint8_t *bytes, uint16_t length) {
+    StunMessage message;
+    StunAttribute attribute;
+    if (!stun_process_stun_message(bytes, length, &message) || !stun_get_attribute(&message, ATTR_LYNCPORT_ID, &attribute)
+            || attribute.length != 16 || attribute.bytes + 16 > bytes + length) {
+        lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+        log_warnf_limited("Discarding malformed message received.");
+        return;
+    }
+    uint16_t owner = lh_gateway_shard(attribute.bytes, worker->gateway->worker_count);
+    if (owner != worker->index) {
+        lh_metrics_inc(LH_COUNTER_GATEWAY_HANDOFFS);
+        gateway_hand_over(worker->gateway->workers[owner], bytes, length);
+        return;
+    }
+    char key[33];
+    gateway_device_key(attribute.bytes, key);
+    int index = worker->device_table == NULL ? -1 : lh_name_table_find(worker->device_table, key, 32);
+    if (index < 0) {
+        lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+        log_warnf_limited("Discarding message for device %s, which is not hosted by the gateway.", key);
+        return;
+    }
+    GatewayDevice *hosted = &worker->devices[index];
+    if (!stun_is_integrity_correct(&message, worker->api_key)) {
+        lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+        lh_device_metrics_add(&hosted->device->metrics, LH_DEVICE_COUNTER_MESSAGES_DROPPED, 1);
+        log_warnf_limited("Discarding message received with bad integrity.");
+        return;
+    }
+
+    uint16_t method, class;
+    stun_get_method_and_class(&message, &method, &class);
+    if (class == CL_ERROR) {
+        if (stun_get_attribute(&message, ATTR_SERVER_TIME, &attribute))
+            lh_update_time_offset(load_be32(attribute.bytes));
+        return;
+    }
+    if (class == CL_SUCCESS && method == M_KEEP_ALIVE && hosted->keepalive_sent_micros != 0
+            && memcmp(message.bytes + 8, hosted->keepalive_trId, 12) == 0) {
+        uint32_t rtt = (uint32_t) (lh_get_absolute_time_micros() - hosted->keepalive_sent_micros);
+        lh_metrics_record(LH_HISTOGRAM_KEEPALIVE_RTT_MICROS, rtt);
+        lh_device_metrics_keepalive_answered(&hosted->device->metrics, rtt);
+        hosted->keepalive_sent_micros = 0;
+        return;
+    }
+    if (class != CL_REQUEST)
+        return;
+    if (method == M_ACTION) {
+        LH_DeviceMetrics *metrics = &hosted->device->metrics;
+        uint64_t start = lh_get_absolute_time_micros();
+        if (gateway_execute_action(worker, hosted->device, &message)) {
+            lh_metrics_inc(LH_COUNTER_ACTIONS_PERFORMED);
+            lh_device_metrics_add(metrics, LH_DEVICE_COUNTER_ACTIONS_PERFORMED, 1);
+        } else {
+            lh_metrics_inc(LH_COUNTER_ACTION_ERRORS);
+            lh_device_metrics_add(metrics, LH_DEVICE_COUNTER_ACTION_ERRORS, 1);
+        }
+        uint32_t elapsed = (uint32_t) (lh_get_absolute_time_micros() - start);
+        lh_metrics_record(LH_HISTOGRAM_ACTION_MICROS, elapsed);
+        lh_device_metrics_add(metrics, LH_DEVICE_COUNTER_ACTION_MICROS, elapsed);
+        gateway_send(worker, stun_get_success_response(hosted->device, &message, NULL));
+    } else if (method == M_STATUS_REQUEST) {
+        gateway_send_status(worker, hosted->device, &message);
+    }
+}
+
+/**
+ * Processes the datagrams handed over by other workers.
+ * @return The number of datagrams processed.
+ */
+int gateway_drain_handoffs(GatewayWorker *worker) {
+    int processed = 0;
+    while (1) {
+        uint64_t position = worker->handoff_dequeue;
+        GatewayHandoffCell *cell = worker->handoffs + (position & (LH_GATEWAY_HANDOFF_CAPACITY - 1));
+        if (LH_ATOMIC_LOAD(&cell->sequence) != position + 1)
+            return processed;
+        gateway_handle_datagram(worker, cell->bytes, cell->length);
+        LH_ATOMIC_STORE(&cell->sequence, position + LH_GATEWAY_HANDOFF_CAPACITY);
+        LH_ATOMIC_STORE(&worker->handoff_dequeue, position + 1);
+        processed++;
+    }
+}
+
+/**
+ * Sends the events and status stores submitted for the devices of the worker.
+ * @return The number of messages sent.
+ */
+int gateway_send_submissions(GatewayWorker *worker) {
+    StunMessage *message;
+    SubmissionKind kind;
+    LH_Device *device;
+    int sent = 0;
+    while (sent < SUBMISSION_QUEUE_CAPACITY && (message = submission_queue_pop_message(&worker->submissions, &kind, &device)) != NULL) {
+        if (kind == SUBMISSION_EVENT) {
+            lh_metrics_inc(LH_COUNTER_EVENTS_SENT);
+            lh_device_metrics_add(&device->metrics, LH_DEVICE_COUNTER_EVENTS_SENT, 1);
+        }
+        gateway_send(worker, message);
+        sent++;
+    }
+    return sent;
+}
+
+void gateway_worker_run(void *argument) {
+    GatewayWorker *worker = argument;
+    uint16_t length;
+    uint8_t *bytes;
+    while (!LH_ATOMIC_LOAD(&worker->gateway->stopping)) {
+        int processed = 0;
+        gateway_send_keepalives(worker, lh_get_absolute_time_millis());
+        while (processed < GATEWAY_RECEIVE_BUDGET && (bytes = lh_udp_shard_receive(worker->index, &length)) != NULL) {
+            gateway_handle_datagram(worker, bytes, length);
+            processed++;
+        }
+        processed += gateway_drain_handoffs(worker);
+        processed += gateway_send_submissions(worker);
+        lh_udp_shard_flush(worker->index);
+        log_report_suppressed();
+        if (processed == 0)
+            lh_udp_shard_wait(worker->index, LH_GATEWAY_MAX_WAIT_MILLIS);
+    }
+    LH_ATOMIC_STORE(&worker->running, 0);
+}
+
+/**
+ * Makes the workers that are running return, waits for them and releases
+ * what lh_gateway_start built, so that it can be called again.
+ */
+void gateway_stop_workers(LH_Gateway *gateway) {
+    int j;
+    LH_ATOMIC_STORE(&gateway->stopping, 1);
+    for (j = 0; j < gateway->worker_count; j++) {
+        GatewayWorker *worker = gateway->workers[j];
+        // they check the flag at least every LH_GATEWAY_MAX_WAIT_MILLIS
+        while (LH_ATOMIC_LOAD(&worker->running))
+            lh_sleep(1);
+        if (worker->device_table != NULL)
+            lh_name_table_free(worker->device_table);
+        worker->device_table = NULL;
+        free(worker->slots);
+        worker->slots = NULL;
+    }
+    lh_udp_shards_close();
+    LH_ATOMIC_STORE(&gateway->stopping, 0);
+}
+
+int lh_gateway_start(LH_Gateway *gateway) {
+    uint32_t devices = 0;
+    int j, k;
+    if (gateway->started) {
+        log_error("The gateway has already been started.");
+        return 0;
+    }
+    if (!lh_udp_shards_open(gateway->worker_count))
+        return 0;
+    uint32_t now = lh_get_absolute_time_millis();
+    for (j = 0; j < gateway->worker_count; j++) {
+        GatewayWorker *worker = gateway->workers[j];
+        const char **keys = malloc((worker->count + 1) * sizeof *keys);
+        for (k = 0; k < worker->count; k++) {
+            keys[k] = worker->devices[k].key;
+            // the first keepalives tell the server where the devices are
+            worker->devices[k].next_keepalive_millis = now;
+        }
+        if (worker->count > 0)
+            worker->device_table = lh_name_table_new(keys, worker->count);
+        free(keys);
+        worker->slots = calloc(worker->slot_count + 1, sizeof *worker->slots);
+        devices += worker->count;
+    }
+    for (j = 0; j < gateway->worker_count; j++) {
+        LH_ATOMIC_STORE(&gateway->workers[j]->running, 1);
+        if (!lh_thread_start(gateway_worker_run, gateway->workers[j])) {
+            gateway->workers[j]->running = 0;
+            log_errorf("Unable to start worker %d of the gateway.", j);
+            gateway_stop_workers(gateway);
+            return 0;
+        }
+    }
+    // devices can not be added from now on
+    gateway->started = 1;
+    log_infof("Gateway started with %u workers and %u devices.", (unsigned) gateway->worker_count, (unsigned) devices);
+    return 1;
+}
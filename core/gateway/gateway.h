@@ -0,0 +1,121 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file gateway.h
+ * @brief Runs many devices of the same user in one process, sharded among
+ * worker threads.
+ *
+ * Every device hosted by a gateway is owned by one worker, chosen with
+ * lh_gateway_shard() from its uuid. Each worker has its own UDP socket, bound
+ * with the sockets of the rest to the same port, its own table of devices,
+ * its own keepalive timers and its own queue of datagrams to send, so the
+ * workers do not share any lock while they verify, dispatch and answer the
+ * messages of their devices. Datagrams that the kernel delivers to the wrong
+ * worker are handed over through a lock-free queue of the right one.
+ *
+ * Hosted devices must be instances of a class (see lh_device_set_class),
+ * whose actions are added with lh_class_add_action_view: the workers fill
+ * the argument views in their own slots, while the other actions get a
+ * dictionary allocated for every message. Action functions run in the
+ * worker of the device, which is returned by lh_gateway_current_device()
+ * while they run; functions of devices of different workers may run at the
+ * same time.
+ *
+ * Events and status are sent with lh_send_event() and lh_store_status(), from
+ * any thread: they are queued for the worker of the device, which sends them
+ * within LH_GATEWAY_MAX_WAIT_MILLIS from its own socket.
+ *
+ * The workers keep sending to the address the server had when the gateway
+ * was started. Unlike a single device, a gateway neither resolves the server
+ * again when the TTL of its records expires nor fails over to another of its
+ * addresses when keepalives go unanswered: the resolver is not thread safe
+ * and the sockets are bound to the family of that address. If the server
+ * moves, the gateway must be restarted.
+ */
+
+#ifndef GATEWAY_H
+#define	GATEWAY_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "../lhings.h"
+
+#define LH_GATEWAY_MAX_WORKERS 64
+    // the workers check their keepalives and queues at least this often
+#define LH_GATEWAY_MAX_WAIT_MILLIS 5
+    // datagrams waiting to be handed over to a worker, must be a power of two
+#define LH_GATEWAY_HANDOFF_CAPACITY 64
+
+    typedef struct _gateway LH_Gateway;
+
+    /**
+     * Creates a gateway and logs its user in Lhings.
+     * @param username
+     * @param password
+     * @param workers Number of worker threads, usually the number of cores.
+     * @return The gateway, or NULL if the user could not log in.
+     */
+    LH_Gateway* lh_gateway_new(char *username, char *password, uint16_t workers);
+
+    /**
+     * Adds a device to a gateway that has not been started yet: registers it
+     * in Lhings if it is new, makes it an instance of the class, sends the
+     * descriptor of the class and starts its session. The device must stay
+     * allocated while the gateway runs.
+     * @param gateway
+     * @param device
+     * @param device_name Name of the device, which must be unique for the user.
+     * @param device_class
+     * @return 1 on success, 0 otherwise.
+     */
+    int lh_gateway_add_device(LH_Gateway *gateway, LH_Device *device, char *device_name, LH_DeviceClass *device_class);
+
+    /**
+     * Opens the sockets of the workers and starts them. The function returns
+     * once they are running, and devices can not be added from then on. If a
+     * worker can not be started, the ones already running are stopped and the
+     * sockets closed, so the gateway can be started again.
+     * @param gateway
+     * @return 1 on success, 0 otherwise.
+     */
+    int lh_gateway_start(LH_Gateway *gateway);
+
+    /**
+     * Returns the device whose action is being performed by the calling worker.
+     * @return The device, or NULL when called outside of an action function
+     * of a hosted device.
+     */
+    LH_Device* lh_gateway_current_device();
+
+    /**
+     * Returns the worker that owns a device: the first 32 bits of its uuid,
+     * which are random, modulo the number of workers. Ports that steer
+     * datagrams to the workers in the network stack must compute the same.
+     * @param uuid The uuid of the device, as the 16 bytes of LYNCPORT_ID.
+     * @param workers
+     * @return
+     */
+    uint16_t lh_gateway_shard(const uint8_t *uuid, uint16_t workers);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* GATEWAY_H */
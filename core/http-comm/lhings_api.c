@@ -17,25 +17,41 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include "../../core/logging/log.h"
 #include "lhings_api.h"
 #include "../../abstraction/http-comm/http_api.h"
 #include "../utils/lhings_json_api.h"
 #include "../utils/lhings_json_api.h"
 #include "../utils/data_structures.h"
+#include "../utils/string_pool.h"
 #include "../stun-messaging/stun_message.h"
+#include "../metrics/metrics.h"
 #include "../../abstraction/udp-comm/udp_api.h"
 
 
 
+/**
+ * Returns the URL of an API resource, which must be freed. The path is
+ * formatted with printf and appended to the configured API prefix.
+ */
+char* build_api_url(const char *path_format, ...) {
+    va_list args;
+    size_t prefix_len = strlen(config.api_prefix);
+    va_start(args, path_format);
+    int path_len = vsnprintf(NULL, 0, path_format, args);
+    va_end(args);
+    char *url = malloc(prefix_len + path_len + 1);
+    memcpy(url, config.api_prefix, prefix_len);
+    va_start(args, path_format);
+    vsnprintf(url + prefix_len, path_len + 1, path_format, args);
+    va_end(args);
+    return url;
+}
+
 int lh_api_start_session(LH_Device* device){
     char* request_body = "{\"name\": \"online\", \"value\": true}";
-    char url[94];
-    url[0] = 0;
-    strcat(url, LHINGS_V1_API_PREFIX);
-    strcat(url, "devices/");
-    strncat(url, device->uuid, 36);
-    strcat(url, "/states/online");
+    char* url = build_api_url("devices/%.36s/states/online", device->uuid);
     
     LH_Dict* headers = lh_dict_new();
     lh_dict_put(headers, "X-Api-Key", device->api_key);
@@ -51,22 +67,19 @@ int lh_api_start_session(LH_Device* device){
         free(message);
         lh_http_free(response);
         lh_dict_free(headers);
+        free(url);
         return 0;
     }
     lh_dict_free(headers);
     lh_http_free(response);
+    free(url);
     return 1;
 }
 
 
 int lh_api_end_session(LH_Device* device){
     char* request_body = "{\"name\": \"online\", \"value\": false}";
-    char url[94];
-    url[0] = 0;
-    strcat(url, LHINGS_V1_API_PREFIX);
-    strcat(url, "devices/");
-    strncat(url, device->uuid, 36);
-    strcat(url, "/states/online");
+    char* url = build_api_url("devices/%.36s/states/online", device->uuid);
     
     LH_Dict* headers = lh_dict_new();
     lh_dict_put(headers, "X-Api-Key", device->api_key);
@@ -82,22 +95,18 @@ int lh_api_end_session(LH_Device* device){
         free(message);
         lh_http_free(response);
         lh_dict_free(headers);
+        free(url);
         return 0;
     }
     lh_dict_free(headers);
     lh_http_free(response);
+    free(url);
     return 1;
 }
 
 
 char* lh_api_get_api_key(const char* username, const char* password){
-    char* url = malloc((62 + strlen(username) + strlen(password)) * sizeof url);
-    url[0] = 0;
-    strcat(url, LHINGS_V1_API_PREFIX);
-    strcat(url, "accounts/");
-    strcat(url, username);
-    strcat(url, "/apikey?password=");
-    strcat(url, password);
+    char* url = build_api_url("accounts/%s/apikey?password=%s", username, password);
     
     LH_Dict* headers = lh_dict_new();
     
@@ -123,10 +132,7 @@ char* lh_api_get_api_key(const char* username, const char* password){
 
 }
 int lh_api_register_device(LH_Device* device){
-    char url[94];
-    url[0] = 0;
-    strcat(url, LHINGS_V1_API_PREFIX);
-    strcat(url, "devices/");
+    char* url = build_api_url("devices/");
     char *request_body_template = "{\"name\": \"deviceName\", \"value\": \"%s\"}";
     uint16_t template_len = strlen(request_body_template);
     uint16_t dev_name_len = strlen(device->name);
@@ -145,6 +151,8 @@ int lh_api_register_device(LH_Device* device){
         free(message);
         lh_http_free(response);
         lh_dict_free(headers);
+        free(request_body);
+        free(url);
         return 0;
     }
     
@@ -153,6 +161,7 @@ int lh_api_register_device(LH_Device* device){
     lh_http_free(response);
     free(request_body);
     lh_dict_free(headers);
+    free(url);
     return 1;
 }
 
@@ -161,7 +170,8 @@ int lh_api_send_event(LH_Device* device, char* event_name, char* payload){
     int sent_success = lh_send_to_server(msg_event);
     stun_free(msg_event);
     if (sent_success){
-        log_info("Keepalive sent");
+        lh_metrics_inc(LH_COUNTER_EVENTS_SENT);
+        log_info("Event sent");
         return 1;
     } else {
         log_warn("Event message could not be sent")
@@ -199,12 +209,7 @@ int lh_api_send_event(LH_Device* device, char* event_name, char* payload){
 }
 
 int lh_api_send_descriptor(LH_Device* device, char* descriptor){
-    char* url = malloc((LHINGS_V1_API_PREFIX_LEN + strlen("devices/") + UUID_STRING_LEN + strlen("/") + 1) * sizeof url);
-    url[0] = 0;
-    strcat(url, LHINGS_V1_API_PREFIX);
-    strcat(url, "devices/");
-    strcat(url, device->uuid);
-    strcat(url, "/");
+    char* url = build_api_url("devices/%s/", device->uuid);
     
     LH_Dict* headers = lh_dict_new();
     lh_dict_put(headers, "X-Api-Key", device->api_key);
@@ -230,7 +235,7 @@ int lh_api_send_descriptor(LH_Device* device, char* descriptor){
     return 1;
 }
 
-char* generate_store_status_json(LH_List *components){
+char* generate_store_status_json(LH_List *components, uint8_t *values){
     char str_buffer[16] = "";
     int true_len = 4;
     int false_len = 5;
@@ -240,25 +245,26 @@ char* generate_store_status_json(LH_List *components){
     int j;
     for (j = 0; j < components->size; j++) {
         LH_Component *component = lh_list_get(components, j);
-        json_len += strlen(component->name) + 2;
+        void *value = lh_component_value(component, values);
+        json_len += lh_intern_length(component->name) + 2;
         switch (component->type) {
             case LH_TYPE_BOOLEAN:
-                if (*(uint32_t *) component->value)
+                if (*(uint32_t *) value)
                     json_len += true_len;
                 else
                     json_len += false_len;
                 break;
             case LH_TYPE_INTEGER:
             case LH_TYPE_TIMESTAMP:
-                snprintf(str_buffer, 16, "%d", (int) *(uint32_t*) component->value);
+                snprintf(str_buffer, 16, "%d", (int) *(uint32_t*) value);
                 json_len += strlen(str_buffer);
                 break;
             case LH_TYPE_FLOAT:
-                snprintf(str_buffer, 16, "%f", *(float *) component->value);
+                snprintf(str_buffer, 16, "%f", *(float *) value);
                 json_len += strlen(str_buffer);
                 break;
             case LH_TYPE_STRING:
-                json_len += strlen((char*) component->value) + 2;
+                json_len += strlen((char*) value) + 2;
                 break;
             case LH_TYPE_NO_TYPE:
             default:
@@ -271,28 +277,29 @@ char* generate_store_status_json(LH_List *components){
     strcpy(json_str, "{");
     for (j = 0; j < components->size; j++) {
         LH_Component *component = lh_list_get(components, j);
+        void *value = lh_component_value(component, values);
         strcat(json_str, "\"");
         strcat(json_str, component->name);
         strcat(json_str, "\":");
         switch (component->type) {
             case LH_TYPE_BOOLEAN:
-                if (*(uint32_t *) component->value)
+                if (*(uint32_t *) value)
                     strcat(json_str, str_true);
                 else
                     strcat(json_str, str_false);
                 break;
             case LH_TYPE_INTEGER:
             case LH_TYPE_TIMESTAMP:
-                snprintf(str_buffer, 16, "%d", (int) *(uint32_t*) component->value);
+                snprintf(str_buffer, 16, "%d", (int) *(uint32_t*) value);
                 strcat(json_str, str_buffer);
                 break;
             case LH_TYPE_FLOAT:
-                snprintf(str_buffer, 16, "%f", *(float *) component->value);
+                snprintf(str_buffer, 16, "%f", *(float *) value);
                 strcat(json_str, str_buffer);
                 break;
             case LH_TYPE_STRING:
                 strcat(json_str, "\"");
-                strcat(json_str, (char*) component->value);
+                strcat(json_str, (char*) value);
                 strcat(json_str, "\"");
                 break;
             case LH_TYPE_NO_TYPE:
@@ -308,6 +315,10 @@ char* generate_store_status_json(LH_List *components){
 
 int lh_api_store_status(LH_Device* device){
     StunMessage *msg_store = stun_get_status_store_message(device);
+    if (msg_store == NULL) {
+        log_warn("Store status message could not be built");
+        return 0;
+    }
     int sent_success = lh_send_to_server(msg_store);
     stun_free(msg_store);
     if (sent_success){
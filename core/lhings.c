@@ -14,25 +14,37 @@
  */
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include "lhings.h"
+#include "lhings_internal.h"
 #include "logging/log.h"
 #include "http-comm/lhings_api.h"
 #include "utils/data_structures.h"
 #include "../abstraction/timing/lhings_time.h"
 #include "../abstraction/permanent-storage/storage_api.h"
 #include "../abstraction/udp-comm/udp_api.h"
+#include "../abstraction/metrics-socket/metrics_socket.h"
+#include "../abstraction/threading/lhings_thread.h"
 #include "stun-messaging/stun_message.h"
+#include "stun-messaging/stun_arguments.h"
+#include "stun-messaging/submission_queue.h"
 #include "utils/utils.h"
+#include "utils/wire.h"
+#include "utils/string_pool.h"
+#include "metrics/metrics.h"
+
+LH_Device this_device;
+LH_Config config = {0, LHINGS_SERVER_HOST, LHINGS_SERVER_UDP_PORT, LHINGS_V1_API_PREFIX};
 
 int component_json_len(LH_Component *component) {
-    return MIN_COMP_JSON_LEN + strlen(component->name) + MAX_STR_TYPE_LEN;
+    return MIN_COMP_JSON_LEN + lh_intern_length(component->name) + MAX_STR_TYPE_LEN;
 }
 
 int action_json_len(LH_Action *action) {
     int json_len = MIN_ACTION_JSON_LEN;
-    json_len += strlen(action->name);
+    json_len += lh_intern_length(action->name);
     if (action->description != NULL)
         json_len += strlen(action->description);
     if (action->arguments != NULL) {
@@ -47,7 +59,7 @@ int action_json_len(LH_Action *action) {
 
 int event_json_len(LH_Event *event) {
     int json_len = MIN_EVENT_JSON_LEN;
-    json_len += strlen(event->name);
+    json_len += lh_intern_length(event->name);
     if (event->components != NULL) {
         int num_comps = event->components->size;
         int j;
@@ -124,6 +136,8 @@ void add_components(char* str_json, LH_List *components) {
 }
 
 void add_actions(char *str_json, LH_List *actions) {
+    if (actions == NULL)
+        return;
     int num_actions = actions->size;
     int j;
     for (j = 0; j < num_actions; j++) {
@@ -142,6 +156,8 @@ void add_actions(char *str_json, LH_List *actions) {
 }
 
 void add_events(char *str_json, LH_List *events) {
+    if (events == NULL)
+        return;
     int num_events = events->size;
     int j;
     for (j = 0; j < num_events; j++) {
@@ -188,13 +204,13 @@ int retry_send_device_descriptor(LH_Device *device, char *descriptor) {
     if (delay != 1)
         lh_sleep(1000 * delay);
     int success = lh_api_send_descriptor(device, descriptor);
-    delay = 2 * delay;
+    // the delay starts again for the next device of a gateway
+    delay = success ? 1 : 2 * delay;
     if (delay > MAX_DELAY_BETWEEN_RETRIES_SECS)
         delay = MAX_DELAY_BETWEEN_RETRIES_SECS;
     if (!success) {
-        char *message = lh_get_message_int("Descriptor could not be sent, retrying again in %d seconds.", delay);
-        log_warn(message);
-        free(message);
+        lh_metrics_inc(LH_COUNTER_RETRIES);
+        log_warnf("Descriptor could not be sent, retrying again in %d seconds.", delay);
     }
     return success;
 }
@@ -204,29 +220,55 @@ int retry_start_session(LH_Device *device) {
     if (delay != 1)
         lh_sleep(1000 * delay);
     int success = lh_api_start_session(device);
-    delay = 2 * delay;
+    // the delay starts again for the next device of a gateway
+    delay = success ? 1 : 2 * delay;
     if (delay > MAX_DELAY_BETWEEN_RETRIES_SECS)
         delay = MAX_DELAY_BETWEEN_RETRIES_SECS;
     if (!success) {
-        char *message_template = "Session could not be started, retrying again in %d seconds.";
-        char *message = malloc((strlen(message_template) + 4) * sizeof message);
-        sprintf(message, message_template, delay);
-        log_warn(message);
-        free(message);
+        lh_metrics_inc(LH_COUNTER_RETRIES);
+        log_warnf("Session could not be started, retrying again in %d seconds.", delay);
     }
     return success;
 }
 
+// transaction id and send time of the last keepalive, to measure the round trip time
+static uint8_t keepalive_trId[12];
+static uint64_t keepalive_sent_micros = 0;
+static uint32_t missed_keepalives = 0;
+
 void send_keepalive(LH_Device *device) {
+    // the previous keepalive was not answered
+    if (keepalive_sent_micros != 0 && ++missed_keepalives >= MISSED_KEEPALIVES_BEFORE_FAILOVER) {
+        lh_metrics_inc(LH_COUNTER_SERVER_FAILOVERS);
+        lh_udp_server_unresponsive();
+        missed_keepalives = 0;
+    }
     StunMessage *msg_keepalive = stun_get_keepalive_message(device);
+    memcpy(keepalive_trId, msg_keepalive->bytes + 8, 12);
+    keepalive_sent_micros = lh_get_absolute_time_micros();
     int sent_success = lh_send_to_server(msg_keepalive);
     stun_free(msg_keepalive);
-    if (sent_success)
+    if (sent_success) {
+        lh_device_metrics_add(&device->metrics, LH_DEVICE_COUNTER_KEEPALIVES_SENT, 1);
         log_info("Keepalive sent");
+    }
 }
 
+// times of the last keepalive and of the last execution of loop()
+static uint32_t last_keepalive = 0;
+static uint32_t last_loop_execution = 0;
+// the device started with lh_device_init
+static LH_Device *running_device = NULL;
+// 1 when the last step left received datagrams unprocessed
+static int receive_pending = 0;
+// position of each descriptor in the array of the last lh_get_fds, -1 if not there
+static int udp_fd_index = -1;
+static int metrics_fd_index = -1;
+static int wakeup_fd_index = -1;
+// events and status stores of the running device, submitted from any thread
+static SubmissionQueue submissions;
+
 void send_keepalive_if_needed(LH_Device *device) {
-    static uint32_t last_keepalive = 0;
     uint32_t now = lh_get_absolute_time_millis();
     //    if (last_keepalive != now && now - last_keepalive <= DELAY_BETWEEN_KEEPALIVES_SECS * 1000)
     if (now - last_keepalive <= DELAY_BETWEEN_KEEPALIVES_SECS * 1000)
@@ -237,7 +279,6 @@ void send_keepalive_if_needed(LH_Device *device) {
 }
 
 void loop_driver() {
-    static uint32_t last_loop_execution = 0;
     uint32_t now = lh_get_absolute_time_millis();
     if (now - last_loop_execution < config.loop_frequency_millis)
         return;
@@ -246,17 +287,61 @@ void loop_driver() {
     loop();
 }
 
-int is_string_arg(uint8_t mask, uint8_t position) {
-    return ((mask >> position) & 0x01) == 1;
+LH_NameTable* build_name_table(LH_List *list, size_t name_offset) {
+    // name tables index names with 16 bits, bigger lists are searched linearly
+    if (list == NULL || list->size > UINT16_MAX)
+        return NULL;
+    const char **names = malloc((list->size + 1) * sizeof *names);
+    int j;
+    for (j = 0; j < list->size; j++)
+        names[j] = *(char **) ((char *) lh_list_get(list, j) + name_offset);
+    LH_NameTable *table = lh_name_table_new(names, list->size);
+    free(names);
+    return table;
 }
 
+void free_model_tables(LH_Device *device) {
+    if (device->action_table != NULL)
+        lh_name_table_free(device->action_table);
+    if (device->event_table != NULL)
+        lh_name_table_free(device->event_table);
+    device->action_table = NULL;
+    device->event_table = NULL;
+}
+
+void compile_model(LH_Device *device) {
+    // devices of a class share the tables built when the class was sealed
+    if (device->device_class != NULL)
+        return;
+    free_model_tables(device);
+    device->action_table = build_name_table(device->actions, offsetof(LH_Action, name));
+    device->event_table = build_name_table(device->events, offsetof(LH_Event, name));
+    if (device->actions == NULL)
+        return;
+    int j;
+    for (j = 0; j < device->actions->size; j++) {
+        LH_Action *action = lh_list_get(device->actions, j);
+        if (action->argument_table != NULL)
+            lh_name_table_free(action->argument_table);
+        action->argument_table = build_name_table(action->arguments, offsetof(LH_Component, name));
+    }
+}
+
+// search_name must be interned, arguments are compared by address
 LH_ComponentType action_get_component_type(const char *search_name, LH_Action *action) {
+    if (action->arguments == NULL)
+        return LH_TYPE_NO_TYPE;
+    if (action->argument_table != NULL) {
+        int index = lh_name_table_find(action->argument_table, search_name, lh_intern_length(search_name));
+        if (index < 0)
+            return LH_TYPE_NO_TYPE;
+        return ((LH_Component *) lh_list_get(action->arguments, index))->type;
+    }
     int num_components = action->arguments->size;
     int j;
     for (j = 0; j < num_components; j++) {
         LH_Component *component = (LH_Component *) lh_list_get(action->arguments, j);
-        char *component_name = component->name;
-        if (strcmp(component_name, search_name) == 0)
+        if (component->name == search_name)
             return component->type;
     }
     return LH_TYPE_NO_TYPE;
@@ -277,187 +362,176 @@ void free_args_dictionary(LH_Dict *dict) {
 }
 
 LH_Dict* process_arguments_attribute(StunAttribute *attr, LH_Action *action) {
-    int num_args = attr->bytes[0];
-    if (num_args > 8 || num_args < 0) {
-        log_error("Maximum 8 arguments are allowed.");
+    StunArgumentsReader reader;
+    if (!stun_args_reader_init(&reader, attr->bytes, attr->length))
         return NULL;
-    }
 
-    uint8_t string_mask = attr->bytes[num_args + 1];
     LH_Dict *processed_args = lh_dict_new();
-    int j = 0;
-    int position = num_args + 2;
-    for (j = 0; j < num_args; j++) {
-        int arg_len = attr->bytes[j + 1];
-        char *arg_name;
+    StunArgument argument;
+    int status;
+    while ((status = stun_args_next(&reader, &argument)) == STUN_ARGS_OK) {
+        // names come from the network, so they are only looked up: a name
+        // that was never interned is not an argument of any action
+        const char *arg_name = lh_intern_lookup(argument.name, argument.name_length);
         void *arg_value;
-        if (is_string_arg(string_mask, j)) {
-            int arg_value_len = byte_array_to_uint16_t(attr->bytes + position);
-            int arg_name_len = byte_array_to_uint16_t(attr->bytes + position + 2);
-            arg_name = malloc((arg_name_len + 1) * sizeof *arg_name);
-            arg_value = malloc((arg_value_len + 1) * sizeof (char));
-            memcpy(arg_value, attr->bytes + position + 4, arg_value_len);
-            memcpy(arg_name, attr->bytes + position + arg_value_len + 4, arg_name_len);
-            ((char*) arg_value)[arg_value_len] = 0;
-            arg_name[arg_name_len] = 0;
+        if (argument.is_string) {
+            if (arg_name == NULL) {
+                log_warnf_limited("Arguments attribute: ignoring unknown string argument.");
+                continue;
+            }
+            arg_value = malloc((argument.value_length + 1) * sizeof (char));
+            memcpy(arg_value, argument.value, argument.value_length);
+            ((char*) arg_value)[argument.value_length] = 0;
         } else {
-            arg_name = malloc((arg_len + 1) * sizeof *arg_name);
-            memcpy(arg_name, attr->bytes + position + 4, arg_len);
-            arg_name[arg_len] = 0;
-            LH_ComponentType type = action_get_component_type(arg_name, action);
+            LH_ComponentType type = arg_name == NULL ? LH_TYPE_NO_TYPE : action_get_component_type(arg_name, action);
             arg_value = malloc(sizeof (uint32_t));
             switch (type) {
                 case LH_TYPE_INTEGER:
                 case LH_TYPE_BOOLEAN:
                 case LH_TYPE_TIMESTAMP:
-                    *((uint32_t *) arg_value) = byte_array_to_uint32(attr->bytes + position);
+                    *((uint32_t *) arg_value) = load_be32(argument.value);
                     break;
                 case LH_TYPE_FLOAT:
-                    *((float *) arg_value) = byte_array_to_float(attr->bytes + position);
+                    *((float *) arg_value) = byte_array_to_float(argument.value);
                     break;
                 case LH_TYPE_STRING:
                 case LH_TYPE_NO_TYPE:
+                default:
                     log_error("Arguments attribute: expected four byte argument type but received string or no type.");
+                    free(arg_value);
                     free_args_dictionary(processed_args);
                     return NULL;
             }
         }
         lh_dict_put(processed_args, arg_name, arg_value);
-        free(arg_name);
-        position = position + arg_len + 4;
+    }
+    if (status == STUN_ARGS_ERROR) {
+        free_args_dictionary(processed_args);
+        return NULL;
     }
     return processed_args;
 }
 
-void perform_action(StunMessage *message) {
-    StunAttribute attr_name;
-    int attr_present = stun_get_attribute(message, ATTR_NAME, &attr_name);
-    if (!attr_present)
-        return;
-    char* action_name = malloc((attr_name.length + 1) * sizeof *action_name);
-    memcpy(action_name, attr_name.bytes, attr_name.length);
-    action_name[attr_name.length] = 0;
-    int num_actions_of_device = this_device.actions->size;
+int action_get_argument_index(const uint8_t *name, uint16_t name_len, LH_Action *action) {
+    if (action->argument_table != NULL)
+        return lh_name_table_find(action->argument_table, name, name_len);
+    int num_components = action->arguments->size;
     int j;
-    LH_Action *action_to_execute = NULL;
-    for (j = 0; j < num_actions_of_device; j++) {
-        LH_Action *action = (LH_Action *) lh_list_get(this_device.actions, j);
-        if (strcmp(action_name, action->name) == 0) {
-            action_to_execute = action;
-            break;
+    for (j = 0; j < num_components; j++) {
+        LH_Component *component = (LH_Component *) lh_list_get(action->arguments, j);
+        if (lh_intern_length(component->name) == name_len && memcmp(component->name, name, name_len) == 0)
+            return j;
+    }
+    return -1;
+}
+
+int fill_arguments_view(StunAttribute *attr, LH_Action *action, LH_Args *view) {
+    int j;
+    for (j = 0; j < view->count; j++)
+        view->slots[j].present = 0;
+
+    StunArgumentsReader reader;
+    if (!stun_args_reader_init(&reader, attr->bytes, attr->length))
+        return 0;
+    StunArgument argument;
+    int status;
+    while ((status = stun_args_next(&reader, &argument)) == STUN_ARGS_OK) {
+        int index = view->count == 0 ? -1 : action_get_argument_index(argument.name, argument.name_length, action);
+        if (index < 0) {
+            log_debug("Arguments attribute: ignoring argument not declared by the action.");
+            continue;
+        }
+        LH_ArgSlot *slot = view->slots + index;
+        if (argument.is_string != (slot->type == LH_TYPE_STRING)) {
+            log_error("Arguments attribute: received argument does not match declared type.");
+            return 0;
         }
+        slot->value = argument.value;
+        slot->value_length = argument.value_length;
+        slot->present = 1;
     }
+    return status != STUN_ARGS_ERROR;
+}
+
+LH_Action* device_get_action(LH_Device *device, const uint8_t *name, uint16_t name_len) {
+    if (device->actions == NULL)
+        return NULL;
+    if (device->action_table != NULL) {
+        int index = lh_name_table_find(device->action_table, name, name_len);
+        return index < 0 ? NULL : lh_list_get(device->actions, index);
+    }
+    int num_actions_of_device = device->actions->size;
+    int j;
+    for (j = 0; j < num_actions_of_device; j++) {
+        LH_Action *action = (LH_Action *) lh_list_get(device->actions, j);
+        if (lh_intern_length(action->name) == name_len && memcmp(action->name, name, name_len) == 0)
+            return action;
+    }
+    return NULL;
+}
+
+int execute_action(StunMessage *message) {
+    StunAttribute attr_name;
+    int attr_present = stun_get_attribute(message, ATTR_NAME, &attr_name);
+    if (!attr_present)
+        return 0;
+    LH_Action *action_to_execute = device_get_action(&this_device, attr_name.bytes, attr_name.length);
     if (action_to_execute == NULL) {
-        char *log_msg = lh_get_message_str("Device has no action with name %s", action_name);
-        log_warn(log_msg);
-        free(log_msg);
-        free(action_name);
-        return;
+        log_warnf_limited("Device has no action with name %.*s", (int) attr_name.length, (const char *) attr_name.bytes);
+        return 0;
     }
 
     StunAttribute attr_arguments;
     attr_present = stun_get_attribute(message, ATTR_ARGUMENTS, &attr_arguments);
-    if (!attr_present) {
-        free(action_name);
-        return;
+    if (!attr_present)
+        return 0;
+
+    if (action_to_execute->action_function_view != NULL) {
+        if (!fill_arguments_view(&attr_arguments, action_to_execute, &action_to_execute->arguments_view)) {
+            log_error("Could not process arguments attribute. Action not performed.");
+            return 0;
+        }
+        action_to_execute->action_function_view(&action_to_execute->arguments_view);
+        return 1;
     }
 
     LH_Dict *arguments = process_arguments_attribute(&attr_arguments, action_to_execute);
     if (arguments == NULL) {
         log_error("Could not process arguments attribute. Action not performed.");
-        free(action_name);
-        return;
+        return 0;
     }
 
     action_to_execute->action_function(arguments);
     free_args_dictionary(arguments);
-    free(action_name);
+    return 1;
 }
 
-uint8_t* build_arguments_attribute(LH_Device *device, int *len) {
-    int num_status = device->status_components->size;
-    if (num_status > 8) {
-        log_error("More than 8 components are not allowed.");
-        return NULL;
+void perform_action(StunMessage *message) {
+    uint64_t start = lh_get_absolute_time_micros();
+    if (execute_action(message)) {
+        lh_metrics_inc(LH_COUNTER_ACTIONS_PERFORMED);
+        lh_device_metrics_add(&this_device.metrics, LH_DEVICE_COUNTER_ACTIONS_PERFORMED, 1);
+    } else {
+        lh_metrics_inc(LH_COUNTER_ACTION_ERRORS);
+        lh_device_metrics_add(&this_device.metrics, LH_DEVICE_COUNTER_ACTION_ERRORS, 1);
     }
-    int size_to_alloc = 2 + num_status;
-    int j;
-    for (j = 0; j < num_status; j++) {
-        LH_Component *status = lh_list_get(device->status_components, j);
-        int name_len = strlen(status->name);
-        int value_len = 0;
-        if (status->type == LH_TYPE_STRING) {
-            char *value = (char *) status->value;
-            value_len = strlen(value);
-        }
-        size_to_alloc += name_len + value_len + 4;
-    }
-    uint8_t *attr_arguments_bytes = malloc(size_to_alloc * sizeof *attr_arguments_bytes);
-    memset(attr_arguments_bytes, size_to_alloc, 0);
-    *len = size_to_alloc;
-    attr_arguments_bytes[0] = num_status;
-    int position = 2 + num_status;
-    for (j = 0; j < num_status; j++) {
-        LH_Component *status = lh_list_get(device->status_components, j);
-        int str_len = 0;
-        int name_len = 0;
-        switch (status->type) {
-            case LH_TYPE_INTEGER:
-            case LH_TYPE_TIMESTAMP:
-                uint32_to_byte_array(*(uint32_t *) status->value, attr_arguments_bytes + position);
-                position += 4;
-                str_len = strlen((char*) status->name);
-                memcpy(attr_arguments_bytes + position, status->name, str_len);
-                // update status length
-                *(attr_arguments_bytes + j + 1) = (uint8_t) str_len;
-                position += str_len;
-                break;
-            case LH_TYPE_BOOLEAN:
-                if (*(int *) status->value)
-                    uint32_to_byte_array((uint32_t) 1, attr_arguments_bytes + position);
-                else
-                    uint32_to_byte_array((uint32_t) 0, attr_arguments_bytes + position);
-                position += 4;
-                str_len = strlen((char*) status->name);
-                memcpy(attr_arguments_bytes + position, status->name, str_len);
-                position += str_len;
-                *(attr_arguments_bytes + j + 1) = (uint8_t) str_len;
-                break;
-            case LH_TYPE_FLOAT:
-                float_to_byte_array(*(float *) status->value, attr_arguments_bytes + position);
-                position += 4;
-                str_len = strlen((char*) status->name);
-                memcpy(attr_arguments_bytes + position, status->name, str_len);
-                position += str_len;
-                *(attr_arguments_bytes + j + 1) = (uint8_t) str_len;
-                break;
-            case LH_TYPE_STRING:
-                // set string mask bit
-                *(attr_arguments_bytes + num_status + 1) = *(attr_arguments_bytes + num_status + 1) | (1 << j);
-                str_len = strlen((char*) status->value);
-                uint16_to_byte_array((uint16_t) str_len, attr_arguments_bytes + position);
-                name_len = strlen(status->name);
-                uint16_to_byte_array((uint16_t) name_len, attr_arguments_bytes + position + 2);
-                position += 4;
-                memcpy(attr_arguments_bytes + position, status->value, str_len);
-                position += str_len;
-                memcpy(attr_arguments_bytes + position, status->name, name_len);
-                position += str_len;
-                *(attr_arguments_bytes + j + 1) = (uint8_t) str_len + name_len;
-                break;
-            case LH_TYPE_NO_TYPE:
-            default:
-                break;
-        }
+    uint32_t elapsed = (uint32_t) (lh_get_absolute_time_micros() - start);
+    lh_metrics_record(LH_HISTOGRAM_ACTION_MICROS, elapsed);
+    lh_device_metrics_add(&this_device.metrics, LH_DEVICE_COUNTER_ACTION_MICROS, elapsed);
+}
 
-    }
-    return attr_arguments_bytes;
+uint8_t* build_arguments_attribute(LH_Device *device, int *len) {
+    return stun_args_build(device->status_components, device->values, len);
 }
 
 void send_status(StunMessage *message) {
     StunAttribute attr_status;
     int length;
     uint8_t *attr_status_bytes = build_arguments_attribute(&this_device, &length);
+    if (attr_status_bytes == NULL) {
+        log_error("Status response could not be built.");
+        return;
+    }
     attr_status.attr_type = ATTR_ARGUMENTS;
     attr_status.bytes = attr_status_bytes;
     attr_status.length = length;
@@ -480,32 +554,39 @@ void send_success_response(StunMessage *message) {
     stun_free(response);
 }
 
-void process_messages() {
+/**
+ * Processes the next datagram received, if any.
+ * @return 1 if a datagram was received, 0 otherwise.
+ */
+int process_messages() {
     uint16_t length;
     uint8_t *bytes = lh_receive_from_server(&length);
     if (bytes == NULL)
-        return;
+        return 0;
 
     StunMessage message;
     if (!stun_process_stun_message(bytes, length, &message)) {
-        log_warn("Discarding malformed message received.");
+        lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+        log_warnf_limited("Discarding malformed message received.");
         free(bytes);
-        return;
+        return 1;
     }
 
     // TODO add here check of trId to avoid processing duplicated messages
 
     if (!stun_is_integrity_correct(&message, this_device.api_key)) {
-        log_warn("Discarding message received with bad integrity.");
+        lh_metrics_inc(LH_COUNTER_MESSAGES_DROPPED);
+        lh_device_metrics_add(&this_device.metrics, LH_DEVICE_COUNTER_MESSAGES_DROPPED, 1);
+        log_warnf_limited("Discarding message received with bad integrity.");
         free(bytes);
-        return;
+        return 1;
     }
 
     uint16_t method, class;
     stun_get_method_and_class(&message, &method, &class);
-    char str[100];
-    encode_hex(message.bytes + 8, 12, str);
-    //printf("STUN message received: class %0x, method %0x, trId %s\n", class, method, str);
+    char trId[25];
+    log_debugf("STUN message received: class %04x, method %04x, trId %s", (unsigned) class, (unsigned) method,
+            lh_hex_encode(message.bytes + 8, 12, trId, sizeof trId));
     if (class == CL_ERROR) {
         // check for bad timestamp message
         StunAttribute attribute;
@@ -517,11 +598,22 @@ void process_messages() {
                 log_warn("Bad timestamp message received.");
         }
         if (stun_get_attribute(&message, ATTR_SERVER_TIME, &attribute)) {
-            uint32_t server_time = byte_array_to_uint32(attribute.bytes);
+            uint32_t server_time = load_be32(attribute.bytes);
             lh_update_time_offset(server_time);
         }
         free(bytes);
-        return;
+        return 1;
+    }
+
+    if (class == CL_SUCCESS && method == M_KEEP_ALIVE)
+        lh_udp_keepalive_answered(message.bytes + 8);
+    if (class == CL_SUCCESS && method == M_KEEP_ALIVE && keepalive_sent_micros != 0
+            && memcmp(message.bytes + 8, keepalive_trId, 12) == 0) {
+        uint32_t rtt = (uint32_t) (lh_get_absolute_time_micros() - keepalive_sent_micros);
+        lh_metrics_record(LH_HISTOGRAM_KEEPALIVE_RTT_MICROS, rtt);
+        lh_device_metrics_keepalive_answered(&this_device.metrics, rtt);
+        keepalive_sent_micros = 0;
+        missed_keepalives = 0;
     }
 
     if (class == CL_REQUEST) {
@@ -538,12 +630,54 @@ void process_messages() {
         }
     }
     free(bytes);
-    return;
+    return 1;
 }
 
-int lh_start_device(LH_Device *device, char *device_name, char *username, char *password) {
+int register_device(LH_Device *device) {
+    char* uuid = lh_storage_get_uuid(device->name);
+    if (uuid != NULL) {
+        device->uuid = uuid;
+        return 1;
+    }
+    if (!lh_api_register_device(device)) {
+        log_error("Device registration failed.");
+        return 0;
+    }
+    lh_storage_save_uuid(device->name, device->uuid);
+    return 1;
+}
+
+void announce_device(LH_Device *device) {
+    // the model does not change after setup, build the dispatch tables
+    compile_model(device);
+    lh_device_metrics_register(&device->metrics, device->uuid);
+
+    // send descriptor file, devices of a class share the one of the class
+    char *device_descriptor;
+    if (device->device_class != NULL)
+        device_descriptor = device->device_class->descriptor;
+    else
+        device_descriptor = generate_descriptor(device);
+    if (LOG_DESCRIPTOR)
+        log_info(device_descriptor);
+    int success;
+    do {
+        success = retry_send_device_descriptor(device, device_descriptor);
+    } while (!success);
+    if (device->device_class == NULL)
+        free(device_descriptor);
+
+    // start session in Lhings
+    do {
+        success = retry_start_session(device);
+    } while (!success);
+}
+
+int lh_device_init(LH_Device *device, char *device_name, char *username, char *password) {
     device->name = device_name;
     device->username = username;
+    // resolve the server while the session is started over HTTP
+    lh_udp_resolve_server();
     char *apikey = lh_api_get_api_key(username, password);
     if (apikey == NULL)
         return 0;
@@ -552,57 +686,140 @@ int lh_start_device(LH_Device *device, char *device_name, char *username, char *
     device->actions = NULL;
     device->events = NULL;
     device->status_components = NULL;
+    device->action_table = NULL;
+    device->event_table = NULL;
+    device->device_class = NULL;
+    device->values = NULL;
+    device->submissions = NULL;
+    device->common_attrs = NULL;
     device->api_key = apikey;
 
-    char* uuid = lh_storage_get_uuid(device->name);
-    if (uuid == NULL) {
-        // device has not been registered before, do it now
-        if (!lh_api_register_device(device)) {
-            log_error("Device registration failed.");
-            free(apikey);
-            return 0;
-        } else {
-            lh_storage_save_uuid(device->name, device->uuid);
-        }
-    } else {
-        device->uuid = uuid;
+    if (!register_device(device)) {
+        free(apikey);
+        return 0;
     }
     // call user defined setup function
     log_info("Configuring device");
     setup();
-
-    // send descriptor file
-    char *device_descriptor = generate_descriptor(device);
-    if (LOG_DESCRIPTOR)
-        log_info(device_descriptor);
-    int success;
-    do {
-        success = retry_send_device_descriptor(device, device_descriptor);
-    } while (!success);
-    free(device_descriptor);
-
-    // start session in Lhings
-    do {
-        success = retry_start_session(device);
-    } while (!success);
+    announce_device(device);
     log_info("Session started!");
     // send first keepalive
+    last_keepalive = lh_get_absolute_time_millis();
     send_keepalive(device);
-    // main loop
+    lh_udp_flush();
+    submission_queue_init(&submissions, lh_wakeup_new());
+    device->submissions = &submissions;
+    running_device = device;
+    return 1;
+}
+
+int lh_get_fds(LH_Fd *fds, int max) {
+    int count = 0, writable;
+    udp_fd_index = metrics_fd_index = wakeup_fd_index = -1;
+    int fd = lh_udp_get_fd();
+    if (fd != -1 && count < max) {
+        fds[count].fd = fd;
+        fds[count].events = LH_FD_READABLE;
+        udp_fd_index = count++;
+    }
+    fd = lh_metrics_socket_get_fd(&writable);
+    if (fd != -1 && count < max) {
+        fds[count].fd = fd;
+        fds[count].events = writable ? LH_FD_WRITABLE : LH_FD_READABLE;
+        metrics_fd_index = count++;
+    }
+    if (submissions.wakeup != -1 && running_device != NULL && count < max) {
+        fds[count].fd = submissions.wakeup;
+        fds[count].events = LH_FD_READABLE;
+        wakeup_fd_index = count++;
+    }
+    return count;
+}
+
+uint32_t lh_next_timeout_ms() {
+    if (running_device == NULL || receive_pending)
+        return 0;
+    uint32_t now = lh_get_absolute_time_millis();
+    uint32_t elapsed = now - last_keepalive;
+    uint32_t timeout = elapsed > DELAY_BETWEEN_KEEPALIVES_SECS * 1000 ? 0 : DELAY_BETWEEN_KEEPALIVES_SECS * 1000 + 1 - elapsed;
+    // with no frequency set, loop() runs once per step and does not wake the device up
+    if (config.loop_frequency_millis >= 1) {
+        uint32_t interval = (uint32_t) config.loop_frequency_millis;
+        elapsed = now - last_loop_execution;
+        if (elapsed >= interval)
+            return 0;
+        if (interval - elapsed < timeout)
+            timeout = interval - elapsed;
+    }
+    return timeout;
+}
+
+/**
+ * Sends the events and status stores submitted so far, including those
+ * submitted by loop() in this step.
+ */
+void send_submissions(SubmissionQueue *queue) {
+    StunMessage *message;
+    SubmissionKind kind;
+    LH_Device *device;
+    int j;
+    submission_queue_rearm(queue);
+    // the ones submitted while sending wait for the next step
+    for (j = 0; j < SUBMISSION_QUEUE_CAPACITY && (message = submission_queue_pop_message(queue, &kind, &device)) != NULL; j++) {
+        int sent_success = lh_send_to_server(message);
+        stun_free(message);
+        if (!sent_success) {
+            log_warn(kind == SUBMISSION_EVENT ? "Event message could not be sent" : "Store status message could not be sent");
+        } else if (kind == SUBMISSION_EVENT) {
+            lh_metrics_inc(LH_COUNTER_EVENTS_SENT);
+            lh_device_metrics_add(&device->metrics, LH_DEVICE_COUNTER_EVENTS_SENT, 1);
+            log_info("Event sent");
+        } else {
+            log_info("Store status sent");
+        }
+    }
+}
+
+int fd_is_ready(uint32_t fd_mask, int index) {
+    return index >= 0 && (fd_mask & (1u << index)) != 0;
+}
+
+void lh_process_ready(uint32_t fd_mask) {
+    if (running_device == NULL)
+        return;
+    send_keepalive_if_needed(running_device);
+    if (receive_pending || fd_is_ready(fd_mask, udp_fd_index)) {
+        int j;
+        receive_pending = 0;
+        for (j = 0; j < LH_MAX_MESSAGES_PER_STEP && process_messages(); j++)
+            ;
+        // the rest are processed in the next step, without waiting
+        receive_pending = j == LH_MAX_MESSAGES_PER_STEP;
+    }
+    loop_driver();
+    if (fd_is_ready(fd_mask, wakeup_fd_index))
+        lh_wakeup_clear(submissions.wakeup);
+    send_submissions(&submissions);
+    if (fd_is_ready(fd_mask, metrics_fd_index))
+        lh_metrics_socket_poll();
+    lh_udp_flush();
+    log_report_suppressed();
+}
+
+int lh_start_device(LH_Device *device, char *device_name, char *username, char *password) {
+    if (!lh_device_init(device, device_name, username, password))
+        return 0;
+    // main loop, waiting for datagrams or the next due work in between
+    LH_Fd fds[LH_MAX_FDS];
     while (1) {
-        send_keepalive_if_needed(device);
-        process_messages();
-        loop_driver();
+        int count = lh_get_fds(fds, LH_MAX_FDS);
+        uint32_t ready = lh_wait_fds(fds, count, lh_next_timeout_ms());
+        lh_process_ready(ready);
     }
 }
 
 void log_frequency_change() {
-    char *template = "loop frequency: interval set to %d millis";
-    int buffer_size = (strlen(template) + 12);
-    char *message = malloc(buffer_size * sizeof message);
-    snprintf(message, buffer_size, template, (int) config.loop_frequency_millis);
-    log_info(message);
-    free(message);
+    log_infof("loop frequency: interval set to %d millis", (int) config.loop_frequency_millis);
 }
 
 void lh_set_loop_frequency_hz(double freq) {
@@ -615,46 +832,235 @@ void lh_set_loop_frequency_secs(uint32_t secs) {
     log_frequency_change();
 }
 
+void lh_set_server(const char *host, const char *udp_port, const char *api_prefix) {
+    if (host != NULL)
+        config.server_host = host;
+    if (udp_port != NULL)
+        config.server_udp_port = udp_port;
+    if (api_prefix != NULL)
+        config.api_prefix = api_prefix;
+    log_infof("Lhings server set to %s:%s, API %s", config.server_host, config.server_udp_port, config.api_prefix);
+}
+
+int model_is_shared(LH_Device *device) {
+    if (device->device_class == NULL)
+        return 0;
+    log_error("The model of a device that is an instance of a class can not be modified.");
+    return 1;
+}
+
 void lh_model_add_event(LH_Device *device, char *name, LH_List *components) {
+    if (model_is_shared(device))
+        return;
     if (device->events == NULL)
         device->events = lh_list_new();
 
+    free_model_tables(device);
     LH_Event *event = malloc(sizeof *event);
     lh_list_add(device->events, event);
-    event->name = name;
+    event->name = lh_intern(name);
 
     event->components = components;
 }
 
 void lh_model_add_status_component(LH_Device *device, char *name, LH_ComponentType type, void *value) {
+    if (model_is_shared(device))
+        return;
     if (device->status_components == NULL)
         device->status_components = lh_list_new();
 
     LH_Component *component = malloc(sizeof *component);
-    component->name = name;
+    component->name = lh_intern(name);
     component->type = type;
     component->value = value;
+    component->offset = 0;
     lh_list_add(device->status_components, component);
 
 }
 
 void lh_model_add_action(LH_Device *device, char *name, char *description, LH_List *arguments, void (*action_function)(LH_Dict *argument_values)) {
+    if (model_is_shared(device))
+        return;
     if (device->actions == NULL)
         device->actions = lh_list_new();
 
+    free_model_tables(device);
     LH_Action *action = malloc(sizeof *action);
     lh_list_add(device->actions, action);
-    action->name = name;
+    action->name = lh_intern(name);
     action->description = description;
     action->action_function = action_function;
+    action->action_function_view = NULL;
     action->arguments = arguments;
+    action->arguments_view.count = 0;
+    action->arguments_view.slots = NULL;
+    action->argument_table = NULL;
+}
+
+void lh_model_add_action_view(LH_Device *device, char *name, char *description, LH_List *arguments, void (*action_function)(const LH_Args *arguments)) {
+    if (model_is_shared(device))
+        return;
+    lh_model_add_action(device, name, description, arguments, NULL);
+    LH_Action *action = lh_list_get(device->actions, device->actions->size - 1);
+    action->action_function_view = action_function;
+    if (arguments == NULL || arguments->size == 0)
+        return;
+
+    // slots are allocated once here, so performing the action does not allocate
+    LH_Args *view = &action->arguments_view;
+    view->count = arguments->size;
+    view->slots = calloc(view->count, sizeof *view->slots);
+    int j;
+    for (j = 0; j < view->count; j++)
+        view->slots[j].type = ((LH_Component *) lh_list_get(arguments, j))->type;
+}
+
+int lh_args_get_int(const LH_Args *args, uint16_t index, int32_t *value) {
+    if (index >= args->count || !args->slots[index].present)
+        return 0;
+    LH_ArgSlot *slot = args->slots + index;
+    if (slot->type != LH_TYPE_INTEGER && slot->type != LH_TYPE_BOOLEAN && slot->type != LH_TYPE_TIMESTAMP)
+        return 0;
+    *value = (int32_t) load_be32(slot->value);
+    return 1;
+}
+
+int lh_args_get_float(const LH_Args *args, uint16_t index, float *value) {
+    if (index >= args->count || !args->slots[index].present)
+        return 0;
+    if (args->slots[index].type != LH_TYPE_FLOAT)
+        return 0;
+    *value = byte_array_to_float(args->slots[index].value);
+    return 1;
+}
+
+const char* lh_args_get_string_view(const LH_Args *args, uint16_t index, uint16_t *length) {
+    if (index >= args->count || !args->slots[index].present)
+        return NULL;
+    if (args->slots[index].type != LH_TYPE_STRING)
+        return NULL;
+    if (length != NULL)
+        *length = args->slots[index].value_length;
+    return (const char *) args->slots[index].value;
+}
+
+LH_DeviceClass* lh_device_class_new() {
+    return calloc(1, sizeof (LH_DeviceClass));
+}
+
+int device_class_is_sealed(LH_DeviceClass *device_class) {
+    if (!device_class->sealed)
+        return 0;
+    log_error("Device class is sealed, its model can not be modified.");
+    return 1;
+}
+
+int lh_class_add_status_component(LH_DeviceClass *device_class, char *name, LH_ComponentType type) {
+    if (device_class_is_sealed(device_class))
+        return -1;
+    LH_Device *model = &device_class->model;
+    lh_model_add_status_component(model, name, type, NULL);
+    LH_Component *component = lh_list_get(model->status_components, model->status_components->size - 1);
+    uint32_t size;
+    switch (type) {
+        case LH_TYPE_STRING:
+            size = sizeof (char *);
+            break;
+        case LH_TYPE_NO_TYPE:
+            size = 0;
+            break;
+        default:
+            size = 4;
+            break;
+    }
+    // values are aligned to their size
+    uint32_t offset = device_class->value_block_size;
+    if (size > 0)
+        offset = (offset + size - 1) / size * size;
+    component->offset = offset;
+    device_class->value_block_size = offset + size;
+    return model->status_components->size - 1;
+}
+
+int lh_class_add_event(LH_DeviceClass *device_class, char *name, LH_List *components) {
+    if (device_class_is_sealed(device_class))
+        return 0;
+    lh_model_add_event(&device_class->model, name, components);
+    return 1;
+}
+
+int lh_class_add_action(LH_DeviceClass *device_class, char *name, char *description, LH_List *arguments, void (*action_function)(LH_Dict *argument_values)) {
+    if (device_class_is_sealed(device_class))
+        return 0;
+    lh_model_add_action(&device_class->model, name, description, arguments, action_function);
+    return 1;
+}
+
+int lh_class_add_action_view(LH_DeviceClass *device_class, char *name, char *description, LH_List *arguments, void (*action_function)(const LH_Args *arguments)) {
+    if (device_class_is_sealed(device_class))
+        return 0;
+    lh_model_add_action_view(&device_class->model, name, description, arguments, action_function);
+    return 1;
+}
+
+void seal_device_class(LH_DeviceClass *device_class) {
+    compile_model(&device_class->model);
+    device_class->descriptor = generate_descriptor(&device_class->model);
+    device_class->sealed = 1;
+}
+
+int lh_device_set_class(LH_Device *device, LH_DeviceClass *device_class) {
+    if (device->device_class != NULL || device->status_components != NULL
+            || device->actions != NULL || device->events != NULL) {
+        log_error("Device already has a model, it can not be made an instance of a class.");
+        return 0;
+    }
+    if (!device_class->sealed)
+        seal_device_class(device_class);
+    uint8_t *values = calloc(device_class->value_block_size + 1, sizeof *values);
+    if (values == NULL)
+        return 0;
+
+    LH_Device *model = &device_class->model;
+    int j;
+    for (j = 0; model->status_components != NULL && j < model->status_components->size; j++) {
+        LH_Component *component = lh_list_get(model->status_components, j);
+        if (component->type == LH_TYPE_STRING)
+            *(const char **) (values + component->offset) = "";
+    }
+    device->device_class = device_class;
+    device->values = values;
+    device->info = model->info;
+    device->status_components = model->status_components;
+    device->actions = model->actions;
+    device->events = model->events;
+    device->action_table = model->action_table;
+    device->event_table = model->event_table;
+    return 1;
+}
+
+void* lh_device_value(LH_Device *device, uint16_t index) {
+    if (device->values == NULL || device->status_components == NULL || index >= device->status_components->size)
+        return NULL;
+    LH_Component *component = lh_list_get(device->status_components, index);
+    return device->values + component->offset;
+}
+
+void* lh_component_value(const LH_Component *component, uint8_t *values) {
+    if (values == NULL)
+        return component->value;
+    uint8_t *slot = values + component->offset;
+    if (component->type == LH_TYPE_STRING)
+        return *(char **) slot;
+    return slot;
 }
 
 LH_Component* lh_model_create_component(char *name, LH_ComponentType type, void *value) {
     LH_Component *component = malloc(sizeof *component);
-    component->name = name;
+    component->name = lh_intern(name);
     component->type = type;
     component->value = value;
+    component->offset = 0;
     return component;
 }
 
@@ -676,7 +1082,7 @@ char *build_structured_payload(LH_List *components) {
     int j;
     for (j = 0; j < components->size; j++) {
         LH_Component *component = lh_list_get(components, j);
-        json_len += strlen(component->name) + 2;
+        json_len += lh_intern_length(component->name) + 2;
         switch (component->type) {
             case LH_TYPE_BOOLEAN:
                 if (*(uint32_t *) component->value)
@@ -745,42 +1151,51 @@ char *build_structured_payload(LH_List *components) {
     return json_str;
 }
 
+/**
+ * Queues an event for the thread that owns the socket of the device, or
+ * sends it right away if the device has not been started yet.
+ */
+int submit_event(LH_Device *device, char *event_name, char *payload) {
+    if (device->submissions == NULL) {
+        lh_api_send_event(device, event_name, payload);
+        return 1;
+    }
+    return submission_queue_push_event(device->submissions, device, event_name, payload);
+}
+
 int lh_send_event(LH_Device *device, char *event_name, char *payload, LH_List * components) {
     int j;
     int event_found = 0;
     LH_Event *event;
-    for (j = 0; j < device->events->size; j++) {
-        event = (LH_Event *) lh_list_get(device->events, (uint16_t) j);
-        if (strcmp(event_name, event->name) == 0) {
-            event_found = 1;
-            break;
+    if (device->event_table != NULL) {
+        event_found = lh_name_table_find(device->event_table, event_name, strlen(event_name)) >= 0;
+    } else if (device->events != NULL) {
+        for (j = 0; j < device->events->size; j++) {
+            event = (LH_Event *) lh_list_get(device->events, j);
+            if (strcmp(event_name, event->name) == 0) {
+                event_found = 1;
+                break;
+            }
         }
     }
     if (!event_found) {
-        char *log_msg = lh_get_message_str("This device has no event named %s", event_name);
-        log_warn(log_msg);
-        free(log_msg);
+        log_warnf("This device has no event named %s", event_name);
         return 0;
     }
 
-    if (payload != NULL) {
-        lh_api_send_event(device, event_name, payload);
-        return 1;
-    }
-
-    if (components == NULL) {
-        lh_api_send_event(device, event_name, NULL);
-        return 1;
-    }
+    if (payload != NULL || components == NULL)
+        return submit_event(device, event_name, payload);
 
     char *json_payload = build_structured_payload(components);
-    lh_api_send_event(device, event_name, json_payload);
+    int queued = submit_event(device, event_name, json_payload);
 //    printf("json_payload: %s\n", json_payload);
     free(json_payload);
-    return 1;
+    return queued;
 }
 
 
 int lh_store_status(LH_Device *device){
-    return lh_api_store_status(device);
+    if (device->submissions == NULL)
+        return lh_api_store_status(device);
+    return submission_queue_push_status(device->submissions, device);
 }
\ No newline at end of file
@@ -91,9 +91,18 @@ extern "C" {
 #endif
 
 #include "utils/data_structures.h"
+#include "metrics/metrics.h"
     
 #define MAX_DELAY_BETWEEN_RETRIES_SECS 120
 #define DELAY_BETWEEN_KEEPALIVES_SECS 30
+    // keepalives without response after which the transport tries another address of the server
+#define MISSED_KEEPALIVES_BEFORE_FAILOVER 2
+    // descriptors returned by lh_get_fds
+#define LH_MAX_FDS 3
+    // datagrams processed by lh_process_ready before letting the host loop run
+#define LH_MAX_MESSAGES_PER_STEP 64
+#define LH_FD_READABLE 1
+#define LH_FD_WRITABLE 2
 #define LOG_DESCRIPTOR 0
     
     
@@ -113,6 +122,10 @@ extern "C" {
     
     typedef struct _lh_config{
         float loop_frequency_millis;
+        // endpoints of the Lhings server, changed with lh_set_server
+        const char *server_host;
+        const char *server_udp_port;
+        const char *api_prefix;
     } LH_Config;
     
     /**
@@ -135,17 +148,25 @@ extern "C" {
      */
     typedef struct _status_component{
         /**
-         * The name of the component.
+         * The name of the component, interned (see string_pool.h) by the 
+         * functions that create components.
          */
-        char *name;
+        const char *name;
         /**
          * The component type.
          */
         LH_ComponentType type;
         /**
          * A pointer to the variable that contains the value of this component.
+         * Null for the status components of an LH_DeviceClass, whose values
+         * live in the value block of each device (see offset).
          */
         void *value;
+        /**
+         * For status components of an LH_DeviceClass, the offset of the value
+         * of the component in the value block of the devices of the class.
+         */
+        uint32_t offset;
     } LH_Component;
     
     /**
@@ -171,6 +192,41 @@ extern "C" {
          * actions that can be performed by the device.
          */
         LH_List *actions;
+        /**
+         * Tables used to find actions and events by name. They are built
+         * after setup() returns, and are null while the model is being defined.
+         */
+        LH_NameTable *action_table, *event_table;
+        /**
+         * The class the device is an instance of, or null if the device
+         * defines its own model. See lh_device_set_class().
+         */
+        struct _device_class *device_class;
+        /**
+         * Values of the status components, for devices that are instances of
+         * a class. Null otherwise.
+         */
+        uint8_t *values;
+        /**
+         * Queue of the events and status stores waiting to be sent by the
+         * thread that owns the socket of the device. Null until the device
+         * is started, in which case they are sent by the calling thread.
+         */
+        struct submission_queue *submissions;
+        /**
+         * The USERNAME, TIMESTAMP and LYNCPORT_ID attributes every message
+         * of the device starts with, encoded by the first message sent. Only
+         * the timestamp changes from one message to the next. The cache
+         * belongs to the device: a copy of a device must clear it, and it is
+         * released with stun_free_common_attrs.
+         */
+        uint8_t *common_attrs;
+        uint16_t common_attrs_length;
+        /**
+         * Counters of the device alone, registered when it is announced. A
+         * copy of a device must not be registered.
+         */
+        LH_DeviceMetrics metrics;
     } LH_Device;
 
     /**
@@ -178,30 +234,113 @@ extern "C" {
      * components, if any.
      */
     typedef struct _event {
-        char *name;
+        /**
+         * The name of the event, interned by lh_model_add_event().
+         */
+        const char *name;
         LH_List *components;
     } LH_Event;
     
+    /**
+     * LH_ArgSlot holds the value of one of the arguments of an action while
+     * it is being performed. Values point into the received message, so they
+     * are only valid during the call to the action function.
+     */
+    typedef struct _arg_slot {
+        /**
+         * The type declared for the argument in lh_model_add_action_view().
+         */
+        LH_ComponentType type;
+        /**
+         * Big endian 4 byte value, or the characters of a string value (not null terminated).
+         */
+        const uint8_t *value;
+        uint16_t value_length;
+        /**
+         * 1 if the argument was received with the action request, 0 otherwise.
+         */
+        uint8_t present;
+    } LH_ArgSlot;
+
+    /**
+     * LH_Args is a read only view over the arguments received with an action
+     * request. Arguments are accessed with lh_args_get_int(), lh_args_get_float()
+     * and lh_args_get_string_view() using the index they had in the list of
+     * arguments passed to lh_model_add_action_view(). Using this view instead
+     * of an LH_Dict, performing an action does not allocate any memory.
+     */
+    typedef struct _args {
+        uint16_t count;
+        LH_ArgSlot *slots;
+    } LH_Args;
+
     /**
      * LH_Action stores the details of an action, like its name and arguments.
      */
     typedef struct _action {
-        char *name, *description;
+        /**
+         * The name of the action, interned by lh_model_add_action().
+         */
+        const char *name;
+        char *description;
         LH_List *arguments;
         /**
          * A pointer to the function that actually performs the action.
          */
         void (*action_function) (LH_Dict* argument_values);
+        /**
+         * A pointer to the function that performs the action, used instead of
+         * action_function for actions added with lh_model_add_action_view().
+         */
+        void (*action_function_view) (const LH_Args* arguments);
+        /**
+         * Preallocated view reused each time the action is performed.
+         */
+        LH_Args arguments_view;
+        /**
+         * Table used to find arguments by name, built together with the
+         * tables of the device.
+         */
+        LH_NameTable *argument_table;
     }LH_Action;
     
+    /**
+     * LH_DeviceClass holds a device model (info, status components, actions
+     * and events) that can be shared by many devices in the same process.
+     * 
+     * The model is defined once using the lh_class_* functions, and becomes
+     * immutable when the first device is attached to the class with 
+     * lh_device_set_class(). At that point the dispatch tables and the 
+     * descriptor are built, and each device only allocates a value block 
+     * with the values of its status components, laid out contiguously.
+     */
+    typedef struct _device_class {
+        /**
+         * The shared model. Only its info, lists and tables are used.
+         */
+        LH_Device model;
+        /**
+         * Size in bytes of the value block of each device of the class.
+         */
+        uint32_t value_block_size;
+        /**
+         * Descriptor of the class, generated when the class is sealed.
+         */
+        char *descriptor;
+        /**
+         * 1 once a device has been attached, the model can not change afterwards.
+         */
+        uint8_t sealed;
+    } LH_DeviceClass;
+    
     /**
      * This instance of LH_Device is used internally by the library to track
      * the state and configuration of the device while it is being executed.
      * Its reference is the one that must be passed in the call to
      * lh_start_device().
      */
-    LH_Device this_device;
-    LH_Config config;
+    extern LH_Device this_device;
+    extern LH_Config config;
     
     /**
      * This function must be used to define the actions, events and status components
@@ -227,6 +366,9 @@ extern "C" {
      * It will connect to Lhings, register the
      * device in Lhings if needed, call setup(), send the descriptor and periodically
      * execute the function loop(). If there are no errors, the call to this function never returns.
+     * Between steps it waits for datagrams from the server or for the next
+     * call to loop() to be due. Use lh_device_init() instead to run the
+     * device inside an event loop of your own.
      * 
      * @param device A pointer to a structure LH_Device. In practice, a pointer to the variable this_device (defined in lhings.h) must always be passed.
      * @param device_name A string with the name given to the device.
@@ -235,6 +377,67 @@ extern "C" {
      * @return 0 if there is no error. On success this function never returns.
      */
     int lh_start_device(LH_Device *device, char *device_name, char *username, char *password);
+
+    /**
+     * A descriptor the device waits on, and the readiness it waits for.
+     */
+    typedef struct _lh_fd {
+        int fd;
+        // LH_FD_READABLE or LH_FD_WRITABLE
+        uint8_t events;
+    } LH_Fd;
+
+    /**
+     * Starts the device like lh_start_device(), but returns once the session
+     * has started instead of running the main loop, so that the device can
+     * be driven from the event loop of the application (select, poll, epoll,
+     * libuv...) with lh_get_fds(), lh_next_timeout_ms() and lh_process_ready():
+     * 
+     * @code
+     * LH_Fd fds[LH_MAX_FDS];
+     * while (1) {
+     *     int count = lh_get_fds(fds, LH_MAX_FDS);
+     *     // add fds to the descriptors of the application and wait for at
+     *     // most lh_next_timeout_ms() milliseconds, then set bit j of ready
+     *     // if fds[j] is ready
+     *     lh_process_ready(ready);
+     * }
+     * @endcode
+     * 
+     * The parameters are the same as those of lh_start_device().
+     * @return 1 if the session has started, 0 otherwise.
+     */
+    int lh_device_init(LH_Device *device, char *device_name, char *username, char *password);
+
+    /**
+     * Returns the descriptors the device started with lh_device_init() waits
+     * on. They may change between steps, so it must be called before every wait.
+     * @param fds Where up to max descriptors are stored, LH_MAX_FDS at most.
+     * @param max
+     * @return The number of descriptors stored.
+     */
+    int lh_get_fds(LH_Fd *fds, int max);
+
+    /**
+     * Returns how long the application may wait for the descriptors of
+     * lh_get_fds() before calling lh_process_ready(), until the next keepalive
+     * or call to loop() is due. It is 0 when there is work pending, for
+     * instance datagrams left unprocessed by the previous step. When the
+     * frequency of loop() has not been set, loop() runs once per step and
+     * does not shorten the timeout.
+     * @return The timeout in milliseconds.
+     */
+    uint32_t lh_next_timeout_ms();
+
+    /**
+     * Performs the work of the device that is due, without blocking: sends
+     * the keepalive, processes up to LH_MAX_MESSAGES_PER_STEP datagrams
+     * received, calls loop(), sends the events and status stores submitted
+     * and serves the metrics socket.
+     * @param fd_mask Bit j set if the descriptor j of the last call to
+     * lh_get_fds() is ready.
+     */
+    void lh_process_ready(uint32_t fd_mask);
     /**
      * Set the frequency at which the function loop will be called. 
      * 
@@ -251,6 +454,18 @@ extern "C" {
      * @param secs The time in seconds between two consecutive calls to loop function.
      */
     void lh_set_loop_frequency_secs(uint32_t secs);
+
+    /**
+     * Changes the server the device connects to, for instance to test it 
+     * against a local stand-in of Lhings. Must be called before lh_start_device().
+     * By default the device connects to www.lhings.com.
+     * @param host The host name or address of the STUN server, or null to keep the current one.
+     * @param udp_port The UDP port of the STUN server, or null to keep the current one.
+     * @param api_prefix The prefix of the URLs of the REST API, including the
+     * scheme and ending in a slash, e.g. "http://127.0.0.1:8080/laas/api/v1/",
+     * or null to keep the current one.
+     */
+    void lh_set_server(const char *host, const char *udp_port, const char *api_prefix);
     
     /**
      * Used to create components, either to define device capabilities (in the function setup)
@@ -287,7 +502,8 @@ extern "C" {
      * 
      * This information
      * will be used by the library to automatically build the device descriptor and send it to 
-     * Lhings. A device can have up to 8 status components. See http://support.lhings.com/The-Device-Descriptor.html
+     * Lhings. A device can have as many status components as fit in a STUN message
+     * (see stun_arguments.h for the encoding used to send them). See http://support.lhings.com/The-Device-Descriptor.html
      * for more details on the device descriptor.
      * @param device The device to which the status component belongs (usually this will be the variable this_device).
      * @param name A string with the name of the status component.
@@ -309,6 +525,116 @@ extern "C" {
      * @param action_function A function pointer to the function that actually performs the requested action.
      */
     void lh_model_add_action(LH_Device *device, char *name, char *description, LH_List *arguments, void (*action_function)(LH_Dict *argument_values));
+    /**
+     * Same as lh_model_add_action(), but the action function receives a read
+     * only view over the received arguments instead of a dictionary, so that
+     * performing the action does not allocate any memory. Arguments are
+     * retrieved from the view by the index they have in the list arguments.
+     * @param device The device that is capable of performing this action (usually this will be the variable this_device).
+     * @param name A string with the name of the action.
+     * @param description A string with the description of the action (optional, can be null).
+     * @param arguments The list of arguments the action needs to know to be executed. If null is passed no arguments are added.
+     * @param action_function A function pointer to the function that actually performs the requested action.
+     */
+    void lh_model_add_action_view(LH_Device *device, char *name, char *description, LH_List *arguments, void (*action_function)(const LH_Args *arguments));
+
+    /**
+     * Retrieves the value of an integer, boolean or timestamp argument.
+     * @param args The view received by the action function.
+     * @param index The index of the argument in the list of arguments of the action.
+     * @param value Where the value is stored.
+     * @return 1 if the argument was received and has one of those types, 0 otherwise.
+     */
+    int lh_args_get_int(const LH_Args *args, uint16_t index, int32_t *value);
+
+    /**
+     * Retrieves the value of a float argument.
+     * @param args The view received by the action function.
+     * @param index The index of the argument in the list of arguments of the action.
+     * @param value Where the value is stored.
+     * @return 1 if the argument was received and is a float, 0 otherwise.
+     */
+    int lh_args_get_float(const LH_Args *args, uint16_t index, float *value);
+
+    /**
+     * Retrieves the value of a string argument, without copying it.
+     * @param args The view received by the action function.
+     * @param index The index of the argument in the list of arguments of the action.
+     * @param length If not null, the length of the string is stored here.
+     * @return A pointer to the characters of the string, which is not null
+     * terminated and is only valid during the call to the action function, or
+     * null if the argument was not received or is not a string.
+     */
+    const char* lh_args_get_string_view(const LH_Args *args, uint16_t index, uint16_t *length);
+
+    /**
+     * Creates a new, empty device class. Its info can be set directly in 
+     * the model field before the class is sealed.
+     * @return A pointer to the LH_DeviceClass created.
+     */
+    LH_DeviceClass* lh_device_class_new();
+
+    /**
+     * Adds a status component to the class. Unlike lh_model_add_status_component(),
+     * no value is given: each device of the class stores its own value, which
+     * is accessed with lh_device_value().
+     * @param device_class
+     * @param name The name of the status component.
+     * @param type The type of the status component.
+     * @return The index of the component, to be passed to lh_device_value(), or
+     * -1 if the class is sealed.
+     */
+    int lh_class_add_status_component(LH_DeviceClass *device_class, char *name, LH_ComponentType type);
+
+    /**
+     * Same as lh_model_add_event(), for a device class.
+     * @return 1 on success, 0 if the class is sealed.
+     */
+    int lh_class_add_event(LH_DeviceClass *device_class, char *name, LH_List *components);
+
+    /**
+     * Same as lh_model_add_action(), for a device class.
+     * @return 1 on success, 0 if the class is sealed.
+     */
+    int lh_class_add_action(LH_DeviceClass *device_class, char *name, char *description, LH_List *arguments, void (*action_function)(LH_Dict *argument_values));
+
+    /**
+     * Same as lh_model_add_action_view(), for a device class.
+     * @return 1 on success, 0 if the class is sealed.
+     */
+    int lh_class_add_action_view(LH_DeviceClass *device_class, char *name, char *description, LH_List *arguments, void (*action_function)(const LH_Args *arguments));
+
+    /**
+     * Makes the device an instance of the given class, usually from setup(). 
+     * The device shares the model of the class, and the lh_model_add_*
+     * functions can no longer be used with it. The first call seals the class.
+     * @param device
+     * @param device_class
+     * @return 1 on success, 0 if the device already defines its own model or
+     * the value block could not be allocated.
+     */
+    int lh_device_set_class(LH_Device *device, LH_DeviceClass *device_class);
+
+    /**
+     * Returns a pointer to the value of a status component of a device that
+     * is an instance of a class. Four byte types are stored as @c int32_t, 
+     * @c uint32_t or @c float. For string components the value is a @c char* 
+     * pointing to a null terminated string, initially "".
+     * @param device
+     * @param index The index returned by lh_class_add_status_component().
+     * @return A pointer to the value, or null if the index is not valid.
+     */
+    void* lh_device_value(LH_Device *device, uint16_t index);
+
+    /**
+     * Returns the value of a component with the semantics of LH_Component.value:
+     * a pointer to the four byte value or to the characters of a string.
+     * @param component
+     * @param values The value block of the device the component belongs to, 
+     * or null if the component has its own value pointer.
+     * @return 
+     */
+    void* lh_component_value(const LH_Component *component, uint8_t *values);
     /**
      * Notifies Lhings about the occurence of the named event, optionally with a <a href="http://support.lhings.com/Event-Payload.html">payload</a>.
      * @param device The device that notifies about the occurence of the event (usually this will be the variable this_device).
@@ -316,15 +642,23 @@ extern "C" {
      * @param payload A string containing the payload of the event (optional, can be null). 
      * If both payload and components are not null, then components is discarded and has no effect.
      * @param components A list of LH_Component structs that contains the components that want to be sent with the event (optional, can be null).
-     * @return 1 if event is sent successfully, 0 otherwise.
+     * 
+     * Once the device has started, the event is copied into a queue and sent
+     * by the thread that runs the device in its next step, so this function
+     * can be called from any thread and never waits for the network.
+     * @return 1 if event is sent or queued successfully, 0 otherwise.
      */
     int lh_send_event(LH_Device *device, char *event_name, char *payload, LH_List *components);
     
     /**
      * Automatically stores the status of the device in Lhings, using the
      * <a href="http://support.lhings.com/The-Data-API.html">Data API</a>.
+     * 
+     * Like lh_send_event(), it can be called from any thread once the device
+     * has started: the values are read by the calling thread and sent by the
+     * thread that runs the device.
      * @param device
-     * @return 
+     * @return 1 if the status is sent or queued successfully, 0 otherwise.
      */
     int lh_store_status(LH_Device *device);
     
@@ -0,0 +1,75 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file lhings_internal.h
+ * @brief Functions of lhings.c shared with the gateway, which are not part
+ * of the public API.
+ */
+
+#ifndef LHINGS_INTERNAL_H
+#define	LHINGS_INTERNAL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "lhings.h"
+#include "stun-messaging/stun_message.h"
+
+    /**
+     * Gets the uuid of a device from the permanent storage, or registers it
+     * in Lhings if it has not been registered before.
+     * @param device
+     * @return 1 on success, 0 otherwise.
+     */
+    int register_device(LH_Device *device);
+
+    /**
+     * Sends the descriptor of a device whose model is complete and starts its
+     * session, retrying until both succeed.
+     * @param device
+     */
+    void announce_device(LH_Device *device);
+
+    /**
+     * Finds an action of a device by its name.
+     * @param device
+     * @param name The name, not null terminated.
+     * @param name_len
+     * @return The action, or null if the device has no action with that name.
+     */
+    LH_Action* device_get_action(LH_Device *device, const uint8_t *name, uint16_t name_len);
+
+    /**
+     * Points the slots of a view at the arguments of an ARGUMENTS attribute.
+     * Arguments the action does not declare are ignored, and slots of
+     * arguments that were not received are left not present.
+     * @param attr
+     * @param action
+     * @param view The view of the action, or a copy with its own slots when
+     * actions run in several threads.
+     * @return 1 on success, 0 if the attribute is malformed or an argument
+     * does not have the declared type.
+     */
+    int fill_arguments_view(StunAttribute *attr, LH_Action *action, LH_Args *view);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LHINGS_INTERNAL_H */
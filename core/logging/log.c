@@ -16,12 +16,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 #include "log.h"
+#include "log_ring.h"
 #include "../../abstraction/logging/platform-logging.h"
+#include "../../abstraction/threading/lhings_thread.h"
+#include "../../abstraction/timing/lhings_time.h"
+
+int log_level = LOG_OFF;
+static LogRing log_ring;
+// set to 1 once the writer thread is running
+static int log_async = 0;
+// signalled when a line is queued while the writer may be waiting, -1 if the platform has none
+static int log_wakeup = -1;
+// 1 from the first line queued after the writer rearmed the wake up
+static uint32_t log_wakeup_pending = 0;
+
+static int rate_limit_has_pending();
 
 #ifdef LOGGING_ON
+/**
+ * Wakes the writer thread up, with a system call only for the first line
+ * queued since it last woke up.
+ */
+static void log_wake_writer() {
+    if (log_wakeup != -1 && !LH_ATOMIC_EXCHANGE(&log_wakeup_pending, 1))
+        lh_wakeup_signal(log_wakeup);
+}
+
 int log_write_log(int level, const char *message, const char *filename, int line) {
-    static int log_level = LOG_OFF;
     static const char *log_level_tag[] = {"", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL", "OFF"};
 
     if (line == LOG_SET_LEVEL) {
@@ -34,12 +57,30 @@ int log_write_log(int level, const char *message, const char *filename, int line
     } 
     
     if (!(level < log_level || level > LOG_FATAL)) {
-        // print log line
+        if (LH_ATOMIC_LOAD(&log_async) && level != LOG_FATAL) {
+            // the writer thread prints it
+            if (log_ring_push(&log_ring, level, filename, line, message)) {
+                log_wake_writer();
+                return level;
+            }
+            return 0;
+        }
+        // print log line, fatal lines are printed right away after the queued ones
+        log_flush();
         lh_printf(log_level_tag[level], filename, line, message);
         return level;
     }
     return 0;
 }
+
+int log_write_logf(int level, const char *filename, int line, const char *format, ...) {
+    char message[LOG_LINE_MAX_LEN];
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(message, sizeof message, format, arguments);
+    va_end(arguments);
+    return log_write_log(level, message, filename, line);
+}
 #else
 int log_do_nothing(){ return 0; }
 
@@ -54,6 +95,179 @@ int log_get_level() {
     return log_write_log(LOG_GET_LEVEL, NULL, NULL, LOG_GET_LEVEL);
 }
 
+void log_writer(void *unused) {
+    static const char *log_level_tag[] = {"", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL", "OFF"};
+    LogRecord record;
+    uint64_t reported_drops = 0;
+    LH_Fd wakeup = {log_wakeup, LH_FD_READABLE};
+    while (1) {
+        if (log_wakeup != -1)
+            lh_wakeup_clear(log_wakeup);
+        // lines queued from now on signal the descriptor again
+        LH_ATOMIC_EXCHANGE(&log_wakeup_pending, 0);
+        while (log_ring_pop(&log_ring, &record))
+            lh_printf(log_level_tag[record.level], record.filename, record.line, record.message);
+        log_report_suppressed();
+        uint64_t dropped = log_ring_dropped(&log_ring);
+        if (dropped != reported_drops) {
+            char message[64];
+            snprintf(message, sizeof message, "%llu log lines dropped, log ring full.", (unsigned long long) (dropped - reported_drops));
+            lh_printf(log_level_tag[LOG_WARNING], __FILE__, __LINE__, message);
+            reported_drops = dropped;
+        }
+        // sleep until a line is queued, or the summaries of suppressed lines are due
+        uint32_t timeout = LOG_WRITER_MAX_WAIT_MILLIS;
+        if (rate_limit_has_pending())
+            timeout = LOG_RATE_LIMIT_REPORT_MILLIS;
+        if (log_wakeup == -1)
+            timeout = LOG_WRITER_IDLE_MILLIS;
+        lh_wait_fds(&wakeup, 1, timeout);
+    }
+}
+
+int log_start_async() {
+    if (LH_ATOMIC_LOAD(&log_async))
+        return 1;
+    log_ring_init(&log_ring);
+    if (log_wakeup == -1)
+        log_wakeup = lh_wakeup_new();
+    if (!lh_thread_start(log_writer, NULL))
+        return 0;
+    LH_ATOMIC_STORE(&log_async, 1);
+    return 1;
+}
+
+void log_flush() {
+    if (!LH_ATOMIC_LOAD(&log_async))
+        return;
+    while (!log_ring_is_empty(&log_ring))
+        lh_sleep(1);
+}
+
+uint64_t log_get_dropped() {
+    if (!LH_ATOMIC_LOAD(&log_async))
+        return 0;
+    return log_ring_dropped(&log_ring);
+}
+
+uint32_t log_get_queue_depth() {
+    if (!LH_ATOMIC_LOAD(&log_async))
+        return 0;
+    return log_ring_depth(&log_ring);
+}
+
+#ifdef LOGGING_ON
+// set in the low bits of the state of a bucket once it has been used
+#define RATE_LIMIT_INITIALIZED 0x80000000u
+#define RATE_LIMIT_TOKENS(state) ((uint32_t) (state) & ~RATE_LIMIT_INITIALIZED)
+#define RATE_LIMIT_REFILL_MILLIS(state) ((uint32_t) ((state) >> 32))
+#define RATE_LIMIT_STATE(refill_millis, tokens) \
+    ((uint64_t) (refill_millis) << 32 | RATE_LIMIT_INITIALIZED | (tokens))
+
+// call sites that suppressed lines not reported yet, pushed with a compare
+// and swap and taken all at once, so there is no ABA problem
+static LogRateLimit *rate_limit_pending = NULL;
+static uint32_t rate_limit_last_report_millis = 0;
+
+static void rate_limit_push_pending(LogRateLimit *limit) {
+    LogRateLimit *head = LH_ATOMIC_LOAD(&rate_limit_pending);
+    do {
+        limit->next_pending = head;
+    } while (!LH_ATOMIC_CAS(&rate_limit_pending, &head, limit));
+}
+
+static void rate_limit_report(LogRateLimit *limit, int level, const char *filename, int line) {
+    uint32_t suppressed = LH_ATOMIC_EXCHANGE(&limit->suppressed, 0);
+    if (suppressed > 0)
+        log_write_logf(level, filename, line, "suppressed %u similar messages", (unsigned) suppressed);
+}
+
+int log_rate_limit_allow(LogRateLimit *limit, int level, const char *filename, int line) {
+    uint32_t now = lh_get_absolute_time_millis();
+    uint64_t state = LH_ATOMIC_LOAD(&limit->state);
+    uint32_t tokens, last_refill_millis;
+    int allowed;
+    do {
+        tokens = LOG_RATE_LIMIT_BURST;
+        last_refill_millis = now;
+        if (state & RATE_LIMIT_INITIALIZED) {
+            tokens = RATE_LIMIT_TOKENS(state);
+            last_refill_millis = RATE_LIMIT_REFILL_MILLIS(state);
+        }
+        // another thread may have refilled it after this one read the clock
+        uint32_t elapsed = (int32_t) (now - last_refill_millis) > 0 ? now - last_refill_millis : 0;
+        uint32_t new_tokens = (uint32_t) ((uint64_t) elapsed * LOG_RATE_LIMIT_PER_SEC / 1000);
+        if (new_tokens > 0) {
+            // only advance the refill time by the tokens added, so fractions are not lost
+            last_refill_millis += new_tokens * 1000 / LOG_RATE_LIMIT_PER_SEC;
+            tokens += new_tokens;
+            if (tokens > LOG_RATE_LIMIT_BURST)
+                tokens = LOG_RATE_LIMIT_BURST;
+        }
+        allowed = tokens > 0;
+        if (!allowed)
+            break;
+        tokens--;
+    } while (!LH_ATOMIC_CAS(&limit->state, &state, RATE_LIMIT_STATE(last_refill_millis, tokens)));
+
+    if (!allowed) {
+        LH_ATOMIC_FETCH_ADD(&limit->suppressed, 1);
+        if (LH_ATOMIC_EXCHANGE(&limit->pending, 1) == 0) {
+            // only the thread that set pending writes these, and the push publishes them
+            limit->level = level;
+            limit->filename = filename;
+            limit->line = line;
+            rate_limit_push_pending(limit);
+            // the writer waits for its summary with a timeout from now on
+            log_wake_writer();
+        }
+        return 0;
+    }
+    rate_limit_report(limit, level, filename, line);
+    return 1;
+}
+
+static int rate_limit_has_pending() {
+    return LH_ATOMIC_LOAD(&rate_limit_pending) != NULL;
+}
+
+void log_report_suppressed() {
+    uint32_t now = lh_get_absolute_time_millis();
+    uint32_t last_report_millis = LH_ATOMIC_LOAD(&rate_limit_last_report_millis);
+    if (now - last_report_millis < LOG_RATE_LIMIT_REPORT_MILLIS
+            || !LH_ATOMIC_CAS(&rate_limit_last_report_millis, &last_report_millis, now))
+        return;
+    LogRateLimit *limit = LH_ATOMIC_EXCHANGE(&rate_limit_pending, NULL);
+    while (limit != NULL) {
+        LogRateLimit *next = limit->next_pending;
+        uint64_t state = LH_ATOMIC_LOAD(&limit->state);
+        if ((int32_t) (now - RATE_LIMIT_REFILL_MILLIS(state)) < 1000 / LOG_RATE_LIMIT_PER_SEC) {
+            // the bucket is still empty, check it again later
+            rate_limit_push_pending(limit);
+        } else {
+            int level = limit->level;
+            const char *filename = limit->filename;
+            int line = limit->line;
+            // a suppression from now on pushes the site again
+            LH_ATOMIC_STORE(&limit->pending, 0);
+            rate_limit_report(limit, level, filename, line);
+        }
+        limit = next;
+    }
+}
+#else
+static int rate_limit_has_pending() {
+    return 0;
+}
+
+int log_rate_limit_allow(LogRateLimit *limit, int level, const char *filename, int line) {
+    return 0;
+}
+
+void log_report_suppressed() {
+}
+#endif
+
 char* log_get_str_level() {
     static char *log_level_tag[] = {"", "DEBUG", "INFO", "WARNING", "ERROR", "FATAL", "OFF"};
     int level = log_write_log(LOG_GET_LEVEL, NULL, NULL, LOG_GET_LEVEL);
@@ -63,7 +277,7 @@ char* log_get_str_level() {
 
 char* lh_get_message_str(const char *template, const char *str){
     int buffer_len = strlen(template) + strlen(str) +1;
-    char *message = malloc(buffer_len * sizeof message);
+    char *message = malloc(buffer_len * sizeof *message);
     snprintf(message, buffer_len, template, str);
     return message;
 }
@@ -71,7 +285,7 @@ char* lh_get_message_str(const char *template, const char *str){
  
 char* lh_get_message_int(const char *template, const int number){
     int buffer_len = strlen(template) + 15 +1;
-    char *message = malloc(buffer_len * sizeof message);
+    char *message = malloc(buffer_len * sizeof *message);
     snprintf(message, buffer_len, template, number);
     return message;
 }
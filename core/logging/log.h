@@ -20,6 +20,8 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 #define LOGGING_ON
 
 #define LOG_DEBUG    1
@@ -32,17 +34,78 @@ extern "C" {
 #define LOG_GET_LEVEL -100
 #define LOG_SET_LEVEL -110
 
+    // the writer thread waits for lines at most this long
+#define LOG_WRITER_MAX_WAIT_MILLIS 60000
+    // time the writer thread sleeps when there is nothing to write, on platforms without wake up descriptors
+#define LOG_WRITER_IDLE_MILLIS 10
+
+
+    // lines with a lower level are removed at compile time
+#ifndef LH_LOG_MIN_LEVEL
+#define LH_LOG_MIN_LEVEL LOG_DEBUG
+#endif
+
+    // maximum length of a line formatted by the log_*f macros
+#define LOG_LINE_MAX_LEN 256
+
+    // lines logged in a burst by a rate limited call site, and lines per second afterwards
+#define LOG_RATE_LIMIT_BURST 5
+#define LOG_RATE_LIMIT_PER_SEC 1
+    // how often the summaries of sites that stopped logging are checked
+#define LOG_RATE_LIMIT_REPORT_MILLIS 100
+
+    /**
+     * Token bucket of a rate limited log call site. The log_*_limited macros
+     * declare one per call site, so it should not be used directly. Call 
+     * sites are shared by every thread that logs, so all the fields are
+     * updated atomically. A zeroed bucket is full.
+     */
+    typedef struct log_rate_limit {
+        // time of the last refill in the high 32 bits, and tokens left in the
+        // low ones, changed together with a compare and swap
+        uint64_t state;
+        // lines dropped and not reported yet
+        uint32_t suppressed;
+        // 1 while the call site is in the list of sites with lines to report
+        uint32_t pending;
+        // where the summary of the suppressed lines is reported
+        int level;
+        const char *filename;
+        int line;
+        struct log_rate_limit *next_pending;
+    } LogRateLimit;
 
 #ifdef LOGGING_ON
     #define log_log(level, message) log_write_log(level, message, __FILE__, __LINE__);
-    #define log_debug(message) log_log(LOG_DEBUG, message);
-    #define log_info(message) log_log(LOG_INFO, message);
-    #define log_warn(message) log_log(LOG_WARNING, message);
-    #define log_warning(message) log_log(LOG_WARNING, message);
-    #define log_error(message) log_log(LOG_ERROR, message);
-    #define log_fatal(message) log_log(LOG_FATAL, message);
+    #define log_enabled(level) ((level) >= LH_LOG_MIN_LEVEL && (level) >= log_level)
+    #define log_debug(message) do { if (log_enabled(LOG_DEBUG)) log_log(LOG_DEBUG, message); } while (0);
+    #define log_info(message) do { if (log_enabled(LOG_INFO)) log_log(LOG_INFO, message); } while (0);
+    #define log_warn(message) do { if (log_enabled(LOG_WARNING)) log_log(LOG_WARNING, message); } while (0);
+    #define log_warning(message) log_warn(message)
+    #define log_error(message) do { if (log_enabled(LOG_ERROR)) log_log(LOG_ERROR, message); } while (0);
+    #define log_fatal(message) do { if (log_enabled(LOG_FATAL)) log_log(LOG_FATAL, message); } while (0);
+
+    // printf style variants, arguments are not evaluated if the level is disabled
+    #define log_logf(level, ...) \
+        do { if (log_enabled(level)) log_write_logf(level, __FILE__, __LINE__, __VA_ARGS__); } while (0)
+    #define log_debugf(...) log_logf(LOG_DEBUG, __VA_ARGS__)
+    #define log_infof(...) log_logf(LOG_INFO, __VA_ARGS__)
+    #define log_warnf(...) log_logf(LOG_WARNING, __VA_ARGS__)
+    #define log_errorf(...) log_logf(LOG_ERROR, __VA_ARGS__)
+    #define log_fatalf(...) log_logf(LOG_FATAL, __VA_ARGS__)
+
+    // rate limited variants, for lines that can be triggered by network traffic
+    #define log_logf_limited(level, ...) \
+        do { \
+            static LogRateLimit log_rate_limit_state; \
+            if (log_enabled(level) && log_rate_limit_allow(&log_rate_limit_state, level, __FILE__, __LINE__)) \
+                log_write_logf(level, __FILE__, __LINE__, __VA_ARGS__); \
+        } while (0)
+    #define log_warnf_limited(...) log_logf_limited(LOG_WARNING, __VA_ARGS__)
+    #define log_errorf_limited(...) log_logf_limited(LOG_ERROR, __VA_ARGS__)
 #else
     #define log_log(level, message) log_do_nothing();
+    #define log_enabled(level) 0
     #define log_debug(message) log_do_nothing();
     #define log_info(message) log_do_nothing();
     #define log_warn(message) log_do_nothing();
@@ -50,8 +113,23 @@ extern "C" {
     #define log_error(message) log_do_nothing();
     #define log_fatal(message) log_do_nothing();
 
+    #define log_logf(level, ...) do { } while (0)
+    #define log_debugf(...) do { } while (0)
+    #define log_infof(...) do { } while (0)
+    #define log_warnf(...) do { } while (0)
+    #define log_errorf(...) do { } while (0)
+    #define log_fatalf(...) do { } while (0)
+    #define log_logf_limited(level, ...) do { } while (0)
+    #define log_warnf_limited(...) do { } while (0)
+    #define log_errorf_limited(...) do { } while (0)
+
     int log_do_nothing();
-#endif    
+#endif
+
+    /**
+     * Current log level, do not modify it directly, use log_set_level().
+     */
+    extern int log_level;    
     /**
      * Sets the log level. Available levels are LOG_DEBUG, LOG_INFO, LOG_WARNING,
      * LOG_ERROR, and LOG_FATAL. To disable logging at all set the level to 
@@ -66,6 +144,35 @@ extern "C" {
      */
     int log_get_level();
 
+    /**
+     * Switches the logging system to asynchronous mode. From then on, log 
+     * lines are copied into a lock-free ring and written by a background
+     * thread, so logging never blocks the caller on output. If the ring is
+     * full, lines are dropped and counted, and the writer reports how many
+     * were lost. LOG_FATAL lines are still written synchronously. The writer
+     * sleeps on a wake up descriptor while there is nothing to write, and the
+     * first line queued wakes it up.
+     * @return 1 if the writer thread is running, 0 if it could not be started,
+     * in which case logging stays synchronous.
+     */
+    int log_start_async();
+
+    /**
+     * Waits until the writer thread has written all the queued log lines.
+     * Has no effect in synchronous mode.
+     */
+    void log_flush();
+
+    /**
+     * Returns the number of log lines dropped because the ring was full.
+     */
+    uint64_t log_get_dropped();
+
+    /**
+     * Returns the number of log lines waiting for the writer thread.
+     */
+    uint32_t log_get_queue_depth();
+
 #ifdef LOGGING_ON
     /**
      * Writes a line to the log. This function is not meant to be used directly,
@@ -74,16 +181,62 @@ extern "C" {
      * @param message
      * @param filename
      * @param line
-     * @return If nothing was logged it returns 0, otherwise it
-     * returns the log level with which the message was logged.
+     * @return If nothing was logged (or the line was dropped in asynchronous
+     * mode) it returns 0, otherwise it returns the log level with which the
+     * message was logged.
      */
     int log_write_log(int level, const char *message, const char *filename, int line);
+
+    /**
+     * Formats a line into a stack buffer of LOG_LINE_MAX_LEN bytes and writes
+     * it to the log. This function is not meant to be used directly, use the
+     * log_*f(format, ...) macros instead, which check the level before 
+     * evaluating their arguments.
+     * @param level
+     * @param filename
+     * @param line
+     * @param format A printf format.
+     * @return The same as log_write_log().
+     */
+    int log_write_logf(int level, const char *filename, int line, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 4, 5)))
+#endif
+    ;
 #endif
     
 
+    /**
+     * Decides whether a rate limited call site may log a line. Each call site
+     * can log LOG_RATE_LIMIT_BURST lines at once, and LOG_RATE_LIMIT_PER_SEC
+     * lines per second afterwards. Lines over the limit are counted, and a
+     * summary with the number of suppressed lines is written before the next
+     * line allowed, or by log_report_suppressed once the bucket refills if the
+     * call site goes quiet, so a flood of identical lines produces at most two
+     * lines per second. Safe to call from several threads. Not meant to be
+     * used directly, use the log_*_limited macros instead.
+     * @param limit The bucket of the call site.
+     * @param level
+     * @param filename
+     * @param line
+     * @return 1 if the line may be logged, 0 if it must be suppressed.
+     */
+    int log_rate_limit_allow(LogRateLimit *limit, int level, const char *filename, int line);
+
+    /**
+     * Writes the summary of the lines suppressed by the rate limited call 
+     * sites whose bucket has refilled since they dropped them. Does nothing if
+     * it has already run in the last LOG_RATE_LIMIT_REPORT_MILLIS, so it can be
+     * called from every iteration of a loop. The writer thread calls it, and
+     * so do the main loop of the device and the gateway workers, so the 
+     * summaries are written in synchronous mode too.
+     */
+    void log_report_suppressed();
+
     /**
      * Function that generates a string containing a message, given a template
-     * for printf and a string argument. Used to ease generation of log messages.
+     * for printf and a string argument. Kept for compatibility, the log_*f 
+     * macros format log messages without allocating memory.
      * @param template
      * @param str
      * @return 
@@ -92,7 +245,8 @@ extern "C" {
 
     /**
      * Function that generates a string containing a message, given a template
-     * for printf and a integer argument. Used to ease generation of log messages.
+     * for printf and a integer argument. Kept for compatibility, the log_*f 
+     * macros format log messages without allocating memory.
      * @param template
      * @param str
      * @return 
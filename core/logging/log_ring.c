@@ -0,0 +1,83 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <string.h>
+#include "log_ring.h"
+#include "../../abstraction/threading/lhings_thread.h"
+
+void log_ring_init(LogRing *ring) {
+    uint64_t j;
+    for (j = 0; j < LOG_RING_CAPACITY; j++)
+        ring->cells[j].sequence = j;
+    ring->enqueue_position = 0;
+    ring->dequeue_position = 0;
+    ring->dropped = 0;
+}
+
+int log_ring_push(LogRing *ring, int level, const char *filename, int line, const char *message) {
+    LogRingCell *cell;
+    uint64_t position = LH_ATOMIC_LOAD_RELAXED(&ring->enqueue_position);
+    while (1) {
+        cell = ring->cells + (position & (LOG_RING_CAPACITY - 1));
+        uint64_t sequence = LH_ATOMIC_LOAD(&cell->sequence);
+        int64_t difference = (int64_t) (sequence - position);
+        if (difference == 0) {
+            // the cell is free, try to claim it
+            if (LH_ATOMIC_CAS(&ring->enqueue_position, &position, position + 1))
+                break;
+        } else if (difference < 0) {
+            // the consumer has not freed the cell yet, the ring is full
+            LH_ATOMIC_FETCH_ADD(&ring->dropped, 1);
+            return 0;
+        } else {
+            // another producer claimed the cell
+            position = LH_ATOMIC_LOAD_RELAXED(&ring->enqueue_position);
+        }
+    }
+    cell->record.level = level;
+    cell->record.line = line;
+    cell->record.filename = filename;
+    strncpy(cell->record.message, message, LOG_RECORD_MESSAGE_LEN - 1);
+    cell->record.message[LOG_RECORD_MESSAGE_LEN - 1] = 0;
+    LH_ATOMIC_STORE(&cell->sequence, position + 1);
+    return 1;
+}
+
+int log_ring_pop(LogRing *ring, LogRecord *record) {
+    uint64_t position = ring->dequeue_position;
+    LogRingCell *cell = ring->cells + (position & (LOG_RING_CAPACITY - 1));
+    if (LH_ATOMIC_LOAD(&cell->sequence) != position + 1)
+        return 0;
+    *record = cell->record;
+    // free the cell for the producer that will use it in the next lap
+    LH_ATOMIC_STORE(&cell->sequence, position + LOG_RING_CAPACITY);
+    LH_ATOMIC_STORE(&ring->dequeue_position, position + 1);
+    return 1;
+}
+
+int log_ring_is_empty(LogRing *ring) {
+    return LH_ATOMIC_LOAD(&ring->dequeue_position) == LH_ATOMIC_LOAD(&ring->enqueue_position);
+}
+
+uint32_t log_ring_depth(LogRing *ring) {
+    uint64_t dequeued = LH_ATOMIC_LOAD(&ring->dequeue_position);
+    uint64_t enqueued = LH_ATOMIC_LOAD(&ring->enqueue_position);
+    // cells claimed but not yet written are counted too
+    return enqueued > dequeued ? (uint32_t) (enqueued - dequeued) : 0;
+}
+
+uint64_t log_ring_dropped(LogRing *ring) {
+    return LH_ATOMIC_LOAD_RELAXED(&ring->dropped);
+}
@@ -0,0 +1,117 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file log_ring.h
+ * @brief Bounded lock-free queue of log records.
+ * 
+ * The ring accepts records from any number of threads and is drained by a
+ * single consumer (the log writer thread). Each cell has a sequence number
+ * that tells producers and the consumer whether it is free or holds a 
+ * record, so neither side ever takes a lock. When the ring is full, records
+ * are dropped and counted instead of blocking the producer.
+ */
+
+#ifndef LOG_RING_H
+#define	LOG_RING_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+    // must be a power of two
+#define LOG_RING_CAPACITY 256
+    // longer messages are truncated
+#define LOG_RECORD_MESSAGE_LEN 192
+
+    typedef struct log_record {
+        int level;
+        int line;
+        // __FILE__ of the call site, which has static storage
+        const char *filename;
+        char message[LOG_RECORD_MESSAGE_LEN];
+    } LogRecord;
+
+    typedef struct log_ring_cell {
+        // equals the position of the cell when free, position + 1 when it holds a record
+        uint64_t sequence;
+        LogRecord record;
+    } LogRingCell;
+
+    typedef struct log_ring {
+        LogRingCell cells[LOG_RING_CAPACITY];
+        // producers and consumer positions are kept in separate cache lines
+        uint64_t enqueue_position __attribute__((aligned(64)));
+        uint64_t dequeue_position __attribute__((aligned(64)));
+        uint64_t dropped __attribute__((aligned(64)));
+    } LogRing;
+
+    /**
+     * Initializes an empty ring. Must be called before any other thread uses it.
+     * @param ring
+     */
+    void log_ring_init(LogRing *ring);
+
+    /**
+     * Copies a record into the ring. Safe to call from any thread.
+     * @param ring
+     * @param level
+     * @param filename
+     * @param line
+     * @param message The message, truncated to LOG_RECORD_MESSAGE_LEN - 1 characters.
+     * @return 1 if the record was queued, 0 if the ring was full and the
+     * record was dropped.
+     */
+    int log_ring_push(LogRing *ring, int level, const char *filename, int line, const char *message);
+
+    /**
+     * Takes the oldest record from the ring. Only one thread may call this function.
+     * @param ring
+     * @param record Where the record is copied.
+     * @return 1 if a record was taken, 0 if the ring was empty.
+     */
+    int log_ring_pop(LogRing *ring, LogRecord *record);
+
+    /**
+     * Returns 1 if the consumer has taken every record pushed so far.
+     * @param ring
+     * @return 
+     */
+    int log_ring_is_empty(LogRing *ring);
+
+    /**
+     * Returns the number of records waiting for the consumer. The value is
+     * approximate while producers are pushing records.
+     * @param ring
+     * @return 
+     */
+    uint32_t log_ring_depth(LogRing *ring);
+
+    /**
+     * Returns the number of records dropped because the ring was full.
+     * @param ring
+     * @return 
+     */
+    uint64_t log_ring_dropped(LogRing *ring);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LOG_RING_H */
+
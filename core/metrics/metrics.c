@@ -0,0 +1,214 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "metrics.h"
+#include "../logging/log.h"
+#include "../../abstraction/threading/lhings_thread.h"
+
+typedef struct metrics_shard {
+    uint64_t counters[LH_COUNTER_COUNT];
+    uint64_t histogram_sums[LH_HISTOGRAM_COUNT];
+    uint64_t histogram_buckets[LH_HISTOGRAM_COUNT][LH_HISTOGRAM_BUCKETS];
+} MetricsShard;
+
+static MetricsShard shards[LH_METRICS_MAX_THREADS];
+static uint32_t shards_used = 0;
+static LH_THREAD_LOCAL MetricsShard *local_shard = NULL;
+static int64_t gauges[LH_GAUGE_COUNT];
+// devices registered, pushed with a compare and swap and never removed
+static LH_DeviceMetrics *devices = NULL;
+
+static const char *counter_names[LH_COUNTER_COUNT] = {
+    "datagrams_sent",
+    "datagrams_received",
+    "bytes_sent",
+    "bytes_received",
+    "send_errors",
+    "integrity_failures",
+    "actions_performed",
+    "action_errors",
+    "http_requests",
+    "http_errors",
+    "retries",
+    "events_sent",
+    "messages_dropped",
+    "log_lines_dropped",
+    "server_failovers",
+    "gateway_handoffs",
+    "submissions_dropped"
+};
+
+static const char *histogram_names[LH_HISTOGRAM_COUNT] = {
+    "action_micros",
+    "http_micros",
+    "keepalive_rtt_micros"
+};
+
+static const char *gauge_names[LH_GAUGE_COUNT] = {
+    "clock_offset_seconds",
+    "log_queue_depth"
+};
+
+static const char *device_counter_names[LH_DEVICE_COUNTER_COUNT] = {
+    "actions_performed",
+    "action_errors",
+    "action_micros",
+    "events_sent",
+    "messages_dropped",
+    "keepalives_sent",
+    "keepalives_answered"
+};
+
+MetricsShard* metrics_get_shard() {
+    if (local_shard == NULL) {
+        uint32_t index = LH_ATOMIC_FETCH_ADD(&shards_used, 1);
+        if (index >= LH_METRICS_MAX_THREADS)
+            index = LH_METRICS_MAX_THREADS - 1;
+        local_shard = &shards[index];
+    }
+    return local_shard;
+}
+
+void lh_metrics_add(LH_Counter counter, uint64_t amount) {
+    // the shard is only shared when there are more threads than shards, but
+    // the addition is atomic anyway so that a snapshot never reads a torn value
+    LH_ATOMIC_FETCH_ADD(&metrics_get_shard()->counters[counter], amount);
+}
+
+void lh_metrics_inc(LH_Counter counter) {
+    lh_metrics_add(counter, 1);
+}
+
+void lh_metrics_record(LH_Histogram histogram, uint32_t value) {
+    MetricsShard *shard = metrics_get_shard();
+    LH_ATOMIC_FETCH_ADD(&shard->histogram_buckets[histogram][lh_histogram_bucket_index(value)], 1);
+    LH_ATOMIC_FETCH_ADD(&shard->histogram_sums[histogram], value);
+}
+
+void lh_metrics_set_gauge(LH_Gauge gauge, int64_t value) {
+    LH_ATOMIC_STORE(&gauges[gauge], value);
+}
+
+void lh_metrics_snapshot(LH_MetricsSnapshot *snapshot) {
+    uint32_t used = LH_ATOMIC_LOAD(&shards_used);
+    uint32_t j, k, b;
+    if (used > LH_METRICS_MAX_THREADS)
+        used = LH_METRICS_MAX_THREADS;
+    memset(snapshot, 0, sizeof *snapshot);
+    for (j = 0; j < LH_GAUGE_COUNT; j++)
+        snapshot->gauges[j] = LH_ATOMIC_LOAD(&gauges[j]);
+    for (j = 0; j < used; j++) {
+        MetricsShard *shard = &shards[j];
+        for (k = 0; k < LH_COUNTER_COUNT; k++)
+            snapshot->counters[k] += LH_ATOMIC_LOAD_RELAXED(&shard->counters[k]);
+        for (k = 0; k < LH_HISTOGRAM_COUNT; k++) {
+            LH_HistogramSnapshot *histogram = &snapshot->histograms[k];
+            histogram->sum += LH_ATOMIC_LOAD_RELAXED(&shard->histogram_sums[k]);
+            for (b = 0; b < LH_HISTOGRAM_BUCKETS; b++) {
+                uint64_t count = LH_ATOMIC_LOAD_RELAXED(&shard->histogram_buckets[k][b]);
+                histogram->buckets[b] += count;
+                histogram->count += count;
+            }
+        }
+    }
+    // counted by the log ring, logging does not depend on the metrics
+    snapshot->counters[LH_COUNTER_LOG_LINES_DROPPED] = log_get_dropped();
+}
+
+void lh_device_metrics_register(LH_DeviceMetrics *metrics, const char *uuid) {
+    const char *registered = NULL;
+    // the first caller that sets the uuid pushes the device
+    while (!LH_ATOMIC_CAS(&metrics->uuid, &registered, uuid)) {
+        if (registered != NULL)
+            return;
+    }
+    LH_DeviceMetrics *head = LH_ATOMIC_LOAD(&devices);
+    do {
+        metrics->next = head;
+    } while (!LH_ATOMIC_CAS(&devices, &head, metrics));
+}
+
+void lh_device_metrics_add(LH_DeviceMetrics *metrics, LH_DeviceCounter counter, uint64_t amount) {
+    LH_ATOMIC_FETCH_ADD(&metrics->counters[counter], amount);
+}
+
+void lh_device_metrics_keepalive_answered(LH_DeviceMetrics *metrics, uint32_t rtt_micros) {
+    LH_ATOMIC_STORE(&metrics->keepalive_rtt_micros, rtt_micros);
+    LH_ATOMIC_FETCH_ADD(&metrics->counters[LH_DEVICE_COUNTER_KEEPALIVES_ANSWERED], 1);
+}
+
+const LH_DeviceMetrics* lh_device_metrics_first() {
+    return LH_ATOMIC_LOAD(&devices);
+}
+
+uint64_t lh_device_metrics_get(const LH_DeviceMetrics *metrics, LH_DeviceCounter counter) {
+    return LH_ATOMIC_LOAD_RELAXED(&metrics->counters[counter]);
+}
+
+uint32_t lh_device_metrics_keepalive_rtt(const LH_DeviceMetrics *metrics) {
+    return LH_ATOMIC_LOAD_RELAXED(&metrics->keepalive_rtt_micros);
+}
+
+const char* lh_metrics_counter_name(LH_Counter counter) {
+    return counter_names[counter];
+}
+
+const char* lh_metrics_histogram_name(LH_Histogram histogram) {
+    return histogram_names[histogram];
+}
+
+const char* lh_metrics_gauge_name(LH_Gauge gauge) {
+    return gauge_names[gauge];
+}
+
+const char* lh_metrics_device_counter_name(LH_DeviceCounter counter) {
+    return device_counter_names[counter];
+}
+
+int lh_histogram_bucket_index(uint32_t value) {
+    if (value < 2 * LH_HISTOGRAM_SUB_BUCKETS)
+        return value;
+    // position of the highest bit, at least 4, and the next 3 bits select the sub bucket
+    int exponent = 31 - __builtin_clz(value);
+    return (exponent - 2) * LH_HISTOGRAM_SUB_BUCKETS + ((value >> (exponent - 3)) & (LH_HISTOGRAM_SUB_BUCKETS - 1));
+}
+
+uint32_t lh_histogram_bucket_limit(int index) {
+    if (index < 2 * LH_HISTOGRAM_SUB_BUCKETS)
+        return index;
+    int exponent = index / LH_HISTOGRAM_SUB_BUCKETS + 2;
+    uint64_t sub_bucket = LH_HISTOGRAM_SUB_BUCKETS + index % LH_HISTOGRAM_SUB_BUCKETS;
+    return (uint32_t) (((sub_bucket + 1) << (exponent - 3)) - 1);
+}
+
+uint32_t lh_histogram_percentile(const LH_HistogramSnapshot *histogram, double percentile) {
+    if (histogram->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t) (percentile / 100 * histogram->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+    if (rank > histogram->count)
+        rank = histogram->count;
+    uint64_t seen = 0;
+    int j;
+    for (j = 0; j < LH_HISTOGRAM_BUCKETS; j++) {
+        seen += histogram->buckets[j];
+        if (seen >= rank)
+            return lh_histogram_bucket_limit(j);
+    }
+    return lh_histogram_bucket_limit(LH_HISTOGRAM_BUCKETS - 1);
+}
@@ -0,0 +1,275 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file metrics.h
+ * @brief Counters and latency histograms of the library.
+ * 
+ * The set of metrics is fixed: every counter and histogram has an entry in
+ * LH_Counter or LH_Histogram. Each thread updates its own shard of the
+ * registry, so recording a value is a couple of uncontended atomic additions
+ * and never allocates memory. lh_metrics_snapshot() adds up the shards.
+ * 
+ * Histograms are log-linear, like HdrHistogram: every power of two is split
+ * in LH_HISTOGRAM_SUB_BUCKETS buckets of the same width, so any 32 bit value
+ * is recorded with a relative error below 12.5%. Latencies are recorded in
+ * microseconds.
+ * 
+ * A process runs a single device, so the metrics of the process are the
+ * metrics of the device, or a gateway, and then they add up the devices it
+ * hosts. So that a gateway can tell which of its devices is failing or slow,
+ * every device also keeps a few counters of its own in LH_DeviceMetrics,
+ * which are exported with the uuid of the device as a label.
+ */
+
+#ifndef METRICS_H
+#define	METRICS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+    // number of threads with their own shard, later threads share the last one
+#define LH_METRICS_MAX_THREADS 16
+#define LH_HISTOGRAM_SUB_BUCKETS 8
+    // 16 exact buckets for values below 16, then 8 buckets per power of two up to 2^32
+#define LH_HISTOGRAM_BUCKETS 240
+
+    typedef enum {
+        LH_COUNTER_DATAGRAMS_SENT,
+        LH_COUNTER_DATAGRAMS_RECEIVED,
+        LH_COUNTER_BYTES_SENT,
+        LH_COUNTER_BYTES_RECEIVED,
+        LH_COUNTER_SEND_ERRORS,
+        LH_COUNTER_INTEGRITY_FAILURES,
+        LH_COUNTER_ACTIONS_PERFORMED,
+        LH_COUNTER_ACTION_ERRORS,
+        LH_COUNTER_HTTP_REQUESTS,
+        LH_COUNTER_HTTP_ERRORS,
+        LH_COUNTER_RETRIES,
+        LH_COUNTER_EVENTS_SENT,
+        // messages received that were malformed or failed the integrity check
+        LH_COUNTER_MESSAGES_DROPPED,
+        // lines the log ring had no room for, read with log_get_dropped() by lh_metrics_snapshot
+        LH_COUNTER_LOG_LINES_DROPPED,
+        // times the device moved to another address of the server
+        LH_COUNTER_SERVER_FAILOVERS,
+        // datagrams a gateway worker received for a device of another worker
+        LH_COUNTER_GATEWAY_HANDOFFS,
+        // events and status stores dropped because too many were waiting to be sent
+        LH_COUNTER_SUBMISSIONS_DROPPED,
+        LH_COUNTER_COUNT
+    } LH_Counter;
+
+    typedef enum {
+        LH_HISTOGRAM_ACTION_MICROS,
+        LH_HISTOGRAM_HTTP_MICROS,
+        LH_HISTOGRAM_KEEPALIVE_RTT_MICROS,
+        LH_HISTOGRAM_COUNT
+    } LH_Histogram;
+
+    typedef enum {
+        // local clock minus server clock, as set by lh_update_time_offset
+        LH_GAUGE_CLOCK_OFFSET_SECONDS,
+        LH_GAUGE_LOG_QUEUE_DEPTH,
+        LH_GAUGE_COUNT
+    } LH_Gauge;
+
+    typedef struct {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t buckets[LH_HISTOGRAM_BUCKETS];
+    } LH_HistogramSnapshot;
+
+    typedef struct {
+        uint64_t counters[LH_COUNTER_COUNT];
+        int64_t gauges[LH_GAUGE_COUNT];
+        LH_HistogramSnapshot histograms[LH_HISTOGRAM_COUNT];
+    } LH_MetricsSnapshot;
+
+    typedef enum {
+        LH_DEVICE_COUNTER_ACTIONS_PERFORMED,
+        LH_DEVICE_COUNTER_ACTION_ERRORS,
+        // time spent in the actions of the device, for their mean latency
+        LH_DEVICE_COUNTER_ACTION_MICROS,
+        LH_DEVICE_COUNTER_EVENTS_SENT,
+        // messages for the device that failed the integrity check
+        LH_DEVICE_COUNTER_MESSAGES_DROPPED,
+        LH_DEVICE_COUNTER_KEEPALIVES_SENT,
+        LH_DEVICE_COUNTER_KEEPALIVES_ANSWERED,
+        LH_DEVICE_COUNTER_COUNT
+    } LH_DeviceCounter;
+
+    /**
+     * Metrics of a single device. They are updated by the thread that owns
+     * the device and read by any thread, so every field is accessed
+     * atomically.
+     */
+    typedef struct lh_device_metrics {
+        uint64_t counters[LH_DEVICE_COUNTER_COUNT];
+        // round trip time of the last keepalive answered
+        uint32_t keepalive_rtt_micros;
+        // uuid of the device, null until it is registered
+        const char *uuid;
+        struct lh_device_metrics *next;
+    } LH_DeviceMetrics;
+
+    /**
+     * Adds the given amount to a counter.
+     * @param counter
+     * @param amount
+     */
+    void lh_metrics_add(LH_Counter counter, uint64_t amount);
+
+    /**
+     * Adds one to a counter.
+     * @param counter
+     */
+    void lh_metrics_inc(LH_Counter counter);
+
+    /**
+     * Records a value in a histogram.
+     * @param histogram
+     * @param value For latency histograms, the latency in microseconds.
+     */
+    void lh_metrics_record(LH_Histogram histogram, uint32_t value);
+
+    /**
+     * Sets the value of a gauge. Gauges are not sharded, the last value set
+     * by any thread is kept.
+     * @param gauge
+     * @param value
+     */
+    void lh_metrics_set_gauge(LH_Gauge gauge, int64_t value);
+
+    /**
+     * Copies the current value of every metric into the given snapshot. Each
+     * value is read atomically, but values updated while the snapshot is taken
+     * may or may not be included, so two counters of the snapshot are not
+     * guaranteed to be consistent with each other.
+     * @param snapshot
+     */
+    void lh_metrics_snapshot(LH_MetricsSnapshot *snapshot);
+
+    /**
+     * Adds the metrics of a device to the ones exported. Devices are
+     * registered when they are announced to Lhings and stay registered for
+     * the rest of the process, so they must not be freed. Registering a
+     * device twice has no effect. Safe to call from any thread.
+     * @param metrics
+     * @param uuid
+     */
+    void lh_device_metrics_register(LH_DeviceMetrics *metrics, const char *uuid);
+
+    /**
+     * Adds the given amount to a counter of a device.
+     * @param metrics
+     * @param counter
+     * @param amount
+     */
+    void lh_device_metrics_add(LH_DeviceMetrics *metrics, LH_DeviceCounter counter, uint64_t amount);
+
+    /**
+     * Records the round trip time of a keepalive of a device that has been
+     * answered, and counts the answer.
+     * @param metrics
+     * @param rtt_micros
+     */
+    void lh_device_metrics_keepalive_answered(LH_DeviceMetrics *metrics, uint32_t rtt_micros);
+
+    /**
+     * Returns the first device registered, whose next field leads to the
+     * rest. The list only grows, so it can be walked while devices are added.
+     * @return The metrics of the device, or null if none is registered.
+     */
+    const LH_DeviceMetrics* lh_device_metrics_first();
+
+    /**
+     * Returns the current value of a counter of a device.
+     * @param metrics
+     * @param counter
+     * @return
+     */
+    uint64_t lh_device_metrics_get(const LH_DeviceMetrics *metrics, LH_DeviceCounter counter);
+
+    /**
+     * Returns the round trip time of the last keepalive of a device answered.
+     * @param metrics
+     * @return The time in microseconds, or 0 if none has been answered.
+     */
+    uint32_t lh_device_metrics_keepalive_rtt(const LH_DeviceMetrics *metrics);
+
+    /**
+     * Returns the name of a counter, in snake case, e.g. "datagrams_sent".
+     * @param counter
+     * @return
+     */
+    const char* lh_metrics_counter_name(LH_Counter counter);
+
+    /**
+     * Returns the name of a histogram, in snake case, e.g. "action_micros".
+     * @param histogram
+     * @return
+     */
+    const char* lh_metrics_histogram_name(LH_Histogram histogram);
+
+    /**
+     * Returns the name of a gauge, in snake case, e.g. "clock_offset_seconds".
+     * @param gauge
+     * @return
+     */
+    const char* lh_metrics_gauge_name(LH_Gauge gauge);
+
+    /**
+     * Returns the name of a counter of a device, in snake case, e.g.
+     * "actions_performed".
+     * @param counter
+     * @return
+     */
+    const char* lh_metrics_device_counter_name(LH_DeviceCounter counter);
+
+    /**
+     * Returns the index of the bucket where a value is recorded.
+     * @param value
+     * @return
+     */
+    int lh_histogram_bucket_index(uint32_t value);
+
+    /**
+     * Returns the largest value recorded in a bucket.
+     * @param index
+     * @return
+     */
+    uint32_t lh_histogram_bucket_limit(int index);
+
+    /**
+     * Returns an estimation of the given percentile of a histogram, e.g. 99
+     * for the p99. The result is the largest value of the bucket where the
+     * percentile falls, so it is never below the real percentile.
+     * @param histogram
+     * @param percentile A number between 0 and 100.
+     * @return The percentile, or 0 if the histogram is empty.
+     */
+    uint32_t lh_histogram_percentile(const LH_HistogramSnapshot *histogram, double percentile);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* METRICS_H */
+
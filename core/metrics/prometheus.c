@@ -0,0 +1,184 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "prometheus.h"
+
+#define SECTION_COUNTERS 0
+#define SECTION_GAUGES 1
+#define SECTION_HISTOGRAMS 2
+#define SECTION_DEVICE_COUNTERS 3
+#define SECTION_DEVICE_GAUGES 4
+#define SECTION_END 5
+
+// histograms are exported with the buckets ending at 2^4 - 1, 2^5 - 1, ... 2^32 - 1
+#define FIRST_EXPORTED_EXPONENT 4
+#define LAST_EXPORTED_EXPONENT 32
+#define STEP_INF_BUCKET (LAST_EXPORTED_EXPONENT - FIRST_EXPORTED_EXPONENT + 2)
+#define STEP_SUM (STEP_INF_BUCKET + 1)
+#define STEP_COUNT (STEP_INF_BUCKET + 2)
+
+void lh_prometheus_start(LH_PrometheusRenderer *renderer) {
+    lh_metrics_snapshot(&renderer->snapshot);
+    renderer->section = SECTION_COUNTERS;
+    renderer->index = 0;
+    renderer->step = 0;
+    renderer->line_length = 0;
+    renderer->device = NULL;
+}
+
+uint64_t cumulative_bucket_count(const LH_HistogramSnapshot *histogram, int exponent) {
+    // last internal bucket below 2^exponent
+    int last = (exponent - 2) * LH_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t count = 0;
+    int j;
+    for (j = 0; j <= last; j++)
+        count += histogram->buckets[j];
+    return count;
+}
+
+/**
+ * Generates the next line in renderer->line and moves to the following one.
+ * Returns 0 when there are no more lines.
+ */
+int prometheus_next_line(LH_PrometheusRenderer *renderer) {
+    char *line = renderer->line;
+    size_t size = sizeof renderer->line;
+    int length = 0;
+    while (length == 0) {
+        const char *name;
+        switch (renderer->section) {
+            case SECTION_COUNTERS:
+                if (renderer->index == LH_COUNTER_COUNT) {
+                    renderer->section = SECTION_GAUGES;
+                    renderer->index = 0;
+                    continue;
+                }
+                name = lh_metrics_counter_name(renderer->index);
+                if (renderer->step == 0) {
+                    length = snprintf(line, size, "# TYPE lhings_%s_total counter\n", name);
+                    renderer->step = 1;
+                } else {
+                    length = snprintf(line, size, "lhings_%s_total %llu\n", name,
+                            (unsigned long long) renderer->snapshot.counters[renderer->index]);
+                    renderer->step = 0;
+                    renderer->index++;
+                }
+                break;
+            case SECTION_GAUGES:
+                if (renderer->index == LH_GAUGE_COUNT) {
+                    renderer->section = SECTION_HISTOGRAMS;
+                    renderer->index = 0;
+                    continue;
+                }
+                name = lh_metrics_gauge_name(renderer->index);
+                if (renderer->step == 0) {
+                    length = snprintf(line, size, "# TYPE lhings_%s gauge\n", name);
+                    renderer->step = 1;
+                } else {
+                    length = snprintf(line, size, "lhings_%s %lld\n", name,
+                            (long long) renderer->snapshot.gauges[renderer->index]);
+                    renderer->step = 0;
+                    renderer->index++;
+                }
+                break;
+            case SECTION_HISTOGRAMS:
+            {
+                if (renderer->index == LH_HISTOGRAM_COUNT) {
+                    renderer->section = SECTION_DEVICE_COUNTERS;
+                    renderer->index = 0;
+                    continue;
+                }
+                const LH_HistogramSnapshot *histogram = &renderer->snapshot.histograms[renderer->index];
+                name = lh_metrics_histogram_name(renderer->index);
+                int step = renderer->step++;
+                if (step == 0)
+                    length = snprintf(line, size, "# TYPE lhings_%s histogram\n", name);
+                else if (step < STEP_INF_BUCKET) {
+                    int exponent = FIRST_EXPORTED_EXPONENT + step - 1;
+                    length = snprintf(line, size, "lhings_%s_bucket{le=\"%llu\"} %llu\n", name,
+                            (1ULL << exponent) - 1, (unsigned long long) cumulative_bucket_count(histogram, exponent));
+                } else if (step == STEP_INF_BUCKET)
+                    length = snprintf(line, size, "lhings_%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long) histogram->count);
+                else if (step == STEP_SUM)
+                    length = snprintf(line, size, "lhings_%s_sum %llu\n", name, (unsigned long long) histogram->sum);
+                else {
+                    length = snprintf(line, size, "lhings_%s_count %llu\n", name, (unsigned long long) histogram->count);
+                    renderer->step = 0;
+                    renderer->index++;
+                }
+                break;
+            }
+            case SECTION_DEVICE_COUNTERS:
+                if (renderer->index == LH_DEVICE_COUNTER_COUNT || lh_device_metrics_first() == NULL) {
+                    renderer->section = SECTION_DEVICE_GAUGES;
+                    renderer->index = 0;
+                    continue;
+                }
+                name = lh_metrics_device_counter_name(renderer->index);
+                if (renderer->step == 0) {
+                    length = snprintf(line, size, "# TYPE lhings_device_%s_total counter\n", name);
+                    renderer->step = 1;
+                    renderer->device = lh_device_metrics_first();
+                } else if (renderer->device == NULL) {
+                    renderer->step = 0;
+                    renderer->index++;
+                } else {
+                    length = snprintf(line, size, "lhings_device_%s_total{device=\"%.40s\"} %llu\n", name, renderer->device->uuid,
+                            (unsigned long long) lh_device_metrics_get(renderer->device, renderer->index));
+                    renderer->device = renderer->device->next;
+                }
+                break;
+            case SECTION_DEVICE_GAUGES:
+                // the only gauge of the devices is the round trip time of their last keepalive
+                if (renderer->index == 1 || lh_device_metrics_first() == NULL) {
+                    renderer->section = SECTION_END;
+                    continue;
+                }
+                if (renderer->step == 0) {
+                    length = snprintf(line, size, "# TYPE lhings_device_keepalive_rtt_micros gauge\n");
+                    renderer->step = 1;
+                    renderer->device = lh_device_metrics_first();
+                } else if (renderer->device == NULL) {
+                    renderer->step = 0;
+                    renderer->index++;
+                } else {
+                    length = snprintf(line, size, "lhings_device_keepalive_rtt_micros{device=\"%.40s\"} %u\n", renderer->device->uuid,
+                            (unsigned) lh_device_metrics_keepalive_rtt(renderer->device));
+                    renderer->device = renderer->device->next;
+                }
+                break;
+            default:
+                return 0;
+        }
+    }
+    renderer->line_length = length;
+    return 1;
+}
+
+size_t lh_prometheus_render(LH_PrometheusRenderer *renderer, char *buffer, size_t size) {
+    size_t written = 0;
+    while (1) {
+        if (renderer->line_length == 0 && !prometheus_next_line(renderer))
+            break;
+        if (renderer->line_length > size - written)
+            break;
+        memcpy(buffer + written, renderer->line, renderer->line_length);
+        written += renderer->line_length;
+        renderer->line_length = 0;
+    }
+    return written;
+}
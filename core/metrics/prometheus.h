@@ -0,0 +1,81 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file prometheus.h
+ * @brief Rendering of the metrics in the Prometheus text exposition format.
+ * 
+ * The renderer works on a snapshot taken when the rendering starts, and
+ * writes the text in chunks of any size the caller can send at once, so a
+ * scrape can be served a bit at a time from the device loop. It does not 
+ * allocate memory.
+ * 
+ * Every metric name has the prefix "lhings_", and counters the suffix 
+ * "_total". Histograms are exported with a bucket per power of two. The
+ * metrics of each device follow, named "lhings_device_..." and labelled with
+ * the uuid of the device. They are not part of the snapshot: each line reads
+ * the current value, so the rendering does not depend on the number of
+ * devices.
+ */
+
+#ifndef PROMETHEUS_H
+#define	PROMETHEUS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include "metrics.h"
+
+    // longest line written by the renderer, including the line feed
+#define LH_PROMETHEUS_LINE_LEN 128
+
+    typedef struct {
+        LH_MetricsSnapshot snapshot;
+        // position of the next line: section, metric in the section, line of the metric
+        int section;
+        int index;
+        int step;
+        // next device of the current device metric
+        const LH_DeviceMetrics *device;
+        // line generated but not yet copied to the caller
+        char line[LH_PROMETHEUS_LINE_LEN];
+        int line_length;
+    } LH_PrometheusRenderer;
+
+    /**
+     * Takes a snapshot of the metrics and starts rendering it from the beginning.
+     * @param renderer
+     */
+    void lh_prometheus_start(LH_PrometheusRenderer *renderer);
+
+    /**
+     * Writes the next lines of the rendering in the given buffer. Only whole
+     * lines are written, so the buffer should be at least LH_PROMETHEUS_LINE_LEN
+     * bytes long. The text is not null terminated.
+     * @param renderer
+     * @param buffer
+     * @param size Size of the buffer.
+     * @return The number of bytes written, 0 when the rendering is complete.
+     */
+    size_t lh_prometheus_render(LH_PrometheusRenderer *renderer, char *buffer, size_t size);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* PROMETHEUS_H */
@@ -0,0 +1,218 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stun_arguments.h"
+#include "../utils/utils.h"
+#include "../utils/wire.h"
+#include "../utils/string_pool.h"
+#include "../logging/log.h"
+
+int stun_args_reader_init(StunArgumentsReader *reader, const uint8_t *bytes, uint16_t length) {
+    if (length < 1) {
+        log_warn("Arguments attribute: empty attribute.");
+        return 0;
+    }
+    WireReader header;
+    wire_reader_init(&header, bytes, length);
+    reader->bytes = bytes;
+    reader->length = length;
+    reader->index = 0;
+    uint8_t marker = wire_read_u8(&header);
+    if (marker == STUN_ARGS_EXTENDED_MARKER) {
+        reader->extended = 1;
+        reader->count = wire_read_be16(&header);
+        if (header.failed) {
+            log_warn("Arguments attribute: truncated extended header.");
+            return 0;
+        }
+        reader->lengths_offset = header.position;
+        wire_read_bytes(&header, 2 * (uint32_t) reader->count);
+        reader->mask_offset = header.position;
+        wire_read_bytes(&header, (reader->count + 7) / 8);
+    } else {
+        if (marker > STUN_ARGS_LEGACY_MAX_ARGS) {
+            log_warn("Arguments attribute: more than 8 arguments in legacy encoding.");
+            return 0;
+        }
+        reader->extended = 0;
+        reader->count = marker;
+        reader->lengths_offset = header.position;
+        wire_read_bytes(&header, reader->count);
+        reader->mask_offset = header.position;
+        wire_read_bytes(&header, 1);
+    }
+    if (header.failed) {
+        log_warn("Arguments attribute: header exceeds attribute length.");
+        return 0;
+    }
+    reader->position = (uint16_t) header.position;
+    return 1;
+}
+
+int stun_args_next(StunArgumentsReader *reader, StunArgument *argument) {
+    if (reader->index >= reader->count)
+        return STUN_ARGS_END;
+
+    // the length table and the mask were checked by stun_args_reader_init
+    uint16_t j = reader->index;
+    uint16_t declared_len;
+    if (reader->extended)
+        declared_len = load_be16(reader->bytes + reader->lengths_offset + 2 * j);
+    else
+        declared_len = reader->bytes[reader->lengths_offset + j];
+    uint8_t mask = reader->bytes[reader->mask_offset + j / 8];
+    argument->is_string = (mask >> (j % 8)) & 0x01;
+
+    WireReader entry;
+    wire_reader_init(&entry, reader->bytes, reader->length);
+    entry.position = reader->position;
+    // both kinds of entry start with 4 bytes (value or value and name lengths)
+    if (wire_remaining(&entry) < 4) {
+        log_warn("Arguments attribute: truncated argument entry.");
+        return STUN_ARGS_ERROR;
+    }
+    if (argument->is_string) {
+        uint16_t value_len = wire_read_be16(&entry);
+        uint16_t name_len = wire_read_be16(&entry);
+        uint32_t entry_len = (uint32_t) value_len + name_len;
+        // legacy encoders store the sum of both lengths truncated to one byte
+        uint16_t expected_len = reader->extended ? entry_len : (entry_len & 0xFF);
+        if (entry_len > 0xFFFF || declared_len != expected_len) {
+            log_warn("Arguments attribute: string argument length mismatch.");
+            return STUN_ARGS_ERROR;
+        }
+        argument->value = wire_read_bytes(&entry, value_len);
+        argument->value_length = value_len;
+        argument->name = wire_read_bytes(&entry, name_len);
+        argument->name_length = name_len;
+        if (entry.failed) {
+            log_warn("Arguments attribute: string argument exceeds attribute length.");
+            return STUN_ARGS_ERROR;
+        }
+    } else {
+        argument->value = wire_read_bytes(&entry, STUN_ARGS_VALUE_LEN);
+        argument->value_length = STUN_ARGS_VALUE_LEN;
+        argument->name = wire_read_bytes(&entry, declared_len);
+        argument->name_length = declared_len;
+        if (entry.failed) {
+            log_warn("Arguments attribute: argument exceeds attribute length.");
+            return STUN_ARGS_ERROR;
+        }
+    }
+    reader->position = (uint16_t) entry.position;
+    reader->index++;
+    return STUN_ARGS_OK;
+}
+
+uint8_t* stun_args_build(LH_List *components, uint8_t *values, int *len) {
+    uint32_t num_args = 0;
+    uint32_t entries_len = 0;
+    int fits_legacy = 1;
+    int j;
+    int num_components = components == NULL ? 0 : components->size;
+    for (j = 0; j < num_components; j++) {
+        LH_Component *component = lh_list_get(components, j);
+        if (component->type == LH_TYPE_NO_TYPE)
+            continue;
+        uint32_t arg_len = lh_intern_length(component->name);
+        if (component->type == LH_TYPE_STRING)
+            arg_len += strlen((char *) lh_component_value(component, values));
+        if (arg_len > STUN_ARGS_LEGACY_MAX_LEN)
+            fits_legacy = 0;
+        entries_len += arg_len + 4;
+        num_args++;
+    }
+    if (num_args > STUN_ARGS_LEGACY_MAX_ARGS)
+        fits_legacy = 0;
+
+    uint32_t header_len;
+    if (fits_legacy)
+        header_len = 2 + num_args;
+    else
+        header_len = 3 + 2 * num_args + (num_args + 7) / 8;
+    uint32_t size_to_alloc = header_len + entries_len;
+    if (num_args > 0xFFFF || size_to_alloc > STUN_ARGS_MAX_LEN) {
+        log_error("Arguments attribute: components do not fit in a STUN attribute.");
+        return NULL;
+    }
+
+    // the header is zeroed here and its tables filled while the entries are written
+    uint8_t *bytes = calloc(size_to_alloc, sizeof *bytes);
+    WireWriter writer;
+    wire_writer_init(&writer, bytes, size_to_alloc);
+    if (fits_legacy) {
+        wire_write_u8(&writer, (uint8_t) num_args);
+    } else {
+        wire_write_u8(&writer, STUN_ARGS_EXTENDED_MARKER);
+        wire_write_be16(&writer, (uint16_t) num_args);
+    }
+    uint8_t *lengths = wire_reserve(&writer, fits_legacy ? num_args : 2 * num_args);
+    uint8_t *string_mask = wire_reserve(&writer, fits_legacy ? 1 : (num_args + 7) / 8);
+
+    uint32_t arg = 0;
+    for (j = 0; j < num_components; j++) {
+        LH_Component *component = lh_list_get(components, j);
+        uint16_t name_len = lh_intern_length(component->name);
+        uint16_t arg_len = name_len;
+        void *value = lh_component_value(component, values);
+        switch (component->type) {
+            case LH_TYPE_INTEGER:
+            case LH_TYPE_TIMESTAMP:
+                wire_write_be32(&writer, *(uint32_t *) value);
+                break;
+            case LH_TYPE_BOOLEAN:
+                wire_write_be32(&writer, *(int *) value ? 1 : 0);
+                break;
+            case LH_TYPE_FLOAT:
+            {
+                uint32_t float_bits;
+                memcpy(&float_bits, value, sizeof float_bits);
+                wire_write_be32(&writer, float_bits);
+                break;
+            }
+            case LH_TYPE_STRING:
+            {
+                uint16_t value_len = strlen((char *) value);
+                string_mask[arg / 8] |= 1 << (arg % 8);
+                wire_write_be16(&writer, value_len);
+                wire_write_be16(&writer, name_len);
+                wire_write_bytes(&writer, value, value_len);
+                arg_len += value_len;
+                break;
+            }
+            case LH_TYPE_NO_TYPE:
+            default:
+                continue;
+        }
+        // the name always goes at the end of the entry
+        wire_write_bytes(&writer, component->name, name_len);
+        if (fits_legacy)
+            lengths[arg] = (uint8_t) arg_len;
+        else
+            store_be16(lengths + 2 * arg, arg_len);
+        arg++;
+    }
+    // a string value that grew after the attribute was sized does not fit
+    if (writer.failed) {
+        log_error("Arguments attribute: a string component changed while it was encoded.");
+        free(bytes);
+        return NULL;
+    }
+    *len = size_to_alloc;
+    return bytes;
+}
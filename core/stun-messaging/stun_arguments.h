@@ -0,0 +1,143 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file stun_arguments.h
+ * @brief Encoding and decoding of the ATTR_ARGUMENTS attribute.
+ *
+ * The ARGUMENTS attribute carries the arguments of an action (server to device)
+ * and the values of the status components (device to server). Two encodings
+ * are supported.
+ *
+ * Legacy encoding (at most 8 arguments):
+ * <pre>
+ * byte 0              number of arguments N
+ * bytes 1 .. N        length of each argument (1 byte each)
+ * byte N + 1          string mask, bit j set if argument j is a string
+ * argument entries
+ * </pre>
+ *
+ * Extended encoding (up to 65535 arguments):
+ * <pre>
+ * byte 0              STUN_ARGS_EXTENDED_MARKER
+ * bytes 1 - 2         number of arguments N
+ * 2 * N bytes         length of each argument (2 bytes each)
+ * (N + 7) / 8 bytes   string mask, bit j % 8 of byte j / 8 set if argument j is a string
+ * argument entries
+ * </pre>
+ *
+ * The argument entries are identical in both encodings. A four byte argument
+ * (integer, float, boolean or timestamp) is stored as its 4 byte big endian value
+ * followed by its name, and its length is the length of the name. A string
+ * argument is stored as the length of the value (2 bytes), the length of the
+ * name (2 bytes), the value and the name, and its length is the sum of both.
+ *
+ * The marker never collides with a legacy attribute, since legacy attributes
+ * declare at most 8 arguments in their first byte. Encoders use the legacy
+ * encoding whenever the arguments fit in it, so peers that only understand the
+ * legacy encoding keep working with devices that do not need the extended one.
+ */
+
+#ifndef STUN_ARGUMENTS_H
+#define	STUN_ARGUMENTS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "../lhings.h"
+
+#define STUN_ARGS_EXTENDED_MARKER   0xFF
+#define STUN_ARGS_LEGACY_MAX_ARGS   8
+#define STUN_ARGS_LEGACY_MAX_LEN    0xFF
+#define STUN_ARGS_VALUE_LEN         4
+#define STUN_ARGS_MAX_LEN           0xFFFF
+
+    // return codes of stun_args_next
+#define STUN_ARGS_ERROR  -1
+#define STUN_ARGS_END     0
+#define STUN_ARGS_OK      1
+
+    /**
+     * Cursor used to iterate over the arguments of an ARGUMENTS attribute.
+     * It does not copy the bytes of the attribute, so they must remain valid
+     * while the reader is in use.
+     */
+    typedef struct StunArgumentsReader {
+        const uint8_t *bytes;
+        uint16_t length;
+        // number of arguments declared in the attribute
+        uint16_t count;
+        // 1 if the attribute uses the extended encoding
+        uint8_t extended;
+        // offsets of the length table and string mask within bytes
+        uint16_t lengths_offset, mask_offset;
+        // offset of the next argument entry and its index
+        uint16_t position, index;
+    } StunArgumentsReader;
+
+    /**
+     * An argument decoded from an ARGUMENTS attribute. Pointers refer to the
+     * bytes of the attribute, names and string values are not null terminated.
+     */
+    typedef struct StunArgument {
+        const uint8_t *name;
+        uint16_t name_length;
+        // for four byte arguments value points to the big endian value and value_length is 4
+        const uint8_t *value;
+        uint16_t value_length;
+        uint8_t is_string;
+    } StunArgument;
+
+    /**
+     * Initializes a reader over the value of an ARGUMENTS attribute, checking
+     * that the header, length table and string mask fit in the attribute.
+     * @param reader
+     * @param bytes The value of the attribute.
+     * @param length The length of the value of the attribute.
+     * @return 1 if the header is valid, 0 otherwise.
+     */
+    int stun_args_reader_init(StunArgumentsReader *reader, const uint8_t *bytes, uint16_t length);
+
+    /**
+     * Decodes the next argument of the attribute. Every length read from the
+     * attribute is validated against its bounds before being used.
+     * @param reader
+     * @param argument Where the decoded argument is stored.
+     * @return STUN_ARGS_OK if an argument was decoded, STUN_ARGS_END if there are
+     * no more arguments, or STUN_ARGS_ERROR if the attribute is malformed.
+     */
+    int stun_args_next(StunArgumentsReader *reader, StunArgument *argument);
+
+    /**
+     * Encodes the given list of LH_Component as an ARGUMENTS attribute, using
+     * the legacy encoding when possible and the extended one otherwise. Components
+     * with type LH_TYPE_NO_TYPE are skipped.
+     * @param components A list of LH_Component (can be null).
+     * @param values The value block of the device when the components belong
+     * to a device class, or null to use the value pointers of the components.
+     * @param len The length of the returned byte array is stored here.
+     * @return A pointer to the encoded attribute, which must be freed with free(),
+     * or null if the components do not fit in an attribute.
+     */
+    uint8_t* stun_args_build(LH_List *components, uint8_t *values, int *len);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* STUN_ARGUMENTS_H */
+
@@ -19,8 +19,11 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include "../utils/utils.h"
+#include "../utils/wire.h"
 #include "../logging/log.h"
+#include "../metrics/metrics.h"
 #include "../crypto/hmac.h"
+#include "../../abstraction/threading/lhings_thread.h"
 #include "stun_message.h"
 #include "../lhings.h"
 #include "../../abstraction/timing/lhings_time.h"
@@ -31,35 +34,36 @@ int stun_process_stun_message(uint8_t *bytes, uint16_t length, StunMessage *mess
     // initialize StunMessage
     message->bytes = bytes;
     message->length = length;
-    uint8_t message_type[2];
-    message_type[0] = bytes[0] >> 2;
-    message_type[1] = (bytes[1] & 0x0F) + ((bytes[1] & 0xE0) >> 1) + ((bytes[0] & 0x02) << 6);
-    message->method = byte_array_to_uint16_t(message_type);
     message->api_key = NULL;
-    message_type[0] = bytes[0] & 0x01;
-    message_type[1] = bytes[1] & 0x10;
-    message->class = byte_array_to_uint16_t(message_type);
+    stun_get_method_and_class(message, &message->method, &message->class);
     return 1;
 }
 
 int stun_get_attribute(const StunMessage *message, uint16_t attribute_code, StunAttribute *attribute) {
-    int position = STUN_MIN_MESS_LEN; // start reading bytes just after message header
-    while (position < message->length) {
-        uint16_t attr_type = byte_array_to_uint16_t(message->bytes + position);
-        uint16_t attr_length = byte_array_to_uint16_t(message->bytes + position + 2);
+    if (message->length < STUN_MIN_MESS_LEN)
+        return 0;
+    // start reading bytes just after message header
+    WireReader reader;
+    wire_reader_init(&reader, message->bytes + STUN_MIN_MESS_LEN, message->length - STUN_MIN_MESS_LEN);
+    while (wire_remaining(&reader) > 0) {
+        uint16_t attr_type = wire_read_be16(&reader);
+        uint16_t attr_length = wire_read_be16(&reader);
+        const uint8_t *value = wire_read_bytes(&reader, attr_length);
+        // an attribute that does not fit in the message is never returned
+        if (value == NULL)
+            return 0;
         if (attr_type == attribute_code) {
             attribute->attr_type = attr_type;
             attribute->length = attr_length;
-            attribute->bytes = (message->bytes + position + 4);
+            attribute->bytes = (uint8_t *) value;
             return 1;
         }
-        // jump to the next attribute
-        int shift = attr_length % 4;
-        if (shift != 0)
-            shift = 4 - shift;
-        // to take into account the padding to 32 bits boundary and the 4
-        // bytes of type length
-        position += attr_length + shift + 4;
+        // jump over the padding to 32 bits boundary, which the last
+        // attribute of some peers lacks
+        uint32_t padding = (4 - attr_length % 4) % 4;
+        if (padding > wire_remaining(&reader))
+            break;
+        wire_read_bytes(&reader, padding);
     }
     // not found, return false
     return 0;
@@ -78,19 +82,13 @@ int stun_is_well_formed(const uint8_t *bytes, uint16_t length) {
         return STUN_FALSE;
     }
 
-    uint32_t magic = MAGIC_COOKIE;
-
-    uint8_t magicCookie[4];
-    uint32_to_byte_array(magic, magicCookie);
     // check magic cookie
-
-    if (!(bytes[4] == magicCookie[0] && bytes[5] == magicCookie[1]
-            && bytes[6] == magicCookie[2] && bytes[7] == magicCookie[3])) {
+    if (load_be32(bytes + 4) != MAGIC_COOKIE) {
         log_warn("Magic cookie is not correct");
         return STUN_FALSE;
     }
     // check message length
-    uint16_t declared_length = byte_array_to_uint16_t(&bytes[2]);
+    uint16_t declared_length = load_be16(bytes + 2);
     if (declared_length != length - 20) {
         log_warn("Incorrect message length");
         return STUN_FALSE;
@@ -106,13 +104,14 @@ int stun_is_integrity_correct(const StunMessage *message, const char *api_key) {
     uint8_t hmac_signature[20];
     int fail = hmac_sha1(api_key, keylen, in, inlen, hmac_signature);
     
-    // check for success of hmac calculation
+    // check for success of hmac calculation. Both checks can be triggered by
+    // anyone able to send packets to the device, so their lines are rate 
+    // limited, and the hex strings are only built when the line is written
     if (fail) {
-        char error_message[70];
-        char trId[15];
-        encode_hex((message->bytes + 8), 12, trId);
-        snprintf(error_message, 70, "hmac_sha1 couldn't be determined for message with trId %s", trId);
-        log_error(error_message);
+        lh_metrics_inc(LH_COUNTER_INTEGRITY_FAILURES);
+        char trId[25];
+        log_errorf_limited("hmac_sha1 couldn't be determined for message with trId %s",
+                lh_hex_encode(message->bytes + 8, 12, trId, sizeof trId));
         return STUN_FALSE;
     }
 
@@ -120,12 +119,11 @@ int stun_is_integrity_correct(const StunMessage *message, const char *api_key) {
     const uint8_t *declared_hmac_signature = (message->bytes + message->length - 20);
     int hmac_incorrect = memcmp(declared_hmac_signature, hmac_signature, 20);
     if (hmac_incorrect) {
-        char error_message[150];
-        char good_hmac[43], bad_hmac[43];
-        encode_hex(hmac_signature, 20, good_hmac);
-        encode_hex(declared_hmac_signature, 20, bad_hmac);
-        snprintf(error_message, 150, "hmac verification failed: should be %s but received %s", good_hmac, bad_hmac);
-        log_error(error_message);
+        lh_metrics_inc(LH_COUNTER_INTEGRITY_FAILURES);
+        char good_hmac[41], bad_hmac[41];
+        log_errorf_limited("hmac verification failed: should be %s but received %s",
+                lh_hex_encode(hmac_signature, 20, good_hmac, sizeof good_hmac),
+                lh_hex_encode(declared_hmac_signature, 20, bad_hmac, sizeof bad_hmac));
         return STUN_FALSE;
     }
     return STUN_TRUE;
@@ -157,40 +155,14 @@ uint16_t stun_get_error_code(const StunMessage *message, char *error_message_buf
 }
 
 void stun_set_method_and_class(StunMessage *message, uint16_t method, uint16_t class) {
-    uint8_t type_bytes[2];
-    uint8_t method_bytes[2];
-    uint16_to_byte_array(method, method_bytes);
-    // encode method
-    type_bytes[1] = (0x0F & method_bytes[1]) + ((0x70 & method_bytes[1]) << 1);
-    type_bytes[0] = ((0x80 & method_bytes[1]) >> 6) + ((0x0F & method_bytes[0]) << 2);
-    // encode class
-    switch (class) {
-        case CL_REQUEST:
-            type_bytes[0] = type_bytes[0] & 0xFE; // set bit to 0
-            type_bytes[1] = type_bytes[1] & 0xEF; // set bit to 0
-            break;
-        case CL_SUCCESS:
-            type_bytes[0] = type_bytes[0] | 0x01; // set bit to 1
-            type_bytes[1] = type_bytes[1] & 0xEF; // set bit to 0
-            break;
-        case CL_ERROR:
-            type_bytes[0] = type_bytes[0] | 0x01; // set bit to 1
-            type_bytes[1] = type_bytes[1] | 0x10; // set bit to 1
-            break;
-        case CL_INDICATION:
-            type_bytes[0] = type_bytes[0] & 0xFE; // set bit to 0
-            type_bytes[1] = type_bytes[1] | 0x10; // set bit to 1
-            break;
-    }
-
-    // set type bytes in STUN message
-    message->bytes[0] = type_bytes[0];
-    message->bytes[1] = type_bytes[1];
-
+    // the 12 bits of the method are split around the two bits of the class,
+    // which the class constants already hold in place
+    uint16_t message_type = (method & 0x000F) + ((method & 0x0070) << 1) + ((method & 0x0F80) << 2);
+    store_be16(message->bytes, message_type | (class & 0x0110));
 }
 
 void stun_get_method_and_class(StunMessage *message, uint16_t *method, uint16_t *class){
-    uint16_t message_type = byte_array_to_uint16_t(message->bytes);
+    uint16_t message_type = load_be16(message->bytes);
     *class = message_type & 0x0110;
     *method = (message_type & 0x000f) + ((message_type & 0x00e0) >> 1) + ((message_type & 0x0e00) >> 2) + ((message_type & 0x3000) >> 2);
 }
@@ -200,36 +172,24 @@ StunMessage* stun_new_empty_stun_message(){
 }
 
 StunMessage* stun_new_stun_message(uint16_t length, uint8_t set_tr_id) {
-    static uint8_t random_generator_initialized = STUN_FALSE;
-    if (!random_generator_initialized) {
-        srand(lh_get_UTC_unix_time());
-        random_generator_initialized = STUN_TRUE;
-    }
-
     StunMessage *stun_message = malloc(sizeof *stun_message);
     stun_message->bytes = malloc(length * sizeof stun_message->bytes);
     stun_message->length = length;
     // set STUN message length to default minimum 
-    uint16_to_byte_array(STUN_MIN_MESS_DECL_LEN, (stun_message->bytes + 2));
+    store_be16(stun_message->bytes + 2, STUN_MIN_MESS_DECL_LEN);
     // set magic cookie
-    uint32_to_byte_array(MAGIC_COOKIE, (stun_message->bytes + 4));
-    // set random transaction id (12 random bytes)
-    if (set_tr_id) {
-        int j;
-        for (j = 0; j < 12; j = j + 2) {
-            uint8_t rand_bytes[2];
-            uint16_to_byte_array(rand() % 65536, rand_bytes);
-            stun_message->bytes[j + 8] = rand_bytes[0];
-            stun_message->bytes[j + 8 + 1] = rand_bytes[1];
-        }
-    }
+    store_be32(stun_message->bytes + 4, MAGIC_COOKIE);
+    // set random transaction id (12 random bytes), from the generator of the calling thread
+    if (set_tr_id)
+        lh_random_bytes(stun_message->bytes + 8, 12);
     return stun_message;
 }
 
 char* stun_to_string(StunMessage *message){
-    static char hex_message[300];
-    strcpy(hex_message, ""); //initialize string
-    encode_hex(message->bytes, message->length, hex_message);
+    static LH_THREAD_LOCAL char hex_message[STUN_STRING_LEN];
+    hex_message[0] = '0';
+    hex_message[1] = 'x';
+    lh_hex_encode(message->bytes, message->length, hex_message + 2, sizeof hex_message - 2);
     return hex_message;
 }
 
@@ -239,15 +199,16 @@ void stun_free(StunMessage* stun_message) {
 }
 
 StunMessage* stun_set_message_integrity(StunMessage *message, char *api_key) {
-    uint16_t declared_length = byte_array_to_uint16_t(message->bytes + 2);
-    uint16_t length_after_mi_added = declared_length + 24;
-    uint16_to_byte_array(length_after_mi_added, message->bytes + 2);
-    // lower case api key
+    uint16_t declared_length = load_be16(message->bytes + 2);
+    store_be16(message->bytes + 2, declared_length + 24);
+    // lower case api key, writing only the characters that change, so that
+    // threads signing with the same key do not write to it once it is lower case
     char *cursor = api_key;
     for (;*cursor; ++cursor){ 
         char a = *cursor;
         a = tolower(a);
-        *cursor = a;
+        if (a != *cursor)
+            *cursor = a;
     }
     uint8_t message_integrity[STUN_ATTR_MESS_INTEGR_VALUE_LEN];
     int fail = hmac_sha1(api_key, STUN_API_KEY_LEN, message->bytes, declared_length + STUN_MIN_MESS_LEN, message_integrity);
@@ -255,58 +216,80 @@ StunMessage* stun_set_message_integrity(StunMessage *message, char *api_key) {
         return NULL;
     
     // restore declared length to original value so that stun_add_attribute does not break the message
-    uint16_to_byte_array(declared_length, message->bytes + 2);
+    store_be16(message->bytes + 2, declared_length);
 
-    
     return stun_add_attribute(message, ATTR_MESSAGE_INTEGRITY, STUN_ATTR_MESS_INTEGR_VALUE_LEN, message_integrity);
 }
 
 StunMessage* stun_add_attribute(StunMessage *message, uint16_t attr_type, uint16_t value_length, uint8_t *value){
-    uint16_t declared_length = byte_array_to_uint16_t(message->bytes + 2);
-    uint8_t num_padding_bytes = value_length % 4;
-    if (num_padding_bytes != 0)
-        num_padding_bytes = 4 - num_padding_bytes;
+    uint16_t declared_length = load_be16(message->bytes + 2);
+    uint8_t num_padding_bytes = (4 - value_length % 4) % 4;
     // check if call to realloc is needed
-    uint16_t needed_length = declared_length + STUN_MIN_MESS_LEN + value_length + num_padding_bytes + 4;
+    uint32_t needed_length = (uint32_t) declared_length + STUN_MIN_MESS_LEN + value_length + num_padding_bytes + 4;
+    if (needed_length > 0xFFFF) {
+        log_error("STUN message would exceed maximum length, attribute not added.");
+        return message;
+    }
     if(needed_length > message->length){
         // increase size of message
         log_debug("Increasing size of message.");
         message->bytes = realloc(message->bytes, needed_length * sizeof *message->bytes);
-        memset(message->bytes + message->length, needed_length - message->length, 0);
         message->length = needed_length;
     }
-    // set attribute length and type
-    uint8_t ptr_attr_start = declared_length + STUN_MIN_MESS_LEN;
-    uint8_t byte_array[2];
-    uint16_to_byte_array(attr_type, byte_array);
-    message->bytes[ptr_attr_start] = byte_array[0];
-    message->bytes[ptr_attr_start+1] = byte_array[1];
-    uint16_to_byte_array(value_length, byte_array);
-    message->bytes[ptr_attr_start+2] = byte_array[0];
-    message->bytes[ptr_attr_start+3] = byte_array[1];
-    // copy bytes 
-    memcpy(message->bytes + ptr_attr_start + 4, value, value_length);
-    // set padding bytes
-    if (num_padding_bytes != 0){
-        int j;
-        for (j = 0; j < num_padding_bytes; j++){
-            message->bytes[ptr_attr_start+value_length + j + 4] = 0x00;
-        }
-    }
-    //update declared message length and byte array length
-    uint16_to_byte_array(needed_length - STUN_MIN_MESS_LEN, byte_array);
-    memcpy(message->bytes+2, byte_array, 2);
+    // write type, length, value and padding just after the declared attributes
+    WireWriter writer;
+    wire_writer_init(&writer, message->bytes, needed_length);
+    writer.position = declared_length + STUN_MIN_MESS_LEN;
+    wire_write_be16(&writer, attr_type);
+    wire_write_be16(&writer, value_length);
+    wire_write_bytes(&writer, value, value_length);
+    wire_write_zeros(&writer, num_padding_bytes);
+    //update declared message length
+    store_be16(message->bytes + 2, needed_length - STUN_MIN_MESS_LEN);
     return message;
 }
 
-StunMessage* stun_add_common_attrs(StunMessage* message, LH_Device *device){
+/**
+ * Encodes the common attributes of the device once, and keeps them in it.
+ */
+void stun_encode_common_attrs(LH_Device *device){
+    StunMessage *message = stun_new_stun_message(STUN_MIN_MESS_LEN, STUN_FALSE);
     message = stun_add_attribute(message, ATTR_USERNAME, strlen(device->username), (uint8_t*)device->username);
-    uint8_t time_bytes[4];
-    uint32_to_byte_array(lh_get_UTC_unix_time(), time_bytes);
+    uint8_t time_bytes[4] = {0};
     message = stun_add_attribute(message, ATTR_TIMESTAMP, 4, time_bytes);
     uint8_t uuid_bytes[16];
     uuid_string_to_byte_array(device->uuid, uuid_bytes);
     message = stun_add_attribute(message, ATTR_LYNCPORT_ID, 16, uuid_bytes);
+    device->common_attrs_length = message->length - STUN_MIN_MESS_LEN;
+    device->common_attrs = malloc(device->common_attrs_length);
+    memcpy(device->common_attrs, message->bytes + STUN_MIN_MESS_LEN, device->common_attrs_length);
+    stun_free(message);
+}
+
+void stun_free_common_attrs(LH_Device *device){
+    free(device->common_attrs);
+    device->common_attrs = NULL;
+}
+
+StunMessage* stun_add_common_attrs(StunMessage* message, LH_Device *device){
+    if (device->common_attrs == NULL)
+        stun_encode_common_attrs(device);
+    uint16_t declared_length = load_be16(message->bytes + 2);
+    uint16_t offset = STUN_MIN_MESS_LEN + declared_length;
+    uint32_t needed_length = (uint32_t) offset + device->common_attrs_length;
+    if (needed_length > 0xFFFF) {
+        log_error("STUN message would exceed maximum length, attribute not added.");
+        return message;
+    }
+    if (needed_length > message->length) {
+        message->bytes = realloc(message->bytes, needed_length * sizeof *message->bytes);
+        message->length = needed_length;
+    }
+    memcpy(message->bytes + offset, device->common_attrs, device->common_attrs_length);
+    store_be16(message->bytes + 2, needed_length - STUN_MIN_MESS_LEN);
+    // the value of TIMESTAMP follows the padded USERNAME attribute and the header of TIMESTAMP
+    uint16_t username_length = load_be16(device->common_attrs + 2);
+    store_be32(message->bytes + offset + 4 + ((username_length + 3) & ~3) + 4, lh_get_UTC_unix_time());
     return message;       
 }
 
@@ -345,13 +328,20 @@ StunMessage* stun_get_success_response(LH_Device *device, StunMessage *received_
 }
 
 StunMessage* stun_get_status_store_message(LH_Device *device){
+    int length;
+    uint8_t *attr_status_bytes = build_arguments_attribute(device, &length);
+    if (attr_status_bytes == NULL)
+        return NULL;
+    StunMessage *message = stun_get_status_store_message_from_arguments(device, attr_status_bytes, length);
+    free(attr_status_bytes);
+    return message;
+}
+
+StunMessage* stun_get_status_store_message_from_arguments(LH_Device *device, const uint8_t *arguments, uint16_t length){
     StunMessage *message = stun_new_empty_stun_message();
     message = stun_add_common_attrs(message, device);
     stun_set_method_and_class(message, M_STORE_STATUS, CL_REQUEST);
-    int length;
-    uint8_t *attr_status_bytes = build_arguments_attribute(&this_device, &length);
-    message = stun_add_attribute(message, ATTR_ARGUMENTS, length, attr_status_bytes);
-    free(attr_status_bytes);
+    message = stun_add_attribute(message, ATTR_ARGUMENTS, length, (uint8_t *) arguments);
     message = stun_set_message_integrity(message, device->api_key);
     return message;
 }
\ No newline at end of file
@@ -40,6 +40,8 @@ extern "C" {
 #define STUN_MIN_MESS_DECL_LEN 0
 #define STUN_API_KEY_LEN 36
 #define STUN_ATTR_MESS_INTEGR_VALUE_LEN 20
+    // size of the string returned by stun_to_string, longer messages are truncated
+#define STUN_STRING_LEN 300
     
     
     // method code definitions (RFC 5389)
@@ -285,10 +287,22 @@ extern "C" {
     int stun_is_well_formed(const uint8_t *bytes, uint16_t length);
 
     /**
-     * Prints the hex representation of the STUN message to stdout.
+     * Returns the hex representation of the STUN message, preceded by 0x and
+     * truncated to STUN_STRING_LEN - 1 characters.
      * @param message
+     * @return A string owned by the calling thread, overwritten by its next call.
      */
     char* stun_to_string(StunMessage *message);
+
+    /**
+     * Appends the USERNAME, TIMESTAMP and LYNCPORT_ID attributes of the device
+     * to a message, with the current time. They are encoded once and cached
+     * in the device (see LH_Device.common_attrs).
+     * @param message
+     * @param device
+     * @return The message, which may have been reallocated.
+     */
+    StunMessage* stun_add_common_attrs(StunMessage* message, LH_Device *device);
     
     /**
      * Generates a ready to send keepalive message for the given device.
@@ -325,6 +339,24 @@ extern "C" {
      * @return 
      */
     StunMessage* stun_get_status_store_message(LH_Device *device);
+
+    /**
+     * Same as stun_get_status_store_message, with an ARGUMENTS attribute that
+     * has already been built with stun_args_build.
+     * @param device
+     * @param arguments The value of the ARGUMENTS attribute.
+     * @param length
+     * @return 
+     */
+    StunMessage* stun_get_status_store_message_from_arguments(LH_Device *device, const uint8_t *arguments, uint16_t length);
+
+    /**
+     * Frees the common attributes cached in the device by the first message
+     * built for it. They are encoded again by the next message, so it must
+     * also be called after changing the username or uuid of the device.
+     * @param device
+     */
+    void stun_free_common_attrs(LH_Device *device);
     
 #ifdef	__cplusplus
 }
@@ -0,0 +1,143 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "submission_queue.h"
+#include "stun_arguments.h"
+#include "../logging/log.h"
+#include "../metrics/metrics.h"
+#include "../../abstraction/threading/lhings_thread.h"
+
+void submission_queue_init(SubmissionQueue *queue, int wakeup) {
+    uint64_t j;
+    for (j = 0; j < SUBMISSION_QUEUE_CAPACITY; j++)
+        queue->cells[j].sequence = j;
+    queue->wakeup = wakeup;
+    queue->enqueue_position = 0;
+    queue->dequeue_position = 0;
+    queue->wakeup_pending = 0;
+}
+
+/**
+ * Claims a free cell for a producer.
+ * @return The submission of the cell, or null if the queue is full.
+ */
+Submission* submission_queue_claim(SubmissionQueue *queue, uint64_t *claimed) {
+    SubmissionCell *cell;
+    uint64_t position = LH_ATOMIC_LOAD_RELAXED(&queue->enqueue_position);
+    while (1) {
+        cell = queue->cells + (position & (SUBMISSION_QUEUE_CAPACITY - 1));
+        uint64_t sequence = LH_ATOMIC_LOAD(&cell->sequence);
+        int64_t difference = (int64_t) (sequence - position);
+        if (difference == 0) {
+            if (LH_ATOMIC_CAS(&queue->enqueue_position, &position, position + 1))
+                break;
+        } else if (difference < 0) {
+            lh_metrics_inc(LH_COUNTER_SUBMISSIONS_DROPPED);
+            log_warnf_limited("Too many events and status stores waiting to be sent, discarding one.");
+            return NULL;
+        } else {
+            position = LH_ATOMIC_LOAD_RELAXED(&queue->enqueue_position);
+        }
+    }
+    *claimed = position;
+    return &cell->submission;
+}
+
+/**
+ * Hands a claimed cell to the consumer, and wakes it up if it may be waiting.
+ */
+void submission_queue_publish(SubmissionQueue *queue, uint64_t position) {
+    LH_ATOMIC_STORE(&queue->cells[position & (SUBMISSION_QUEUE_CAPACITY - 1)].sequence, position + 1);
+    // only the first submission after the consumer rearms the queue needs a system call
+    if (queue->wakeup != -1 && !LH_ATOMIC_EXCHANGE(&queue->wakeup_pending, 1))
+        lh_wakeup_signal(queue->wakeup);
+}
+
+int submission_queue_push_event(SubmissionQueue *queue, LH_Device *device, const char *event_name, const char *payload) {
+    size_t name_length = strlen(event_name);
+    size_t payload_length = payload == NULL ? 0 : strlen(payload);
+    if (name_length >= SUBMISSION_NAME_LEN || payload_length >= SUBMISSION_PAYLOAD_LEN) {
+        log_warnf("Event %s is too long to be sent.", event_name);
+        return 0;
+    }
+    uint64_t position;
+    Submission *submission = submission_queue_claim(queue, &position);
+    if (submission == NULL)
+        return 0;
+    submission->kind = SUBMISSION_EVENT;
+    submission->device = device;
+    memcpy(submission->name, event_name, name_length + 1);
+    submission->has_payload = payload != NULL;
+    submission->payload_length = (uint16_t) payload_length;
+    if (payload != NULL)
+        memcpy(submission->payload, payload, payload_length + 1);
+    submission_queue_publish(queue, position);
+    return 1;
+}
+
+int submission_queue_push_status(SubmissionQueue *queue, LH_Device *device) {
+    int length;
+    // the values are read now, by the thread that submits them
+    uint8_t *arguments = stun_args_build(device->status_components, device->values, &length);
+    if (arguments == NULL)
+        return 0;
+    if (length > SUBMISSION_PAYLOAD_LEN) {
+        log_warn("Status is too long to be stored.");
+        free(arguments);
+        return 0;
+    }
+    uint64_t position;
+    Submission *submission = submission_queue_claim(queue, &position);
+    if (submission == NULL) {
+        free(arguments);
+        return 0;
+    }
+    submission->kind = SUBMISSION_STATUS;
+    submission->device = device;
+    submission->has_payload = 1;
+    submission->payload_length = (uint16_t) length;
+    memcpy(submission->payload, arguments, length);
+    free(arguments);
+    submission_queue_publish(queue, position);
+    return 1;
+}
+
+void submission_queue_rearm(SubmissionQueue *queue) {
+    LH_ATOMIC_EXCHANGE(&queue->wakeup_pending, 0);
+}
+
+StunMessage* submission_queue_pop_message(SubmissionQueue *queue, SubmissionKind *kind, LH_Device **device) {
+    uint64_t position = queue->dequeue_position;
+    SubmissionCell *cell = queue->cells + (position & (SUBMISSION_QUEUE_CAPACITY - 1));
+    if (LH_ATOMIC_LOAD(&cell->sequence) != position + 1)
+        return NULL;
+    Submission *submission = &cell->submission;
+    StunMessage *message;
+    if (submission->kind == SUBMISSION_EVENT)
+        message = stun_get_event_message(submission->device, submission->name,
+            submission->has_payload ? (char *) submission->payload : NULL);
+    else
+        message = stun_get_status_store_message_from_arguments(submission->device, submission->payload, submission->payload_length);
+    if (kind != NULL)
+        *kind = submission->kind;
+    if (device != NULL)
+        *device = submission->device;
+    // free the cell for the producer that will use it in the next lap
+    LH_ATOMIC_STORE(&cell->sequence, position + SUBMISSION_QUEUE_CAPACITY);
+    LH_ATOMIC_STORE(&queue->dequeue_position, position + 1);
+    return message;
+}
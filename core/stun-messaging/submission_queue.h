@@ -0,0 +1,132 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file submission_queue.h
+ * @brief Bounded lock-free queue of the events and status stores waiting to
+ * be sent.
+ *
+ * Any thread can submit an event or a status store, and the thread that owns
+ * the socket of the device (the main loop, or the worker of a gateway) takes
+ * them, signs them and sends them together. Each cell holds a copy of
+ * everything the message needs, so submitting does not wait for the network
+ * and the device may change right after. The cells follow the same protocol
+ * as those of log_ring.h. When the queue is full, submissions are dropped
+ * and counted.
+ */
+
+#ifndef SUBMISSION_QUEUE_H
+#define	SUBMISSION_QUEUE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "stun_message.h"
+
+    // must be a power of two
+#define SUBMISSION_QUEUE_CAPACITY 64
+    // longer event names are rejected
+#define SUBMISSION_NAME_LEN 64
+    // longer payloads and status are rejected
+#define SUBMISSION_PAYLOAD_LEN 1024
+
+    typedef enum {
+        SUBMISSION_EVENT,
+        SUBMISSION_STATUS
+    } SubmissionKind;
+
+    typedef struct submission {
+        SubmissionKind kind;
+        LH_Device *device;
+        // name of the event, null terminated
+        char name[SUBMISSION_NAME_LEN];
+        // payload of the event, null terminated, or the ARGUMENTS attribute of the status
+        uint8_t payload[SUBMISSION_PAYLOAD_LEN];
+        uint16_t payload_length;
+        uint8_t has_payload;
+    } Submission;
+
+    typedef struct submission_cell {
+        // equals the position of the cell when free, position + 1 when it holds a submission
+        uint64_t sequence;
+        Submission submission;
+    } SubmissionCell;
+
+    typedef struct submission_queue {
+        SubmissionCell cells[SUBMISSION_QUEUE_CAPACITY];
+        // signalled when a submission is queued, -1 if the consumer checks the queue periodically
+        int wakeup;
+        uint64_t enqueue_position __attribute__((aligned(64)));
+        uint64_t dequeue_position __attribute__((aligned(64)));
+        // 1 from the first submission after the consumer took the last wake up
+        uint32_t wakeup_pending __attribute__((aligned(64)));
+    } SubmissionQueue;
+
+    /**
+     * Initializes an empty queue. Must be called before any other thread uses it.
+     * @param queue
+     * @param wakeup A descriptor created with lh_wakeup_new(), which is
+     * signalled when the queue stops being empty, or -1.
+     */
+    void submission_queue_init(SubmissionQueue *queue, int wakeup);
+
+    /**
+     * Queues an event. Safe to call from any thread.
+     * @param queue
+     * @param device
+     * @param event_name
+     * @param payload The payload of the event, or null.
+     * @return 1 if the event was queued, 0 if it does not fit in a cell or
+     * the queue was full.
+     */
+    int submission_queue_push_event(SubmissionQueue *queue, LH_Device *device, const char *event_name, const char *payload);
+
+    /**
+     * Queues a store of the current values of the status components of the
+     * device. Safe to call from any thread.
+     * @param queue
+     * @param device
+     * @return 1 if the status was queued, 0 if it does not fit in a cell or
+     * the queue was full.
+     */
+    int submission_queue_push_status(SubmissionQueue *queue, LH_Device *device);
+
+    /**
+     * Tells the queue that the consumer has cleared its wake up descriptor,
+     * so that the next submission signals it again. Must be called before
+     * taking the submissions. Only the consumer may call it.
+     * @param queue
+     */
+    void submission_queue_rearm(SubmissionQueue *queue);
+
+    /**
+     * Takes the oldest submission and builds its message, signed with the
+     * api key of its device. Only one thread may call this function.
+     * @param queue
+     * @param kind If not null, the kind of the submission is stored here.
+     * @param device If not null, the device of the submission is stored here.
+     * @return null if the queue is empty, otherwise the message, which must
+     * be freed using stun_free.
+     */
+    StunMessage* submission_queue_pop_message(SubmissionQueue *queue, SubmissionKind *kind, LH_Device **device);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* SUBMISSION_QUEUE_H */
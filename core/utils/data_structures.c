@@ -15,76 +15,134 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <stdio.h>
+#include <stdint.h>
 #include "data_structures.h"
+#include "utils.h"
 
 LH_List* lh_list_new() {
-    return lh_list_new_custom_capacity(LIST_INITIAL_CAPACITY);
+    return lh_list_new_custom_capacity(LIST_INLINE_CAPACITY);
 }
 
 LH_List* lh_list_new_custom_capacity(int capacity){
     LH_List* my_list = malloc(sizeof *my_list);
-    my_list->max_capacity = capacity;
-    my_list->items = malloc(my_list->max_capacity * sizeof my_list->items);
+    my_list->items = my_list->inline_items;
+    my_list->max_capacity = LIST_INLINE_CAPACITY;
     my_list->size = 0;
+    if (capacity > LIST_INLINE_CAPACITY && !lh_list_reserve(my_list, capacity)) {
+        free(my_list);
+        return NULL;
+    }
     return my_list;
 }
 
-void* lh_list_get(LH_List *my_list, uint16_t index) {
-    if (index < 0 || index >= my_list->size)
+void* lh_list_get(LH_List *my_list, uint32_t index) {
+    if (index >= my_list->size)
         return NULL;
     return my_list->items[index].ptr_this;
 
 }
 
-void lh_list_add(LH_List *my_list, void *element) {
-    if (my_list->size == 0) {
-        my_list->items[0].ptr_this = element;
-        my_list->size = 1;
-    } else if (my_list->size > 0 && my_list->size < my_list->max_capacity) {
-        my_list->items[my_list->size].ptr_this = element;
-        my_list->size++;
+int lh_list_reserve(LH_List *my_list, uint32_t capacity) {
+    if (capacity <= my_list->max_capacity)
+        return 1;
+    if (capacity > SIZE_MAX / sizeof *my_list->items)
+        return 0;
+    LH_ListItem *items;
+    if (my_list->items == my_list->inline_items) {
+        items = malloc(capacity * sizeof *items);
+        if (items != NULL)
+            memcpy(items, my_list->inline_items, my_list->size * sizeof *items);
     } else {
-        uint16_t new_capacity = my_list->max_capacity * LIST_INCREMENT_CAPACITY_FACTOR;
-        my_list->items = realloc(my_list->items, new_capacity * sizeof my_list->items);
-        my_list->max_capacity = new_capacity;
-        lh_list_add(my_list, element);
+        items = realloc(my_list->items, capacity * sizeof *items);
     }
+    if (items == NULL)
+        return 0;
+    my_list->items = items;
+    my_list->max_capacity = capacity;
+    return 1;
+}
+
+/**
+ * Grows the list so that it can hold at least needed items, multiplying its
+ * capacity by LIST_INCREMENT_CAPACITY_FACTOR as many times as required.
+ */
+int list_grow(LH_List *my_list, uint64_t needed) {
+    if (needed > UINT32_MAX)
+        return 0;
+    uint64_t new_capacity = my_list->max_capacity;
+    if (new_capacity < LIST_INITIAL_CAPACITY)
+        new_capacity = LIST_INITIAL_CAPACITY;
+    while (new_capacity < needed)
+        new_capacity *= LIST_INCREMENT_CAPACITY_FACTOR;
+    if (new_capacity > UINT32_MAX)
+        new_capacity = UINT32_MAX;
+    return lh_list_reserve(my_list, (uint32_t) new_capacity);
+}
+
+int lh_list_add(LH_List *my_list, void *element) {
+    if (my_list->size == my_list->max_capacity && !list_grow(my_list, (uint64_t) my_list->size + 1))
+        return 0;
+    my_list->items[my_list->size].ptr_this = element;
+    my_list->size++;
+    return 1;
+}
+
+int lh_list_add_all(LH_List *my_list, void* const* elements, uint32_t count) {
+    uint64_t needed = (uint64_t) my_list->size + count;
+    if (needed > my_list->max_capacity && !list_grow(my_list, needed))
+        return 0;
+    uint32_t j;
+    for (j = 0; j < count; j++)
+        my_list->items[my_list->size + j].ptr_this = elements[j];
+    my_list->size += count;
+    return 1;
 }
 
 void lh_list_free(LH_List *my_list) {
-    free(my_list->items);
+    if (my_list->items != my_list->inline_items)
+        free(my_list->items);
     free(my_list);
 }
 
-uint32_t string_hash_code(const char *string) {
-    uint32_t h = 0;
-    uint16_t j = 0;
-    while (string[j] != 0) {
-        h = (h << 5) - h + string[j];
-        j++;
-    }
-    return h;
+uint8_t dict_hash_tag(uint32_t hash) {
+    return hash & 0x7F;
 }
 
-LH_DictItem* dict_get_entry (const LH_Dict* my_dict, const char* key){
-    uint32_t position = string_hash_code(key) % my_dict->max_capacity;
-    uint32_t iteration_count = 0;
-    do {
-        LH_DictItem* entry = my_dict->items + position;
-        if (entry->ptr_key == NULL)
-            return entry;
-        else if (strcmp(entry->ptr_key, key) == 0)
-            return entry;
-        position++;
-        iteration_count++;
-        if(position >= my_dict->max_capacity)
-            position = 0;
-    } while (iteration_count < my_dict->max_capacity);
-    // this code only returns NULL if dict is full and key is not found
-    return NULL;
+uint32_t dict_home_slot(const LH_Dict* my_dict, uint32_t hash) {
+    return (hash >> 7) & (my_dict->max_capacity - 1);
 }
 
+uint32_t string_hash_code(const char *string, size_t length) {
+    return (uint32_t) lh_hash_bytes(string, length, 0);
+}
+
+/**
+ * Returns the slot that holds the given key, or -1 if it is not found. 
+ */
+int64_t dict_find_slot(const LH_Dict* my_dict, const char* key, uint32_t hash) {
+    uint32_t mask = my_dict->max_capacity - 1;
+    uint32_t position = dict_home_slot(my_dict, hash);
+    uint8_t tag = dict_hash_tag(hash);
+    // load is always below 1, so there is at least one empty slot to stop at
+    while (my_dict->ctrl[position] != DICT_CTRL_EMPTY) {
+        if (my_dict->ctrl[position] == tag && my_dict->hashes[position] == hash
+                && strcmp(my_dict->keys[position], key) == 0)
+            return position;
+        position = (position + 1) & mask;
+    }
+    return -1;
+}
+
+/**
+ * Returns the first empty or deleted slot in the probe sequence of the given hash.
+ */
+uint32_t dict_find_free_slot(const LH_Dict* my_dict, uint32_t hash) {
+    uint32_t mask = my_dict->max_capacity - 1;
+    uint32_t position = dict_home_slot(my_dict, hash);
+    while (my_dict->ctrl[position] != DICT_CTRL_EMPTY && my_dict->ctrl[position] != DICT_CTRL_DELETED)
+        position = (position + 1) & mask;
+    return position;
+}
 
 LH_Dict* lh_dict_new() {
     return lh_dict_new_custom_capacity(DICT_INITIAL_CAPACITY);
@@ -92,121 +150,271 @@ LH_Dict* lh_dict_new() {
 
 LH_Dict* lh_dict_new_custom_capacity(int capacity){
     LH_Dict *my_dict = malloc(sizeof *my_dict);
-    my_dict->items = malloc(capacity * sizeof *my_dict->items);
-    // initialize memory to zero (required for dict to work)
-    memset(my_dict->items, 0, capacity * sizeof *my_dict->items);
+    uint32_t slots = 8;
+    while (slots < (uint32_t) capacity)
+        slots *= 2;
+    my_dict->ctrl = malloc(slots * sizeof *my_dict->ctrl);
+    memset(my_dict->ctrl, DICT_CTRL_EMPTY, slots * sizeof *my_dict->ctrl);
+    my_dict->hashes = malloc(slots * sizeof *my_dict->hashes);
+    my_dict->keys = malloc(slots * sizeof *my_dict->keys);
+    my_dict->values = malloc(slots * sizeof *my_dict->values);
     my_dict->size = 0;
-    my_dict->max_capacity = capacity;
-    
-    int j;
-    for (j = 0; j < my_dict->max_capacity; j++){
-        int key_null = 1;
-        int value_null = 1;
-        if ((my_dict->items+j)->ptr_key != NULL)
-            key_null = 0;
-        if((my_dict->items+j)->ptr_value != NULL)
-            value_null = 0;
-        if ((my_dict->items+j)->ptr_key != NULL || (my_dict->items+j)->ptr_value != NULL)
-            printf("item %d, key_null %d, value_null %d\n", j, key_null, value_null);
-    }
+    my_dict->deleted = 0;
+    my_dict->max_capacity = slots;
     return my_dict;
 }
 
-void dict_increase_and_rehash(LH_Dict* my_dict){
-    int size = my_dict->size;
-    char** keys = malloc(size * sizeof *keys);
-    void** values = malloc (size * sizeof *values);
-    int i, j;
-    i = 0;
-    for(j = 0; j < my_dict->max_capacity; j++){
-        char* key = my_dict->items[j].ptr_key;
-        if (key == NULL || strlen(key) == 0)
+/**
+ * Rehashes the dictionary in place, without allocating temporary storage.
+ * Tombstones are dropped and every entry is moved to the first free slot of
+ * its probe sequence. When called after growing the arrays, the new slots
+ * must be marked as empty.
+ */
+void dict_rehash_in_place(LH_Dict* my_dict) {
+    uint32_t j;
+    // tombstones become empty slots, and full slots are marked as deleted 
+    // to signal that their entry has not been placed yet
+    for (j = 0; j < my_dict->max_capacity; j++) {
+        if (my_dict->ctrl[j] == DICT_CTRL_DELETED)
+            my_dict->ctrl[j] = DICT_CTRL_EMPTY;
+        else if (my_dict->ctrl[j] != DICT_CTRL_EMPTY)
+            my_dict->ctrl[j] = DICT_CTRL_DELETED;
+    }
+    for (j = 0; j < my_dict->max_capacity; j++) {
+        if (my_dict->ctrl[j] != DICT_CTRL_DELETED)
             continue;
-        void* value = my_dict->items[j].ptr_value;
-        keys[i] = key;
-        values[i] = value;
-        i++;
+        uint32_t hash = my_dict->hashes[j];
+        uint32_t target = dict_find_free_slot(my_dict, hash);
+        if (target == j) {
+            my_dict->ctrl[j] = dict_hash_tag(hash);
+        } else if (my_dict->ctrl[target] == DICT_CTRL_EMPTY) {
+            my_dict->ctrl[target] = dict_hash_tag(hash);
+            my_dict->hashes[target] = hash;
+            my_dict->keys[target] = my_dict->keys[j];
+            my_dict->values[target] = my_dict->values[j];
+            my_dict->ctrl[j] = DICT_CTRL_EMPTY;
+        } else {
+            // target holds an entry not placed yet, swap and process slot j again
+            uint32_t target_hash = my_dict->hashes[target];
+            char* key = my_dict->keys[target];
+            void* value = my_dict->values[target];
+            my_dict->ctrl[target] = dict_hash_tag(hash);
+            my_dict->hashes[target] = hash;
+            my_dict->keys[target] = my_dict->keys[j];
+            my_dict->values[target] = my_dict->values[j];
+            my_dict->hashes[j] = target_hash;
+            my_dict->keys[j] = key;
+            my_dict->values[j] = value;
+            j--;
+        }
     }
-    
-    int my_dict_new_capacity = my_dict->max_capacity * DICT_INCREMENT_CAPACITY_FACTOR;
-    my_dict->items = realloc(my_dict->items, my_dict_new_capacity * sizeof *my_dict->items);
-   
-    memset(my_dict->items, 0, my_dict_new_capacity * sizeof *my_dict->items);
-    my_dict->max_capacity = my_dict_new_capacity;
-    my_dict->size = 0;
-    for (j=0; j<size; j++){
-        lh_dict_put(my_dict, keys[j], values[j]);
+    my_dict->deleted = 0;
+}
+
+void dict_increase_and_rehash(LH_Dict* my_dict){
+    // if half of the load are tombstones, purging them is enough
+    if (my_dict->deleted >= my_dict->size) {
+        dict_rehash_in_place(my_dict);
+        return;
     }
-    
-    
-    
-   free(keys);
-   free(values);
+    uint32_t old_capacity = my_dict->max_capacity;
+    uint32_t new_capacity = old_capacity * DICT_INCREMENT_CAPACITY_FACTOR;
+    my_dict->ctrl = realloc(my_dict->ctrl, new_capacity * sizeof *my_dict->ctrl);
+    my_dict->hashes = realloc(my_dict->hashes, new_capacity * sizeof *my_dict->hashes);
+    my_dict->keys = realloc(my_dict->keys, new_capacity * sizeof *my_dict->keys);
+    my_dict->values = realloc(my_dict->values, new_capacity * sizeof *my_dict->values);
+    memset(my_dict->ctrl + old_capacity, DICT_CTRL_EMPTY, (new_capacity - old_capacity) * sizeof *my_dict->ctrl);
+    my_dict->max_capacity = new_capacity;
+    dict_rehash_in_place(my_dict);
 }
 
 void lh_dict_put(LH_Dict* my_dict, const char *key, void* value){
-    LH_DictItem *entry = dict_get_entry(my_dict, key);
-    if (entry != NULL && entry->ptr_key != NULL && strcmp(entry->ptr_key, key) == 0){
+    size_t keylen = strlen(key);
+    uint32_t hash = string_hash_code(key, keylen);
+    int64_t position = dict_find_slot(my_dict, key, hash);
+    if (position >= 0){
         // update entry
-        entry->ptr_value = value;
+        my_dict->values[position] = value;
         return;
     }
-    // add new entry
-    uint16_t keylen = strlen(key);
-    char* keycopy = calloc(1 + keylen, sizeof *keycopy);
-    strcpy(keycopy, key);
-    entry->ptr_key = keycopy;
-    entry->ptr_value = value;
+    // add new entry, reusing a tombstone if there is one in the probe sequence
+    position = dict_find_free_slot(my_dict, hash);
+    if (my_dict->ctrl[position] == DICT_CTRL_DELETED)
+        my_dict->deleted--;
+    char* keycopy = malloc(keylen + 1);
+    memcpy(keycopy, key, keylen + 1);
+    my_dict->ctrl[position] = dict_hash_tag(hash);
+    my_dict->hashes[position] = hash;
+    my_dict->keys[position] = keycopy;
+    my_dict->values[position] = value;
     my_dict->size++;
     
-    if ((float)my_dict->size / my_dict->max_capacity > DICT_MAX_LOAD_FACTOR)
+    if ((float) (my_dict->size + my_dict->deleted) / my_dict->max_capacity > DICT_MAX_LOAD_FACTOR)
         dict_increase_and_rehash(my_dict);
-    
-    
 }
 
 void* lh_dict_get(LH_Dict* my_dict, const char* key) {
-    LH_DictItem* entry = dict_get_entry(my_dict, key);
-    if (entry == NULL)
-        return NULL;
-    else if (entry->ptr_key == NULL)
+    int64_t position = dict_find_slot(my_dict, key, string_hash_code(key, strlen(key)));
+    if (position < 0)
         return NULL;
-    else
-        return entry->ptr_value;
+    return my_dict->values[position];
 }
 
 void lh_dict_remove(LH_Dict* my_dict, const char* key){
-    LH_DictItem* entry = dict_get_entry(my_dict, key);
-    if (my_dict->size > 0 && entry != NULL){
-        if(entry->ptr_key != NULL && strcmp(entry->ptr_key, key) == 0){
-            strcpy(entry->ptr_key, "");
-            my_dict->size --;
-        }
-            //free(entry->ptr_key);
-        //entry->ptr_key = NULL;
-        entry->ptr_value = NULL;
-    }
+    int64_t position = dict_find_slot(my_dict, key, string_hash_code(key, strlen(key)));
+    if (position < 0)
+        return;
+    free(my_dict->keys[position]);
+    my_dict->ctrl[position] = DICT_CTRL_DELETED;
+    my_dict->size--;
+    my_dict->deleted++;
 }
 
 void lh_dict_free(LH_Dict* my_dict) {
-    int j;
+    uint32_t j;
     for (j = 0; j < my_dict->max_capacity; j++){
-        char* entry_key = (my_dict->items+j)->ptr_key;
-        if(entry_key != NULL)
-            free(entry_key);
+        if (my_dict->ctrl[j] != DICT_CTRL_EMPTY && my_dict->ctrl[j] != DICT_CTRL_DELETED)
+            free(my_dict->keys[j]);
     }
-    free(my_dict->items);
+    free(my_dict->ctrl);
+    free(my_dict->hashes);
+    free(my_dict->keys);
+    free(my_dict->values);
     free(my_dict);
 }
 
 LH_List* lh_dict_get_keys(LH_Dict* my_dict){
     LH_List* keys = lh_list_new();
-    int j;
+    uint32_t j;
     for (j = 0; j < my_dict->max_capacity; j++){
-        char* entry_key = (my_dict->items+j)->ptr_key;
-        if(entry_key != NULL)
-            lh_list_add(keys, entry_key);
+        if (my_dict->ctrl[j] != DICT_CTRL_EMPTY && my_dict->ctrl[j] != DICT_CTRL_DELETED)
+            lh_list_add(keys, my_dict->keys[j]);
     }
     return keys;
 }
 
+uint32_t name_table_slot(const LH_NameTable* table, uint64_t hash, uint16_t seed) {
+    uint64_t mixed = (hash ^ (seed * 0x9E3779B97F4A7C15ULL)) * 0xBF58476D1CE4E5B9ULL;
+    return (uint32_t) (mixed >> 32) & table->mask;
+}
+
+uint32_t name_table_bucket(const LH_NameTable* table, uint64_t hash) {
+    return (uint32_t) hash & table->bucket_mask;
+}
+
+int name_table_place_bucket(LH_NameTable* table, const char** names, const uint64_t* hashes, const uint16_t* members, uint16_t num_members, uint32_t bucket) {
+    uint16_t seed;
+    for (seed = 0; seed < NAME_TABLE_MAX_SEEDS; seed++) {
+        int j, k;
+        int placed = 1;
+        for (j = 0; j < num_members && placed; j++) {
+            uint32_t slot = name_table_slot(table, hashes[members[j]], seed);
+            if (table->names[slot] != NULL)
+                placed = 0;
+            // members of the same bucket must not collide with each other either
+            for (k = 0; k < j && placed; k++) {
+                if (name_table_slot(table, hashes[members[k]], seed) == slot)
+                    placed = 0;
+            }
+        }
+        if (!placed)
+            continue;
+        for (j = 0; j < num_members; j++) {
+            uint32_t slot = name_table_slot(table, hashes[members[j]], seed);
+            table->names[slot] = names[members[j]];
+            table->name_lengths[slot] = strlen(names[members[j]]);
+            table->indexes[slot] = members[j];
+        }
+        table->seeds[bucket] = seed;
+        return 1;
+    }
+    return 0;
+}
+
+int name_table_build_perfect(LH_NameTable* table, const char** names, const uint64_t* hashes, uint16_t count) {
+    uint32_t num_buckets = table->bucket_mask + 1;
+    uint16_t* bucket_sizes = calloc(num_buckets, sizeof *bucket_sizes);
+    uint16_t* members = malloc((count + 1) * sizeof *members);
+    int j, success = 1;
+    uint32_t bucket;
+    uint16_t size, max_size = 0;
+    for (j = 0; j < count; j++) {
+        bucket = name_table_bucket(table, hashes[j]);
+        bucket_sizes[bucket]++;
+        if (bucket_sizes[bucket] > max_size)
+            max_size = bucket_sizes[bucket];
+    }
+    // place the biggest buckets first, while the table is still empty
+    for (size = max_size; size > 0 && success; size--) {
+        for (bucket = 0; bucket < num_buckets && success; bucket++) {
+            if (bucket_sizes[bucket] != size)
+                continue;
+            uint16_t num_members = 0;
+            for (j = 0; j < count; j++) {
+                if (name_table_bucket(table, hashes[j]) == bucket)
+                    members[num_members++] = j;
+            }
+            success = name_table_place_bucket(table, names, hashes, members, num_members, bucket);
+        }
+    }
+    free(bucket_sizes);
+    free(members);
+    return success;
+}
+
+LH_NameTable* lh_name_table_new(const char** names, uint16_t count) {
+    LH_NameTable* table = malloc(sizeof *table);
+    // keep the load factor at 0.5 at most so that seeds are found quickly
+    uint32_t capacity = 4;
+    while (capacity < 2 * (uint32_t) count)
+        capacity *= 2;
+    table->mask = capacity - 1;
+    table->bucket_mask = capacity / 2 - 1;
+    table->names = calloc(capacity, sizeof *table->names);
+    table->name_lengths = malloc(capacity * sizeof *table->name_lengths);
+    table->indexes = malloc(capacity * sizeof *table->indexes);
+    table->seeds = calloc(table->bucket_mask + 1, sizeof *table->seeds);
+    // zeroed, so that no element is read uninitialized when count is 0
+    uint64_t* hashes = calloc(count + 1, sizeof *hashes);
+    int j;
+    for (j = 0; j < count; j++)
+        hashes[j] = lh_hash_bytes(names[j], strlen(names[j]), 0);
+
+    table->perfect = name_table_build_perfect(table, names, hashes, count);
+    if (!table->perfect) {
+        // fall back to linear probing, with seed 0 for every bucket
+        memset(table->names, 0, capacity * sizeof *table->names);
+        memset(table->seeds, 0, (table->bucket_mask + 1) * sizeof *table->seeds);
+        for (j = 0; j < count; j++) {
+            uint32_t slot = name_table_slot(table, hashes[j], 0);
+            while (table->names[slot] != NULL)
+                slot = (slot + 1) & table->mask;
+            table->names[slot] = names[j];
+            table->name_lengths[slot] = strlen(names[j]);
+            table->indexes[slot] = j;
+        }
+    }
+    free(hashes);
+    return table;
+}
+
+int lh_name_table_find(const LH_NameTable* table, const void* name, uint16_t length) {
+    uint64_t hash = lh_hash_bytes(name, length, 0);
+    uint32_t slot = name_table_slot(table, hash, table->seeds[name_table_bucket(table, hash)]);
+    while (table->names[slot] != NULL) {
+        if (table->name_lengths[slot] == length && memcmp(table->names[slot], name, length) == 0)
+            return table->indexes[slot];
+        if (table->perfect)
+            return -1;
+        slot = (slot + 1) & table->mask;
+    }
+    return -1;
+}
+
+void lh_name_table_free(LH_NameTable* table) {
+    free(table->names);
+    free(table->name_lengths);
+    free(table->indexes);
+    free(table->seeds);
+    free(table);
+}
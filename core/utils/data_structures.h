@@ -24,30 +24,55 @@ extern "C" {
 #include <stdint.h>
     
 #define LIST_INITIAL_CAPACITY 10
+    // number of items stored inside the LH_List struct before allocating an array
+#define LIST_INLINE_CAPACITY 4
 #define LIST_INCREMENT_CAPACITY_FACTOR 2
 #define DICT_INITIAL_CAPACITY 10
 #define DICT_INCREMENT_CAPACITY_FACTOR 2
-#define DICT_MAX_LOAD_FACTOR 0.5
+#define DICT_MAX_LOAD_FACTOR 0.75
+    // control bytes of the dictionary slots, full slots hold 7 bits of the hash of their key
+#define DICT_CTRL_EMPTY 0x80
+#define DICT_CTRL_DELETED 0xFE
+#define NAME_TABLE_MAX_SEEDS 1024
     
     typedef struct collection_item {
         void* ptr_this;
     }LH_ListItem;
     
     typedef struct list {
+        // points to inline_items until the list outgrows them
         LH_ListItem* items;
-        uint16_t size, max_capacity;
+        uint32_t size, max_capacity;
+        LH_ListItem inline_items[LIST_INLINE_CAPACITY];
     }LH_List;
     
-    typedef struct dictionary_item {
-        char* ptr_key;
-        void* ptr_value;
-    }LH_DictItem;
-    
     typedef struct dictionary {
-        LH_DictItem* items;
-        uint16_t size, max_capacity;
+        // one control byte per slot: DICT_CTRL_EMPTY, DICT_CTRL_DELETED or 
+        // the lower 7 bits of the hash of the key stored in the slot
+        uint8_t* ctrl;
+        // cached hash of the key stored in each slot, so that rehashing 
+        // never hashes keys again
+        uint32_t* hashes;
+        // copies of the keys owned by the dictionary, compared with strcmp when the hashes match
+        char** keys;
+        void** values;
+        // max_capacity is always a power of two, deleted is the number of tombstones
+        uint32_t size, max_capacity, deleted;
     }LH_Dict;
     
+    typedef struct name_table {
+        // for each slot, the name stored in it (NULL if empty) and its length
+        const char** names;
+        uint16_t* name_lengths;
+        // for each slot, the index of the name in the array it was built from
+        uint16_t* indexes;
+        // names are spread in buckets, each bucket has the seed used to place its names
+        uint16_t* seeds;
+        uint32_t mask, bucket_mask;
+        // 1 if every name has its own slot, so a lookup never probes
+        uint8_t perfect;
+    }LH_NameTable;
+    
     /**
      * Creates a new list with default initial capacity. 
      * 
@@ -57,9 +82,11 @@ extern "C" {
      * is dynamically allocated, so do not forget to free that memory using
      * the lh_list_free.
      * 
-     * The default initial
-     * capacity can be changed at compile time by changing the value of the
-     * directive LIST_INITIAL_CAPACITY in lhings.h.
+     * The first LIST_INLINE_CAPACITY items are stored inside the LH_List 
+     * struct itself, so short lists need a single allocation. When the list
+     * outgrows them, an array of at least LIST_INITIAL_CAPACITY items is 
+     * allocated. Since items may point inside the struct, an LH_List must 
+     * never be copied by value.
      * @return A pointer to the LH_List struct created.
      */
     LH_List* lh_list_new();
@@ -78,8 +105,28 @@ extern "C" {
      * defined in lhings.h.
      * @param my_list
      * @param item
+     * @return 1 if the item was added, 0 if the list could not be resized.
+     */
+    int lh_list_add(LH_List* my_list, void* item);
+    
+    /**
+     * Makes sure the list can hold at least the given number of items 
+     * without being resized again.
+     * @param my_list
+     * @param capacity
+     * @return 1 on success, 0 if the memory could not be allocated.
+     */
+    int lh_list_reserve(LH_List* my_list, uint32_t capacity);
+    
+    /**
+     * Adds all the given items at the end of the list, resizing it at most once.
+     * @param my_list
+     * @param items Array of pointers to the items to add.
+     * @param count The number of items in the array.
+     * @return 1 if the items were added, 0 if the list could not be resized,
+     * in which case the list is not modified.
      */
-    void lh_list_add(LH_List* my_list, void* item);
+    int lh_list_add_all(LH_List* my_list, void* const* items, uint32_t count);
     /**
      * Retrieves the item of the list with the given index. The index of the 
      * first and last items are 0, and my_list->size - 1, respectively. 
@@ -89,7 +136,7 @@ extern "C" {
      * appropriate data type before using it. If index is negative or greater than
      * my_list->size - 1, NULL is returned.
      */
-    void* lh_list_get(LH_List* my_list, uint16_t index);
+    void* lh_list_get(LH_List* my_list, uint32_t index);
     
     /**
      * Frees the memory allocated by lh_list_new and lh_list_new_custom_capacity.
@@ -102,11 +149,15 @@ extern "C" {
      * 
      * A dictionary is a dynamic data structure that stores key - value pairs.
      * In this dictionary implementation, keys are always strings, and values can
-     * be any data type. This implementation uses a simple and fast hash based
-     * approach to index items and being able to retrieve them. 
+     * be any data type. This implementation is an open addressing hash table 
+     * with linear probing. Every slot has a control byte holding 7 bits of the 
+     * hash of its key, so most slots whose key does not match are discarded 
+     * without reading the key. Removed keys leave a tombstone behind.
      * 
-     * When the dictionary is full, its size is automatically increased and its
-     * elements rehashed.
+     * When the load of the dictionary (including tombstones) exceeds 
+     * DICT_MAX_LOAD_FACTOR, it is rehashed in place: if most of the load are
+     * tombstones they are purged keeping the capacity, otherwise the capacity
+     * is multiplied by DICT_INCREMENT_CAPACITY_FACTOR.
      * 
      * The default initial
      * capacity can be changed at compile time by changing the value of the
@@ -121,16 +172,17 @@ extern "C" {
      * If the size
      * of the dictionary is known in advanced providing its value will allow making
      * better use of available memory.
-     * @param capacity
+     * @param capacity The number of slots, which is rounded up to the next
+     * power of two.
      * @return 
      */
     LH_Dict* lh_dict_new_custom_capacity(int capacity);
     /**
      * Stores the given key - value pair in the dictionary. 
      * 
-     * This function makes a copy of the given key, which is automatically freed
-     * when calling lh_dict_free. No copy is make of the value, only the pointer 
-     * to it is stored. 
+     * The dictionary stores its own copy of the given key, which is freed
+     * when the entry is removed or the dictionary is freed. No copy is made
+     * of the value, only the pointer to it is stored. 
      * 
      * @param my_dict
      * @param key A pointer to the string that holds the value of the key. Bear in mind that this dictionary implementation does not allow for NULL keys.
@@ -169,6 +221,39 @@ extern "C" {
      */
     LH_List* lh_dict_get_keys(LH_Dict* my_dict);
 
+    /**
+     * Builds an immutable table that maps each of the given names to its
+     * index in the array. 
+     * 
+     * The table is meant for sets of names that do not change once built,
+     * like the names of the actions of a device. It is a perfect hash table:
+     * names are first distributed in buckets, and for each bucket a seed is
+     * searched that places all its names in free slots, so that any lookup costs
+     * a single hash and a single memcmp. If a bucket cannot be placed in
+     * NAME_TABLE_MAX_SEEDS attempts (for instance because a name is repeated),
+     * names are stored using linear probing instead.
+     * @param names Array of null terminated names. Names are not copied, so
+     * they must outlive the table.
+     * @param count The number of names in the array.
+     * @return A pointer to the LH_NameTable created.
+     */
+    LH_NameTable* lh_name_table_new(const char** names, uint16_t count);
+    
+    /**
+     * Returns the index of the given name in the array the table was built from.
+     * @param table
+     * @param name The bytes of the name, which do not need to be null terminated.
+     * @param length The length of the name.
+     * @return The index of the name, or -1 if the table does not contain it.
+     */
+    int lh_name_table_find(const LH_NameTable* table, const void* name, uint16_t length);
+    
+    /**
+     * Frees the memory allocated by lh_name_table_new.
+     * @param table
+     */
+    void lh_name_table_free(LH_NameTable* table);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -0,0 +1,118 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include "string_pool.h"
+#include "utils.h"
+
+typedef struct interned_string {
+    uint32_t hash;
+    uint32_t length;
+    char chars[];
+} InternedString;
+
+typedef struct string_pool {
+    // open addressing table of interned strings, NULL if the slot is empty
+    InternedString **slots;
+    uint32_t size, capacity;
+} StringPool;
+
+static StringPool pool = {NULL, 0, 0};
+
+InternedString* interned_header(const char *interned) {
+    return (InternedString *) (interned - offsetof(InternedString, chars));
+}
+
+/**
+ * Returns the slot that holds the given bytes, or the empty slot where they
+ * should be inserted.
+ */
+uint32_t string_pool_find_slot(const void *bytes, uint32_t length, uint32_t hash) {
+    uint32_t mask = pool.capacity - 1;
+    uint32_t position = hash & mask;
+    while (pool.slots[position] != NULL) {
+        InternedString *entry = pool.slots[position];
+        if (entry->hash == hash && entry->length == length && memcmp(entry->chars, bytes, length) == 0)
+            break;
+        position = (position + 1) & mask;
+    }
+    return position;
+}
+
+int string_pool_grow() {
+    uint32_t new_capacity = pool.capacity == 0 ? STRING_POOL_INITIAL_CAPACITY : pool.capacity * 2;
+    InternedString **new_slots = calloc(new_capacity, sizeof *new_slots);
+    if (new_slots == NULL)
+        return 0;
+    uint32_t j;
+    for (j = 0; j < pool.capacity; j++) {
+        InternedString *entry = pool.slots[j];
+        if (entry == NULL)
+            continue;
+        uint32_t position = entry->hash & (new_capacity - 1);
+        while (new_slots[position] != NULL)
+            position = (position + 1) & (new_capacity - 1);
+        new_slots[position] = entry;
+    }
+    free(pool.slots);
+    pool.slots = new_slots;
+    pool.capacity = new_capacity;
+    return 1;
+}
+
+const char* lh_intern(const char *string) {
+    return lh_intern_len(string, strlen(string));
+}
+
+const char* lh_intern_len(const void *bytes, uint32_t length) {
+    // keep the load factor below 0.5
+    if (2 * (pool.size + 1) > pool.capacity && !string_pool_grow())
+        return NULL;
+    uint32_t hash = (uint32_t) lh_hash_bytes(bytes, length, 0);
+    uint32_t position = string_pool_find_slot(bytes, length, hash);
+    if (pool.slots[position] != NULL)
+        return pool.slots[position]->chars;
+
+    InternedString *entry = malloc(sizeof *entry + length + 1);
+    if (entry == NULL)
+        return NULL;
+    entry->hash = hash;
+    entry->length = length;
+    memcpy(entry->chars, bytes, length);
+    entry->chars[length] = 0;
+    pool.slots[position] = entry;
+    pool.size++;
+    return entry->chars;
+}
+
+const char* lh_intern_lookup(const void *bytes, uint32_t length) {
+    if (pool.capacity == 0)
+        return NULL;
+    uint32_t hash = (uint32_t) lh_hash_bytes(bytes, length, 0);
+    uint32_t position = string_pool_find_slot(bytes, length, hash);
+    if (pool.slots[position] == NULL)
+        return NULL;
+    return pool.slots[position]->chars;
+}
+
+uint32_t lh_intern_length(const char *interned) {
+    return interned_header(interned)->length;
+}
+
+uint32_t lh_intern_hash(const char *interned) {
+    return interned_header(interned)->hash;
+}
@@ -0,0 +1,98 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file string_pool.h
+ * @brief Pool of interned strings.
+ * 
+ * Interning a string returns a canonical pointer for its contents: two
+ * strings with the same characters are always interned to the same pointer,
+ * so they can be compared with ==. The length and hash of every interned
+ * string are computed once and stored right before its characters, so 
+ * lh_intern_length() and lh_intern_hash() do not walk the string.
+ * 
+ * Interned strings are null terminated and live until the process ends, so
+ * only the names of the model (components, actions and events), which are
+ * registered before the devices start, should be interned. Strings received
+ * from the network must be resolved with lh_intern_lookup() instead.
+ * 
+ * The pool has no lock: lh_intern() and lh_intern_len() may only be called
+ * while no other thread uses the pool. Once the devices are started nothing
+ * is interned, and lh_intern_lookup() can be called from any thread.
+ */
+
+#ifndef STRING_POOL_H
+#define	STRING_POOL_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define STRING_POOL_INITIAL_CAPACITY 64
+
+    /**
+     * Returns the interned copy of the given null terminated string, adding
+     * it to the pool if needed.
+     * @param string
+     * @return The canonical pointer for the contents of string, or null if
+     * memory could not be allocated.
+     */
+    const char* lh_intern(const char *string);
+
+    /**
+     * Returns the interned copy of the given bytes, adding it to the pool if
+     * needed. The bytes do not need to be null terminated.
+     * @param bytes
+     * @param length
+     * @return The canonical pointer for the given bytes, or null if memory
+     * could not be allocated.
+     */
+    const char* lh_intern_len(const void *bytes, uint32_t length);
+
+    /**
+     * Returns the interned copy of the given bytes only if it is already in
+     * the pool. Use it for strings received from the network that should 
+     * match an existing name, so that the pool does not grow with them.
+     * @param bytes
+     * @param length
+     * @return The canonical pointer for the given bytes, or null if they 
+     * were never interned.
+     */
+    const char* lh_intern_lookup(const void *bytes, uint32_t length);
+
+    /**
+     * Returns the length of an interned string in constant time.
+     * @param interned A pointer returned by lh_intern, lh_intern_len or lh_intern_lookup.
+     * @return 
+     */
+    uint32_t lh_intern_length(const char *interned);
+
+    /**
+     * Returns the hash of an interned string, computed with lh_hash_bytes
+     * when it was interned.
+     * @param interned A pointer returned by lh_intern, lh_intern_len or lh_intern_lookup.
+     * @return 
+     */
+    uint32_t lh_intern_hash(const char *interned);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* STRING_POOL_H */
+
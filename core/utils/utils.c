@@ -17,20 +17,68 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "utils.h"
+#include "wire.h"
+#include "../../abstraction/random/lhings_random.h"
+#include "../../abstraction/threading/lhings_thread.h"
 
 char* encode_hex(const uint8_t *intArray, size_t len, char* hexStr) {
-    char byte[3] = "FF";
-    int j;
+    hexStr[0] = '0';
+    hexStr[1] = 'x';
+    lh_hex_encode(intArray, len, hexStr + 2, 2 * len + 1);
+    return hexStr;
+}
 
-    strcpy(hexStr, "0x");
+// the two characters of every byte, so that each byte takes a single lookup
+static const char hex_pairs[513] =
+    "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+    "202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+    "404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+    "606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+    "808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+    "a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+    "c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+    "e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
 
-    for (j = 0; j < len; j++) {
-        sprintf(byte, "%02x", *(intArray + j));
-        strcat(hexStr, byte);
+char* lh_hex_encode(const uint8_t *bytes, size_t len, char *out, size_t out_len) {
+    if (out_len == 0)
+        return out;
+    if (len > (out_len - 1) / 2)
+        len = (out_len - 1) / 2;
+    char *cursor = out;
+#if defined(__SSE2__)
+    // split every byte in its two nibbles, interleaved high first, and turn
+    // each nibble into '0' + nibble, plus 39 more for the letters
+    const __m128i low_mask = _mm_set1_epi8(0x0F);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i digits = _mm_set1_epi8('0');
+    const __m128i letters = _mm_set1_epi8('a' - '0' - 10);
+    while (len >= 16) {
+        __m128i value = _mm_loadu_si128((const __m128i *) bytes);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(value, 4), low_mask);
+        __m128i low = _mm_and_si128(value, low_mask);
+        __m128i first = _mm_unpacklo_epi8(high, low);
+        __m128i second = _mm_unpackhi_epi8(high, low);
+        first = _mm_add_epi8(_mm_add_epi8(first, digits), _mm_and_si128(_mm_cmpgt_epi8(first, nine), letters));
+        second = _mm_add_epi8(_mm_add_epi8(second, digits), _mm_and_si128(_mm_cmpgt_epi8(second, nine), letters));
+        _mm_storeu_si128((__m128i *) cursor, first);
+        _mm_storeu_si128((__m128i *) (cursor + 16), second);
+        bytes += 16;
+        cursor += 32;
+        len -= 16;
     }
-
-    return hexStr;
+#endif
+    while (len > 0) {
+        memcpy(cursor, hex_pairs + 2 * *bytes, 2);
+        bytes++;
+        cursor += 2;
+        len--;
+    }
+    *cursor = 0;
+    return out;
 }
 
 int is_big_endian(void) {
@@ -43,46 +91,24 @@ int is_big_endian(void) {
     return bint.c[0] == 1;
 }
 
+// the byte helpers are kept for existing callers, the work is done by wire.h
+
 uint8_t* uint32_to_byte_array(uint32_t number, uint8_t *byte_array) {
-    if (is_big_endian) {
-        byte_array[0] = number >> 24;
-        byte_array[1] = (number & 0x00ff0000) >> 16;
-        byte_array[2] = (number & 0x0000ff00) >> 8;
-        byte_array[3] = number & 0x000000ff;
-    } else {
-        byte_array[0] = number & 0x000000ff;
-        byte_array[1] = (number & 0x0000ff00) >> 8;
-        byte_array[2] = (number & 0x00ff0000) >> 16;
-        byte_array[3] = number >> 24;
-    }
+    store_be32(byte_array, number);
     return byte_array;
 }
 
 uint32_t byte_array_to_uint32(const uint8_t *byte_array) {
-    if (is_big_endian) {
-        return (uint32_t) (byte_array[0] << 24 | byte_array[1] << 16 | byte_array[2] << 8 | byte_array[3]);
-    } else {
-        return (uint32_t) (byte_array[3] << 24 | byte_array[2] << 16 | byte_array[1] << 8 | byte_array[0]);
-    }
+    return load_be32(byte_array);
 }
 
 uint8_t* uint16_to_byte_array(uint16_t number, uint8_t *byte_array) {
-    if (is_big_endian) {
-        byte_array[0] = number >> 8;
-        byte_array[1] = number & 0x00ff;
-    } else {
-        byte_array[0] = number & 0x00ff;
-        byte_array[1] = number >> 8;
-    }
+    store_be16(byte_array, number);
     return byte_array;
 }
 
 uint16_t byte_array_to_uint16_t(const uint8_t *byte_array) {
-
-    if (is_big_endian) {
-        return (uint16_t) (byte_array[0] << 8 | byte_array[1]);
-    } else
-        return (uint16_t) (byte_array[1] << 8 | byte_array[0]);
+    return load_be16(byte_array);
 }
 
 int uuid_string_to_byte_array(const char *uuid, uint8_t *bytes) {
@@ -93,54 +119,54 @@ int uuid_string_to_byte_array(const char *uuid, uint8_t *bytes) {
     buffer[3] = uuid[3];
     buffer[4] = 0;
     long number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes);
+    store_be16(bytes, (uint16_t) number);
     buffer[0] = uuid[4];
     buffer[1] = uuid[5];
     buffer[2] = uuid[6];
     buffer[3] = uuid[7];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 2);
+    store_be16(bytes + 2, (uint16_t) number);
     buffer[0] = uuid[9];
     buffer[1] = uuid[10];
     buffer[2] = uuid[11];
     buffer[3] = uuid[12];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 4);
+    store_be16(bytes + 4, (uint16_t) number);
     buffer[0] = uuid[14];
     buffer[1] = uuid[15];
     buffer[2] = uuid[16];
     buffer[3] = uuid[17];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 6);
+    store_be16(bytes + 6, (uint16_t) number);
     buffer[0] = uuid[19];
     buffer[1] = uuid[20];
     buffer[2] = uuid[21];
     buffer[3] = uuid[22];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 8);
+    store_be16(bytes + 8, (uint16_t) number);
     buffer[0] = uuid[24];
     buffer[1] = uuid[25];
     buffer[2] = uuid[26];
     buffer[3] = uuid[27];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 10);
+    store_be16(bytes + 10, (uint16_t) number);
     buffer[0] = uuid[28];
     buffer[1] = uuid[29];
     buffer[2] = uuid[30];
     buffer[3] = uuid[31];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 12);
+    store_be16(bytes + 12, (uint16_t) number);
     buffer[0] = uuid[32];
     buffer[1] = uuid[33];
     buffer[2] = uuid[34];
     buffer[3] = uuid[35];
     number = strtol(buffer, NULL, 16);
-    uint16_to_byte_array((uint16_t) number, bytes + 14);
+    store_be16(bytes + 14, (uint16_t) number);
     return 1;
 }
 
 float byte_array_to_float(const uint8_t *byte_array) {
-    uint32_t number = byte_array_to_uint32(byte_array);
+    uint32_t number = load_be32(byte_array);
 
     union {
         uint32_t i;
@@ -157,5 +183,94 @@ void float_to_byte_array(float number, uint8_t * byte_array) {
         float f;
     } u;
     u.f = number;
-    uint32_to_byte_array(u.i, byte_array);
-}
\ No newline at end of file
+    store_be32(byte_array, u.i);
+}
+
+#define HASH_PRIME_1 0x9E3779B185EBCA87ULL
+#define HASH_PRIME_2 0xC2B2AE3D27D4EB4FULL
+#define HASH_PRIME_3 0x165667B19E3779F9ULL
+#define HASH_PRIME_4 0x85EBCA77C2B2AE63ULL
+#define HASH_PRIME_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+uint64_t lh_hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *cursor = data;
+    uint64_t hash = seed + HASH_PRIME_5 + len;
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, cursor, 8);
+        word = rotate_left(word * HASH_PRIME_2, 31) * HASH_PRIME_1;
+        hash = rotate_left(hash ^ word, 27) * HASH_PRIME_1 + HASH_PRIME_4;
+        cursor += 8;
+        len -= 8;
+    }
+    if (len >= 4) {
+        uint32_t word;
+        memcpy(&word, cursor, 4);
+        hash = rotate_left(hash ^ (word * HASH_PRIME_1), 23) * HASH_PRIME_2 + HASH_PRIME_3;
+        cursor += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        hash = rotate_left(hash ^ (*cursor * HASH_PRIME_5), 11) * HASH_PRIME_1;
+        cursor++;
+        len--;
+    }
+    // final avalanche
+    hash ^= hash >> 33;
+    hash *= HASH_PRIME_2;
+    hash ^= hash >> 29;
+    hash *= HASH_PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+// state of the generator of the thread, all zero until it is seeded
+static LH_THREAD_LOCAL uint64_t random_state[4];
+
+/**
+ * Seeds the generator of the thread, spreading the seed with splitmix64 so
+ * that the state is never all zero.
+ */
+static void random_seed_thread() {
+    uint64_t seed[4];
+    int j;
+    lh_random_seed((uint8_t *) seed, sizeof seed);
+    for (j = 0; j < 4; j++) {
+        uint64_t z = seed[j] + (j + 1) * HASH_PRIME_1;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        random_state[j] = z ^ (z >> 31);
+    }
+}
+
+uint64_t lh_random_uint64(void) {
+    uint64_t *s = random_state;
+    if ((s[0] | s[1] | s[2] | s[3]) == 0)
+        random_seed_thread();
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+void lh_random_bytes(uint8_t *bytes, size_t len) {
+    while (len >= 8) {
+        uint64_t word = lh_random_uint64();
+        memcpy(bytes, &word, 8);
+        bytes += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t word = lh_random_uint64();
+        memcpy(bytes, &word, len);
+    }
+}
@@ -34,6 +34,20 @@ extern "C" {
      */
     char* encode_hex(const uint8_t *intArray, size_t len, char* hexStr);
 
+    /**
+     * Writes the lower case hex representation of an array of bytes, without
+     * prefix, followed by a null character. Sixteen bytes are encoded per
+     * step where SSE2 is available, and one per table lookup elsewhere.
+     * @param bytes
+     * @param len The number of bytes to encode.
+     * @param out Where the characters are written.
+     * @param out_len The size of out. Bytes that do not fit, 2 * len + 1
+     * characters are needed, are left out; nothing is written if it is 0.
+     * @return out, so that it can be passed to the log functions, which only
+     * evaluate their arguments when the line is written.
+     */
+    char* lh_hex_encode(const uint8_t *bytes, size_t len, char *out, size_t out_len);
+
     /**
      * Returns true if host processor is big endian, false otherwise.
      * @return 
@@ -100,6 +114,36 @@ extern "C" {
      * @param number
      */
     void float_to_byte_array(float number, uint8_t * byte_array);
+
+    /**
+     * Returns a 64 bit hash of the given bytes. Based on the mixing steps of
+     * xxHash64, it is fast for the short strings (names, keys) hashed by the
+     * library and distributes them well enough for open addressing tables.
+     * Hashes depend on host endianness, so they must not be sent over the network.
+     * @param data
+     * @param len Number of bytes to hash.
+     * @param seed Different seeds produce unrelated hashes for the same data.
+     * @return
+     */
+    uint64_t lh_hash_bytes(const void *data, size_t len, uint64_t seed);
+
+    /**
+     * Returns 64 pseudo random bits from a xoshiro256** generator. Each
+     * thread has its own generator, seeded with lh_random_seed() the first
+     * time the thread calls it, so calls never contend and threads or
+     * devices started at the same time get unrelated sequences. Fit for
+     * transaction ids and ports, not for keys.
+     * @return 
+     */
+    uint64_t lh_random_uint64(void);
+
+    /**
+     * Fills a buffer with bytes from the generator of lh_random_uint64, eight
+     * bytes per step.
+     * @param bytes
+     * @param len
+     */
+    void lh_random_bytes(uint8_t *bytes, size_t len);
     
     
 #ifdef	__cplusplus
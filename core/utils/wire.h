@@ -0,0 +1,213 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file wire.h
+ * @brief Big endian loads and stores, and bounds checked cursors to parse and
+ * build STUN messages and their attributes.
+ *
+ * Everything is inline and the byte order of the host is known at compile
+ * time, so on little endian hosts a load or store is a single unaligned move
+ * plus a byte swap, and on big endian hosts just the move.
+ *
+ * Cursors never read or write outside their buffer. The first operation that
+ * does not fit sets failed, and from then on every operation does nothing and
+ * reads return zero, so a parser can read a whole header and check failed
+ * once at the end.
+ */
+
+#ifndef WIRE_H
+#define	WIRE_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define WIRE_FROM_HOST16(x) (x)
+#define WIRE_FROM_HOST32(x) (x)
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define WIRE_FROM_HOST16(x) __builtin_bswap16(x)
+#define WIRE_FROM_HOST32(x) __builtin_bswap32(x)
+#else
+    // unknown byte order, fall back to shifts
+#define WIRE_PORTABLE
+#endif
+
+    static inline uint16_t load_be16(const uint8_t *bytes) {
+#ifdef WIRE_PORTABLE
+        return (uint16_t) (bytes[0] << 8 | bytes[1]);
+#else
+        uint16_t value;
+        memcpy(&value, bytes, sizeof value);
+        return WIRE_FROM_HOST16(value);
+#endif
+    }
+
+    static inline uint32_t load_be32(const uint8_t *bytes) {
+#ifdef WIRE_PORTABLE
+        return (uint32_t) bytes[0] << 24 | (uint32_t) bytes[1] << 16 | (uint32_t) bytes[2] << 8 | bytes[3];
+#else
+        uint32_t value;
+        memcpy(&value, bytes, sizeof value);
+        return WIRE_FROM_HOST32(value);
+#endif
+    }
+
+    static inline void store_be16(uint8_t *bytes, uint16_t value) {
+#ifdef WIRE_PORTABLE
+        bytes[0] = (uint8_t) (value >> 8);
+        bytes[1] = (uint8_t) value;
+#else
+        value = WIRE_FROM_HOST16(value);
+        memcpy(bytes, &value, sizeof value);
+#endif
+    }
+
+    static inline void store_be32(uint8_t *bytes, uint32_t value) {
+#ifdef WIRE_PORTABLE
+        bytes[0] = (uint8_t) (value >> 24);
+        bytes[1] = (uint8_t) (value >> 16);
+        bytes[2] = (uint8_t) (value >> 8);
+        bytes[3] = (uint8_t) value;
+#else
+        value = WIRE_FROM_HOST32(value);
+        memcpy(bytes, &value, sizeof value);
+#endif
+    }
+
+    /**
+     * Cursor over bytes received from the network.
+     */
+    typedef struct wire_reader {
+        const uint8_t *bytes;
+        uint32_t length;
+        // offset of the next byte to read, never greater than length
+        uint32_t position;
+        uint8_t failed;
+    } WireReader;
+
+    static inline void wire_reader_init(WireReader *reader, const uint8_t *bytes, uint32_t length) {
+        reader->bytes = bytes;
+        reader->length = length;
+        reader->position = 0;
+        reader->failed = 0;
+    }
+
+    static inline uint32_t wire_remaining(const WireReader *reader) {
+        return reader->length - reader->position;
+    }
+
+    /**
+     * Advances the reader.
+     * @return The bytes skipped, or null if there are not enough of them.
+     */
+    static inline const uint8_t* wire_read_bytes(WireReader *reader, uint32_t count) {
+        if (reader->failed || count > reader->length - reader->position) {
+            reader->failed = 1;
+            return NULL;
+        }
+        const uint8_t *bytes = reader->bytes + reader->position;
+        reader->position += count;
+        return bytes;
+    }
+
+    static inline uint8_t wire_read_u8(WireReader *reader) {
+        const uint8_t *bytes = wire_read_bytes(reader, 1);
+        return bytes == NULL ? 0 : bytes[0];
+    }
+
+    static inline uint16_t wire_read_be16(WireReader *reader) {
+        const uint8_t *bytes = wire_read_bytes(reader, 2);
+        return bytes == NULL ? 0 : load_be16(bytes);
+    }
+
+    static inline uint32_t wire_read_be32(WireReader *reader) {
+        const uint8_t *bytes = wire_read_bytes(reader, 4);
+        return bytes == NULL ? 0 : load_be32(bytes);
+    }
+
+    /**
+     * Cursor over a buffer being filled to be sent.
+     */
+    typedef struct wire_writer {
+        uint8_t *bytes;
+        uint32_t capacity;
+        // offset of the next byte to write, never greater than capacity
+        uint32_t position;
+        uint8_t failed;
+    } WireWriter;
+
+    static inline void wire_writer_init(WireWriter *writer, uint8_t *bytes, uint32_t capacity) {
+        writer->bytes = bytes;
+        writer->capacity = capacity;
+        writer->position = 0;
+        writer->failed = 0;
+    }
+
+    /**
+     * Advances the writer.
+     * @return Where the next count bytes must be written, or null if they do
+     * not fit.
+     */
+    static inline uint8_t* wire_reserve(WireWriter *writer, uint32_t count) {
+        if (writer->failed || count > writer->capacity - writer->position) {
+            writer->failed = 1;
+            return NULL;
+        }
+        uint8_t *bytes = writer->bytes + writer->position;
+        writer->position += count;
+        return bytes;
+    }
+
+    static inline void wire_write_u8(WireWriter *writer, uint8_t value) {
+        uint8_t *bytes = wire_reserve(writer, 1);
+        if (bytes != NULL)
+            bytes[0] = value;
+    }
+
+    static inline void wire_write_be16(WireWriter *writer, uint16_t value) {
+        uint8_t *bytes = wire_reserve(writer, 2);
+        if (bytes != NULL)
+            store_be16(bytes, value);
+    }
+
+    static inline void wire_write_be32(WireWriter *writer, uint32_t value) {
+        uint8_t *bytes = wire_reserve(writer, 4);
+        if (bytes != NULL)
+            store_be32(bytes, value);
+    }
+
+    static inline void wire_write_bytes(WireWriter *writer, const void *value, uint32_t count) {
+        uint8_t *bytes = wire_reserve(writer, count);
+        if (bytes != NULL && count > 0)
+            memcpy(bytes, value, count);
+    }
+
+    static inline void wire_write_zeros(WireWriter *writer, uint32_t count) {
+        uint8_t *bytes = wire_reserve(writer, count);
+        if (bytes != NULL && count > 0)
+            memset(bytes, 0, count);
+    }
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* WIRE_H */
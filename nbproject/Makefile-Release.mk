@@ -52,9 +52,11 @@ OBJECTFILES= \
 	${OBJECTDIR}/core/utils/lhings_json_api.o \
 	${OBJECTDIR}/core/utils/utils.o \
 	${OBJECTDIR}/main.o \
+	${OBJECTDIR}/tests/arguments_attribute_tests.o \
 	${OBJECTDIR}/tests/data_structures_tests.o \
 	${OBJECTDIR}/tests/hmac_sha1_test.o \
 	${OBJECTDIR}/tests/logging_system_tests.o \
+	${OBJECTDIR}/tests/metrics_tests.o \
 	${OBJECTDIR}/tests/stun_message_tests.o
 
 
@@ -167,6 +169,11 @@ ${OBJECTDIR}/main.o: main.c
 	${RM} "$@.d"
 	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/main.o main.c
 
+${OBJECTDIR}/tests/arguments_attribute_tests.o: tests/arguments_attribute_tests.c 
+	${MKDIR} -p ${OBJECTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tests/arguments_attribute_tests.o tests/arguments_attribute_tests.c
+
 ${OBJECTDIR}/tests/data_structures_tests.o: tests/data_structures_tests.c 
 	${MKDIR} -p ${OBJECTDIR}/tests
 	${RM} "$@.d"
@@ -182,6 +189,11 @@ ${OBJECTDIR}/tests/logging_system_tests.o: tests/logging_system_tests.c
 	${RM} "$@.d"
 	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tests/logging_system_tests.o tests/logging_system_tests.c
 
+${OBJECTDIR}/tests/metrics_tests.o: tests/metrics_tests.c 
+	${MKDIR} -p ${OBJECTDIR}/tests
+	${RM} "$@.d"
+	$(COMPILE.c) -O2 -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/tests/metrics_tests.o tests/metrics_tests.c
+
 ${OBJECTDIR}/tests/stun_message_tests.o: tests/stun_message_tests.c 
 	${MKDIR} -p ${OBJECTDIR}/tests
 	${RM} "$@.d"
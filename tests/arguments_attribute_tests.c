@@ -0,0 +1,239 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/lhings.h"
+#include "../core/lhings_internal.h"
+#include "../core/stun-messaging/stun_arguments.h"
+#include "../core/utils/utils.h"
+
+/**
+ * Decodes all the arguments of the given attribute, returning the number of
+ * arguments read or -1 if the attribute is malformed.
+ */
+int count_arguments(const uint8_t *bytes, int length) {
+    StunArgumentsReader reader;
+    StunArgument argument;
+    int count = 0;
+    int status;
+    if (!stun_args_reader_init(&reader, bytes, length))
+        return -1;
+    while ((status = stun_args_next(&reader, &argument)) == STUN_ARGS_OK)
+        count++;
+    if (status == STUN_ARGS_ERROR)
+        return -1;
+    return count;
+}
+
+// what the action of TEST CASE 6 read through its view
+static int view_calls = 0;
+static int view_got_speed, view_got_ratio, view_got_label, view_got_mistyped;
+static int32_t view_speed;
+static float view_ratio;
+static char view_label[16];
+
+void view_action(const LH_Args *arguments) {
+    uint16_t label_length;
+    int32_t not_an_int;
+    view_calls++;
+    view_got_speed = lh_args_get_int(arguments, 0, &view_speed);
+    view_got_ratio = lh_args_get_float(arguments, 1, &view_ratio);
+    const char *label = lh_args_get_string_view(arguments, 2, &label_length);
+    view_got_label = label != NULL;
+    if (label != NULL)
+        snprintf(view_label, sizeof view_label, "%.*s", (int) label_length, label);
+    // a float read as an integer, and an index the action does not declare
+    view_got_mistyped = lh_args_get_int(arguments, 1, &not_an_int) || lh_args_get_int(arguments, 3, &not_an_int);
+}
+
+/**
+ * Builds the ARGUMENTS attribute of the given components and performs the
+ * action "move" of the device through its view, like the main loop does.
+ * @return The result of filling the view, the action only runs if it is 1.
+ */
+int perform_view_action(LH_Device *device, LH_List *components) {
+    int length;
+    uint8_t *bytes = stun_args_build(components, NULL, &length);
+    StunAttribute attribute;
+    attribute.attr_type = ATTR_ARGUMENTS;
+    attribute.bytes = bytes;
+    attribute.length = length;
+    LH_Action *action = device_get_action(device, (const uint8_t *) "move", 4);
+    int filled = action != NULL && fill_arguments_view(&attribute, action, &action->arguments_view);
+    if (filled)
+        action->action_function_view(&action->arguments_view);
+    free(bytes);
+    return filled;
+}
+
+/**
+ * Runs the test cases for the encoding and decoding of the ARGUMENTS attribute.
+ * @return
+ */
+int arguments_attribute_tests() {
+    puts("**********************************************************");
+    puts("****         Running arguments attribute tests        ****");
+    puts("**********************************************************");
+    puts("");
+
+    uint32_t number = 8000;
+    float temperature = 24.5;
+    char surname[] = "Lorenzo";
+    int length;
+
+    printf("TEST CASE 1: ");
+    LH_List *components = lh_list_new();
+    lh_list_add(components, lh_model_create_component("quantity", LH_TYPE_INTEGER, &number));
+    lh_list_add(components, lh_model_create_component("surname", LH_TYPE_STRING, surname));
+    lh_list_add(components, lh_model_create_component("temperature", LH_TYPE_FLOAT, &temperature));
+    uint8_t *bytes = stun_args_build(components, NULL, &length);
+    if (bytes == NULL || bytes[0] != 3 || bytes[4] != 0x02) {
+        printf("FAILED: three components were not encoded with the legacy encoding.\n");
+        return EXIT_FAILURE;
+    }
+    StunArgumentsReader reader;
+    StunArgument argument;
+    stun_args_reader_init(&reader, bytes, length);
+    stun_args_next(&reader, &argument);
+    stun_args_next(&reader, &argument);
+    if (!argument.is_string || argument.value_length != 7 || memcmp(argument.value, "Lorenzo", 7) != 0
+            || argument.name_length != 7 || memcmp(argument.name, "surname", 7) != 0) {
+        printf("FAILED: string argument was not decoded correctly.\n");
+        return EXIT_FAILURE;
+    }
+    stun_args_next(&reader, &argument);
+    if (argument.is_string || byte_array_to_float(argument.value) != temperature
+            || stun_args_next(&reader, &argument) != STUN_ARGS_END) {
+        printf("FAILED: float argument was not decoded correctly.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 2: ");
+    if (count_arguments(bytes, length - 1) != -1) {
+        printf("FAILED: truncated attribute was not detected.\n");
+        return EXIT_FAILURE;
+    }
+    free(bytes);
+    printf("OK (failed as expected)\n");
+
+    printf("TEST CASE 3: ");
+    char names[12][8];
+    int j;
+    for (j = 0; j < 12; j++) {
+        snprintf(names[j], 8, "comp%d", j);
+        lh_list_add(components, lh_model_create_component(names[j], j % 2 ? LH_TYPE_STRING : LH_TYPE_INTEGER, j % 2 ? (void *) surname : (void *) &number));
+    }
+    bytes = stun_args_build(components, NULL, &length);
+    if (bytes == NULL || bytes[0] != STUN_ARGS_EXTENDED_MARKER || count_arguments(bytes, length) != 15) {
+        printf("FAILED: fifteen components were not encoded with the extended encoding.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 4: ");
+    // declare more arguments than the attribute can hold
+    bytes[2] = 0xF0;
+    if (count_arguments(bytes, length) != -1) {
+        printf("FAILED: bad argument count was not detected.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK (failed as expected)\n");
+
+    free(bytes);
+    for (j = 0; j < components->size; j++)
+        lh_model_free_component(lh_list_get(components, j));
+    lh_list_free(components);
+
+    printf("TEST CASE 5: ");
+    LH_DeviceClass *device_class = lh_device_class_new();
+    int quantity_index = lh_class_add_status_component(device_class, "quantity", LH_TYPE_INTEGER);
+    int surname_index = lh_class_add_status_component(device_class, "surname", LH_TYPE_STRING);
+    LH_Device first, second;
+    memset(&first, 0, sizeof first);
+    memset(&second, 0, sizeof second);
+    lh_device_set_class(&first, device_class);
+    lh_device_set_class(&second, device_class);
+    *(uint32_t *) lh_device_value(&first, quantity_index) = 1;
+    *(uint32_t *) lh_device_value(&second, quantity_index) = 2;
+    *(char **) lh_device_value(&second, surname_index) = surname;
+    uint8_t *first_bytes = build_arguments_attribute(&first, &length);
+    int second_length;
+    bytes = build_arguments_attribute(&second, &second_length);
+    stun_args_reader_init(&reader, bytes, second_length);
+    stun_args_next(&reader, &argument);
+    if (first.status_components != second.status_components || first_bytes == NULL || bytes == NULL
+            || length != second_length - 7 || byte_array_to_uint32(argument.value) != 2
+            || lh_class_add_status_component(device_class, "late", LH_TYPE_INTEGER) != -1) {
+        printf("FAILED: devices of the same class did not keep their own values.\n");
+        return EXIT_FAILURE;
+    }
+    free(first_bytes);
+    free(bytes);
+    printf("OK\n");
+
+    printf("TEST CASE 6: ");
+    LH_Device device;
+    memset(&device, 0, sizeof device);
+    LH_List *declared = lh_list_new();
+    lh_list_add(declared, lh_model_create_component("speed", LH_TYPE_INTEGER, NULL));
+    lh_list_add(declared, lh_model_create_component("ratio", LH_TYPE_FLOAT, NULL));
+    lh_list_add(declared, lh_model_create_component("label", LH_TYPE_STRING, NULL));
+    lh_model_add_action_view(&device, "move", "Moves the device", declared, view_action);
+    int32_t speed = -42;
+    float ratio = 0.75;
+    char label[] = "north";
+    LH_Component *speed_component = lh_model_create_component("speed", LH_TYPE_INTEGER, &speed);
+    LH_Component *ratio_component = lh_model_create_component("ratio", LH_TYPE_FLOAT, &ratio);
+    // arguments are matched by name, so the label can be sent first
+    components = lh_list_new();
+    lh_list_add(components, lh_model_create_component("label", LH_TYPE_STRING, label));
+    lh_list_add(components, speed_component);
+    lh_list_add(components, ratio_component);
+    LH_List *unlabelled = lh_list_new();
+    lh_list_add(unlabelled, speed_component);
+    lh_list_add(unlabelled, ratio_component);
+    if (!perform_view_action(&device, components) || view_calls != 1 || view_got_mistyped
+            || !view_got_speed || view_speed != -42 || !view_got_ratio || view_ratio != ratio
+            || !view_got_label || strcmp(view_label, "north") != 0) {
+        printf("FAILED: the action did not read its arguments through the view.\n");
+        return EXIT_FAILURE;
+    }
+    // the next request does not carry the label
+    if (!perform_view_action(&device, unlabelled) || view_calls != 2
+            || !view_got_speed || !view_got_ratio || view_got_label) {
+        printf("FAILED: a missing argument was reported as present.\n");
+        return EXIT_FAILURE;
+    }
+    // speed sent as a string does not match the declared type, the action is not performed
+    LH_List *mistyped = lh_list_new();
+    lh_list_add(mistyped, lh_model_create_component("speed", LH_TYPE_STRING, label));
+    if (perform_view_action(&device, mistyped) || view_calls != 2) {
+        printf("FAILED: an argument of the wrong type was accepted.\n");
+        return EXIT_FAILURE;
+    }
+    for (j = 0; j < components->size; j++)
+        lh_model_free_component(lh_list_get(components, j));
+    lh_model_free_component(lh_list_get(mistyped, 0));
+    lh_list_free(components);
+    lh_list_free(unlabelled);
+    lh_list_free(mistyped);
+    printf("OK\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,205 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/utils/data_structures.h"
+#include "../core/utils/string_pool.h"
+
+/**
+ * Runs the test cases for the list and dictionary implementations.
+ * @return
+ */
+int data_structures_tests() {
+    puts("**********************************************************");
+    puts("****          Running data structures tests           ****");
+    puts("**********************************************************");
+    puts("");
+
+    int values[1000];
+    char key[16];
+    int j;
+    for (j = 0; j < 1000; j++)
+        values[j] = j;
+
+    printf("TEST CASE 1: ");
+    LH_Dict *dict = lh_dict_new();
+    lh_dict_put(dict, "X-Api-Key", &values[1]);
+    lh_dict_put(dict, "Content-Type", &values[2]);
+    lh_dict_put(dict, "X-Api-Key", &values[3]);
+    if (dict->size != 2 || lh_dict_get(dict, "X-Api-Key") != &values[3]
+            || lh_dict_get(dict, "Content-Type") != &values[2] || lh_dict_get(dict, "Accept") != NULL) {
+        printf("FAILED: put and get returned unexpected values.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 2: ");
+    lh_dict_remove(dict, "X-Api-Key");
+    lh_dict_remove(dict, "Accept");
+    LH_List *keys = lh_dict_get_keys(dict);
+    if (dict->size != 1 || lh_dict_get(dict, "X-Api-Key") != NULL || keys->size != 1
+            || strcmp(lh_list_get(keys, 0), "Content-Type") != 0) {
+        printf("FAILED: removed key is still in the dictionary.\n");
+        return EXIT_FAILURE;
+    }
+    lh_list_free(keys);
+    lh_dict_free(dict);
+    printf("OK\n");
+
+    printf("TEST CASE 3: ");
+    dict = lh_dict_new();
+    for (j = 0; j < 1000; j++) {
+        snprintf(key, sizeof key, "key%d", j);
+        lh_dict_put(dict, key, &values[j]);
+    }
+    for (j = 0; j < 1000; j += 2) {
+        snprintf(key, sizeof key, "key%d", j);
+        lh_dict_remove(dict, key);
+    }
+    for (j = 0; j < 1000; j++) {
+        snprintf(key, sizeof key, "key%d", j);
+        void *expected = j % 2 ? &values[j] : NULL;
+        if (lh_dict_get(dict, key) != expected) {
+            printf("FAILED: wrong value for %s after growing the dictionary.\n", key);
+            return EXIT_FAILURE;
+        }
+    }
+    if (dict->size != 500) {
+        printf("FAILED: expected 500 entries but found %u.\n", dict->size);
+        return EXIT_FAILURE;
+    }
+    lh_dict_free(dict);
+    printf("OK\n");
+
+    printf("TEST CASE 4: ");
+    // inserting and removing keys must not grow the dictionary forever
+    dict = lh_dict_new();
+    for (j = 0; j < 100000; j++) {
+        snprintf(key, sizeof key, "churn%d", j);
+        lh_dict_put(dict, key, &values[j % 1000]);
+        lh_dict_remove(dict, key);
+    }
+    lh_dict_put(dict, "last", &values[0]);
+    if (dict->max_capacity > 16 || dict->size != 1 || lh_dict_get(dict, "last") != &values[0]) {
+        printf("FAILED: tombstones were not purged, capacity is %u.\n", dict->max_capacity);
+        return EXIT_FAILURE;
+    }
+    lh_dict_free(dict);
+    printf("OK\n");
+
+    printf("TEST CASE 5: ");
+    LH_List *list = lh_list_new();
+    for (j = 0; j < LIST_INLINE_CAPACITY; j++)
+        lh_list_add(list, &values[j]);
+    if (list->items != list->inline_items) {
+        printf("FAILED: short list did not use its inline storage.\n");
+        return EXIT_FAILURE;
+    }
+    lh_list_add(list, &values[j]);
+    if (list->items == list->inline_items || list->size != LIST_INLINE_CAPACITY + 1
+            || lh_list_get(list, 0) != &values[0] || lh_list_get(list, LIST_INLINE_CAPACITY) != &values[LIST_INLINE_CAPACITY]) {
+        printf("FAILED: items were lost when moving out of the inline storage.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 6: ");
+    void *pointers[1000];
+    for (j = 0; j < 1000; j++)
+        pointers[j] = &values[j];
+    lh_list_add_all(list, pointers, 1000);
+    if (list->size != 1000 + LIST_INLINE_CAPACITY + 1 || lh_list_get(list, list->size - 1) != &values[999]
+            || lh_list_get(list, list->size) != NULL) {
+        printf("FAILED: bulk append returned unexpected values.\n");
+        return EXIT_FAILURE;
+    }
+    lh_list_free(list);
+    printf("OK\n");
+
+    printf("TEST CASE 7: ");
+    // sizes used to wrap at 65535 items
+    list = lh_list_new();
+    lh_list_reserve(list, 70000);
+    if (list->max_capacity != 70000) {
+        printf("FAILED: expected capacity 70000 after reserve, found %u.\n", list->max_capacity);
+        return EXIT_FAILURE;
+    }
+    for (j = 0; j < 100000; j++)
+        lh_list_add(list, &values[j % 1000]);
+    if (list->size != 100000 || lh_list_get(list, 99999) != &values[999]) {
+        printf("FAILED: list with 100000 items has size %u.\n", list->size);
+        return EXIT_FAILURE;
+    }
+    lh_list_free(list);
+    printf("OK\n");
+
+    printf("TEST CASE 8: ");
+    char name[] = "temperature";
+    const char *interned = lh_intern(name);
+    if (interned == name || lh_intern_len("temperature_max", 11) != interned
+            || lh_intern_length(interned) != 11 || strcmp(interned, name) != 0
+            || lh_intern_lookup("humidity", 8) != NULL || lh_intern("humidity") == interned) {
+        printf("FAILED: equal strings were not interned to the same pointer.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 9: ");
+    static char generated[200][16];
+    const char *names[200];
+    for (j = 0; j < 200; j++) {
+        snprintf(generated[j], sizeof generated[j], "action_%d", j);
+        names[j] = generated[j];
+    }
+    LH_NameTable *table = lh_name_table_new(names, 200);
+    for (j = 0; j < 200; j++) {
+        if (lh_name_table_find(table, names[j], strlen(names[j])) != j) {
+            printf("FAILED: %s was not found in the name table.\n", names[j]);
+            return EXIT_FAILURE;
+        }
+    }
+    // "action_1" is a prefix of "action_10" and "action_" of every name
+    if (lh_name_table_find(table, "action_200", 10) != -1 || lh_name_table_find(table, "action_", 7) != -1
+            || lh_name_table_find(table, "action_10", 8) != 1 || lh_name_table_find(table, "action_1x", 9) != -1) {
+        printf("FAILED: an unknown name was found in the name table.\n");
+        return EXIT_FAILURE;
+    }
+    lh_name_table_free(table);
+    printf("OK\n");
+
+    printf("TEST CASE 10: ");
+    const char *short_names[] = {"on", "onward", "temperature"};
+    table = lh_name_table_new(short_names, 3);
+    if (lh_name_table_find(table, "onward", 2) != 0 || lh_name_table_find(table, "onwards", 7) != -1
+            || lh_name_table_find(table, "temperature", 4) != -1 || lh_name_table_find(table, "o", 1) != -1
+            || lh_name_table_find(table, "temperature", 11) != 2) {
+        printf("FAILED: names that differ only in length were confused.\n");
+        return EXIT_FAILURE;
+    }
+    lh_name_table_free(table);
+    table = lh_name_table_new(NULL, 0);
+    if (lh_name_table_find(table, "on", 2) != -1 || lh_name_table_find(table, "", 0) != -1) {
+        printf("FAILED: a name was found in an empty table.\n");
+        return EXIT_FAILURE;
+    }
+    lh_name_table_free(table);
+    printf("OK\n");
+
+    return EXIT_SUCCESS;
+}
@@ -18,6 +18,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "../core/logging/log.h"
+#include "../core/logging/log_ring.h"
+#include "../abstraction/threading/lhings_thread.h"
+#include "../abstraction/timing/lhings_time.h"
 
 
 
@@ -82,6 +85,84 @@ int logging_system_tests() {
         return EXIT_FAILURE;
     }
     
+    puts("TEST CASE 6: ");
+    // log level is LOG_INFO, arguments of disabled lines must not be evaluated
+    int evaluations = 0;
+    log_debugf("debug message %d", ++evaluations);
+    log_errorf("test message error %d of %s", ++evaluations, "formatted");
+    if (evaluations == 1)
+        printf("OK\n");
+    else {
+        printf("FAILED! Expected 1 evaluation of arguments but found %d\n", evaluations);
+        return EXIT_FAILURE;
+    }
+    
+    puts("TEST CASE 7: ");
+    LogRing *ring = malloc(sizeof *ring);
+    LogRecord record;
+    log_ring_init(ring);
+    int j;
+    for (j = 0; j < LOG_RING_CAPACITY + 5; j++)
+        log_ring_push(ring, LOG_INFO, __FILE__, j, "queued message");
+    if (log_ring_dropped(ring) != 5) {
+        printf("FAILED! Expected 5 dropped records but found %d\n", (int) log_ring_dropped(ring));
+        return EXIT_FAILURE;
+    }
+    for (j = 0; log_ring_pop(ring, &record); j++) {
+        if (record.line != j) {
+            printf("FAILED! Expected record %d but found %d\n", j, record.line);
+            return EXIT_FAILURE;
+        }
+    }
+    if (j != LOG_RING_CAPACITY || !log_ring_is_empty(ring)) {
+        printf("FAILED! Expected %d records but found %d\n", LOG_RING_CAPACITY, j);
+        return EXIT_FAILURE;
+    }
+    free(ring);
+    printf("OK\n");
+    
+    puts("TEST CASE 8: ");
+    if (!log_start_async()) {
+        printf("FAILED! Writer thread could not be started\n");
+        return EXIT_FAILURE;
+    }
+    level = log_log(LOG_ERROR, "test message error written by the writer thread");
+    log_flush();
+    if (level == LOG_ERROR)
+        printf("OK\n");
+    else {
+        printf("FAILED! Expected ERROR but log_write_log returned %d\n", level);
+        return EXIT_FAILURE;
+    }
+    
+    puts("TEST CASE 9: ");
+    // static, the writer thread reports the suppressed lines after the test
+    static LogRateLimit limit;
+    int allowed = 0;
+    for (j = 0; j < 100; j++)
+        allowed += log_rate_limit_allow(&limit, LOG_WARNING, __FILE__, __LINE__);
+    if (allowed == LOG_RATE_LIMIT_BURST && limit.suppressed == 100 - LOG_RATE_LIMIT_BURST)
+        printf("OK\n");
+    else {
+        printf("FAILED! Expected %d lines allowed but found %d\n", LOG_RATE_LIMIT_BURST, allowed);
+        return EXIT_FAILURE;
+    }
+    for (j = 0; j < 1000; j++)
+        log_warnf_limited("flood of identical lines %d", j);
+    log_flush();
+    
+    puts("TEST CASE 10: ");
+    // the site stays quiet, the summary is written once its bucket refills
+    lh_sleep(1000 / LOG_RATE_LIMIT_PER_SEC + 2 * LOG_RATE_LIMIT_REPORT_MILLIS);
+    log_report_suppressed();
+    log_flush();
+    if (LH_ATOMIC_LOAD(&limit.suppressed) == 0 && LH_ATOMIC_LOAD(&limit.pending) == 0)
+        printf("OK\n");
+    else {
+        printf("FAILED! Expected the suppressed lines to be reported but %u are left\n", (unsigned) limit.suppressed);
+        return EXIT_FAILURE;
+    }
+    
     return EXIT_SUCCESS;
     
 }
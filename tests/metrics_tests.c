@@ -0,0 +1,151 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../core/metrics/metrics.h"
+#include "../core/metrics/prometheus.h"
+#include "../abstraction/threading/lhings_thread.h"
+#include "../abstraction/timing/lhings_time.h"
+
+static volatile int metrics_thread_done = 0;
+
+void count_from_thread(void *argument) {
+    int j;
+    for (j = 0; j < 1000; j++)
+        lh_metrics_inc(LH_COUNTER_RETRIES);
+    LH_ATOMIC_STORE(&metrics_thread_done, 1);
+}
+
+/**
+ * Runs the test cases for the metrics registry.
+ * @return 
+ */
+int metrics_tests() {
+    puts("**********************************************************");
+    puts("****               Running metrics tests              ****");
+    puts("**********************************************************");
+    puts("");
+
+    // use a separate snapshot for each test case, other tests may have updated the registry
+    static LH_MetricsSnapshot before, after;
+    uint32_t j;
+
+    printf("TEST CASE 1: ");
+    for (j = 0; j < 100000; j++) {
+        int index = lh_histogram_bucket_index(j);
+        if (j > lh_histogram_bucket_limit(index) || (index > 0 && j <= lh_histogram_bucket_limit(index - 1))) {
+            printf("FAILED: value %u recorded in bucket %d.\n", j, index);
+            return EXIT_FAILURE;
+        }
+    }
+    if (lh_histogram_bucket_index(UINT32_MAX) != LH_HISTOGRAM_BUCKETS - 1 
+            || lh_histogram_bucket_limit(LH_HISTOGRAM_BUCKETS - 1) != UINT32_MAX) {
+        printf("FAILED: largest value is not in the last bucket.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 2: ");
+    lh_metrics_snapshot(&before);
+    for (j = 1; j <= 1000; j++)
+        lh_metrics_record(LH_HISTOGRAM_HTTP_MICROS, j * 100);
+    lh_metrics_snapshot(&after);
+    LH_HistogramSnapshot *histogram = &after.histograms[LH_HISTOGRAM_HTTP_MICROS];
+    for (j = 0; j < LH_HISTOGRAM_BUCKETS; j++)
+        histogram->buckets[j] -= before.histograms[LH_HISTOGRAM_HTTP_MICROS].buckets[j];
+    histogram->count -= before.histograms[LH_HISTOGRAM_HTTP_MICROS].count;
+    uint32_t p50 = lh_histogram_percentile(histogram, 50);
+    uint32_t p99 = lh_histogram_percentile(histogram, 99);
+    if (histogram->count != 1000 || p50 < 50000 || p50 > 50000 * 1.125 || p99 < 99000 || p99 > 99000 * 1.125) {
+        printf("FAILED: expected p50 50000 and p99 99000 but found %u and %u.\n", p50, p99);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 3: ");
+    lh_metrics_snapshot(&before);
+    lh_metrics_add(LH_COUNTER_BYTES_SENT, 20);
+    if (!lh_thread_start(count_from_thread, NULL)) {
+        printf("FAILED: thread could not be started.\n");
+        return EXIT_FAILURE;
+    }
+    while (!LH_ATOMIC_LOAD(&metrics_thread_done))
+        lh_sleep(1);
+    lh_metrics_snapshot(&after);
+    if (after.counters[LH_COUNTER_RETRIES] - before.counters[LH_COUNTER_RETRIES] != 1000
+            || after.counters[LH_COUNTER_BYTES_SENT] - before.counters[LH_COUNTER_BYTES_SENT] != 20) {
+        printf("FAILED: counters of two threads were not added up.\n");
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 4: ");
+    static LH_PrometheusRenderer renderer;
+    static char text[32768];
+    size_t length = 0, written;
+    lh_metrics_set_gauge(LH_GAUGE_CLOCK_OFFSET_SECONDS, -3);
+    lh_prometheus_start(&renderer);
+    // render in the smallest chunks allowed
+    while ((written = lh_prometheus_render(&renderer, text + length, LH_PROMETHEUS_LINE_LEN)) > 0)
+        length += written;
+    text[length] = 0;
+    if (strstr(text, "# TYPE lhings_retries_total counter\nlhings_retries_total ") == NULL
+            || strstr(text, "\nlhings_clock_offset_seconds -3\n") == NULL
+            || strstr(text, "\nlhings_http_micros_bucket{le=\"4294967295\"} ") == NULL
+            || strstr(text, "\nlhings_keepalive_rtt_micros_count 0\n") == NULL || text[length - 1] != '\n') {
+        printf("FAILED: unexpected Prometheus text:\n%s\n", text);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 5: ");
+    static LH_DeviceMetrics slow, failing;
+    lh_device_metrics_register(&slow, "0a1b2c3d-0000-4000-8000-000000000001");
+    lh_device_metrics_register(&failing, "0a1b2c3d-0000-4000-8000-000000000002");
+    // a device is only listed once
+    lh_device_metrics_register(&slow, "0a1b2c3d-0000-4000-8000-000000000001");
+    lh_device_metrics_add(&slow, LH_DEVICE_COUNTER_ACTIONS_PERFORMED, 2);
+    lh_device_metrics_add(&slow, LH_DEVICE_COUNTER_ACTION_MICROS, 900000);
+    lh_device_metrics_keepalive_answered(&slow, 250000);
+    lh_device_metrics_add(&failing, LH_DEVICE_COUNTER_ACTION_ERRORS, 7);
+    lh_device_metrics_add(&failing, LH_DEVICE_COUNTER_KEEPALIVES_SENT, 3);
+    int listed = 0;
+    const LH_DeviceMetrics *device;
+    for (device = lh_device_metrics_first(); device != NULL; device = device->next)
+        listed++;
+    length = 0;
+    lh_prometheus_start(&renderer);
+    while ((written = lh_prometheus_render(&renderer, text + length, LH_PROMETHEUS_LINE_LEN)) > 0)
+        length += written;
+    text[length] = 0;
+    if (listed != 2 || lh_device_metrics_get(&slow, LH_DEVICE_COUNTER_KEEPALIVES_ANSWERED) != 1
+            || strstr(text, "# TYPE lhings_device_action_errors_total counter\n") == NULL
+            || strstr(text, "\nlhings_device_action_errors_total{device=\"0a1b2c3d-0000-4000-8000-000000000002\"} 7\n") == NULL
+            || strstr(text, "\nlhings_device_action_errors_total{device=\"0a1b2c3d-0000-4000-8000-000000000001\"} 0\n") == NULL
+            || strstr(text, "\nlhings_device_action_micros_total{device=\"0a1b2c3d-0000-4000-8000-000000000001\"} 900000\n") == NULL
+            || strstr(text, "\nlhings_device_keepalive_rtt_micros{device=\"0a1b2c3d-0000-4000-8000-000000000001\"} 250000\n") == NULL
+            || strstr(text, "\nlhings_device_keepalive_rtt_micros{device=\"0a1b2c3d-0000-4000-8000-000000000002\"} 0\n") == NULL
+            || text[length - 1] != '\n') {
+        printf("FAILED: unexpected metrics of the devices, %d listed:\n%s\n", listed, text);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    return EXIT_SUCCESS;
+}
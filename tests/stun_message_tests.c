@@ -17,8 +17,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "../core/stun-messaging/stun_message.h"
+#include "../core/stun-messaging/submission_queue.h"
 #include "../core/utils/utils.h"
+#include "../core/utils/wire.h"
+#include "../abstraction/timing/lhings_time.h"
 
 int stun_message_tests() {
     puts("**********************************************************");
@@ -157,5 +161,100 @@ int stun_message_tests() {
         printf("FAILED: message reported message type 0x%04x but 0x%04x was expected.\n", byte_array_to_uint16_t(message.bytes), 0x3ACA);
         return (EXIT_FAILURE);
     }
+
+    printf("TEST CASE 9: ");
+    // events queued by a producer come out in order, signed, and the ones that do not fit are dropped
+    char device_key[] = "45ced63d-a080-434a-a53b-df3d404814b2";
+    LH_Device device = {0};
+    device.username = "joseantonio";
+    device.uuid = "fd75e4a0-9dbc-e97a-1f15-92daaba51050";
+    device.api_key = device_key;
+    SubmissionQueue *queue = malloc(sizeof *queue);
+    submission_queue_init(queue, -1);
+    char name[16];
+    int j, queued = 0;
+    for (j = 0; j < SUBMISSION_QUEUE_CAPACITY + 3; j++) {
+        snprintf(name, sizeof name, "event%d", j);
+        queued += submission_queue_push_event(queue, &device, name, j % 2 ? "{}" : NULL);
+    }
+    StunMessage *queued_message;
+    SubmissionKind kind;
+    StunAttribute attribute;
+    for (j = 0; (queued_message = submission_queue_pop_message(queue, &kind, NULL)) != NULL; j++) {
+        snprintf(name, sizeof name, "event%d", j);
+        stun_process_stun_message(queued_message->bytes, queued_message->length, &message);
+        if (kind != SUBMISSION_EVENT || !stun_get_attribute(&message, ATTR_NAME, &attribute)
+                || attribute.length != strlen(name) || memcmp(attribute.bytes, name, attribute.length) != 0
+                || stun_get_attribute(&message, ATTR_PAYLOAD, &attribute) != j % 2
+                || !stun_is_integrity_correct(&message, device_key)) {
+            printf("FAILED: queued event %d was not sent as submitted.\n", j);
+            return EXIT_FAILURE;
+        }
+        stun_free(queued_message);
+    }
+    free(queue);
+    if (queued != SUBMISSION_QUEUE_CAPACITY || j != SUBMISSION_QUEUE_CAPACITY) {
+        printf("FAILED: %d events were queued and %d sent but %d were expected.\n", queued, j, SUBMISSION_QUEUE_CAPACITY);
+        return EXIT_FAILURE;
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 10: ");
+    // the common attributes are encoded once, and every message gets the current time
+    uint8_t uuid_bytes[16];
+    uuid_string_to_byte_array(device.uuid, uuid_bytes);
+    for (j = 0; j < 2; j++) {
+        queued_message = stun_get_keepalive_message(&device);
+        stun_process_stun_message(queued_message->bytes, queued_message->length, &message);
+        if (!stun_get_attribute(&message, ATTR_USERNAME, &attribute) || attribute.length != strlen(device.username)
+                || memcmp(attribute.bytes, device.username, attribute.length) != 0
+                || !stun_get_attribute(&message, ATTR_LYNCPORT_ID, &attribute) || memcmp(attribute.bytes, uuid_bytes, 16) != 0
+                || !stun_get_attribute(&message, ATTR_TIMESTAMP, &attribute) || attribute.length != 4
+                || byte_array_to_uint32(attribute.bytes) + 1 < lh_get_UTC_unix_time()
+                || !stun_is_integrity_correct(&message, device_key)) {
+            printf("FAILED: keepalive %d does not have the common attributes of the device.\n", j);
+            return EXIT_FAILURE;
+        }
+        stun_free(queued_message);
+    }
+    if (device.common_attrs == NULL) {
+        printf("FAILED: the common attributes were not kept in the device.\n");
+        return EXIT_FAILURE;
+    }
+    free(device.common_attrs);
+    printf("OK\n");
+
+    printf("TEST CASE 11: ");
+    // transaction ids of consecutive messages are different
+    uint8_t previous_id[12] = {0};
+    for (j = 0; j < 1000; j++) {
+        queued_message = stun_new_empty_stun_message();
+        if (memcmp(queued_message->bytes + 8, previous_id, 12) == 0) {
+            printf("FAILED: message %d repeated the transaction id of the previous one.\n", j);
+            return EXIT_FAILURE;
+        }
+        memcpy(previous_id, queued_message->bytes + 8, 12);
+        stun_free(queued_message);
+    }
+    printf("OK\n");
+
+    printf("TEST CASE 12: ");
+    // an attribute whose length runs past the end of the message is not returned
+    uint8_t values[4] = {0xDE, 0xAD, 0xBE, 0xEF};
+    queued_message = stun_new_empty_stun_message();
+    queued_message = stun_add_attribute(queued_message, ATTR_TIMESTAMP, 4, values);
+    store_be16(queued_message->bytes + STUN_MIN_MESS_LEN + 2, 8);
+    if (stun_get_attribute(queued_message, ATTR_TIMESTAMP, &attribute)) {
+        printf("FAILED: an attribute longer than the message was returned.\n");
+        return EXIT_FAILURE;
+    }
+    store_be16(queued_message->bytes + STUN_MIN_MESS_LEN + 2, 4);
+    if (!stun_get_attribute(queued_message, ATTR_TIMESTAMP, &attribute)
+            || load_be32(attribute.bytes) != 0xDEADBEEF || byte_array_to_uint32(attribute.bytes) != 0xDEADBEEF) {
+        printf("FAILED: the attribute was not found after fixing its length.\n");
+        return EXIT_FAILURE;
+    }
+    stun_free(queued_message);
+    printf("OK\n");
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,536 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * Local stand-in of the Lhings server, to test devices and gateways offline.
+ * Build it with make -f Makefile.prj fake-server and run:
+ *
+ *     ./build/lhings-fake-server [options]
+ *
+ *     --udp-port PORT          STUN port (3478)
+ *     --http-port PORT         plain HTTP port of the REST API (8080)
+ *     --api-key KEY            api key handed out and used to sign (a fixed test key)
+ *     --action-interval MS     send an action and a status request to every
+ *                              known device each MS milliseconds (0, disabled)
+ *     --action NAME            name of the action sent (toggle_heater)
+ *     --devices N              simulate N devices that send keepalives and
+ *                              events and answer actions (0)
+ *     --rate R                 messages per second sent by each simulated device (1)
+ *     --target HOST:PORT       where the simulated devices send (this server)
+ *     --duration SECS          stop and print the report after SECS seconds (0, never)
+ *     --quiet                  do not print every request
+ *
+ * Devices are pointed to it with lh_set_server("127.0.0.1", "3478",
+ * "http://127.0.0.1:8080/laas/api/v1/"). The server answers the keepalive,
+ * event and store status requests with signed success responses, and the
+ * REST endpoints used by the library with canned responses. On exit it
+ * prints the number of requests of each kind and the latency percentiles of
+ * the actions, status requests and simulated device requests.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "lhings_tools.h"
+#include "../core/stun-messaging/stun_arguments.h"
+#include "../core/utils/utils.h"
+#include "../abstraction/udp-comm/udp_api.h"
+#include "../abstraction/timing/lhings_time.h"
+#include "../abstraction/threading/lhings_thread.h"
+
+#define FAKE_MAX_DEVICES 1024
+#define FAKE_DEVICE_SLOTS 2048
+#define FAKE_HTTP_REQUEST_LEN 65536
+#define FAKE_MAX_SIMULATED 1024
+
+// the library calls the setup and loop functions of the program
+void setup() {
+}
+
+void loop() {
+}
+
+typedef struct {
+    uint8_t id[16];
+    struct sockaddr_storage address;
+    socklen_t address_len;
+    uint8_t used;
+} KnownDevice;
+
+static const char *udp_port = "3478";
+static const char *http_port = "8080";
+static char api_key[37] = TOOLS_DEFAULT_API_KEY;
+static uint32_t action_interval_millis = 0;
+static const char *action_name = "toggle_heater";
+static int simulated_devices = 0;
+static double simulated_rate = 1;
+static const char *target = NULL;
+static uint32_t duration_secs = 0;
+static int quiet = 0;
+static volatile sig_atomic_t stopped = 0;
+
+static LH_Device identity;
+static char identity_uuid[37];
+static KnownDevice known_devices[FAKE_DEVICE_SLOTS];
+static int known_devices_count = 0;
+static ToolsPending server_pending;
+static ToolsStats action_stats, status_stats;
+static uint64_t keepalives = 0, events = 0, stores = 0, malformed = 0, bad_integrity = 0, http_requests = 0;
+static uint32_t simulation_done = 0;
+
+void stop(int signal) {
+    stopped = 1;
+}
+
+/* ---------- STUN ---------- */
+
+KnownDevice* find_device(const uint8_t *id, int add) {
+    uint32_t slot = (uint32_t) lh_hash_bytes(id, 16, 0) & (FAKE_DEVICE_SLOTS - 1);
+    while (known_devices[slot].used) {
+        if (memcmp(known_devices[slot].id, id, 16) == 0)
+            return &known_devices[slot];
+        slot = (slot + 1) & (FAKE_DEVICE_SLOTS - 1);
+    }
+    if (!add || known_devices_count == FAKE_MAX_DEVICES)
+        return NULL;
+    known_devices_count++;
+    known_devices[slot].used = 1;
+    memcpy(known_devices[slot].id, id, 16);
+    return &known_devices[slot];
+}
+
+void send_message(int fd, StunMessage *message, const struct sockaddr_storage *address, socklen_t address_len) {
+    if (sendto(fd, message->bytes, message->length, 0, (const struct sockaddr *) address, address_len) != message->length)
+        perror("sendto");
+}
+
+void handle_datagram(int fd, uint8_t *bytes, int length, struct sockaddr_storage *address, socklen_t address_len) {
+    StunMessage message;
+    StunAttribute attribute;
+    uint16_t method, class;
+    if (!stun_process_stun_message(bytes, length, &message)) {
+        malformed++;
+        return;
+    }
+    if (!stun_is_integrity_correct(&message, api_key)) {
+        bad_integrity++;
+        return;
+    }
+    stun_get_method_and_class(&message, &method, &class);
+    if (class == CL_SUCCESS) {
+        tools_pending_answer(&server_pending, method == M_ACTION ? &action_stats : &status_stats, &message);
+        return;
+    }
+    if (class != CL_REQUEST)
+        return;
+    // remember where each device listens, to send it actions
+    const uint8_t *device_id = NULL;
+    if (stun_get_attribute(&message, ATTR_LYNCPORT_ID, &attribute) && attribute.length == 16) {
+        device_id = attribute.bytes;
+        KnownDevice *device = find_device(device_id, 1);
+        if (device != NULL) {
+            memcpy(&device->address, address, address_len);
+            device->address_len = address_len;
+        }
+    }
+    switch (method) {
+        case M_KEEP_ALIVE:
+            keepalives++;
+            break;
+        case M_EVENT:
+            events++;
+            if (!quiet && stun_get_attribute(&message, ATTR_NAME, &attribute))
+                printf("event %.*s\n", (int) attribute.length, (const char *) attribute.bytes);
+            break;
+        case M_STORE_STATUS:
+            stores++;
+            break;
+        default:
+            return;
+    }
+    LH_Device target;
+    char target_uuid[37];
+    if (device_id != NULL)
+        tools_address_device(&identity, device_id, &target, target_uuid);
+    StunMessage *response = stun_get_success_response(device_id != NULL ? &target : &identity, &message, NULL);
+    send_message(fd, response, address, address_len);
+    stun_free(response);
+    if (device_id != NULL)
+        stun_free_common_attrs(&target);
+}
+
+void send_actions(int fd) {
+    LH_Device target;
+    char target_uuid[37];
+    int j;
+    for (j = 0; j < FAKE_DEVICE_SLOTS; j++) {
+        KnownDevice *device = &known_devices[j];
+        if (!device->used)
+            continue;
+        tools_address_device(&identity, device->id, &target, target_uuid);
+        StunMessage *action = tools_server_request(&target, M_ACTION, action_name);
+        tools_pending_add(&server_pending, action);
+        send_message(fd, action, &device->address, device->address_len);
+        action_stats.sent++;
+        stun_free(action);
+        StunMessage *status = tools_server_request(&target, M_STATUS_REQUEST, NULL);
+        tools_pending_add(&server_pending, status);
+        send_message(fd, status, &device->address, device->address_len);
+        status_stats.sent++;
+        stun_free(status);
+        stun_free_common_attrs(&target);
+    }
+}
+
+/* ---------- REST API ---------- */
+
+void http_respond(int fd, int code, const char *reason, const char *body) {
+    char response[512];
+    int length = snprintf(response, sizeof response, "HTTP/1.1 %d %s\r\nContent-Type: application/json\r\n"
+            "Content-Length: %d\r\nConnection: close\r\n\r\n%s", code, reason, (int) strlen(body), body);
+    if (write(fd, response, length) != length)
+        perror("http write");
+}
+
+int ends_with(const char *string, const char *suffix) {
+    size_t length = strlen(string), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(string + length - suffix_length, suffix) == 0;
+}
+
+void handle_http_client(int fd) {
+    static char request[FAKE_HTTP_REQUEST_LEN];
+    char method[8], path[1024], body[256];
+    int length = 0, received;
+    char *headers_end = NULL;
+    struct timeval timeout = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    // read the headers, then the body announced by Content-Length
+    while (headers_end == NULL && length < FAKE_HTTP_REQUEST_LEN - 1) {
+        if ((received = read(fd, request + length, FAKE_HTTP_REQUEST_LEN - 1 - length)) <= 0)
+            return;
+        length += received;
+        request[length] = 0;
+        headers_end = strstr(request, "\r\n\r\n");
+    }
+    if (headers_end == NULL || sscanf(request, "%7s %1023s", method, path) != 2)
+        return;
+    const char *content_length = strcasestr(request, "\r\nContent-Length:");
+    int body_length = content_length != NULL && content_length < headers_end ? atoi(content_length + 17) : 0;
+    const char *expect = strcasestr(request, "\r\nExpect: 100-continue");
+    if (expect != NULL && expect < headers_end && write(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 25)
+        return;
+    int header_length = headers_end + 4 - request;
+    while (length < header_length + body_length && length < FAKE_HTTP_REQUEST_LEN - 1) {
+        if ((received = read(fd, request + length, FAKE_HTTP_REQUEST_LEN - 1 - length)) <= 0)
+            break;
+        length += received;
+    }
+    http_requests++;
+    if (!quiet)
+        printf("%s %s\n", method, path);
+
+    char *query = strchr(path, '?');
+    if (query != NULL)
+        *query = 0;
+    if (strcmp(method, "GET") == 0 && ends_with(path, "/apikey")) {
+        // accounts/<username>/apikey, the library takes the 8th quoted token
+        snprintf(body, sizeof body, "{\"username\":\"fake\",\"apikey\":\"%s\"}", api_key);
+        http_respond(fd, 200, "OK", body);
+    } else if (strcmp(method, "POST") == 0 && ends_with(path, "/devices/")) {
+        char uuid[37];
+        tools_random_uuid(uuid);
+        snprintf(body, sizeof body, "{\"uuid\":\"%s\"}", uuid);
+        http_respond(fd, 200, "OK", body);
+    } else if (strcmp(method, "PUT") == 0 && ends_with(path, "/states/online")) {
+        http_respond(fd, 200, "OK", "{}");
+    } else if (strcmp(method, "PUT") == 0 && ends_with(path, "/")) {
+        // device descriptor
+        http_respond(fd, 201, "Created", "{}");
+    } else {
+        http_respond(fd, 404, "Not Found", "{\"error\":\"not found\"}");
+    }
+}
+
+int tcp_listener(const char *port) {
+    struct sockaddr_in address;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+    memset(&address, 0, sizeof address);
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(atoi(port));
+    if (bind(fd, (struct sockaddr *) &address, sizeof address) == -1 || listen(fd, 16) == -1) {
+        perror("http listener");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* ---------- simulated devices ---------- */
+
+typedef struct {
+    int fd;
+    LH_Device identity;
+    char uuid[37];
+    char username[24];
+} SimulatedDevice;
+
+static SimulatedDevice simulated[FAKE_MAX_SIMULATED];
+static ToolsPending simulation_pending;
+static ToolsStats keepalive_stats, event_stats;
+static double simulation_seconds = 0;
+
+void answer_server_request(SimulatedDevice *device, StunMessage *request, struct sockaddr_storage *address, socklen_t address_len) {
+    StunAttribute status;
+    uint16_t method, class;
+    stun_get_method_and_class(request, &method, &class);
+    if (method == M_STATUS_REQUEST) {
+        // empty status
+        int length;
+        uint8_t *arguments = stun_args_build(NULL, NULL, &length);
+        status.attr_type = ATTR_ARGUMENTS;
+        status.bytes = arguments;
+        status.length = length;
+        StunMessage *response = stun_get_success_response(&device->identity, request, &status);
+        send_message(device->fd, response, address, address_len);
+        stun_free(response);
+        free(arguments);
+    } else {
+        StunMessage *response = stun_get_success_response(&device->identity, request, NULL);
+        send_message(device->fd, response, address, address_len);
+        stun_free(response);
+    }
+}
+
+void run_simulation(void *argument) {
+    struct sockaddr_storage server;
+    socklen_t server_len;
+    char host[256] = "127.0.0.1";
+    const char *port = udp_port;
+    static struct pollfd fds[FAKE_MAX_SIMULATED];
+    uint8_t buffer[MAXBUFLEN];
+    int j;
+    if (target != NULL) {
+        const char *colon = strrchr(target, ':');
+        snprintf(host, sizeof host, "%.*s", colon != NULL ? (int) (colon - target) : (int) strlen(target), target);
+        if (colon != NULL)
+            port = colon + 1;
+    }
+    if (!tools_resolve(host, port, &server, &server_len)) {
+        fprintf(stderr, "could not resolve %s:%s\n", host, port);
+        LH_ATOMIC_STORE(&simulation_done, 1);
+        return;
+    }
+    for (j = 0; j < simulated_devices; j++) {
+        SimulatedDevice *device = &simulated[j];
+        device->fd = tools_udp_socket("0");
+        tools_random_uuid(device->uuid);
+        snprintf(device->username, sizeof device->username, "simulated-%d", j);
+        tools_init_identity(&device->identity, device->username, device->uuid, api_key);
+        fds[j].fd = device->fd;
+        fds[j].events = POLLIN;
+    }
+    double interval_micros = 1e6 / (simulated_rate * simulated_devices);
+    uint64_t start = lh_get_absolute_time_micros();
+    uint64_t end = start + (uint64_t) (duration_secs > 0 ? duration_secs : 10) * 1000000;
+    uint64_t sent = 0;
+    while (!stopped) {
+        uint64_t now = lh_get_absolute_time_micros();
+        if (now >= end)
+            break;
+        // send the messages due, round robin over the devices, alternating keepalives and events
+        while (start + sent * interval_micros <= now) {
+            SimulatedDevice *device = &simulated[sent % simulated_devices];
+            int is_event = (sent / simulated_devices) % 2;
+            StunMessage *message = is_event ? stun_get_event_message(&device->identity, "simulated_event", "{}")
+                    : stun_get_keepalive_message(&device->identity);
+            tools_pending_add(&simulation_pending, message);
+            send_message(device->fd, message, &server, server_len);
+            if (is_event)
+                event_stats.sent++;
+            else
+                keepalive_stats.sent++;
+            stun_free(message);
+            sent++;
+        }
+        if (poll(fds, simulated_devices, 1) <= 0)
+            continue;
+        for (j = 0; j < simulated_devices; j++) {
+            struct sockaddr_storage from;
+            socklen_t from_len = sizeof from;
+            int length;
+            if (!(fds[j].revents & POLLIN))
+                continue;
+            while ((length = recvfrom(fds[j].fd, buffer, sizeof buffer, 0, (struct sockaddr *) &from, &from_len)) > 0) {
+                StunMessage message;
+                uint16_t method, class;
+                if (!stun_process_stun_message(buffer, length, &message) || !stun_is_integrity_correct(&message, api_key))
+                    continue;
+                stun_get_method_and_class(&message, &method, &class);
+                if (class == CL_REQUEST)
+                    answer_server_request(&simulated[j], &message, &from, from_len);
+                else if (class == CL_SUCCESS)
+                    tools_pending_answer(&simulation_pending, method == M_EVENT ? &event_stats : &keepalive_stats, &message);
+                from_len = sizeof from;
+            }
+        }
+    }
+    // give the last responses some time to arrive
+    lh_sleep(100);
+    for (j = 0; j < simulated_devices; j++) {
+        uint8_t *bytes = buffer;
+        int length;
+        while ((length = recv(simulated[j].fd, bytes, sizeof buffer, 0)) > 0) {
+            StunMessage message;
+            uint16_t method, class;
+            if (!stun_process_stun_message(bytes, length, &message))
+                continue;
+            stun_get_method_and_class(&message, &method, &class);
+            if (class == CL_SUCCESS)
+                tools_pending_answer(&simulation_pending, method == M_EVENT ? &event_stats : &keepalive_stats, &message);
+        }
+        close(simulated[j].fd);
+    }
+    simulation_seconds = (lh_get_absolute_time_micros() - start) / 1e6;
+    LH_ATOMIC_STORE(&simulation_done, 1);
+}
+
+/* ---------- main ---------- */
+
+void usage() {
+    fprintf(stderr, "usage: lhings-fake-server [--udp-port PORT] [--http-port PORT] [--api-key KEY]\n"
+            "    [--action-interval MS] [--action NAME] [--devices N] [--rate R] [--target HOST:PORT]\n"
+            "    [--duration SECS] [--quiet]\n");
+    exit(1);
+}
+
+void parse_arguments(int argc, char **argv) {
+    int j;
+    for (j = 1; j < argc; j++) {
+        const char *option = argv[j];
+        if (strcmp(option, "--quiet") == 0) {
+            quiet = 1;
+            continue;
+        }
+        if (j + 1 == argc)
+            usage();
+        const char *value = argv[++j];
+        if (strcmp(option, "--udp-port") == 0)
+            udp_port = value;
+        else if (strcmp(option, "--http-port") == 0)
+            http_port = value;
+        else if (strcmp(option, "--api-key") == 0 && strlen(value) == 36)
+            strcpy(api_key, value);
+        else if (strcmp(option, "--action-interval") == 0)
+            action_interval_millis = atoi(value);
+        else if (strcmp(option, "--action") == 0)
+            action_name = value;
+        else if (strcmp(option, "--devices") == 0)
+            simulated_devices = atoi(value);
+        else if (strcmp(option, "--rate") == 0)
+            simulated_rate = atof(value);
+        else if (strcmp(option, "--target") == 0)
+            target = value;
+        else if (strcmp(option, "--duration") == 0)
+            duration_secs = atoi(value);
+        else
+            usage();
+    }
+    if (simulated_devices < 0 || simulated_devices > FAKE_MAX_SIMULATED || simulated_rate <= 0)
+        usage();
+}
+
+int main(int argc, char **argv) {
+    parse_arguments(argc, argv);
+    srand(time(NULL));
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    tools_random_uuid(identity_uuid);
+    tools_init_identity(&identity, "lhings-fake-server", identity_uuid, api_key);
+
+    int udp_fd = tools_udp_socket(udp_port);
+    int http_fd = tcp_listener(http_port);
+    if (udp_fd == -1 || http_fd == -1)
+        return 1;
+    printf("Fake Lhings server: STUN on udp port %s, API on http://127.0.0.1:%s/laas/api/v1/\n", udp_port, http_port);
+    fflush(stdout);
+    if (simulated_devices > 0 && !lh_thread_start(run_simulation, NULL))
+        return 1;
+
+    struct pollfd fds[2] = {{udp_fd, POLLIN, 0}, {http_fd, POLLIN, 0}};
+    uint8_t buffer[MAXBUFLEN];
+    uint64_t start = lh_get_absolute_time_micros();
+    uint64_t last_actions = start;
+    while (!stopped) {
+        uint64_t now = lh_get_absolute_time_micros();
+        // with simulated devices, the simulation decides when to stop
+        if (simulated_devices > 0 ? LH_ATOMIC_LOAD(&simulation_done)
+                : duration_secs > 0 && now - start >= (uint64_t) duration_secs * 1000000)
+            break;
+        if (action_interval_millis > 0 && now - last_actions >= action_interval_millis * 1000ULL) {
+            send_actions(udp_fd);
+            last_actions = now;
+        }
+        if (poll(fds, 2, 10) <= 0)
+            continue;
+        if (fds[0].revents & POLLIN) {
+            struct sockaddr_storage address;
+            socklen_t address_len = sizeof address;
+            int length;
+            while ((length = recvfrom(udp_fd, buffer, sizeof buffer, 0, (struct sockaddr *) &address, &address_len)) > 0) {
+                handle_datagram(udp_fd, buffer, length, &address, address_len);
+                address_len = sizeof address;
+            }
+        }
+        if (fds[1].revents & POLLIN) {
+            int client = accept(http_fd, NULL, NULL);
+            if (client != -1) {
+                handle_http_client(client);
+                close(client);
+            }
+        }
+    }
+    while (simulated_devices > 0 && !LH_ATOMIC_LOAD(&simulation_done))
+        lh_sleep(10);
+    double seconds = (lh_get_absolute_time_micros() - start) / 1e6;
+
+    printf("\nServer: %.1f s, %d devices seen, %llu keepalives, %llu events, %llu store status, "
+            "%llu malformed, %llu bad integrity, %llu HTTP requests\n", seconds, known_devices_count,
+            (unsigned long long) keepalives, (unsigned long long) events, (unsigned long long) stores,
+            (unsigned long long) malformed, (unsigned long long) bad_integrity, (unsigned long long) http_requests);
+    if (action_stats.sent > 0) {
+        tools_print_stats("action", &action_stats, seconds);
+        tools_print_stats("status request", &status_stats, seconds);
+    }
+    if (simulated_devices > 0) {
+        printf("Simulated devices: %d at %.1f messages/s each, %.1f s\n", simulated_devices, simulated_rate, simulation_seconds);
+        tools_print_stats("keepalive", &keepalive_stats, simulation_seconds);
+        tools_print_stats("event", &event_stats, simulation_seconds);
+    }
+    close(udp_fd);
+    close(http_fd);
+    return 0;
+}
@@ -0,0 +1,269 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * Load generator that sends actions and status requests to a running device
+ * and measures the time until their success responses arrive, to find the
+ * rate a device can sustain. Build it with make -f Makefile.prj loadgen and run:
+ *
+ *     ./build/lhings-loadgen [options]
+ *
+ *     --udp-port PORT       port the device sends to (3479)
+ *     --device HOST:PORT    address of the device, by default the source of
+ *                           the first request received from it
+ *     --devices N           devices of a gateway to spread the requests
+ *                           among, waiting for a request of each (1)
+ *     --api-key KEY         api key of the device (the key of the fake server)
+ *     --rate R              requests per second (100)
+ *     --status-percent P    percentage of status requests, the rest are actions (50)
+ *     --action NAME         name of the action requested (toggle_heater)
+ *     --duration SECS       time sending requests (10)
+ *
+ * Devices send their responses to the server, so the device under test must
+ * send its UDP traffic to the load generator, while the REST API is served by
+ * the fake server:
+ *
+ *     ./build/lhings-fake-server --udp-port 3478 --http-port 8080 &
+ *     ./build/lhings-loadgen --udp-port 3479 --rate 1000
+ *     lh_set_server("127.0.0.1", "3479", "http://127.0.0.1:8080/laas/api/v1/") in the device
+ *
+ * The keepalives, events and store status of the device are answered as the
+ * server would. Requests are sent on a fixed schedule, whether the previous
+ * ones have been answered or not, so a device that falls behind shows up as
+ * growing latency and loss instead of as a lower rate. Responses arriving
+ * later than one second after the end of the test are counted as lost.
+ *
+ * Requests carry the uuid of the device they are for, learnt from the
+ * requests of the device, so a gateway can be tested with --devices: the
+ * requests are sent round robin to the devices it hosts.
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/socket.h>
+#include "lhings_tools.h"
+#include "../abstraction/timing/lhings_time.h"
+#include "../abstraction/udp-comm/udp_api.h"
+
+// time waiting for the last responses
+#define LOADGEN_DRAIN_MICROS 1000000
+#define LOADGEN_MAX_DEVICES 4096
+
+// the library calls the setup and loop functions of the program
+void setup() {
+}
+
+void loop() {
+}
+
+static const char *udp_port = "3479";
+static const char *device_endpoint = NULL;
+static char api_key[37] = TOOLS_DEFAULT_API_KEY;
+static double rate = 100;
+static int status_percent = 50;
+static const char *action_name = "toggle_heater";
+static uint32_t duration_secs = 10;
+static int wanted_devices = 1;
+static volatile sig_atomic_t stopped = 0;
+
+static LH_Device identity;
+static char identity_uuid[37];
+static struct sockaddr_storage device_address;
+static socklen_t device_address_len = 0;
+// uuids of the devices learnt from their requests
+static uint8_t device_ids[LOADGEN_MAX_DEVICES][16];
+static int device_count = 0;
+static ToolsPending pending;
+static ToolsStats action_stats, status_stats;
+static uint64_t device_requests = 0, unexpected = 0, bad_integrity = 0;
+
+void stop(int signal) {
+    stopped = 1;
+}
+
+void usage() {
+    fprintf(stderr, "usage: lhings-loadgen [--udp-port PORT] [--device HOST:PORT] [--devices N] [--api-key KEY] [--rate R]\n"
+            "    [--status-percent P] [--action NAME] [--duration SECS]\n");
+    exit(1);
+}
+
+void parse_arguments(int argc, char **argv) {
+    int j;
+    for (j = 1; j + 1 < argc; j += 2) {
+        const char *option = argv[j], *value = argv[j + 1];
+        if (strcmp(option, "--udp-port") == 0)
+            udp_port = value;
+        else if (strcmp(option, "--device") == 0)
+            device_endpoint = value;
+        else if (strcmp(option, "--devices") == 0)
+            wanted_devices = atoi(value);
+        else if (strcmp(option, "--api-key") == 0 && strlen(value) == 36)
+            strcpy(api_key, value);
+        else if (strcmp(option, "--rate") == 0)
+            rate = atof(value);
+        else if (strcmp(option, "--status-percent") == 0)
+            status_percent = atoi(value);
+        else if (strcmp(option, "--action") == 0)
+            action_name = value;
+        else if (strcmp(option, "--duration") == 0)
+            duration_secs = atoi(value);
+        else
+            usage();
+    }
+    if (j != argc || rate <= 0 || status_percent < 0 || status_percent > 100 || duration_secs == 0
+            || wanted_devices < 1 || wanted_devices > LOADGEN_MAX_DEVICES)
+        usage();
+}
+
+void learn_device(const uint8_t *id) {
+    int j;
+    for (j = 0; j < device_count; j++)
+        if (memcmp(device_ids[j], id, 16) == 0)
+            return;
+    if (device_count < LOADGEN_MAX_DEVICES)
+        memcpy(device_ids[device_count++], id, 16);
+}
+
+/**
+ * Handles a datagram from the device: answers its requests as the server
+ * would and matches the responses with the requests sent.
+ */
+void handle_datagram(int fd, uint8_t *bytes, int length, struct sockaddr_storage *address, socklen_t address_len) {
+    StunMessage message;
+    StunAttribute attribute;
+    LH_Device target;
+    char target_uuid[37];
+    uint16_t method, class;
+    if (!stun_process_stun_message(bytes, length, &message) || !stun_is_integrity_correct(&message, api_key)) {
+        bad_integrity++;
+        return;
+    }
+    stun_get_method_and_class(&message, &method, &class);
+    if (class == CL_SUCCESS) {
+        if (!tools_pending_answer(&pending, method == M_ACTION ? &action_stats : &status_stats, &message))
+            unexpected++;
+        return;
+    }
+    if (class != CL_REQUEST)
+        return;
+    device_requests++;
+    if (device_address_len == 0) {
+        // the device listens on the port it sends from
+        memcpy(&device_address, address, address_len);
+        device_address_len = address_len;
+    }
+    if (!stun_get_attribute(&message, ATTR_LYNCPORT_ID, &attribute) || attribute.length != 16)
+        return;
+    learn_device(attribute.bytes);
+    tools_address_device(&identity, attribute.bytes, &target, target_uuid);
+    StunMessage *response = stun_get_success_response(&target, &message, NULL);
+    sendto(fd, response->bytes, response->length, 0, (struct sockaddr *) address, address_len);
+    stun_free(response);
+    stun_free_common_attrs(&target);
+}
+
+void receive_all(int fd) {
+    uint8_t buffer[MAXBUFLEN];
+    struct sockaddr_storage address;
+    socklen_t address_len = sizeof address;
+    int length;
+    while ((length = recvfrom(fd, buffer, sizeof buffer, 0, (struct sockaddr *) &address, &address_len)) > 0) {
+        handle_datagram(fd, buffer, length, &address, address_len);
+        address_len = sizeof address;
+    }
+}
+
+void send_request(int fd, uint64_t sequence) {
+    // spread the status requests evenly among the actions
+    int is_status = (sequence * status_percent) / 100 != ((sequence + 1) * status_percent) / 100;
+    LH_Device target;
+    char target_uuid[37];
+    tools_address_device(&identity, device_ids[sequence % device_count], &target, target_uuid);
+    StunMessage *request = tools_server_request(&target, is_status ? M_STATUS_REQUEST : M_ACTION, action_name);
+    tools_pending_add(&pending, request);
+    if (sendto(fd, request->bytes, request->length, 0, (struct sockaddr *) &device_address, device_address_len) == request->length) {
+        if (is_status)
+            status_stats.sent++;
+        else
+            action_stats.sent++;
+    }
+    stun_free(request);
+    stun_free_common_attrs(&target);
+}
+
+int main(int argc, char **argv) {
+    parse_arguments(argc, argv);
+    srand(time(NULL));
+    signal(SIGINT, stop);
+    signal(SIGTERM, stop);
+    tools_random_uuid(identity_uuid);
+    tools_init_identity(&identity, "lhings-loadgen", identity_uuid, api_key);
+
+    int fd = tools_udp_socket(udp_port);
+    if (fd == -1)
+        return 1;
+    struct pollfd pfd = {fd, POLLIN, 0};
+    if (device_endpoint != NULL) {
+        char host[256];
+        const char *colon = strrchr(device_endpoint, ':');
+        if (colon == NULL)
+            usage();
+        snprintf(host, sizeof host, "%.*s", (int) (colon - device_endpoint), device_endpoint);
+        if (!tools_resolve(host, colon + 1, &device_address, &device_address_len)) {
+            fprintf(stderr, "could not resolve %s\n", device_endpoint);
+            return 1;
+        }
+    }
+    // the uuids of the devices are learnt from their keepalives
+    printf("Waiting for %d device%s on udp port %s\n", wanted_devices, wanted_devices == 1 ? "" : "s", udp_port);
+    fflush(stdout);
+    while (!stopped && device_count < wanted_devices)
+        if (poll(&pfd, 1, 100) > 0)
+            receive_all(fd);
+    printf("Sending %.1f requests/s for %u s, %d%% status requests\n", rate, duration_secs, status_percent);
+    fflush(stdout);
+
+    double interval_micros = 1e6 / rate;
+    uint64_t start = lh_get_absolute_time_micros();
+    uint64_t end = start + (uint64_t) duration_secs * 1000000;
+    uint64_t sent = 0;
+    while (!stopped) {
+        uint64_t now = lh_get_absolute_time_micros();
+        if (now >= end + LOADGEN_DRAIN_MICROS)
+            break;
+        // send every request due, so that a slow iteration does not lower the rate
+        while (now < end && start + sent * interval_micros <= now)
+            send_request(fd, sent++);
+        if (poll(&pfd, 1, 1) > 0)
+            receive_all(fd);
+    }
+    uint64_t finished = lh_get_absolute_time_micros();
+    double seconds = ((finished < end ? finished : end) - start) / 1e6;
+
+    printf("\nOffered %.1f requests/s, sent %llu in %.1f s, %llu device requests answered, %llu unexpected responses, "
+            "%llu malformed or bad integrity\n", rate, (unsigned long long) sent, seconds,
+            (unsigned long long) device_requests, (unsigned long long) unexpected, (unsigned long long) bad_integrity);
+    tools_print_stats("action", &action_stats, seconds);
+    tools_print_stats("status request", &status_stats, seconds);
+    close(fd);
+    return 0;
+}
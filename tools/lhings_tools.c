@@ -0,0 +1,149 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include "lhings_tools.h"
+#include "../core/stun-messaging/stun_message.h"
+#include "../core/stun-messaging/stun_arguments.h"
+#include "../core/utils/utils.h"
+#include "../abstraction/timing/lhings_time.h"
+
+void tools_init_identity(LH_Device *identity, char *username, char *uuid, char *api_key) {
+    memset(identity, 0, sizeof *identity);
+    identity->name = username;
+    identity->username = username;
+    identity->uuid = uuid;
+    identity->api_key = api_key;
+}
+
+void tools_random_uuid(char *uuid) {
+    static const char *hex = "0123456789abcdef";
+    int j;
+    for (j = 0; j < 36; j++)
+        uuid[j] = (j == 8 || j == 13 || j == 18 || j == 23) ? '-' : hex[rand() % 16];
+    uuid[36] = 0;
+}
+
+void tools_uuid_to_string(const uint8_t *bytes, char *uuid) {
+    static const char *hex = "0123456789abcdef";
+    int j, k = 0;
+    for (j = 0; j < 16; j++) {
+        if (j == 4 || j == 6 || j == 8 || j == 10)
+            uuid[k++] = '-';
+        uuid[k++] = hex[bytes[j] >> 4];
+        uuid[k++] = hex[bytes[j] & 0x0F];
+    }
+    uuid[36] = 0;
+}
+
+void tools_address_device(const LH_Device *identity, const uint8_t *device_id, LH_Device *target, char *uuid) {
+    *target = *identity;
+    // the cache of the identity carries its own uuid
+    target->common_attrs = NULL;
+    tools_uuid_to_string(device_id, uuid);
+    target->uuid = uuid;
+}
+
+StunMessage* tools_server_request(LH_Device *identity, uint16_t method, const char *action_name) {
+    StunMessage *message = stun_new_empty_stun_message();
+    message = stun_add_common_attrs(message, identity);
+    stun_set_method_and_class(message, method, CL_REQUEST);
+    if (method == M_ACTION) {
+        int length;
+        uint8_t *arguments = stun_args_build(NULL, NULL, &length);
+        message = stun_add_attribute(message, ATTR_NAME, strlen(action_name), (uint8_t *) action_name);
+        message = stun_add_attribute(message, ATTR_ARGUMENTS, length, arguments);
+        free(arguments);
+    }
+    return stun_set_message_integrity(message, identity->api_key);
+}
+
+int tools_udp_socket(const char *port) {
+    struct addrinfo hints, *info;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(NULL, port, &hints, &info) != 0)
+        return -1;
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd == -1 || bind(fd, info->ai_addr, info->ai_addrlen) == -1) {
+        perror("udp socket");
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(info);
+        return -1;
+    }
+    freeaddrinfo(info);
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+int tools_resolve(const char *host, const char *port, struct sockaddr_storage *address, socklen_t *address_len) {
+    struct addrinfo hints, *info;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, port, &hints, &info) != 0)
+        return 0;
+    memcpy(address, info->ai_addr, info->ai_addrlen);
+    *address_len = info->ai_addrlen;
+    freeaddrinfo(info);
+    return 1;
+}
+
+uint32_t pending_slot(const uint8_t *trId) {
+    return (uint32_t) lh_hash_bytes(trId, 12, 0) & (TOOLS_PENDING_CAPACITY - 1);
+}
+
+void tools_pending_add(ToolsPending *pending, const StunMessage *message) {
+    uint32_t slot = pending_slot(message->bytes + 8);
+    memcpy(pending->trIds[slot], message->bytes + 8, 12);
+    pending->sent_micros[slot] = lh_get_absolute_time_micros();
+}
+
+int tools_pending_answer(ToolsPending *pending, ToolsStats *stats, const StunMessage *response) {
+    uint32_t slot = pending_slot(response->bytes + 8);
+    if (pending->sent_micros[slot] == 0 || memcmp(pending->trIds[slot], response->bytes + 8, 12) != 0)
+        return 0;
+    tools_record_latency(stats, lh_get_absolute_time_micros() - pending->sent_micros[slot]);
+    pending->sent_micros[slot] = 0;
+    return 1;
+}
+
+void tools_record_latency(ToolsStats *stats, uint64_t micros) {
+    uint32_t value = micros > UINT32_MAX ? UINT32_MAX : (uint32_t) micros;
+    stats->latency.buckets[lh_histogram_bucket_index(value)]++;
+    stats->latency.count++;
+    stats->latency.sum += value;
+    stats->answered++;
+}
+
+void tools_print_stats(const char *name, const ToolsStats *stats, double seconds) {
+    double loss = stats->sent == 0 ? 0 : 100.0 * (stats->sent - stats->answered) / stats->sent;
+    printf("%-16s sent %8llu  answered %8llu  loss %6.2f%%  rate %9.1f/s", name, (unsigned long long) stats->sent,
+            (unsigned long long) stats->answered, loss, seconds > 0 ? stats->answered / seconds : 0);
+    if (stats->latency.count > 0)
+        printf("  latency us p50 %u p99 %u p999 %u mean %.1f", lh_histogram_percentile(&stats->latency, 50),
+            lh_histogram_percentile(&stats->latency, 99), lh_histogram_percentile(&stats->latency, 99.9),
+            (double) stats->latency.sum / stats->latency.count);
+    printf("\n");
+}
@@ -0,0 +1,163 @@
+/* Copyright 2015 Lyncos Technologies S. L.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License. 
+ */
+
+/**
+ * @file lhings_tools.h
+ * @brief Helpers shared by the testing tools: the fake Lhings server and the
+ * load generator.
+ *
+ * The tools are Linux programs linked with the library, so they build and
+ * sign their STUN messages with the same code the devices use.
+ */
+
+#ifndef LHINGS_TOOLS_H
+#define	LHINGS_TOOLS_H
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "../core/lhings.h"
+#include "../core/stun-messaging/stun_message.h"
+#include "../core/metrics/metrics.h"
+
+    // api key handed out by the fake server and used by default by the tools
+#define TOOLS_DEFAULT_API_KEY "45ced63d-a080-434a-a53b-df3d404814b2"
+    // transactions waiting for a response, per tool
+#define TOOLS_PENDING_CAPACITY 65536
+
+    /**
+     * Requests sent and waiting for their response, indexed by transaction id.
+     * When a slot is reused before its response arrives, the old request is
+     * counted as lost.
+     */
+    typedef struct {
+        uint8_t trIds[TOOLS_PENDING_CAPACITY][12];
+        uint64_t sent_micros[TOOLS_PENDING_CAPACITY];
+    } ToolsPending;
+
+    /**
+     * Latency histogram and counters of a kind of request.
+     */
+    typedef struct {
+        LH_HistogramSnapshot latency;
+        uint64_t sent;
+        uint64_t answered;
+    } ToolsStats;
+
+    /**
+     * Fills the identity used in the common attributes of the messages a tool sends.
+     * @param identity
+     * @param username
+     * @param uuid A uuid string, which must live as long as the identity.
+     * @param api_key The key used to sign the messages. It must be writable,
+     * because signing a message lower cases it.
+     */
+    void tools_init_identity(LH_Device *identity, char *username, char *uuid, char *api_key);
+
+    /**
+     * Writes a random uuid string.
+     * @param uuid A buffer of at least 37 bytes.
+     */
+    void tools_random_uuid(char *uuid);
+
+    /**
+     * Writes the uuid string of the 16 bytes of a LYNCPORT_ID attribute.
+     * @param bytes
+     * @param uuid A buffer of at least 37 bytes.
+     */
+    void tools_uuid_to_string(const uint8_t *bytes, char *uuid);
+
+    /**
+     * Makes a copy of the identity of the server that addresses a device:
+     * the messages the server sends to a device carry the uuid of the device,
+     * so that gateways can tell which of their devices they are for.
+     * @param identity The identity of the tool.
+     * @param device_id The 16 bytes of the uuid of the device.
+     * @param target Where the copy is stored.
+     * @param uuid A buffer of at least 37 bytes for the uuid string of the
+     * copy, which must live as long as it.
+     * The messages built for the copy cache its common attributes, which
+     * must be released with stun_free_common_attrs when it is no longer used.
+     */
+    void tools_address_device(const LH_Device *identity, const uint8_t *device_id, LH_Device *target, char *uuid);
+
+    /**
+     * Builds a signed request sent by the server to a device.
+     * @param identity
+     * @param method M_ACTION or M_STATUS_REQUEST.
+     * @param action_name The name of the action for M_ACTION, ignored otherwise.
+     * @return The message, which must be freed with stun_free.
+     */
+    StunMessage* tools_server_request(LH_Device *identity, uint16_t method, const char *action_name);
+
+    /**
+     * Opens a non blocking UDP socket bound to the given port of all the local
+     * IPv4 addresses.
+     * @param port The port, or "0" for any free port.
+     * @return The socket, or -1 on failure.
+     */
+    int tools_udp_socket(const char *port);
+
+    /**
+     * Resolves the IPv4 address of a UDP endpoint.
+     * @param host
+     * @param port
+     * @param address Where the address is stored.
+     * @param address_len Where the length of the address is stored.
+     * @return 1 on success, 0 otherwise.
+     */
+    int tools_resolve(const char *host, const char *port, struct sockaddr_storage *address, socklen_t *address_len);
+
+    /**
+     * Remembers the send time of a request.
+     * @param pending
+     * @param message
+     */
+    void tools_pending_add(ToolsPending *pending, const StunMessage *message);
+
+    /**
+     * Looks up the request answered by a response, records its latency in
+     * stats and forgets it.
+     * @param pending
+     * @param stats
+     * @param response
+     * @return 1 if the request was pending, 0 otherwise.
+     */
+    int tools_pending_answer(ToolsPending *pending, ToolsStats *stats, const StunMessage *response);
+
+    /**
+     * Records a latency in microseconds.
+     * @param stats
+     * @param micros
+     */
+    void tools_record_latency(ToolsStats *stats, uint64_t micros);
+
+    /**
+     * Prints the rate, loss and latency percentiles of a kind of request.
+     * @param name
+     * @param stats
+     * @param seconds Duration of the test.
+     */
+    void tools_print_stats(const char *name, const ToolsStats *stats, double seconds);
+
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* LHINGS_TOOLS_H */